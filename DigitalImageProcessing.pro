@@ -11,11 +11,15 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 TARGET = DigitalImageProcessing
 TEMPLATE = app
 
+include(core/core.pri)
 
 SOURCES += main.cpp\
         widget.cpp \
-    image_widget.cpp
+    image_widget.cpp \
+    image_loader.cpp \
+    preview_renderer.cpp
 
 HEADERS  += widget.h \
     image_widget.h \
-    global_defs.h
+    image_loader.h \
+    preview_renderer.h
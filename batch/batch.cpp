@@ -0,0 +1,395 @@
+#include "batch.h"
+#include "bmp_image.h"
+#include "bmp_codec.h"
+#include "image_filters.h"
+#include "filter_pipeline.h"
+#include "temporal_filter.h"
+#include "filter_scratch.h"
+#include "image_metrics.h"
+#include "noise_generator.h"
+#include "noise_mask.h"
+#include "global_defs.h"
+#include <QTextStream>
+#include <QRegExp>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <vector>
+#include <cmath>
+
+namespace
+{
+    //解析一个操作，加到pipeline的最后，不认识的操作返回false
+    bool AddOperation(FilterPipeline &pipeline,const QString &text)
+    {
+        FilterOperation operation;
+        if(!ParseOperation(text,operation))
+            return false;
+        pipeline.Add(operation.kind,operation.size,operation.percentile);
+        return true;
+    }
+
+    //只换掉region的mask里标出来的点
+    void FilterMasked(BmpImage &image,const FilterOperation &operation,const ImageFilters::Region &region,FilterScratch &scratch)
+    {
+        switch(operation.kind)
+        {
+        case FilterPipeline::MEDIAN:
+            ImageFilters::MedianFilter(image,operation.size,region,scratch);
+            break;
+        case FilterPipeline::MIN:
+            ImageFilters::MinFilter(image,operation.size,region,scratch);
+            break;
+        case FilterPipeline::MAX:
+            ImageFilters::MaxFilter(image,operation.size,region,scratch);
+            break;
+        case FilterPipeline::RANK:
+            ImageFilters::RankFilter(image,operation.size,operation.percentile,region,scratch);
+            break;
+        case FilterPipeline::ADAPTIVE_MEDIAN:
+            ImageFilters::AdaptiveMedianFilter(image,operation.size,region,scratch);
+            break;
+        }
+    }
+
+    //噪声点的位置。fromInput为真时图还是输入文件的原样：输入旁边存的对得上就直接用，否则检测一遍再存到旁边；
+    //否则图已经滤过了，只在内存里检测，不覆盖输入旁边的
+    void PrepareNoiseMask(const QString &inputFile,bool fromInput,const BmpImage &image,NoiseMask &mask,
+                          FilterScratch &scratch,QTextStream &err)
+    {
+        fromInput=fromInput && !inputFile.isEmpty();
+        QByteArray maskFile=QFile::encodeName(inputFile+NOISE_MASK_SUFFIX);
+        if(fromInput && mask.Load(maskFile.constData(),image)==0 && mask.Matches(image))
+            return;
+        mask.Detect(image,scratch);
+        if(fromInput && mask.Save(maskFile.constData())!=0)
+            err<<inputFile<<NOISE_MASK_SUFFIX<<": cannot write\n";
+    }
+
+    //读一幅图，失败时输出原因
+    bool LoadImage(const QString &fileName,BmpImage &image,QTextStream &err)
+    {
+        int error=BmpCodec::Load(QFile::encodeName(fileName).constData(),image);
+        if(error==IO_ERROR)
+            err<<fileName<<": cannot read\n";
+        else if(error==BITCOUNT_ERROR)
+            err<<fileName<<": not an 8-bit or 24-bit bitmap\n";
+        else if(error==SIZE_ERROR)
+            err<<fileName<<": too large for this build\n";
+        else if(error!=0)
+            err<<fileName<<": not a bitmap\n";
+        return error==0;
+    }
+
+    //RLE压缩的输入照样压缩着存；rle为true时8位的图都按RLE8存
+    bool SaveImage(const QString &fileName,const BmpImage &image,QTextStream &err,bool rle=false)
+    {
+        int compression=rle || image.Compression()!=BMP_RGB?BMP_RLE8:BMP_RGB;
+        if(BmpCodec::Save(QFile::encodeName(fileName).constData(),image,compression)!=0)
+        {
+            err<<fileName<<": cannot write\n";
+            return false;
+        }
+        return true;
+    }
+}
+
+bool ParseOperation(const QString &text, FilterOperation &operation)
+{
+    QRegExp pattern("(median|min|max|rank)(3|5|7)(?::(\\d+))?");
+    if(text=="adaptive")
+    {
+        operation.kind=FilterPipeline::ADAPTIVE_MEDIAN;
+        operation.size=MAX_FILTER_SIZE;
+        operation.percentile=50;
+        return true;
+    }
+    if(!pattern.exactMatch(text))
+        return false;
+
+    QString name=pattern.cap(1);
+    bool hasPercentile=!pattern.cap(3).isEmpty();
+    operation.size=pattern.cap(2).toInt();
+    operation.percentile=pattern.cap(3).toInt();
+
+    if(name=="rank")
+    {
+        if(!hasPercentile || operation.percentile>100)
+            return false;
+        operation.kind=FilterPipeline::RANK;
+    }
+    else if(hasPercentile)
+        return false;
+    else if(name=="median")
+    {
+        operation.kind=FilterPipeline::MEDIAN;
+        operation.percentile=50;
+    }
+    else if(name=="min")
+    {
+        operation.kind=FilterPipeline::MIN;
+        operation.percentile=0;
+    }
+    else
+    {
+        operation.kind=FilterPipeline::MAX;
+        operation.percentile=100;
+    }
+    return true;
+}
+
+bool ParseIterate(const QString &text, int &size, int &passes)
+{
+    QRegExp iteratePattern("iterate(3|5|7)(?::(\\d+))?");
+    if(!iteratePattern.exactMatch(text))
+        return false;
+    size=iteratePattern.cap(1).toInt();
+    passes=iteratePattern.cap(2).isEmpty()?MAX_MEDIAN_PASSES:iteratePattern.cap(2).toInt();
+    return passes>=1;
+}
+
+bool IsOperation(const QString &text)
+{
+    FilterOperation operation;
+    int size,passes;
+    return text=="mask" || text=="auto" || ParseIterate(text,size,passes) || ParseOperation(text,operation);
+}
+
+bool ApplyOperations(BmpImage &image, const QString &inputFile, const QStringList &operations,
+                     FilterScratch &scratch, QTextStream &err)
+{
+    //连续的几个滤波融合成一遍做；auto、iterate要看整幅图，前面的操作得先做完
+    FilterPipeline pipeline;
+    NoiseMask noiseMask;
+    ImageFilters::Region maskRegion;
+    std::vector<unsigned char> maskBytes;
+    for(int i=0;i<operations.size();i++)
+    {
+        FilterOperation operation;
+        int iterateSize,passes;
+        if(!IsOperation(operations[i]))
+        {
+            err<<"unknown operation: "<<operations[i]<<"\n";
+            return false;
+        }
+        else if(operations[i]=="mask")
+        {
+            pipeline.Run(image,scratch);
+            pipeline.Clear();
+            PrepareNoiseMask(inputFile,i==0,image,noiseMask,scratch,err);
+            noiseMask.ToRegion(maskRegion,maskBytes);
+        }
+        else if(!noiseMask.IsNull() && ParseOperation(operations[i],operation))
+            FilterMasked(image,operation,maskRegion,scratch);
+        else if(operations[i]=="auto")
+        {
+            pipeline.Run(image,scratch);
+            pipeline.Clear();
+            ImageFilters::AutoFilter(image,scratch);
+        }
+        else if(ParseIterate(operations[i],iterateSize,passes))
+        {
+            pipeline.Run(image,scratch);
+            pipeline.Clear();
+            ImageFilters::IterativeMedianFilter(image,iterateSize,passes,scratch);
+        }
+        else
+            AddOperation(pipeline,operations[i]);
+    }
+    pipeline.Run(image,scratch);
+    return true;
+}
+
+int RunBatch(const QStringList &arguments,bool mapped,bool rle)
+{
+    QTextStream err(stderr);
+    if(arguments.size()<3)
+    {
+        err<<"usage: dip_batch [-mapped|-rle] input.bmp output.bmp operation [operation ...]\n";
+        return 1;
+    }
+
+    //映射方式：先把输入原样复制成输出，再把输出映射进来就地滤波，改的页由系统写回文件
+    BmpImage image;
+    if(mapped)
+    {
+        QFile::remove(arguments[1]);
+        if(!QFile::copy(arguments[0],arguments[1]))
+        {
+            err<<arguments[1]<<": cannot copy "<<arguments[0]<<"\n";
+            return 1;
+        }
+        int error=BmpCodec::Map(QFile::encodeName(arguments[1]).constData(),image);
+        if(error!=0)
+        {
+            err<<arguments[1]<<(error==IO_ERROR?": cannot map\n":error==BITCOUNT_ERROR?": not an 8-bit or 24-bit bitmap\n"
+                                :error==SIZE_ERROR?": too large for this build\n":": not an uncompressed bitmap\n");
+            return 1;
+        }
+    }
+    else if(!LoadImage(arguments[0],image,err))
+        return 1;
+
+    FilterScratch scratch;
+    if(!ApplyOperations(image,arguments[0],arguments.mid(2),scratch,err))
+        return 1;
+
+    if(mapped)
+        return 0;
+    return SaveImage(arguments[1],image,err,rle)?0:1;
+}
+
+int RunSequence(const QStringList &arguments)
+{
+    QTextStream err(stderr);
+    bool ok=false;
+    int windowSize=arguments.size()>0?arguments[0].toInt(&ok):0;
+    if(arguments.size()<3 || !ok || windowSize<1 || windowSize%2==0)
+    {
+        err<<"usage: dip_batch -sequence K outputDir frame1.bmp [frame2.bmp ...]  (K odd)\n";
+        return 1;
+    }
+
+    QDir outputDir(arguments[1]);
+    QStringList frames=arguments.mid(2);
+    int frameCount=frames.size();
+    int radius=windowSize/2;
+
+    //环形缓冲区：第f帧读进来的图放在images[f%windowSize]里，它的r、g、b三个通道放在slot f%windowSize里。
+    //输出第f帧时直接写回它读进来的那幅图，沿用它自己的文件头、调色板，每帧只读、解码一次；写完就释放
+    int width=0,height=0,bitCount=0;
+    size_t planeSize=0;
+    std::vector<BmpImage> images(windowSize);
+    std::vector<unsigned char> ring;
+    std::vector<unsigned char> result;
+    TemporalFilter::SlidingMedian median;
+    int nextFrame=0;        //下一个要读进来的帧
+    int nextRemoved=0;      //下一个要移出窗口的帧
+
+    for(int current=0;current<frameCount;current++)
+    {
+        int first=current-radius<0?0:current-radius;
+        int last=current+radius>frameCount-1?frameCount-1:current+radius;
+
+        //先移出窗口，它的slot才能给新读进来的帧用
+        for(;nextRemoved<first;nextRemoved++)
+            median.Remove(&ring[planeSize*3*(nextRemoved%windowSize)]);
+        for(;nextFrame<=last;nextFrame++)
+        {
+            BmpImage &frame=images[nextFrame%windowSize];
+            if(!LoadImage(frames[nextFrame],frame,err))
+                return 1;
+            if(nextFrame==0)
+            {
+                width=frame.Width();
+                height=frame.Height();
+                bitCount=frame.BitCount();
+                planeSize=frame.PixelCount();
+                ring.resize(planeSize*3*windowSize);
+                result.resize(planeSize*3);
+                median.Reset(planeSize*3,windowSize);
+            }
+            else if(frame.Width()!=width || frame.Height()!=height || frame.BitCount()!=bitCount)
+            {
+                err<<frames[nextFrame]<<": frame size differs from "<<frames[0]<<"\n";
+                return 1;
+            }
+            unsigned char *slot=&ring[planeSize*3*(nextFrame%windowSize)];
+            frame.ExtractPlanes(slot,slot+planeSize,slot+planeSize*2);
+            median.Add(slot);
+        }
+
+        median.Median(&result[0]);
+        BmpImage &frame=images[current%windowSize];
+        frame.StorePlanes(&result[0],&result[planeSize],&result[planeSize*2]);
+        if(!SaveImage(outputDir.filePath(QFileInfo(frames[current]).fileName()),frame,err))
+            return 1;
+        frame=BmpImage();
+    }
+    return 0;
+}
+
+int RunQuality(const QStringList &arguments)
+{
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+    if(arguments.size()<2)
+    {
+        err<<"usage: dip_batch -quality reference.bmp image1.bmp [image2.bmp ...]\n";
+        return 1;
+    }
+
+    BmpImage reference;
+    if(!LoadImage(arguments[0],reference,err))
+        return 1;
+
+    FilterScratch scratch;
+    BmpImage image;
+    int result=0;
+    out<<"image\tMSE\tPSNR(dB)\tSSIM\n";
+    for(int i=1;i<arguments.size();i++)
+    {
+        if(!LoadImage(arguments[i],image,err))
+        {
+            result=1;
+            continue;
+        }
+        ImageMetrics::Quality quality;
+        if(ImageMetrics::Compare(image,reference,quality,scratch)==SIZE_ERROR)
+        {
+            err<<arguments[i]<<": image size differs from "<<arguments[0]<<"\n";
+            result=1;
+            continue;
+        }
+        out<<arguments[i]<<"\t"<<QString::number(quality.mse,'f',3)<<"\t"
+           <<(std::isinf(quality.psnr)?QString("inf"):QString::number(quality.psnr,'f',2))<<"\t"
+           <<QString::number(quality.ssim,'f',4)<<"\n";
+    }
+    return result;
+}
+
+int RunNoise(const QStringList &arguments)
+{
+    QTextStream err(stderr);
+    bool densityOk=false,seedOk=false;
+    NoiseGenerator::Options options;
+    options.width=0;
+    options.height=0;
+    options.density=arguments.size()>1?arguments[1].toDouble(&densityOk):0;
+    options.seed=arguments.size()>2?arguments[2].toULongLong(&seedOk):0;
+
+    QString cleanFile;
+    QRegExp sizePattern("(\\d+)x(\\d+)");
+    bool ok=arguments.size()>=3 && arguments.size()<=5 && densityOk && seedOk
+            && options.density>=0 && options.density<=1;
+    for(int i=3;i<arguments.size() && ok;i++)
+    {
+        if(sizePattern.exactMatch(arguments[i]) && options.width==0)
+        {
+            options.width=sizePattern.cap(1).toInt();
+            options.height=sizePattern.cap(2).toInt();
+            ok=options.width>0 && options.height>0;
+        }
+        else if(cleanFile.isEmpty())
+            cleanFile=arguments[i];
+        else
+            ok=false;
+    }
+    if(ok && cleanFile.isEmpty() && options.width==0)
+        ok=false;           //合成的图一定要给大小
+    if(!ok)
+    {
+        err<<"usage: dip_batch -noise output.bmp density seed [WIDTHxHEIGHT] [clean.bmp]  (density 0-1)\n";
+        return 1;
+    }
+
+    BmpImage clean;
+    if(!cleanFile.isEmpty() && !LoadImage(cleanFile,clean,err))
+        return 1;
+    int error=NoiseGenerator::Generate(QFile::encodeName(arguments[0]).constData(),cleanFile.isEmpty()?0:&clean,options);
+    if(error==SIZE_ERROR)
+        err<<arguments[0]<<": invalid image size\n";
+    else if(error!=0)
+        err<<arguments[0]<<": cannot write\n";
+    return error==0?0:1;
+}
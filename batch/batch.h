@@ -0,0 +1,94 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <QStringList>
+#include "filter_pipeline.h"
+
+class BmpImage;
+class FilterScratch;
+class QTextStream;
+
+//一个滤波操作：median3、min5、max7、rank5:30（5x5窗口取30%分位）、adaptive。percentile是等价的百分位数
+struct FilterOperation
+{
+    FilterPipeline::StageKind kind;
+    int size;
+    int percentile;
+};
+
+//解析一个操作，不认识的返回false
+bool ParseOperation(const QString &text,FilterOperation &operation);
+
+//iterate3:20：反复3x3中值滤波，冒号后面是最多几遍，不给时是MAX_MEDIAN_PASSES。不是这种操作返回false
+bool ParseIterate(const QString &text,int &size,int &passes);
+
+//是不是RunBatch认识的一个操作
+bool IsOperation(const QString &text);
+
+//对image按顺序做operations（RunBatch的那些操作），inputFile是image的文件，mask用它找存好的噪声点，
+//为空时（比如客户端发来的内存里的图）每次都重新检测
+//不认识的操作输出原因并返回false
+bool ApplyOperations(BmpImage &image,const QString &inputFile,const QStringList &operations,
+                     FilterScratch &scratch,QTextStream &err);
+
+//批处理：dip_batch 输入.bmp 输出.bmp 操作1 [操作2 ...]
+//操作按顺序执行，可以是 median3/5/7、min3/5/7、max3/5/7、rank5:30（5x5窗口取30%分位）、adaptive、
+//auto（按噪声自动选）、iterate3:20（反复3x3中值滤波直到不变，最多20遍）、
+//mask（找出噪声点，之后的median、min、max、rank、adaptive只换掉这些点）。mask是第一个操作时，
+//噪声点的位置存在输入旁边的“输入.bmp.mask”里，下次处理同一个输入时直接读，不再检测
+//mapped时（dip_batch -mapped ...）不把图读进内存，而是把输出文件映射进来就地滤波，比内存还大的图也能滤；
+//auto、iterate仍然要按整幅图分配通道，只有中值、最小值、最大值、百分位数、自适应是按行带流过去的。压缩的图不能映射
+//RLE8、RLE4压缩的输入读的时候解开，结果照样按RLE8压缩存；rle时（dip_batch -rle ...）8位的结果都按RLE8存
+//成功返回0
+int RunBatch(const QStringList &arguments,bool mapped=false,bool rle=false);
+
+//序列模式：dip_batch -sequence K 输出目录 帧1.bmp 帧2.bmp ...
+//每一帧的每个点取前后共K帧（K为奇数，首尾不够时只取有的）的中值，按原文件名存到输出目录
+//各帧的大小和位数必须一样。每帧只读一次，任何时候内存里最多只有K帧的通道、每个位置排好序的K个值，
+//和还没输出的K/2+1幅图。中值是滑动着更新的（见TemporalFilter::SlidingMedian）
+int RunSequence(const QStringList &arguments);
+
+//质量评价：dip_batch -quality 参考图.bmp 图1.bmp [图2.bmp ...]
+//每幅图和参考图（比如加噪之前的干净图）比较，输出MSE、PSNR、SSIM。大小不一样或者读不了的图跳过，这时返回1
+int RunQuality(const QStringList &arguments);
+
+//生成带椒盐噪声的测试图：dip_batch -noise 输出.bmp 密度 种子 [宽x高] [干净图.bmp]
+//密度是0-1。给了干净图就在它上面加噪声（给了大小时先按最近邻缩放），否则合成一幅，这时一定要给大小
+//同样的参数生成的文件总是一样的，可以用来做大图的测速、核对
+int RunNoise(const QStringList &arguments);
+
+//守护模式：dip_batch -watch 输入目录 输出目录 [-queue N] [-memory MB] [-jobs N] 操作1 [操作2 ...]
+//一直监视输入目录，新的bmp写完后按操作处理，按原文件名写到输出目录，每个文件输出排队、处理各用了多久
+//队列最多N个文件（默认16），排队和正在处理的图估计的内存不超过MB（默认2048，0为不限），超过时新文件先留在输入目录里
+//-jobs是同时处理几个文件（默认1，每个文件的滤波本身已经用了线程池）。见WatchFolder
+int RunWatch(const QStringList &arguments);
+
+//本机服务：dip_batch -serve [名字]，名字默认是dip_batch。一直运行，别的进程通过本地套接字发请求，协议见JobServer
+//请求没有认证，FILE可以读写启动服务的用户能读写的任何文件，所以套接字只有同一个用户的进程能连
+int RunServe(const QStringList &arguments);
+
+//压测本机服务：dip_batch -client [-server 名字] [-connections N] [-requests N] [-depth N] [-file 输出目录] 输入.bmp 操作1 [操作2 ...]
+//开N个连接（默认4），每个连接发N个请求（默认100），最多depth个（默认4）同时没收到回复。默认把图的内容发过去（DATA），
+//-file时只发路径（FILE），结果写到输出目录。最后输出每秒请求数、延迟的分布和服务端的计数
+int RunClient(const QStringList &arguments);
+
+//测速：dip_batch -benchmark [图.bmp]
+//各种窗口大小下分别用直方图、位串行两种实现做中值滤波，看哪个快，WindowFilter::RankFilter据此选择。不给图就用随机图
+int RunBenchmark(const QStringList &arguments);
+
+//核对：dip_batch -verify golden.txt
+//golden.txt每行是“图 操作 校验和”，图是bmp文件（相对当前目录）、test:宽x高（ReferenceFilters::MakeTestImage生成的图）
+//或者rle:文件（按RLE8存一遍再读回来）。操作是RunBatch的median3、rank5:30、adaptive、iterate3:4、auto等，
+//后面加@roi只滤中间的一块矩形，加@mask只滤这块里的一个椭圆；metrics:操作是做完这个操作后和原图比较，
+//这时最后一项不是校验和，而是“MSE/PSNR/SSIM”
+//先用ReferenceFilters逐点算出标准答案，和校验和对一下，再用每一种优化过的实现各做一遍，结果必须一模一样，
+//每项都输出用时和相对标准答案的加速比；然后每种实现再在几种线程数和竖条大小（WindowFilter::SetTileBytes）下各做一遍
+//dip_batch -verify -large 目录 [宽x高] [操作]核对超过4GB的图：默认生成40000x36000的24位图（4.3GB），
+//按-mapped滤波后抽几处的行和标准答案比较，操作只能是最小值、最大值、百分位数，默认rank5:30
+//全部一致返回0
+int RunVerify(const QStringList &arguments);
+
+//生成golden.txt：dip_batch -make-golden golden.txt 图1 [图2 ...]，对每幅图做一组固定的操作，记下标准答案的校验和
+int RunMakeGolden(const QStringList &arguments);
+
+#endif // BATCH_H
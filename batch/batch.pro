@@ -0,0 +1,27 @@
+#-------------------------------------------------
+#
+# 批处理程序：不需要显示器，只链接QtCore、QtNetwork（本机服务的本地套接字）和图像处理核心
+#
+#-------------------------------------------------
+
+QT       += core network
+QT       -= gui
+
+TARGET = dip_batch
+CONFIG   += console
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+include(../core/core.pri)
+
+SOURCES += main.cpp \
+    batch.cpp \
+    benchmark.cpp \
+    verify.cpp \
+    watch_folder.cpp \
+    job_server.cpp \
+    job_client.cpp
+
+HEADERS  += batch.h \
+    watch_folder.h \
+    job_server.h
@@ -0,0 +1,154 @@
+#include "batch.h"
+#include "bmp_image.h"
+#include "bmp_codec.h"
+#include "window_filter.h"
+#include "in_place_filter.h"
+#include "filter_scratch.h"
+#include "global_defs.h"
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+    const int BENCHMARK_RUNS=5;         //每项跑几次，取最快的一次
+    const int SYNTHETIC_SIZE=1024;      //没给图时用的随机图的边长
+
+    enum Engine{HISTOGRAM,BIT_SERIAL,DISPATCHED};
+
+    //对一个通道做一次中值滤波，返回毫秒数
+    double TimeRankFilter(Engine engine,const unsigned char *src,unsigned char *dst,int width,int height,
+                          int size,FilterScratch &scratch)
+    {
+        double best=0;
+        for(int run=0;run<BENCHMARK_RUNS;run++)
+        {
+            QElapsedTimer timer;
+            timer.start();
+            if(engine==HISTOGRAM)
+                WindowFilter::HistogramRankFilter(src,dst,width,height,size,50,scratch);
+            else if(engine==BIT_SERIAL)
+                WindowFilter::BitSerialRankFilter(src,dst,width,height,size,50);
+            else
+                WindowFilter::RankFilter(src,dst,width,height,size,50,scratch);
+            double elapsed=timer.nsecsElapsed()/1e6;
+            if(run==0 || elapsed<best)
+                best=elapsed;
+        }
+        return best;
+    }
+
+    //对三个通道做一次就地中值滤波（中值按钮的做法），每次都从plane拷一份新的，返回毫秒数
+    double TimeInPlaceMedian(Engine engine,const unsigned char *plane,unsigned char *planes,int width,int height,int size)
+    {
+        size_t count=(size_t)width*height;
+        unsigned char *channels[3]={planes,planes+count,planes+count*2};
+        double best=0;
+        for(int run=0;run<BENCHMARK_RUNS;run++)
+        {
+            for(int channel=0;channel<3;channel++)
+                memcpy(channels[channel],plane,count);
+            QElapsedTimer timer;
+            timer.start();
+            if(engine==HISTOGRAM)
+                InPlaceFilter::HistogramMedianFilter(channels,width,height,0,0,width,height,0,size,0,0);
+            else if(engine==BIT_SERIAL)
+                InPlaceFilter::BitSerialMedianFilter(channels,width,height,0,0,width,height,0,size,0,0);
+            else
+                InPlaceFilter::MedianFilter(channels,width,height,0,0,width,height,0,size,0,0);
+            double elapsed=timer.nsecsElapsed()/1e6;
+            if(run==0 || elapsed<best)
+                best=elapsed;
+        }
+        return best;
+    }
+
+    //就地的自适应中值滤波，sorted时逐点做（没有SSE2时的做法），否则16行一起做
+    double TimeInPlaceAdaptive(bool sorted,const unsigned char *plane,unsigned char *planes,int width,int height)
+    {
+        size_t count=(size_t)width*height;
+        unsigned char *channels[3]={planes,planes+count,planes+count*2};
+        double best=0;
+        for(int run=0;run<BENCHMARK_RUNS;run++)
+        {
+            for(int channel=0;channel<3;channel++)
+                memcpy(channels[channel],plane,count);
+            QElapsedTimer timer;
+            timer.start();
+            if(sorted)
+                InPlaceFilter::SortedAdaptiveMedianFilter(channels,width,height,0,0,width,height,0,MAX_FILTER_SIZE,0,0);
+            else
+                InPlaceFilter::AdaptiveMedianFilter(channels,width,height,0,0,width,height,0,MAX_FILTER_SIZE,0,0);
+            double elapsed=timer.nsecsElapsed()/1e6;
+            if(run==0 || elapsed<best)
+                best=elapsed;
+        }
+        return best;
+    }
+}
+
+int RunBenchmark(const QStringList &arguments)
+{
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    int width=SYNTHETIC_SIZE,height=SYNTHETIC_SIZE;
+    std::vector<unsigned char> planes;
+    if(!arguments.isEmpty())
+    {
+        BmpImage image;
+        if(BmpCodec::Load(QFile::encodeName(arguments[0]).constData(),image)!=0)
+        {
+            err<<arguments[0]<<": cannot load\n";
+            return 1;
+        }
+        width=image.Width();
+        height=image.Height();
+        planes.resize(image.PixelCount()*3);
+        image.ExtractPlanes(&planes[0],&planes[image.PixelCount()],&planes[image.PixelCount()*2]);
+    }
+    else
+    {
+        planes.resize((size_t)width*height);
+        srand(1);
+        for(size_t i=0;i<planes.size();i++)     //一成椒盐噪声
+        {
+            int r=rand()%20;
+            planes[i]=(unsigned char)(r==0?0:r==1?255:rand()%256);
+        }
+    }
+
+    //只量红色通道，三个通道的开销一样
+    std::vector<unsigned char> result((size_t)width*height);
+    FilterScratch scratch;      //两种百分位数引擎只用到直方图，不用Reserve
+
+    out<<width<<" x "<<height<<", median of one channel, best of "<<BENCHMARK_RUNS<<" runs (ms)\n";
+    out<<"size\thistogram\tbit-serial\tRankFilter\n";
+    for(int size=3;size<=MAX_FILTER_SIZE;size+=2)
+    {
+        out<<size<<"\t"
+           <<TimeRankFilter(HISTOGRAM,&planes[0],&result[0],width,height,size,scratch)<<"\t\t"
+           <<TimeRankFilter(BIT_SERIAL,&planes[0],&result[0],width,height,size,scratch)<<"\t\t"
+           <<TimeRankFilter(DISPATCHED,&planes[0],&result[0],width,height,size,scratch)<<"\n";
+    }
+
+    //就地滤波要三个通道，都用红色通道的值
+    std::vector<unsigned char> inPlace((size_t)width*height*3);
+    out<<"in-place median of three channels, best of "<<BENCHMARK_RUNS<<" runs (ms)\n";
+    out<<"size\thistogram\tbit-serial\tMedianFilter\n";
+    for(int size=3;size<=InPlaceFilter::BIT_SERIAL_MAX_SIZE+2;size+=2)
+    {
+        out<<size<<"\t"
+           <<TimeInPlaceMedian(HISTOGRAM,&planes[0],&inPlace[0],width,height,size)<<"\t\t"
+           <<TimeInPlaceMedian(BIT_SERIAL,&planes[0],&inPlace[0],width,height,size)<<"\t\t"
+           <<TimeInPlaceMedian(DISPATCHED,&planes[0],&inPlace[0],width,height,size)<<"\n";
+    }
+    out<<"in-place adaptive median up to "<<MAX_FILTER_SIZE<<"x"<<MAX_FILTER_SIZE<<" (ms)\n";
+    out<<"sorted\t\tAdaptiveMedianFilter\n";
+    out<<TimeInPlaceAdaptive(true,&planes[0],&inPlace[0],width,height)<<"\t\t"
+       <<TimeInPlaceAdaptive(false,&planes[0],&inPlace[0],width,height)<<"\n";
+    return 0;
+}
@@ -0,0 +1,251 @@
+#include "batch.h"
+#include "job_server.h"
+#include <QLocalSocket>
+#include <QFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QTextStream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+namespace
+{
+    const int TIMEOUT_MS=60000;
+
+    qint64 NowNanoseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    //阻塞地读一行（不含换行）
+    bool ReadLine(QLocalSocket &socket,QByteArray &line)
+    {
+        while(!socket.canReadLine())
+        {
+            if(!socket.waitForReadyRead(TIMEOUT_MS))
+                return false;
+        }
+        line=socket.readLine();
+        line.chop(1);
+        return true;
+    }
+
+    bool ReadBytes(QLocalSocket &socket,int size,QByteArray &data)
+    {
+        data.clear();
+        data.reserve(size);
+        while(data.size()<size)
+        {
+            if(socket.bytesAvailable()==0 && !socket.waitForReadyRead(TIMEOUT_MS))
+                return false;
+            data.append(socket.read(size-data.size()));
+        }
+        return true;
+    }
+
+    struct ClientOptions
+    {
+        QString server;
+        int requests;               //每个连接发几个
+        int depth;                  //每个连接最多同时有几个没收到回复的请求
+        QString outputDir;          //不为空时发FILE请求，结果写到这里；否则发DATA请求
+        QString input;
+        QByteArray image;
+        QByteArray operations;      //已经用tab连好，开头有tab
+    };
+
+    struct ClientResult
+    {
+        std::vector<qint64> latencies;      //纳秒
+        qint64 errors;
+        qint64 bytes;                       //收发的图的字节数
+        QString failure;                    //连接断了等，不为空时这个连接没做完
+    };
+
+    //一个连接：流水线地发请求，收到一个回复就补发一个
+    void RunConnection(const ClientOptions &options,int index,ClientResult &result)
+    {
+        result.errors=0;
+        result.bytes=0;
+        QLocalSocket socket;
+        socket.connectToServer(options.server);
+        if(!socket.waitForConnected(TIMEOUT_MS))
+        {
+            result.failure=socket.errorString();
+            return;
+        }
+
+        std::vector<qint64> sentAt(options.requests,0);
+        int sent=0;
+        int received=0;
+        while(received<options.requests)
+        {
+            while(sent<options.requests && sent-received<options.depth)
+            {
+                QByteArray id=QByteArray::number(sent);
+                if(options.outputDir.isEmpty())
+                {
+                    socket.write("DATA\t"+id+"\t"+QByteArray::number(options.image.size())+options.operations+"\n");
+                    socket.write(options.image);
+                    result.bytes+=options.image.size();
+                }
+                else
+                {
+                    //同一个连接同时在做的请求各写各的文件
+                    QString output=QDir(options.outputDir).filePath(QString("client%1_%2.bmp").arg(index).arg(sent%options.depth));
+                    socket.write("FILE\t"+id+"\t"+options.input.toUtf8()+"\t"+output.toUtf8()+options.operations+"\n");
+                }
+                sentAt[sent++]=NowNanoseconds();
+            }
+            while(socket.bytesToWrite()>0)
+            {
+                if(!socket.waitForBytesWritten(TIMEOUT_MS))
+                {
+                    result.failure=socket.errorString();
+                    return;
+                }
+            }
+
+            QByteArray line,data;
+            if(!ReadLine(socket,line))
+            {
+                result.failure="no reply: "+socket.errorString();
+                return;
+            }
+            QList<QByteArray> fields=line.split('\t');
+            if(fields[0]=="DATA" && fields.size()>=3)
+            {
+                if(!ReadBytes(socket,fields[2].toInt(),data))
+                {
+                    result.failure="incomplete reply: "+socket.errorString();
+                    return;
+                }
+                result.bytes+=data.size();
+            }
+            else if(fields[0]!="OK")
+                result.errors++;
+            int id=fields.size()>=2?fields[1].toInt():-1;
+            if(id>=0 && id<sent)
+                result.latencies.push_back(NowNanoseconds()-sentAt[id]);
+            received++;
+        }
+    }
+
+    QString Milliseconds(qint64 nanoseconds)
+    {
+        return QString::number(nanoseconds/1e6,'f',2);
+    }
+}
+
+int RunClient(const QStringList &arguments)
+{
+    QTextStream err(stderr);
+    QTextStream out(stdout);
+    ClientOptions options;
+    options.server=DEFAULT_SERVER_NAME;
+    options.requests=100;
+    options.depth=4;
+    int connections=4;
+
+    bool ok=true;
+    QStringList rest;
+    for(int i=0;i<arguments.size() && ok;i++)
+    {
+        bool isNumber=true;
+        if(arguments[i]=="-server" && i+1<arguments.size())
+            options.server=arguments[++i];
+        else if(arguments[i]=="-connections" && i+1<arguments.size())
+            connections=arguments[++i].toInt(&isNumber);
+        else if(arguments[i]=="-requests" && i+1<arguments.size())
+            options.requests=arguments[++i].toInt(&isNumber);
+        else if(arguments[i]=="-depth" && i+1<arguments.size())
+            options.depth=arguments[++i].toInt(&isNumber);
+        else if(arguments[i]=="-file" && i+1<arguments.size())
+            options.outputDir=arguments[++i];
+        else
+            rest<<arguments[i];
+        ok=isNumber;
+    }
+    if(!ok || rest.size()<2 || connections<1 || options.requests<1 || options.depth<1)
+    {
+        err<<"usage: dip_batch -client [-server name] [-connections N] [-requests N] [-depth N] [-file outputDir] "
+             "input.bmp operation [operation ...]\n";
+        return 1;
+    }
+
+    options.input=QFileInfo(rest[0]).absoluteFilePath();
+    for(int i=1;i<rest.size();i++)
+    {
+        if(!IsOperation(rest[i]))
+        {
+            err<<"unknown operation: "<<rest[i]<<"\n";
+            return 1;
+        }
+        options.operations+="\t"+rest[i].toUtf8();
+    }
+    if(options.outputDir.isEmpty())
+    {
+        QFile file(rest[0]);
+        if(!file.open(QFile::ReadOnly))
+        {
+            err<<rest[0]<<": cannot read\n";
+            return 1;
+        }
+        options.image=file.readAll();
+    }
+    else if(!QDir().mkpath(options.outputDir))
+    {
+        err<<options.outputDir<<": cannot create\n";
+        return 1;
+    }
+
+    //每个连接一个线程，阻塞地收发
+    std::vector<ClientResult> results(connections);
+    std::vector<std::thread> threads;
+    qint64 started=NowNanoseconds();
+    for(int i=0;i<connections;i++)
+        threads.push_back(std::thread(RunConnection,std::cref(options),i,std::ref(results[i])));
+    for(int i=0;i<connections;i++)
+        threads[i].join();
+    double seconds=(NowNanoseconds()-started)/1e9;
+
+    std::vector<qint64> latencies;
+    qint64 errors=0,bytes=0;
+    int failed=0;
+    for(int i=0;i<connections;i++)
+    {
+        latencies.insert(latencies.end(),results[i].latencies.begin(),results[i].latencies.end());
+        errors+=results[i].errors;
+        bytes+=results[i].bytes;
+        if(!results[i].failure.isEmpty())
+        {
+            err<<"connection "<<i<<": "<<results[i].failure<<"\n";
+            failed++;
+        }
+    }
+    std::sort(latencies.begin(),latencies.end());
+    qint64 total=0;
+    for(size_t i=0;i<latencies.size();i++)
+        total+=latencies[i];
+
+    out<<"requests "<<latencies.size()<<", errors "<<errors<<", "<<QString::number(seconds,'f',3)<<" s, "
+       <<QString::number(seconds>0?latencies.size()/seconds:0,'f',1)<<" requests/s, "
+       <<QString::number(seconds>0?bytes/1048576.0/seconds:0,'f',1)<<" MB/s\n";
+    if(!latencies.empty())
+        out<<"latency ms: mean "<<Milliseconds(total/(qint64)latencies.size())
+           <<", p50 "<<Milliseconds(latencies[latencies.size()/2])
+           <<", p99 "<<Milliseconds(latencies[latencies.size()*99/100])
+           <<", max "<<Milliseconds(latencies.back())<<"\n";
+
+    //最后看一眼服务端的计数
+    QLocalSocket socket;
+    socket.connectToServer(options.server);
+    QByteArray status;
+    if(socket.waitForConnected(TIMEOUT_MS) && socket.write("STATUS\n")>0 && socket.waitForBytesWritten(TIMEOUT_MS)
+            && ReadLine(socket,status))
+        out<<"server: "<<QString::fromUtf8(status.mid(7).replace('\t',' ').constData())<<"\n";
+    return failed==0 && errors==0?0:1;
+}
@@ -0,0 +1,467 @@
+#include "job_server.h"
+#include "batch.h"
+#include "bmp_image.h"
+#include "bmp_codec.h"
+#include "filter_scratch.h"
+#include "thread_pool.h"
+#include "global_defs.h"
+#include <QCoreApplication>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QFile>
+#include <QTextStream>
+#include <chrono>
+
+namespace
+{
+    const qint64 SMALL_IMAGE_PIXELS=1<<20;      //比这小的图攒成一批，一个线程做一幅；大的单独做，按行分给所有线程
+    const qint64 BATCH_PIXELS=64<<20;           //一批小图的像素总数的上限
+    const int TASKS_PER_THREAD=4;               //一批最多线程数的这么多倍幅图，大小不一时ForEachTask能偷着做
+    const unsigned long BATCH_WAIT_MS=2;        //小图不够每个线程一幅时，最多再等这么久看看还有没有
+    const int MAX_LINE_BYTES=64*1024;           //请求的一行最长多少，超过就断开
+    const int MAX_PAYLOAD_BYTES=1<<30;
+
+    qint64 NowNanoseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    QByteArray Milliseconds(qint64 nanoseconds)
+    {
+        return QByteArray::number(nanoseconds/1e6,'f',2);
+    }
+
+    //bmp文件头里的宽乘高，分批时估计代价用。不是bmp时为0，处理时自然会报错
+    qint64 HeaderPixels(const char *header,int size)
+    {
+        if(size<BMP_HEADER_SIZE)
+            return 0;
+        const unsigned char *p=(const unsigned char *)header;
+        qint64 width=(int)((unsigned int)p[18]|(unsigned int)p[19]<<8|(unsigned int)p[20]<<16|(unsigned int)p[21]<<24);
+        qint64 height=(int)((unsigned int)p[22]|(unsigned int)p[23]<<8|(unsigned int)p[24]<<16|(unsigned int)p[25]<<24);
+        return (width<0?-width:width)*(height<0?-height:height);
+    }
+
+    //回复里的原因不能有tab和换行
+    QByteArray OneLine(const QString &text)
+    {
+        QByteArray line=text.trimmed().toUtf8();
+        line.replace('\t',' ');
+        line.replace('\n',"; ");
+        return line;
+    }
+}
+
+JobServer::JobServer(const QString &name, QObject *parent)
+    : QObject(parent),m_name(name),m_server(new QLocalServer(this)),m_nextClient(1),m_stopping(false),m_dispatcher(this),
+      m_startedAt(NowNanoseconds()),m_received(0),m_completed(0),m_failed(0),m_dropped(0),m_batches(0),m_running(0),
+      m_pixelsDone(0),m_bytesIn(0),m_bytesOut(0),m_busyNs(0)
+{
+    connect(m_server,SIGNAL(newConnection()),this,SLOT(onNewConnection()));
+}
+
+JobServer::~JobServer()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping=true;
+        m_wake.wakeAll();
+    }
+    m_dispatcher.wait();
+    for(size_t i=0;i<m_pending.size();i++)
+        delete m_pending[i];
+    for(size_t i=0;i<m_finished.size();i++)
+        delete m_finished[i];
+    for(QHash<quint64,Connection>::iterator i=m_connections.begin();i!=m_connections.end();++i)
+        delete i->waiting;
+}
+
+bool JobServer::Start(QString &error)
+{
+    //上次没有正常退出时留下的socket文件会让listen失败，先确认没有同名的服务在运行再删掉
+    QLocalSocket probe;
+    probe.connectToServer(m_name);
+    if(probe.waitForConnected(100))
+    {
+        error=QString("another server is already listening on %1").arg(m_name);
+        return false;
+    }
+    QLocalServer::removeServer(m_name);
+    //只有同一个用户的进程能连上来：请求里没有认证，FILE能读写这个用户能读写的任何文件
+    m_server->setSocketOptions(QLocalServer::UserAccessOption);
+    if(!m_server->listen(m_name))
+    {
+        error=m_server->errorString();
+        return false;
+    }
+    m_dispatcher.start();
+    return true;
+}
+
+void JobServer::onNewConnection()
+{
+    while(m_server->hasPendingConnections())
+    {
+        QLocalSocket *socket=m_server->nextPendingConnection();
+        Connection connection;
+        connection.socket=socket;
+        connection.waiting=0;
+        connection.expected=0;
+        quint64 client=m_nextClient++;
+        m_connections.insert(client,connection);
+        m_clientIds.insert(socket,client);
+        connect(socket,SIGNAL(readyRead()),this,SLOT(onReadyRead()));
+        connect(socket,SIGNAL(disconnected()),this,SLOT(onDisconnected()));
+    }
+}
+
+void JobServer::onReadyRead()
+{
+    QLocalSocket *socket=qobject_cast<QLocalSocket *>(this->sender());
+    if(socket==0 || !m_clientIds.contains(socket))
+        return;
+    quint64 client=m_clientIds.value(socket);
+    Connection &connection=m_connections[client];
+    QByteArray data=socket->readAll();
+    {
+        QMutexLocker locker(&m_mutex);
+        m_bytesIn+=data.size();
+    }
+    connection.buffer.append(data);
+    if(!this->ParseRequests(client,connection))
+        socket->disconnectFromServer();     //后面的数据已经对不上了，只能断开
+}
+
+void JobServer::onDisconnected()
+{
+    QLocalSocket *socket=qobject_cast<QLocalSocket *>(this->sender());
+    if(socket==0 || !m_clientIds.contains(socket))
+        return;
+    quint64 client=m_clientIds.value(socket);
+    delete m_connections[client].waiting;
+    m_connections.remove(client);
+    m_clientIds.remove(socket);
+    socket->deleteLater();
+}
+
+bool JobServer::ParseRequests(quint64 client, Connection &connection)
+{
+    for(;;)
+    {
+        //DATA的图直接接到请求的data后面，不在buffer里攒
+        if(connection.waiting!=0)
+        {
+            Request *request=connection.waiting;
+            int take=connection.expected-request->data->size();
+            if(take>connection.buffer.size())
+                take=connection.buffer.size();
+            request->data->append(connection.buffer.constData(),take);
+            connection.buffer.remove(0,take);
+            if(request->data->size()<connection.expected)
+                return true;
+
+            connection.waiting=0;
+            request->pixels=HeaderPixels(request->data->constData(),request->data->size());
+            if(request->error.isEmpty())
+                this->Submit(request);
+            else
+            {
+                this->Reply(client,"ERROR\t"+request->id+"\t"+OneLine(request->error)+"\n");
+                delete request;
+            }
+            continue;
+        }
+
+        int end=connection.buffer.indexOf('\n');
+        if(end<0)
+            return connection.buffer.size()<=MAX_LINE_BYTES;
+        QByteArray line=connection.buffer.left(end);
+        connection.buffer.remove(0,end+1);
+        if(line.endsWith('\r'))
+            line.chop(1);
+        if(!line.isEmpty() && !this->ParseHeader(client,line,connection))
+            return false;
+    }
+}
+
+bool JobServer::ParseHeader(quint64 client, const QByteArray &line, Connection &connection)
+{
+    QList<QByteArray> fields=line.split('\t');
+    if(fields[0]=="STATUS")
+    {
+        this->Reply(client,"STATUS\t"+this->Status()+"\n");
+        return true;
+    }
+
+    bool isFile=fields[0]=="FILE" && fields.size()>=5;
+    bool isData=fields[0]=="DATA" && fields.size()>=4;
+    if(!isFile && !isData)
+    {
+        this->Reply(client,"ERROR\t"+(fields.size()>1?fields[1]:QByteArray("-"))+"\tunknown request\n");
+        return fields[0]!="DATA";       //DATA后面跟着的图没法跳过
+    }
+
+    Request *request=new Request;
+    request->client=client;
+    request->id=fields[1];
+    request->inMemory=isData;
+    request->pixels=0;
+    request->receivedAt=NowNanoseconds();
+    request->startedAt=0;
+    request->finishedAt=0;
+    request->ok=false;
+    for(int i=isFile?4:3;i<fields.size();i++)
+    {
+        QString operation=QString::fromUtf8(fields[i].constData());
+        if(!IsOperation(operation) && request->error.isEmpty())
+            request->error="unknown operation: "+operation;
+        request->operations<<operation;
+    }
+    {
+        QMutexLocker locker(&m_mutex);
+        m_received++;
+    }
+
+    if(isData)
+    {
+        bool isNumber;
+        qint64 size=fields[2].toLongLong(&isNumber);
+        if(!isNumber || size<BMP_HEADER_SIZE || size>MAX_PAYLOAD_BYTES)
+        {
+            this->Reply(client,"ERROR\t"+request->id+"\tbad size\n");
+            delete request;
+            return false;
+        }
+        request->data=std::make_shared<QByteArray>();
+        request->data->reserve((int)size);
+        connection.waiting=request;
+        connection.expected=(int)size;
+        return true;
+    }
+
+    request->input=QString::fromUtf8(fields[2].constData());
+    request->output=QString::fromUtf8(fields[3].constData());
+    if(!request->error.isEmpty())
+    {
+        this->Reply(client,"ERROR\t"+request->id+"\t"+OneLine(request->error)+"\n");
+        delete request;
+        return true;
+    }
+    QFile file(request->input);
+    if(file.open(QFile::ReadOnly))
+    {
+        QByteArray header=file.read(BMP_HEADER_SIZE);
+        request->pixels=HeaderPixels(header.constData(),header.size());
+    }
+    this->Submit(request);
+    return true;
+}
+
+void JobServer::Submit(Request *request)
+{
+    QMutexLocker locker(&m_mutex);
+    m_pending.push_back(request);
+    m_wake.wakeOne();
+}
+
+bool JobServer::Reply(quint64 client, const QByteArray &line, const QByteArray &payload)
+{
+    QHash<quint64,Connection>::iterator connection=m_connections.find(client);
+    if(connection==m_connections.end())
+        return false;
+    connection->socket->write(line);
+    if(!payload.isEmpty())
+        connection->socket->write(payload);
+    QMutexLocker locker(&m_mutex);
+    m_bytesOut+=line.size()+payload.size();
+    return true;
+}
+
+void JobServer::onBatchFinished()
+{
+    std::vector<Request *> finished;
+    {
+        QMutexLocker locker(&m_mutex);
+        finished.swap(m_finished);
+    }
+    for(size_t i=0;i<finished.size();i++)
+    {
+        Request *request=finished[i];
+        QByteArray times=Milliseconds(request->startedAt-request->receivedAt)+"\t"
+                +Milliseconds(request->finishedAt-request->startedAt)+"\n";
+        bool delivered;
+        if(!request->ok)
+            delivered=this->Reply(request->client,"ERROR\t"+request->id+"\t"+OneLine(request->error)+"\n");
+        else if(request->inMemory)
+            delivered=this->Reply(request->client,"DATA\t"+request->id+"\t"+QByteArray::number(request->data->size())+"\t"+times,
+                                  *request->data);
+        else
+            delivered=this->Reply(request->client,"OK\t"+request->id+"\t"+times);
+        if(!delivered)
+        {
+            QMutexLocker locker(&m_mutex);
+            m_dropped++;
+        }
+        delete request;
+    }
+}
+
+void JobServer::DispatchLoop()
+{
+    ThreadPool &pool=ThreadPool::Instance();
+    FilterScratch scratch;
+    scratch.PrepareWorkers(pool.ThreadCount());
+    for(;;)
+    {
+        std::vector<Request *> batch;
+        {
+            QMutexLocker locker(&m_mutex);
+            while(m_pending.empty() && !m_stopping)
+                m_wake.wait(&m_mutex);
+            qint64 deadline=NowNanoseconds()+BATCH_WAIT_MS*1000000;
+            while(!m_stopping && m_pending.front()->pixels<SMALL_IMAGE_PIXELS && (int)m_pending.size()<pool.ThreadCount())
+            {
+                qint64 left=deadline-NowNanoseconds();
+                if(left<=0)
+                    break;
+                m_wake.wait(&m_mutex,(unsigned long)((left+999999)/1000000));
+            }
+            if(m_stopping)
+                return;
+
+            //按到达的顺序取：小图一直取到批满，碰到大图就停；大图自己一批
+            qint64 pixels=0;
+            while(!m_pending.empty() && (int)batch.size()<pool.ThreadCount()*TASKS_PER_THREAD)
+            {
+                Request *request=m_pending.front();
+                bool small=request->pixels<SMALL_IMAGE_PIXELS;
+                if(!batch.empty() && (!small || pixels+request->pixels>BATCH_PIXELS))
+                    break;
+                batch.push_back(request);
+                m_pending.pop_front();
+                pixels+=request->pixels;
+                if(!small)
+                    break;
+            }
+            m_running=(qint64)batch.size();
+        }
+
+        //一幅时在这个线程里做，里面的For照常按行分给所有线程；多幅时每个任务里的For就在做它的线程里做
+        qint64 started=NowNanoseconds();
+        if(batch.size()==1)
+            this->Process(*batch[0],scratch);
+        else
+            pool.ForEachTask((int)batch.size(),[&](int task){
+                this->Process(*batch[task],scratch.Worker(ThreadPool::ThreadIndex()));
+            });
+        qint64 finished=NowNanoseconds();
+
+        {
+            QMutexLocker locker(&m_mutex);
+            m_batches++;
+            m_running=0;
+            m_busyNs+=finished-started;
+            for(size_t i=0;i<batch.size();i++)
+            {
+                if(batch[i]->ok)
+                {
+                    m_completed++;
+                    m_pixelsDone+=batch[i]->pixels;
+                }
+                else
+                    m_failed++;
+                m_finished.push_back(batch[i]);
+            }
+        }
+        QMetaObject::invokeMethod(this,"onBatchFinished",Qt::QueuedConnection);
+    }
+}
+
+void JobServer::Process(Request &request, FilterScratch &scratch)
+{
+    request.startedAt=NowNanoseconds();
+    QString errorText;
+    QTextStream err(&errorText);
+
+    //内存里的图直接在收到的数据上滤波，结果就是要发回去的文件
+    BmpImage image;
+    int error;
+    if(request.inMemory)
+    {
+        error=image.Attach((unsigned char *)request.data->data(),(size_t)request.data->size(),request.data);
+        if(error==FORMAT_ERROR)     //RLE压缩的图没法就地滤波，解到image自己的内存里
+            error=image.Parse((const unsigned char *)request.data->constData(),(size_t)request.data->size());
+    }
+    else
+        error=BmpCodec::Load(QFile::encodeName(request.input).constData(),image);
+
+    if(error==BITCOUNT_ERROR)
+        err<<"not an 8-bit or 24-bit bitmap";
+    else if(error==IO_ERROR)
+        err<<request.input<<": cannot read";
+    else if(error==SIZE_ERROR)
+        err<<"too large for this build";
+    else if(error!=0)
+        err<<"not a bitmap";
+    request.ok=error==0 && ApplyOperations(image,request.inMemory?QString():request.input,request.operations,scratch,err);
+    if(request.ok && !request.inMemory && BmpCodec::Save(QFile::encodeName(request.output).constData(),image,
+                                                         image.Compression()==BMP_RGB?BMP_RGB:BMP_RLE8)!=0)
+    {
+        err<<request.output<<": cannot write";
+        request.ok=false;
+    }
+    //解压过的图发回去的是不压缩的
+    if(request.ok && request.inMemory && !image.IsAttached())
+        *request.data=QByteArray((const char *)image.FileContent(),(int)image.FileSize());
+    err.flush();
+    request.error=errorText;
+    request.pixels=(qint64)image.PixelCount();
+    request.finishedAt=NowNanoseconds();
+}
+
+QByteArray JobServer::Status()
+{
+    QMutexLocker locker(&m_mutex);
+    double seconds=(NowNanoseconds()-m_startedAt)/1e9;
+    qint64 done=m_completed+m_failed;
+    QByteArray status;
+    status+="uptime="+QByteArray::number(seconds,'f',1);
+    status+="\tconnections="+QByteArray::number(m_connections.size());
+    status+="\treceived="+QByteArray::number(m_received);
+    status+="\tqueued="+QByteArray::number((qint64)m_pending.size());
+    status+="\trunning="+QByteArray::number(m_running);
+    status+="\tcompleted="+QByteArray::number(m_completed);
+    status+="\tfailed="+QByteArray::number(m_failed);
+    status+="\tdropped="+QByteArray::number(m_dropped);
+    status+="\tbatches="+QByteArray::number(m_batches);
+    status+="\tbatch_size="+QByteArray::number(m_batches>0?(double)done/m_batches:0,'f',2);
+    status+="\timages_per_s="+QByteArray::number(seconds>0?m_completed/seconds:0,'f',2);
+    status+="\tmpixels_per_s="+QByteArray::number(seconds>0?m_pixelsDone/1e6/seconds:0,'f',2);
+    status+="\tmb_in="+QByteArray::number(m_bytesIn/1048576.0,'f',1);
+    status+="\tmb_out="+QByteArray::number(m_bytesOut/1048576.0,'f',1);
+    status+="\tbusy="+QByteArray::number(seconds>0?m_busyNs/1e7/seconds:0,'f',1)+"%";
+    return status;
+}
+
+int RunServe(const QStringList &arguments)
+{
+    QTextStream err(stderr);
+    if(arguments.size()>1)
+    {
+        err<<"usage: dip_batch -serve [name]\n";
+        return 1;
+    }
+
+    QString name=arguments.isEmpty()?QString(DEFAULT_SERVER_NAME):arguments[0];
+    JobServer server(name);
+    QString error;
+    if(!server.Start(error))
+    {
+        err<<error<<"\n";
+        return 1;
+    }
+    err<<"listening on "<<name<<", "<<ThreadPool::Instance().ThreadCount()<<" threads\n";
+    err.flush();
+    return QCoreApplication::exec();
+}
@@ -0,0 +1,122 @@
+#ifndef JOB_SERVER_H
+#define JOB_SERVER_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QHash>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <deque>
+#include <vector>
+#include <memory>
+
+const char DEFAULT_SERVER_NAME[]="dip_batch";     //-serve、-client不给名字时用的
+
+class QLocalServer;
+class QLocalSocket;
+class FilterScratch;
+
+//本机的滤波服务：别的进程通过本地套接字（Unix上是socket文件，Windows上是命名管道）发来请求，
+//一行一个请求，字段之间用tab分开，回复可能不按请求的顺序，用请求里的id对应：
+//  FILE id 输入.bmp 输出.bmp 操作1 [操作2 ...]     ->  OK id 排队毫秒 处理毫秒
+//  DATA id 字节数 操作1 [操作2 ...] 后面紧跟整个bmp文件 ->  DATA id 字节数 排队毫秒 处理毫秒 后面紧跟结果的bmp文件
+//  STATUS                                          ->  STATUS key=value ...（计数和吞吐量）
+//出错时回复 ERROR id 原因。RLE压缩的输入FILE时照样压缩着写，DATA时发回不压缩的
+//STATUS、FILE、DATA都没有任何认证，FILE的路径也不限制目录，服务以启动它的用户的权限读写文件。
+//所以套接字只开给同一个用户（QLocalServer::UserAccessOption），不要用别的办法把它开给别的用户
+//小图一幅图的行数不够分给所有线程，攒成一批，每个线程各做几幅（ThreadPool::ForEachTask）；大图单独做，按行分给所有线程
+class JobServer:public QObject
+{
+    Q_OBJECT
+public:
+    explicit JobServer(const QString &name,QObject *parent=0);
+    ~JobServer();
+
+    //开始监听。同名的服务已经在运行、或者套接字建不起来时返回false，error是原因
+    bool Start(QString &error);
+
+    //STATUS回复的内容，不含开头的"STATUS\t"和结尾的换行
+    QByteArray Status();
+
+private slots:
+    void onNewConnection();
+    void onReadyRead();
+    void onDisconnected();
+    void onBatchFinished();     //分派线程做完一批，把结果发给各自的客户端
+
+private:
+    struct Request
+    {
+        quint64 client;
+        QByteArray id;
+        bool inMemory;              //DATA：整个bmp文件在data里，就地滤波后原样发回去
+        QString input;
+        QString output;
+        QStringList operations;
+        std::shared_ptr<QByteArray> data;
+        qint64 pixels;              //估计的像素数，分批用
+        qint64 receivedAt;          //纳秒
+        qint64 startedAt;
+        qint64 finishedAt;
+        bool ok;
+        QString error;
+    };
+
+    //一个客户端连接：收到的还没凑成完整请求的数据
+    struct Connection
+    {
+        QLocalSocket *socket;
+        QByteArray buffer;
+        Request *waiting;           //DATA请求的头已经收到，还在等后面的图，一共要expected个字节
+        int expected;
+    };
+
+    //分派线程：攒一批请求交给线程池
+    class Dispatcher:public QThread
+    {
+    public:
+        explicit Dispatcher(JobServer *server) : m_server(server) {}
+    protected:
+        void run() {m_server->DispatchLoop();}
+    private:
+        JobServer *m_server;
+    };
+
+    bool ParseRequests(quint64 client,Connection &connection);
+    bool ParseHeader(quint64 client,const QByteArray &line,Connection &connection);
+    void Submit(Request *request);
+    bool Reply(quint64 client,const QByteArray &line,const QByteArray &payload=QByteArray());
+    void DispatchLoop();
+    void Process(Request &request,FilterScratch &scratch);
+
+    QString m_name;
+    QLocalServer *m_server;
+    QHash<quint64,Connection> m_connections;
+    QHash<QLocalSocket *,quint64> m_clientIds;
+    quint64 m_nextClient;
+
+    QMutex m_mutex;                 //保护下面这些，分派线程和主线程都会用
+    QWaitCondition m_wake;
+    std::deque<Request *> m_pending;
+    std::vector<Request *> m_finished;
+    bool m_stopping;
+    Dispatcher m_dispatcher;
+
+    //计数，都在m_mutex里改
+    qint64 m_startedAt;
+    qint64 m_received;
+    qint64 m_completed;
+    qint64 m_failed;
+    qint64 m_dropped;               //做完时客户端已经断开了
+    qint64 m_batches;
+    qint64 m_running;
+    qint64 m_pixelsDone;
+    qint64 m_bytesIn;
+    qint64 m_bytesOut;
+    qint64 m_busyNs;                //分派线程在做批的时间
+};
+
+#endif // JOB_SERVER_H
@@ -0,0 +1,89 @@
+#include "batch.h"
+#include "thread_pool.h"
+#include "window_filter.h"
+#include <QCoreApplication>
+#include <QStringList>
+#include <QTextStream>
+
+namespace
+{
+    //每个线程在For里干活的时间占总时间的比例
+    void PrintThreadStatistics()
+    {
+        QTextStream err(stderr);
+        ThreadPool &pool=ThreadPool::Instance();
+        std::vector<ThreadPool::ThreadStats> stats=pool.Statistics();
+        double elapsed=pool.ElapsedSeconds();
+        err<<"threads: "<<pool.ThreadCount()<<(pool.IsPinned()?" (pinned)":"")
+           <<", wall "<<QString::number(elapsed,'f',3)<<" s\n";
+        for(size_t i=0;i<stats.size();i++)
+            err<<"  thread "<<i<<": busy "<<QString::number(stats[i].busySeconds,'f',3)<<" s, "
+               <<QString::number(elapsed>0?stats[i].busySeconds*100/elapsed:0,'f',1)<<"%, "
+               <<stats[i].tasks<<" tasks, "<<stats[i].stolen<<" stolen\n";
+    }
+}
+
+//不需要显示器，也不用创建QApplication
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    //全局选项可以放在任何位置：-threads N（0是CPU的核数）、-pin把工作线程绑核、-stats最后输出每个线程的利用率、
+    //-tile 字节数（百分位数引擎切竖条的大小，见WindowFilter::SetTileBytes）
+    //不给-threads/-pin时用环境变量DIP_THREADS、DIP_PIN_THREADS
+    QStringList arguments;
+    QStringList all=a.arguments().mid(1);
+    int threads=-1;
+    bool pin=ThreadPool::Instance().IsPinned();
+    bool stats=false;
+    for(int i=0;i<all.size();i++)
+    {
+        if(all[i]=="-threads" && i+1<all.size())
+            threads=all[++i].toInt();
+        else if(all[i]=="-pin")
+            pin=true;
+        else if(all[i]=="-stats")
+            stats=true;
+        else if(all[i]=="-tile" && i+1<all.size())
+        {
+            int bytes=all[++i].toInt();
+            if(bytes>0)
+                WindowFilter::SetTileBytes(bytes);
+        }
+        else
+            arguments<<all[i];
+    }
+    if(threads>=0 || pin!=ThreadPool::Instance().IsPinned())
+        ThreadPool::Instance().Configure(threads>=0?threads:ThreadPool::Instance().ThreadCount(),pin);
+    ThreadPool::Instance().ResetStatistics();
+
+    int result;
+    if(!arguments.isEmpty() && arguments[0]=="-sequence")
+        result=RunSequence(arguments.mid(1));
+    else if(!arguments.isEmpty() && arguments[0]=="-quality")
+        result=RunQuality(arguments.mid(1));
+    else if(!arguments.isEmpty() && arguments[0]=="-watch")
+        result=RunWatch(arguments.mid(1));
+    else if(!arguments.isEmpty() && arguments[0]=="-serve")
+        result=RunServe(arguments.mid(1));
+    else if(!arguments.isEmpty() && arguments[0]=="-client")
+        result=RunClient(arguments.mid(1));
+    else if(!arguments.isEmpty() && arguments[0]=="-noise")
+        result=RunNoise(arguments.mid(1));
+    else if(!arguments.isEmpty() && arguments[0]=="-benchmark")
+        result=RunBenchmark(arguments.mid(1));
+    else if(!arguments.isEmpty() && arguments[0]=="-verify")
+        result=RunVerify(arguments.mid(1));
+    else if(!arguments.isEmpty() && arguments[0]=="-make-golden")
+        result=RunMakeGolden(arguments.mid(1));
+    else if(!arguments.isEmpty() && arguments[0]=="-mapped")
+        result=RunBatch(arguments.mid(1),true);
+    else if(!arguments.isEmpty() && arguments[0]=="-rle")
+        result=RunBatch(arguments.mid(1),false,true);
+    else
+        result=RunBatch(arguments);
+
+    if(stats)
+        PrintThreadStatistics();
+    return result;
+}
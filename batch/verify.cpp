@@ -0,0 +1,543 @@
+#include "batch.h"
+#include "bmp_image.h"
+#include "bmp_codec.h"
+#include "image_filters.h"
+#include "image_metrics.h"
+#include "filter_pipeline.h"
+#include "window_filter.h"
+#include "reference_filters.h"
+#include "filter_scratch.h"
+#include "global_defs.h"
+#include "thread_pool.h"
+#include "noise_generator.h"
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <QRegExp>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTemporaryFile>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+    //生成golden.txt时对每幅图做的操作
+    const char *const GOLDEN_OPERATIONS[]={"median3","median5","median7","min5","max5","rank5:30","rank5:50","adaptive",
+                                           "median5@roi","median3@mask","adaptive@mask","rank5:30@mask","max3@roi",
+                                           "iterate3:4","auto","metrics:median3","metrics:adaptive"};
+    const int GOLDEN_OPERATION_COUNT=sizeof(GOLDEN_OPERATIONS)/sizeof(GOLDEN_OPERATIONS[0]);
+
+    const unsigned int TEST_IMAGE_SEED=2024;
+
+    //每种实现还要在这几种线程数、竖条大小的组合下各做一遍，分行带、分竖条的边界不能影响结果
+    const int SWEEP_THREADS[]={1,2,4};
+    const int SWEEP_THREAD_COUNT=sizeof(SWEEP_THREADS)/sizeof(SWEEP_THREADS[0]);
+    const int SWEEP_TILE_BYTES[]={1024,WindowFilter::DEFAULT_TILE_BYTES,1<<20};
+    const int SWEEP_TILE_COUNT=sizeof(SWEEP_TILE_BYTES)/sizeof(SWEEP_TILE_BYTES[0]);
+
+    //-verify -large默认的大小：24位的文件有4.3GB，像素的偏移过了2^31、2^32
+    const int LARGE_WIDTH=40000;
+    const int LARGE_HEIGHT=36000;
+    const double LARGE_DENSITY=0.1;
+    const unsigned long long LARGE_SEED=2024;
+    const int LARGE_CHECK_ROWS=8;       //每处核对这么多行
+
+    //被核对的各种实现。REFERENCE是标准答案
+    enum Engine{REFERENCE,DISPATCH,PIPELINE,HISTOGRAM,BIT_SERIAL,ITERATE_ONCE,ENGINE_COUNT};
+    const char *const ENGINE_NAMES[ENGINE_COUNT]={"reference","dispatch","pipeline","histogram","bit-serial","iterate:1"};
+
+    //golden.txt里的一个操作
+    struct VerifyCase
+    {
+        enum Type{FILTER,REGION,ITERATE,AUTO,METRICS};
+        Type type;
+        FilterOperation operation;      //FILTER、REGION、METRICS的滤波
+        bool masked;                    //REGION时只滤椭圆里的点
+        int size;                       //ITERATE的窗口大小和最多几遍
+        int passes;
+    };
+
+    bool ParseCase(const QString &text,VerifyCase &verifyCase)
+    {
+        verifyCase.masked=false;
+        if(text=="auto")
+        {
+            verifyCase.type=VerifyCase::AUTO;
+            return true;
+        }
+        if(ParseIterate(text,verifyCase.size,verifyCase.passes))
+        {
+            verifyCase.type=VerifyCase::ITERATE;
+            return true;
+        }
+        if(text.startsWith("metrics:"))
+        {
+            verifyCase.type=VerifyCase::METRICS;
+            return ParseOperation(text.mid(8),verifyCase.operation);
+        }
+        QRegExp regionPattern("(.+)@(roi|mask)");
+        if(!regionPattern.exactMatch(text))
+        {
+            verifyCase.type=VerifyCase::FILTER;
+            return ParseOperation(text,verifyCase.operation);
+        }
+        verifyCase.type=VerifyCase::REGION;
+        verifyCase.masked=regionPattern.cap(2)=="mask";
+        return ParseOperation(regionPattern.cap(1),verifyCase.operation);
+    }
+
+    //中间偏一点的一块矩形，四边离图像边界的距离各不相同；masked时只选这块里内切的椭圆
+    ImageFilters::Region MakeRegion(int width,int height,bool masked,std::vector<unsigned char> &mask)
+    {
+        ImageFilters::Region region={width/5,height/6,width-width/7,height-height/4,0};
+        if(!masked)
+            return region;
+
+        int regionWidth=region.right-region.left;
+        int regionHeight=region.bottom-region.top;
+        mask.assign((size_t)regionWidth*regionHeight,0);
+        for(int y=0;y<regionHeight;y++)
+        {
+            for(int x=0;x<regionWidth;x++)
+            {
+                double dx=(2.0*x+1-regionWidth)/regionWidth;
+                double dy=(2.0*y+1-regionHeight)/regionHeight;
+                mask[(size_t)y*regionWidth+x]=dx*dx+dy*dy<=1?1:0;
+            }
+        }
+        region.mask=&mask[0];
+        return region;
+    }
+
+    bool Supports(Engine engine,const VerifyCase &verifyCase)
+    {
+        if(engine==REFERENCE || engine==DISPATCH)
+            return true;
+        if(verifyCase.type!=VerifyCase::FILTER && verifyCase.type!=VerifyCase::METRICS)
+            return false;
+        FilterPipeline::StageKind kind=verifyCase.operation.kind;
+        if(engine==PIPELINE)
+            return true;
+        if(engine==ITERATE_ONCE)
+            return verifyCase.type==VerifyCase::FILTER && kind==FilterPipeline::RANK && verifyCase.operation.percentile==50;
+        //两个百分位数引擎不是就地滤的，只能核对最小值、最大值、百分位数
+        return verifyCase.type==VerifyCase::FILTER && kind!=FilterPipeline::MEDIAN && kind!=FilterPipeline::ADAPTIVE_MEDIAN;
+    }
+
+    //用engine对image做一次operation，region为0时滤整幅图
+    void ApplyFilter(Engine engine,const FilterOperation &operation,const ImageFilters::Region *region,
+                     BmpImage &image,FilterScratch &scratch)
+    {
+        int size=operation.size;
+        int percentile=operation.percentile;
+        ImageFilters::Region whole={0,0,image.Width(),image.Height(),0};
+        const ImageFilters::Region &area=region!=0?*region:whole;
+        switch(engine)
+        {
+        case REFERENCE:
+            if(operation.kind==FilterPipeline::ADAPTIVE_MEDIAN)
+                ReferenceFilters::AdaptiveMedianFilter(image,size,area);
+            else if(operation.kind==FilterPipeline::MEDIAN)
+                ReferenceFilters::MedianFilter(image,size,area);
+            else
+                ReferenceFilters::RankFilter(image,size,percentile,area);
+            break;
+        case DISPATCH:
+            if(operation.kind==FilterPipeline::ADAPTIVE_MEDIAN)
+                ImageFilters::AdaptiveMedianFilter(image,size,area,scratch);
+            else if(operation.kind==FilterPipeline::MEDIAN)
+                ImageFilters::MedianFilter(image,size,area,scratch);
+            else if(operation.kind==FilterPipeline::MIN)
+                ImageFilters::MinFilter(image,size,area,scratch);
+            else if(operation.kind==FilterPipeline::MAX)
+                ImageFilters::MaxFilter(image,size,area,scratch);
+            else
+                ImageFilters::RankFilter(image,size,percentile,area,scratch);
+            break;
+        case PIPELINE:
+        {
+            FilterPipeline pipeline;
+            pipeline.Add(operation.kind,size,percentile);
+            pipeline.Run(image,scratch);
+            break;
+        }
+        case ITERATE_ONCE:
+            ImageFilters::IterativeMedianFilter(image,size,1,scratch);
+            break;
+        default:        //直接调用某一个百分位数引擎
+        {
+            int width=image.Width();
+            int height=image.Height();
+            scratch.Reserve(width,height,size>MAX_FILTER_SIZE?size:MAX_FILTER_SIZE,FilterScratch::PLANES);
+            image.ExtractPlanes(scratch.SourcePlane(0),scratch.SourcePlane(1),scratch.SourcePlane(2));
+            for(int channel=0;channel<3;channel++)
+            {
+                if(engine==HISTOGRAM)
+                    WindowFilter::HistogramRankFilter(scratch.SourcePlane(channel),scratch.ResultPlane(channel),
+                                                      width,height,size,percentile,scratch);
+                else
+                    WindowFilter::BitSerialRankFilter(scratch.SourcePlane(channel),scratch.ResultPlane(channel),
+                                                      width,height,size,percentile);
+            }
+            image.StorePlanes(scratch.ResultPlane(0),scratch.ResultPlane(1),scratch.ResultPlane(2));
+            break;
+        }
+        }
+    }
+
+    QString ChecksumText(unsigned long long checksum)
+    {
+        return QString("%1").arg(checksum,16,16,QChar('0'));
+    }
+
+    QString QualityText(const ImageMetrics::Quality &quality)
+    {
+        return QString::number(quality.mse,'f',6)+"/"
+               +(std::isinf(quality.psnr)?QString("inf"):QString::number(quality.psnr,'f',6))+"/"
+               +QString::number(quality.ssim,'f',6);
+    }
+
+    //用engine对source做verifyCase，返回和golden.txt里一样写法的结果
+    QString Run(Engine engine,const VerifyCase &verifyCase,const BmpImage &source,FilterScratch &scratch)
+    {
+        BmpImage image=source;
+        switch(verifyCase.type)
+        {
+        case VerifyCase::FILTER:
+            ApplyFilter(engine,verifyCase.operation,0,image,scratch);
+            break;
+        case VerifyCase::REGION:
+        {
+            std::vector<unsigned char> mask;
+            ImageFilters::Region region=MakeRegion(image.Width(),image.Height(),verifyCase.masked,mask);
+            ApplyFilter(engine,verifyCase.operation,&region,image,scratch);
+            break;
+        }
+        case VerifyCase::ITERATE:
+            if(engine==REFERENCE)
+                ReferenceFilters::IterativeMedianFilter(image,verifyCase.size,verifyCase.passes);
+            else
+                ImageFilters::IterativeMedianFilter(image,verifyCase.size,verifyCase.passes,scratch);
+            break;
+        case VerifyCase::AUTO:
+            if(engine==REFERENCE)
+                ReferenceFilters::AutoFilter(image);
+            else
+                ImageFilters::AutoFilter(image,scratch);
+            break;
+        case VerifyCase::METRICS:
+        {
+            ApplyFilter(engine,verifyCase.operation,0,image,scratch);
+            ImageMetrics::Quality quality;
+            if(engine==REFERENCE)
+                ReferenceFilters::Compare(image,source,quality);
+            else
+                ImageMetrics::Compare(image,source,quality,scratch);
+            return QualityText(quality);
+        }
+        }
+        return ChecksumText(ReferenceFilters::Checksum(image));
+    }
+
+    //bmp文件、test:宽x高，或者rle:文件
+    bool LoadTestImage(const QString &name,BmpImage &image,QTextStream &err)
+    {
+        QRegExp testPattern("test:(\\d+)x(\\d+)");
+        if(testPattern.exactMatch(name))
+        {
+            ReferenceFilters::MakeTestImage(testPattern.cap(1).toInt(),testPattern.cap(2).toInt(),TEST_IMAGE_SEED,image);
+            return !image.IsNull();
+        }
+        bool rle=name.startsWith("rle:");
+        QString fileName=rle?name.mid(4):name;
+        if(BmpCodec::Load(QFile::encodeName(fileName).constData(),image)!=0)
+        {
+            err<<fileName<<": cannot load\n";
+            return false;
+        }
+        if(!rle)
+            return true;
+
+        //按RLE8存到临时文件里，再从那里读回来，核对的是解码出来的图
+        QTemporaryFile file;
+        if(!file.open())
+        {
+            err<<name<<": cannot create a temporary file\n";
+            return false;
+        }
+        QByteArray tempName=QFile::encodeName(file.fileName());
+        file.close();
+        if(BmpCodec::Save(tempName.constData(),image,BMP_RLE8)!=0 || BmpCodec::Load(tempName.constData(),image)!=0)
+        {
+            err<<name<<": RLE8 round trip failed\n";
+            return false;
+        }
+        return true;
+    }
+
+    void PutUInt32(unsigned char *p,unsigned int value)
+    {
+        p[0]=(unsigned char)value;
+        p[1]=(unsigned char)(value>>8);
+        p[2]=(unsigned char)(value>>16);
+        p[3]=(unsigned char)(value>>24);
+    }
+
+    //把image储存顺序的第first行开始的count行单独拷成一幅图，文件头、调色板照抄
+    void CopyRows(const BmpImage &image,int first,int count,BmpImage &rows)
+    {
+        std::vector<unsigned char> file(image.OffBits()+image.RowStride()*count);
+        memcpy(&file[0],image.FileContent(),image.OffBits());
+        memcpy(&file[image.OffBits()],image.Row(first),image.RowStride()*count);
+        PutUInt32(&file[2],(unsigned int)file.size());
+        PutUInt32(&file[22],(unsigned int)(image.IsBottomUp()?count:-count));
+        rows.Parse(&file[0],file.size());
+    }
+
+    //dip_batch -verify -large 目录 [宽x高] [操作]
+    //在目录里用NoiseGenerator生成一幅超过4GB的图，按dip_batch -mapped滤波，再抽几处的行和ReferenceFilters比较：
+    //开头、像素偏移跨过2^31和2^32的地方、中间、最后。每处连同上下的窗口半径拷出来单独算，所以只能核对不就地的
+    //最小值、最大值、百分位数。要有两倍文件大小的磁盘空间，做完删掉
+    int RunLargeVerify(const QStringList &arguments)
+    {
+        QTextStream out(stdout);
+        QTextStream err(stderr);
+        int width=LARGE_WIDTH,height=LARGE_HEIGHT;
+        QString operationName="rank5:30";
+        bool ok=arguments.size()>=1 && arguments.size()<=3;
+        QRegExp sizePattern("(\\d+)x(\\d+)");
+        for(int i=1;ok && i<arguments.size();i++)
+        {
+            if(sizePattern.exactMatch(arguments[i]))
+            {
+                width=sizePattern.cap(1).toInt();
+                height=sizePattern.cap(2).toInt();
+            }
+            else
+                operationName=arguments[i];
+        }
+        FilterOperation operation;
+        ok=ok && width>0 && height>0 && ParseOperation(operationName,operation)
+                && operation.kind!=FilterPipeline::MEDIAN && operation.kind!=FilterPipeline::ADAPTIVE_MEDIAN;
+        if(!ok)
+        {
+            err<<"usage: dip_batch -verify -large dir [WIDTHxHEIGHT] [min|max|rank operation]\n";
+            return 1;
+        }
+
+        QDir dir(arguments[0]);
+        QString input=dir.filePath("large_input.bmp");
+        QString output=dir.filePath("large_output.bmp");
+        QElapsedTimer timer;
+        timer.start();
+        NoiseGenerator::Options options={width,height,LARGE_DENSITY,LARGE_SEED};
+        if(NoiseGenerator::Generate(QFile::encodeName(input).constData(),0,options)!=0)
+        {
+            err<<input<<": cannot write\n";
+            QFile::remove(input);
+            return 1;
+        }
+        out<<input<<"\t"<<width<<" x "<<height<<", "<<QFileInfo(input).size()<<" bytes\t"
+           <<QString::number(timer.nsecsElapsed()/1e6,'f',1)<<" ms\n";
+
+        timer.restart();
+        int failures=RunBatch(QStringList()<<input<<output<<operationName,true)!=0?1:0;
+        out<<output<<"\t-mapped "<<operationName<<"\t"<<QString::number(timer.nsecsElapsed()/1e6,'f',1)<<" ms\n";
+
+        if(failures==0)
+        {
+            BmpImage source,filtered;
+            if(BmpCodec::Map(QFile::encodeName(input).constData(),source)!=0
+                    || BmpCodec::Map(QFile::encodeName(output).constData(),filtered)!=0)
+            {
+                err<<"cannot map "<<input<<" or "<<output<<"\n";
+                failures++;
+            }
+            else
+            {
+                int rows=LARGE_CHECK_ROWS<height?LARGE_CHECK_ROWS:height;
+                std::vector<int> firsts;
+                firsts.push_back(0);
+                for(int bits=31;bits<=32;bits++)
+                {
+                    unsigned long long offset=1ULL<<bits;
+                    if(offset>source.OffBits() && offset<source.FileSize())
+                        firsts.push_back((int)((offset-source.OffBits())/source.RowStride())-rows/2);
+                    else
+                        out<<"no pixel at offset 2^"<<bits<<", image is too small\n";
+                }
+                firsts.push_back(height/2);
+                firsts.push_back(height-rows);
+
+                int radius=operation.size/2;
+                size_t rowBytes=(size_t)width*(source.BitCount()/8);
+                FilterScratch scratch;
+                for(size_t i=0;i<firsts.size();i++)
+                {
+                    int first=firsts[i]<0?0:(firsts[i]>height-rows?height-rows:firsts[i]);
+                    int top=first-radius<0?0:first-radius;
+                    int bottom=first+rows+radius>height?height:first+rows+radius;
+                    BmpImage expected;
+                    CopyRows(source,top,bottom-top,expected);
+                    ApplyFilter(REFERENCE,operation,0,expected,scratch);
+
+                    bool same=true;
+                    for(int row=first;row<first+rows;row++)
+                        same=same && memcmp(expected.Row(row-top),filtered.Row(row),rowBytes)==0;
+                    if(!same)
+                        failures++;
+                    out<<"rows "<<first<<"-"<<first+rows-1<<"\toffset "<<(qint64)(filtered.Row(first)-filtered.FileContent())
+                       <<"\t"<<(same?"ok":"DIFFERS")<<"\n";
+                }
+            }
+        }
+        QFile::remove(input);
+        QFile::remove(output);
+        out<<(failures==0?"all results match\n":QString("%1 mismatches\n").arg(failures));
+        return failures==0?0:1;
+    }
+}
+
+int RunVerify(const QStringList &arguments)
+{
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+    if(arguments.size()>=1 && arguments[0]=="-large")
+        return RunLargeVerify(arguments.mid(1));
+    if(arguments.size()!=1)
+    {
+        err<<"usage: dip_batch -verify golden.txt | -verify -large dir [WIDTHxHEIGHT] [operation]\n";
+        return 1;
+    }
+
+    QFile golden(arguments[0]);
+    if(!golden.open(QFile::ReadOnly | QFile::Text))
+    {
+        err<<arguments[0]<<": cannot read\n";
+        return 1;
+    }
+
+    QTextStream in(&golden);
+    FilterScratch scratch;
+    ThreadPool &pool=ThreadPool::Instance();
+    int threads=pool.ThreadCount();
+    bool pinned=pool.IsPinned();
+    int tileBytes=WindowFilter::TileBytes();
+    int failures=0;
+    while(!in.atEnd())
+    {
+        QString line=in.readLine().trimmed();
+        if(line.isEmpty() || line.startsWith("#"))
+            continue;
+
+        //文件名里可能有空格，从后往前取
+        QStringList fields=line.split(QRegExp("\\s+"));
+        VerifyCase verifyCase;
+        if(fields.size()<3 || !ParseCase(fields[fields.size()-2],verifyCase))
+        {
+            err<<"bad line: "<<line<<"\n";
+            return 1;
+        }
+        QString imageName=QStringList(fields.mid(0,fields.size()-2)).join(" ");
+        QString operationName=fields[fields.size()-2];
+        QString expected=fields.last().toLower();
+
+        BmpImage source;
+        if(!LoadTestImage(imageName,source,err))
+            return 1;
+
+        double referenceTime=0;
+        QString referenceResult;
+        for(int engine=0;engine<ENGINE_COUNT;engine++)
+        {
+            if(!Supports((Engine)engine,verifyCase))
+                continue;
+
+            QElapsedTimer timer;
+            timer.start();
+            QString result=Run((Engine)engine,verifyCase,source,scratch);
+            double elapsed=timer.nsecsElapsed()/1e6;
+
+            bool ok;
+            if(engine==REFERENCE)
+            {
+                referenceTime=elapsed;
+                referenceResult=result;
+                ok=result==expected;
+            }
+            else
+                ok=result==referenceResult;
+            if(!ok)
+                failures++;
+
+            out<<imageName<<"\t"<<operationName<<"\t"<<ENGINE_NAMES[engine]<<"\t"
+               <<QString::number(elapsed,'f',1)<<" ms\t";
+            if(engine!=REFERENCE)
+                out<<"x"<<QString::number(elapsed>0?referenceTime/elapsed:0,'f',1)<<"\t";
+            out<<(ok?"ok":(engine==REFERENCE?"GOLDEN MISMATCH":"DIFFERS"))<<"\n";
+        }
+
+        //每种实现在各种线程数、竖条大小下再做一遍，只输出不一致的组合
+        for(int engine=DISPATCH;engine<ENGINE_COUNT;engine++)
+        {
+            if(!Supports((Engine)engine,verifyCase))
+                continue;
+            QStringList differs;
+            for(int i=0;i<SWEEP_THREAD_COUNT;i++)
+            {
+                pool.Configure(SWEEP_THREADS[i],pinned);
+                for(int j=0;j<SWEEP_TILE_COUNT;j++)
+                {
+                    WindowFilter::SetTileBytes(SWEEP_TILE_BYTES[j]);
+                    if(Run((Engine)engine,verifyCase,source,scratch)!=referenceResult)
+                        differs<<QString("%1 threads/%2 bytes").arg(SWEEP_THREADS[i]).arg(SWEEP_TILE_BYTES[j]);
+                }
+            }
+            failures+=differs.size();
+            out<<imageName<<"\t"<<operationName<<"\t"<<ENGINE_NAMES[engine]<<"\tsweep "
+               <<SWEEP_THREAD_COUNT*SWEEP_TILE_COUNT-differs.size()<<"/"<<SWEEP_THREAD_COUNT*SWEEP_TILE_COUNT<<"\t"
+               <<(differs.isEmpty()?QString("ok"):"DIFFERS at "+differs.join(", "))<<"\n";
+        }
+        pool.Configure(threads,pinned);
+        WindowFilter::SetTileBytes(tileBytes);
+    }
+
+    out<<(failures==0?"all results match\n":QString("%1 mismatches\n").arg(failures));
+    return failures==0?0:1;
+}
+
+int RunMakeGolden(const QStringList &arguments)
+{
+    QTextStream err(stderr);
+    if(arguments.size()<2)
+    {
+        err<<"usage: dip_batch -make-golden golden.txt image1 [image2 ...]\n";
+        return 1;
+    }
+
+    QFile golden(arguments[0]);
+    if(!golden.open(QFile::WriteOnly | QFile::Text))
+    {
+        err<<arguments[0]<<": cannot write\n";
+        return 1;
+    }
+
+    QTextStream out(&golden);
+    FilterScratch scratch;
+    out<<"# image operation checksum (MSE/PSNR/SSIM for metrics:), generated by dip_batch -make-golden with ReferenceFilters\n";
+    for(int i=1;i<arguments.size();i++)
+    {
+        BmpImage source;
+        if(!LoadTestImage(arguments[i],source,err))
+            return 1;
+        for(int j=0;j<GOLDEN_OPERATION_COUNT;j++)
+        {
+            VerifyCase verifyCase;
+            ParseCase(GOLDEN_OPERATIONS[j],verifyCase);
+            out<<arguments[i]<<" "<<GOLDEN_OPERATIONS[j]<<" "<<Run(REFERENCE,verifyCase,source,scratch)<<"\n";
+        }
+    }
+    return 0;
+}
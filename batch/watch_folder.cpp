@@ -0,0 +1,292 @@
+#include "watch_folder.h"
+#include "batch.h"
+#include "bmp_image.h"
+#include "bmp_codec.h"
+#include "filter_scratch.h"
+#include "global_defs.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSet>
+#include <QTextStream>
+#include <chrono>
+
+namespace
+{
+    const qint64 SETTLE_NS=500000000;       //文件大小0.5秒不变才算扫描仪写完了
+    const int SCAN_INTERVAL_MS=250;
+    const int FILTER_BYTES_PER_PIXEL=8;     //滤波时每个点大约要用的内存：原图、结果各3个通道，再加中间结果
+    const int DEFAULT_QUEUE_LENGTH=16;
+    const qint64 DEFAULT_MEMORY_MB=2048;
+
+    qint64 NowNanoseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    QString Milliseconds(qint64 nanoseconds)
+    {
+        return QString::number(nanoseconds/1e6,'f',1);
+    }
+}
+
+WatchFolder::WatchFolder(const QString &inputDir, const QString &outputDir, const QStringList &operations,
+                         const Limits &limits, QObject *parent)
+    : QObject(parent),m_inputDir(inputDir),m_outputDir(outputDir),m_operations(operations),m_limits(limits),
+      m_backpressure(false),m_bytesInFlight(0),m_running(0),m_stopping(false)
+{
+    m_scanTimer.setInterval(SCAN_INTERVAL_MS);
+    connect(&m_scanTimer,SIGNAL(timeout()),this,SLOT(onScan()));
+    connect(&m_watcher,SIGNAL(directoryChanged(QString)),this,SLOT(onScan()));
+}
+
+WatchFolder::~WatchFolder()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping=true;
+        m_wake.wakeAll();
+    }
+    for(size_t i=0;i<m_workers.size();i++)
+    {
+        m_workers[i]->wait();
+        delete m_workers[i];
+    }
+}
+
+bool WatchFolder::Start()
+{
+    if(!QDir(m_inputDir).exists() || !QDir().mkpath(m_outputDir) || !m_watcher.addPath(m_inputDir))
+        return false;
+    for(int i=0;i<m_limits.jobs;i++)
+    {
+        m_workers.push_back(new Worker(this));
+        m_workers.back()->start();
+    }
+    this->onScan();
+    return true;
+}
+
+void WatchFolder::onScan()
+{
+    //从最早的文件开始收，被挡住时后面的也先不收，保持先来先处理
+    QFileInfoList files=QDir(m_inputDir).entryInfoList(QStringList()<<"*.bmp"<<"*.BMP",QDir::Files,QDir::Time|QDir::Reversed);
+    qint64 now=NowNanoseconds();
+    bool waiting=false;
+    bool blocked=false;
+    QString reason;
+    QSet<QString> present;
+    for(int i=0;i<files.size();i++)
+    {
+        const QFileInfo &info=files[i];
+        QString name=info.fileName();
+        present.insert(name);
+        if(blocked || (m_admitted.contains(name) && m_admitted.value(name)==info.lastModified()))
+            continue;
+
+        //还在写：大小或者修改时间变了就重新计时
+        QHash<QString,Candidate>::iterator candidate=m_candidates.find(name);
+        if(candidate==m_candidates.end() || candidate->size!=info.size() || candidate->modified!=info.lastModified())
+        {
+            Candidate fresh={info.size(),info.lastModified(),now};
+            m_candidates.insert(name,fresh);
+            waiting=true;
+            continue;
+        }
+        if(now-candidate->stableSince<SETTLE_NS)
+        {
+            waiting=true;
+            continue;
+        }
+
+        Job job;
+        job.name=name;
+        job.bytes=this->EstimateMemory(info.absoluteFilePath(),info.size());
+        {
+            QMutexLocker locker(&m_mutex);
+            if((int)m_queue.size()>=m_limits.queueLength)
+            {
+                blocked=true;
+                reason=QString("queue full (%1 files)").arg((int)m_queue.size());
+                continue;
+            }
+            //一幅图就超过上限时，等别的都做完了单独做
+            if(m_limits.memoryBytes>0 && m_bytesInFlight>0 && m_bytesInFlight+job.bytes>m_limits.memoryBytes)
+            {
+                blocked=true;
+                reason=QString("memory limit (%1 MB in flight)").arg(m_bytesInFlight>>20);
+                continue;
+            }
+            job.queuedAt=NowNanoseconds();
+            m_queue.push_back(job);
+            m_bytesInFlight+=job.bytes;
+            m_wake.wakeOne();
+        }
+        m_admitted.insert(name,info.lastModified());
+        m_candidates.remove(name);
+    }
+
+    //已经不在输入目录里的文件不用再记着
+    QStringList names=m_admitted.keys();
+    for(int i=0;i<names.size();i++)
+    {
+        if(!present.contains(names[i]))
+            m_admitted.remove(names[i]);
+    }
+    names=m_candidates.keys();
+    for(int i=0;i<names.size();i++)
+    {
+        if(!present.contains(names[i]))
+            m_candidates.remove(names[i]);
+    }
+
+    this->SetBackpressure(blocked,reason);
+    //被背压挡住的文件在前面的处理完时（WorkerLoop）再扫；还没写完的要定时看
+    if(waiting)
+        m_scanTimer.start();
+    else
+        m_scanTimer.stop();
+}
+
+void WatchFolder::SetBackpressure(bool on, const QString &reason)
+{
+    if(on==m_backpressure)
+        return;
+    m_backpressure=on;
+    QTextStream err(stderr);
+    if(on)
+        err<<"backpressure: "<<reason<<", new files wait in "<<m_inputDir<<"\n";
+    else
+        err<<"backpressure released\n";
+}
+
+qint64 WatchFolder::EstimateMemory(const QString &path, qint64 fileSize) const
+{
+    //只读文件头里的宽高。读不到就只算文件本身，处理时自然会报错
+    QFile file(path);
+    QByteArray header;
+    if(file.open(QFile::ReadOnly))
+        header=file.read(BMP_HEADER_SIZE);
+    if(header.size()<BMP_HEADER_SIZE)
+        return fileSize;
+    const unsigned char *p=(const unsigned char *)header.constData();
+    qint64 width=(int)((unsigned int)p[18]|(unsigned int)p[19]<<8|(unsigned int)p[20]<<16|(unsigned int)p[21]<<24);
+    qint64 height=(int)((unsigned int)p[22]|(unsigned int)p[23]<<8|(unsigned int)p[24]<<16|(unsigned int)p[25]<<24);
+    if(width<0)
+        width=-width;
+    if(height<0)
+        height=-height;
+    return fileSize+width*height*FILTER_BYTES_PER_PIXEL;
+}
+
+void WatchFolder::WorkerLoop()
+{
+    FilterScratch scratch;
+    for(;;)
+    {
+        Job job;
+        {
+            QMutexLocker locker(&m_mutex);
+            while(m_queue.empty() && !m_stopping)
+                m_wake.wait(&m_mutex);
+            if(m_stopping)
+                return;
+            job=m_queue.front();
+            m_queue.pop_front();
+            m_running++;
+        }
+
+        this->Process(job,scratch);
+
+        {
+            QMutexLocker locker(&m_mutex);
+            m_running--;
+            m_bytesInFlight-=job.bytes;
+        }
+        QMetaObject::invokeMethod(this,"onScan",Qt::QueuedConnection);     //腾出地方了，看看有没有被挡住的文件
+    }
+}
+
+void WatchFolder::Process(const Job &job, FilterScratch &scratch)
+{
+    qint64 started=NowNanoseconds();
+    QString input=QDir(m_inputDir).filePath(job.name);
+    QString output=QDir(m_outputDir).filePath(job.name);
+    QString part=output+".part";
+    QTextStream err(stderr);
+
+    //ApplyOperations失败时自己会输出原因
+    BmpImage image;
+    int error=BmpCodec::Load(QFile::encodeName(input).constData(),image);
+    bool ok=error==0 && ApplyOperations(image,input,m_operations,scratch,err);
+    bool written=ok && BmpCodec::Save(QFile::encodeName(part).constData(),image,
+                                      image.Compression()==BMP_RGB?BMP_RGB:BMP_RLE8)==0;     //压缩的扫描件照样压缩着存
+    if(written)
+    {
+        QFile::remove(output);
+        written=QFile::rename(part,output);
+    }
+    qint64 finished=NowNanoseconds();
+
+    QMutexLocker locker(&m_mutex);
+    if(!written)
+    {
+        if(error==BITCOUNT_ERROR)
+            err<<job.name<<": not an 8-bit or 24-bit bitmap\n";
+        else if(error==SIZE_ERROR)
+            err<<job.name<<": too large for this build\n";
+        else if(error!=0)
+            err<<job.name<<": cannot read\n";
+        else if(ok)
+            err<<job.name<<": cannot write "<<output<<"\n";
+        return;
+    }
+    QTextStream out(stdout);
+    out<<job.name<<"\twait "<<Milliseconds(started-job.queuedAt)<<" ms\tprocess "<<Milliseconds(finished-started)
+       <<" ms\tqueued "<<(int)m_queue.size()<<"\trunning "<<m_running<<"\n";
+}
+
+int RunWatch(const QStringList &arguments)
+{
+    QTextStream err(stderr);
+    WatchFolder::Limits limits;
+    limits.queueLength=DEFAULT_QUEUE_LENGTH;
+    limits.memoryBytes=DEFAULT_MEMORY_MB<<20;
+    limits.jobs=1;
+
+    bool ok=arguments.size()>=3;
+    QStringList operations;
+    for(int i=2;i<arguments.size() && ok;i++)
+    {
+        bool isNumber=true;
+        if(arguments[i]=="-queue" && i+1<arguments.size())
+            limits.queueLength=arguments[++i].toInt(&isNumber);
+        else if(arguments[i]=="-memory" && i+1<arguments.size())
+            limits.memoryBytes=arguments[++i].toLongLong(&isNumber)<<20;
+        else if(arguments[i]=="-jobs" && i+1<arguments.size())
+            limits.jobs=arguments[++i].toInt(&isNumber);
+        else if(IsOperation(arguments[i]))
+            operations<<arguments[i];
+        else
+        {
+            err<<"unknown operation: "<<arguments[i]<<"\n";
+            ok=false;
+        }
+        ok=ok && isNumber;
+    }
+    if(!ok || operations.isEmpty() || limits.queueLength<1 || limits.memoryBytes<0 || limits.jobs<1)
+    {
+        err<<"usage: dip_batch -watch inputDir outputDir [-queue N] [-memory MB] [-jobs N] operation [operation ...]\n";
+        return 1;
+    }
+
+    WatchFolder folder(arguments[0],arguments[1],operations,limits);
+    if(!folder.Start())
+    {
+        err<<arguments[0]<<": cannot watch (or cannot create "<<arguments[1]<<")\n";
+        return 1;
+    }
+    return QCoreApplication::exec();
+}
@@ -0,0 +1,95 @@
+#ifndef WATCH_FOLDER_H
+#define WATCH_FOLDER_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QDateTime>
+#include <QFileSystemWatcher>
+#include <QTimer>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <deque>
+#include <vector>
+
+class FilterScratch;
+
+//守护模式：监视输入目录，扫描仪放进来的bmp写完之后排进一个有上限的队列，由几个工作线程按RunBatch的操作处理，
+//结果按原文件名写到输出目录（先写成.part再改名，别的程序不会读到写了一半的文件）。每个文件输出排队和处理的时间
+//背压：队列满了、或者排队和正在处理的图估计要用的内存超过上限时，新来的文件先留在输入目录里不读，
+//等前面的处理完了再接着收，内存不会随着扫描仪的速度无限增长
+class WatchFolder:public QObject
+{
+    Q_OBJECT
+public:
+    struct Limits
+    {
+        int queueLength;            //最多排多少个文件（不含正在处理的）
+        qint64 memoryBytes;         //排队和正在处理的图估计的内存总和的上限，0为不限
+        int jobs;                   //几个文件同时处理。每个文件的滤波本身已经用了线程池
+    };
+
+    WatchFolder(const QString &inputDir,const QString &outputDir,const QStringList &operations,
+                const Limits &limits,QObject *parent=0);
+    ~WatchFolder();
+
+    //开始监视并处理已经在输入目录里的文件。目录不存在时返回false
+    bool Start();
+
+private slots:
+    void onScan();          //目录变了、有文件处理完了、或者定时：看看有没有能收下的新文件
+
+private:
+    struct Job
+    {
+        QString name;
+        qint64 bytes;               //估计的内存
+        qint64 queuedAt;            //排进队列的时刻，纳秒
+    };
+
+    //每个工作线程一个，跑WatchFolder::WorkerLoop
+    class Worker:public QThread
+    {
+    public:
+        explicit Worker(WatchFolder *folder) : m_folder(folder) {}
+    protected:
+        void run() {m_folder->WorkerLoop();}
+    private:
+        WatchFolder *m_folder;
+    };
+
+    void WorkerLoop();
+    void Process(const Job &job,FilterScratch &scratch);
+    qint64 EstimateMemory(const QString &path,qint64 fileSize) const;
+    void SetBackpressure(bool on,const QString &reason);
+
+    QString m_inputDir;
+    QString m_outputDir;
+    QStringList m_operations;
+    Limits m_limits;
+    QFileSystemWatcher m_watcher;
+    QTimer m_scanTimer;             //还有没写完或者被背压挡住的文件时定时再扫一遍
+
+    //输入目录里的文件：上次看到的大小和修改时间，大小不变够久了才算写完
+    struct Candidate
+    {
+        qint64 size;
+        QDateTime modified;
+        qint64 stableSince;         //纳秒
+    };
+    QHash<QString,Candidate> m_candidates;
+    QHash<QString,QDateTime> m_admitted;        //已经收下的文件和收下时的修改时间，改过的文件会重新处理
+    bool m_backpressure;
+
+    QMutex m_mutex;                 //保护下面这些，工作线程和主线程都会用
+    QWaitCondition m_wake;
+    std::deque<Job> m_queue;
+    qint64 m_bytesInFlight;         //排队和正在处理的图估计的内存
+    int m_running;
+    bool m_stopping;
+    std::vector<Worker *> m_workers;
+};
+
+#endif // WATCH_FOLDER_H
@@ -0,0 +1,188 @@
+#include "bmp_codec.h"
+#include "bmp_image.h"
+#include "bmp_rle.h"
+#include "global_defs.h"
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const size_t RLE_CHUNK_BYTES=1<<20;     //压缩的像素每次读这么多，解完再读下一块
+
+    //整个文件的大小。long在Windows上是32位的，超过2GB的文件要用64位的版本
+    long long FileSize(FILE *file)
+    {
+#if defined(_WIN32)
+        if(_fseeki64(file,0,SEEK_END)!=0)
+            return -1;
+        long long size=_ftelli64(file);
+        return _fseeki64(file,0,SEEK_SET)==0?size:-1;
+#else
+        if(fseeko(file,0,SEEK_END)!=0)
+            return -1;
+        long long size=ftello(file);
+        return fseeko(file,0,SEEK_SET)==0?size:-1;
+#endif
+    }
+
+    //映射进来的整个文件，最后一个用它的BmpImage释放时解除映射，改过的页由系统写回文件
+    struct MappedFile
+    {
+        unsigned char *data;
+        size_t size;
+#if defined(_WIN32)
+        HANDLE file;
+        HANDLE mapping;
+#else
+        int file;
+#endif
+
+        ~MappedFile()
+        {
+#if defined(_WIN32)
+            if(data!=0)
+                UnmapViewOfFile(data);
+            if(mapping!=0)
+                CloseHandle(mapping);
+            if(file!=INVALID_HANDLE_VALUE)
+                CloseHandle(file);
+#else
+            if(data!=0)
+                munmap(data,size);
+            if(file>=0)
+                close(file);
+#endif
+        }
+    };
+
+    //读写方式映射整个文件，失败时返回0
+    std::shared_ptr<MappedFile> MapFile(const char *fileName)
+    {
+        std::shared_ptr<MappedFile> mapped(new MappedFile());
+        mapped->data=0;
+        mapped->size=0;
+#if defined(_WIN32)
+        mapped->mapping=0;
+        mapped->file=CreateFileA(fileName,GENERIC_READ|GENERIC_WRITE,FILE_SHARE_READ,0,OPEN_EXISTING,
+                                 FILE_FLAG_SEQUENTIAL_SCAN,0);
+        LARGE_INTEGER size;
+        if(mapped->file==INVALID_HANDLE_VALUE || !GetFileSizeEx(mapped->file,&size) || size.QuadPart==0)
+            return std::shared_ptr<MappedFile>();
+        mapped->size=(size_t)size.QuadPart;
+        mapped->mapping=CreateFileMappingA(mapped->file,0,PAGE_READWRITE,0,0,0);
+        if(mapped->mapping==0)
+            return std::shared_ptr<MappedFile>();
+        mapped->data=(unsigned char *)MapViewOfFile(mapped->mapping,FILE_MAP_ALL_ACCESS,0,0,0);
+#else
+        mapped->file=open(fileName,O_RDWR);
+        struct stat status;
+        if(mapped->file<0 || fstat(mapped->file,&status)!=0 || status.st_size==0)
+            return std::shared_ptr<MappedFile>();
+        mapped->size=(size_t)status.st_size;
+        void *data=mmap(0,mapped->size,PROT_READ|PROT_WRITE,MAP_SHARED,mapped->file,0);
+        if(data==MAP_FAILED)
+            return std::shared_ptr<MappedFile>();
+        mapped->data=(unsigned char *)data;
+#if defined(MADV_SEQUENTIAL)
+        madvise(data,mapped->size,MADV_SEQUENTIAL);      //滤波按行带从头到尾走一遍，读过的页可以早点换出去
+#endif
+#endif
+        return mapped->data!=0?mapped:std::shared_ptr<MappedFile>();
+    }
+
+    //文件头已经读过了、image已经按解开的大小准备好：读调色板，压缩的像素一块一块地读进来直接解到image里，
+    //不用把整个压缩的数据放在内存里
+    int LoadCompressed(FILE *file,size_t fileSize,BmpImage &image)
+    {
+        size_t paletteBytes=image.OffBits()-BMP_HEADER_SIZE;
+        if(fread(image.FileContent()+BMP_HEADER_SIZE,1,paletteBytes,file)!=paletteBytes)
+            return IO_ERROR;
+
+        BmpRle::Decoder decoder(image);
+        std::vector<unsigned char> buffer(RLE_CHUNK_BYTES);
+        size_t kept=0;          //上一块最后不到一条指令的字节，挪到了buffer的最前面
+        size_t left=fileSize-image.OffBits();
+        while(left>0 && !decoder.IsFinished())
+        {
+            size_t want=buffer.size()-kept<left?buffer.size()-kept:left;
+            if(fread(&buffer[kept],1,want,file)!=want)
+                return IO_ERROR;
+            left-=want;
+            size_t used=decoder.Decode(&buffer[0],kept+want);
+            kept=kept+want-used;
+            memmove(&buffer[0],&buffer[used],kept);
+        }
+        decoder.Finish();
+        return 0;
+    }
+}
+
+int BmpCodec::Load(const char *fileName, BmpImage &image)
+{
+    FILE *file=fopen(fileName,"rb");
+    if(file==0)
+        return IO_ERROR;
+
+    long long size=FileSize(file);
+    if(size<0 || (unsigned long long)size>(size_t)-1)
+    {
+        fclose(file);
+        return IO_ERROR;
+    }
+
+    //先只读文件头，解析好之后直接把剩下的内容读进image，不用再拷一遍
+    unsigned char header[BMP_HEADER_SIZE];
+    if(size<BMP_HEADER_SIZE || fread(header,1,BMP_HEADER_SIZE,file)!=BMP_HEADER_SIZE)
+    {
+        fclose(file);
+        return FORMAT_ERROR;
+    }
+    int error=image.ParseHeader(header,(size_t)size);
+    if(error==0 && image.Compression()!=BMP_RGB)
+        error=LoadCompressed(file,(size_t)size,image);
+    else if(error==0)
+    {
+        size_t rest=(size_t)size-BMP_HEADER_SIZE;
+        if(fread(image.FileContent()+BMP_HEADER_SIZE,1,rest,file)!=rest)
+            error=IO_ERROR;
+    }
+    fclose(file);
+    return error;
+}
+
+int BmpCodec::Save(const char *fileName, const BmpImage &image, int compression)
+{
+    FILE *file=fopen(fileName,"wb");
+    if(file==0)
+        return IO_ERROR;
+
+    if(compression==BMP_RLE8 && image.BitCount()==8)
+    {
+        bool failed=BmpRle::Write(file,image)!=0;
+        if(fclose(file)!=0)
+            failed=true;
+        return failed?IO_ERROR:0;
+    }
+
+    bool failed=fwrite(image.FileContent(),1,image.FileSize(),file)!=image.FileSize();
+    if(fclose(file)!=0)
+        failed=true;
+    return failed?IO_ERROR:0;
+}
+
+int BmpCodec::Map(const char *fileName, BmpImage &image)
+{
+    std::shared_ptr<MappedFile> mapped=MapFile(fileName);
+    if(mapped==0)
+        return IO_ERROR;
+    return image.Attach(mapped->data,mapped->size,mapped);
+}
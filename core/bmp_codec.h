@@ -0,0 +1,20 @@
+#ifndef BMP_CODEC
+#define BMP_CODEC
+
+#include "global_defs.h"
+
+class BmpImage;
+
+//bmp文件的读写。成功返回0，否则返回global_defs.h里的错误码
+//RLE8、RLE4压缩的文件读的时候直接解到image里（见BmpImage::Compression）
+namespace BmpCodec
+{
+    int Load(const char *fileName,BmpImage &image);
+    //compression为BMP_RLE8时8位的图按RLE8压缩写（见BmpRle::Write），24位的图没有RLE，照常不压缩
+    int Save(const char *fileName,const BmpImage &image,int compression=BMP_RGB);
+    //把整个文件读写方式映射到image里，不读进内存。对image的修改直接改在文件上，不用再Save；
+    //比内存还大的图也可以这样用FilterPipeline按行带滤波，系统按需要换页。压缩的文件没法就地改，返回FORMAT_ERROR
+    int Map(const char *fileName,BmpImage &image);
+}
+
+#endif // BMP_CODEC
@@ -0,0 +1,333 @@
+#include "bmp_image.h"
+#include "global_defs.h"
+#include "pixel_codec.h"
+#include "thread_pool.h"
+#include "bmp_rle.h"
+#include <map>
+#include <cstring>
+
+namespace
+{
+    //bmp文件头里的各个字段的位置
+    const int OFF_BITS_POS=10;
+    const int INFO_SIZE_POS=14;
+    const int WIDTH_POS=18;
+    const int HEIGHT_POS=22;
+    const int BIT_COUNT_POS=28;
+    const int COMPRESSION_POS=30;
+    const int IMAGE_SIZE_POS=34;
+    const int COLORS_USED_POS=46;
+    const int FILE_SIZE_POS=2;
+    const int FILE_HEADER_SIZE=14;
+
+    //小头存的4字节整数
+    unsigned int ReadUInt32(const unsigned char *p)
+    {
+        return (unsigned int)p[0] | (unsigned int)p[1]<<8 | (unsigned int)p[2]<<16 | (unsigned int)p[3]<<24;
+    }
+
+    void PutUInt32(unsigned char *p,unsigned int value)
+    {
+        p[0]=(unsigned char)value;
+        p[1]=(unsigned char)(value>>8);
+        p[2]=(unsigned char)(value>>16);
+        p[3]=(unsigned char)(value>>24);
+    }
+}
+
+BmpImage::BmpImage()
+    : m_data(0),m_size(0),m_width(0),m_height(0),m_bottomUp(true),m_bitCount(0),m_compression(BMP_RGB),m_offBits(0),
+      m_rowStride(0),m_palettePos(0),m_paletteSize(0)
+{
+}
+
+BmpImage::BmpImage(const BmpImage &other)
+    : m_data(0),m_size(0)
+{
+    *this=other;
+}
+
+BmpImage &BmpImage::operator=(const BmpImage &other)
+{
+    if(this==&other)
+        return *this;
+    if(other.m_owner!=0)
+        m_fileContent.assign(other.m_data,other.m_data+other.m_size);
+    else
+        m_fileContent=other.m_fileContent;
+    m_owner.reset();
+    m_data=m_fileContent.empty()?0:&m_fileContent[0];
+    m_size=m_fileContent.size();
+    m_width=other.m_width;
+    m_height=other.m_height;
+    m_bottomUp=other.m_bottomUp;
+    m_bitCount=other.m_bitCount;
+    m_compression=other.m_compression;
+    m_offBits=other.m_offBits;
+    m_rowStride=other.m_rowStride;
+    m_palettePos=other.m_palettePos;
+    m_paletteSize=other.m_paletteSize;
+    return *this;
+}
+
+int BmpImage::Parse(const unsigned char *data, size_t size)
+{
+    if(size<(size_t)BMP_HEADER_SIZE)
+        return FORMAT_ERROR;
+
+    int error=this->ParseHeader(data,size);
+    if(error!=0)
+        return error;
+    if(m_compression==BMP_RGB)
+    {
+        memcpy(m_data,data,size);
+        return 0;
+    }
+
+    //压缩的：文件头已经改好了，只抄调色板，像素直接解到自己的内存里
+    memcpy(m_data+BMP_HEADER_SIZE,data+BMP_HEADER_SIZE,m_offBits-BMP_HEADER_SIZE);
+    BmpRle::Decoder decoder(*this);
+    decoder.Decode(data+m_offBits,size-m_offBits);
+    return 0;
+}
+
+int BmpImage::ParseHeader(const unsigned char *data, size_t size)
+{
+    int error=this->ParseLayout(data,size);
+    if(error!=0)
+        return error;
+
+    //压缩的图按解开的大小分配并清零，文件里的大小只是压缩后的
+    m_owner.reset();
+    if(m_compression!=BMP_RGB)
+    {
+        size=m_offBits+m_rowStride*(size_t)m_height;
+        m_fileContent.assign(size,0);
+    }
+    else
+        m_fileContent.resize(size);
+    m_data=&m_fileContent[0];
+    m_size=size;
+    memcpy(m_data,data,BMP_HEADER_SIZE);
+
+    //内存里的是不压缩的8位图，文件头也要跟着改，FileContent()原样写出去就是一个正常的文件
+    if(m_compression!=BMP_RGB)
+    {
+        m_data[BIT_COUNT_POS]=8;
+        m_data[BIT_COUNT_POS+1]=0;
+        PutUInt32(m_data+COMPRESSION_POS,BMP_RGB);
+        PutUInt32(m_data+IMAGE_SIZE_POS,size-m_offBits>0xffffffffu?0:(unsigned int)(size-m_offBits));
+        PutUInt32(m_data+FILE_SIZE_POS,size>0xffffffffu?0:(unsigned int)size);
+        PutUInt32(m_data+COLORS_USED_POS,(unsigned int)m_paletteSize);    //RLE4的0表示16种颜色，8位的0却表示256种
+    }
+    return 0;
+}
+
+int BmpImage::Attach(unsigned char *data, size_t size, const std::shared_ptr<void> &owner)
+{
+    if(size<(size_t)BMP_HEADER_SIZE)
+        return FORMAT_ERROR;
+    if(ReadUInt32(data+COMPRESSION_POS)!=(unsigned int)BMP_RGB)
+        return FORMAT_ERROR;
+    int error=this->ParseLayout(data,size);
+    if(error!=0)
+        return error;
+
+    std::vector<unsigned char>().swap(m_fileContent);
+    m_owner=owner;
+    m_data=data;
+    m_size=size;
+    return 0;
+}
+
+int BmpImage::ParseLayout(const unsigned char *data, size_t size)
+{
+    if(data[0]!=0x42 || data[1]!=0x4D)      //bmp文件以"BM"开头
+        return FORMAT_ERROR;
+
+    //只允许8位和24位，以及解开后是8位的RLE8、RLE4
+    int bitCount=data[BIT_COUNT_POS];
+    unsigned int compression=ReadUInt32(data+COMPRESSION_POS);
+    bool rle=(compression==(unsigned int)BMP_RLE8 && bitCount==8) || (compression==(unsigned int)BMP_RLE4 && bitCount==4);
+    if(!rle && bitCount!=8 && bitCount!=24)
+        return BITCOUNT_ERROR;
+    if(!rle && compression!=(unsigned int)BMP_RGB)
+        return FORMAT_ERROR;
+
+    //文件头里的文件大小是32位的，超过4GB的文件存不下，不用它，以实际的文件大小为准
+    size_t offBits=ReadUInt32(data+OFF_BITS_POS);
+    size_t palettePos=FILE_HEADER_SIZE+(size_t)ReadUInt32(data+INFO_SIZE_POS);
+    long long width=(int)ReadUInt32(data+WIDTH_POS);
+    long long height=(int)ReadUInt32(data+HEIGHT_POS);
+    bool bottomUp=height>0;             //高度>0，则图片信息是从最后一行开始储存的
+    if(height<0)
+        height=-height;
+    if(width<=0 || height==0 || height>0x7fffffff || palettePos>offBits || offBits<(size_t)BMP_HEADER_SIZE
+            || (rle && !bottomUp))      //压缩的图只能从最下面一行开始存
+        return FORMAT_ERROR;
+    //滤波要按点数的几倍（最多是自适应中值的10倍）分配内存，32位的程序里放不下的图不读
+    if((unsigned long long)width*(unsigned long long)height>(unsigned long long)((size_t)-1/16))
+        return SIZE_ERROR;
+
+    //windows进行行扫描的时候最小单位是4字节，每行要补齐到4的倍数。压缩的图按解开后的8位算，像素不用都在文件里
+    if(rle)
+        bitCount=8;
+    size_t rowStride=((size_t)width*bitCount+31)/32*4;
+    if(offBits>size || (!rle && rowStride>(size-offBits)/(size_t)height)
+            || (rle && rowStride>((size_t)-1-offBits)/(size_t)height))
+        return FORMAT_ERROR;
+
+    m_width=(int)width;
+    m_height=(int)height;
+    m_bottomUp=bottomUp;
+    m_bitCount=bitCount;
+    m_compression=rle?(int)compression:BMP_RGB;
+    m_offBits=offBits;
+    m_rowStride=rowStride;
+    m_palettePos=palettePos;
+    m_paletteSize=bitCount==8?(int)((offBits-palettePos)/4>256?256:(offBits-palettePos)/4):0;
+    return 0;
+}
+
+void BmpImage::FullPalette(unsigned char palette[256*4]) const
+{
+    int size=m_paletteSize<256?m_paletteSize:256;
+    memset(palette,0,256*4);
+    if(size>0)
+        memcpy(palette,this->Palette(),(size_t)size*4);
+}
+
+void BmpImage::ExtractPlanes(unsigned char *red, unsigned char *green, unsigned char *blue) const
+{
+    this->ExtractRows(0,m_height,red,green,blue);
+}
+
+void BmpImage::StorePlanes(const unsigned char *red, const unsigned char *green, const unsigned char *blue)
+{
+    this->StoreRows(0,m_height,red,green,blue);
+}
+
+void BmpImage::ExtractRows(int firstRow, int rowCount, unsigned char *red, unsigned char *green, unsigned char *blue) const
+{
+    this->ExtractRect(0,firstRow,m_width,rowCount,red,green,blue,m_width);
+}
+
+void BmpImage::StoreRows(int firstRow, int rowCount, const unsigned char *red, const unsigned char *green, const unsigned char *blue)
+{
+    this->StoreRect(0,firstRow,m_width,rowCount,red,green,blue,m_width);
+}
+
+void BmpImage::ToRgb32(int firstRow, int rowCount, unsigned char *image, ptrdiff_t bytesPerLine) const
+{
+    this->ToRgb32Rect(0,firstRow,m_width,rowCount,image,bytesPerLine);
+}
+
+void BmpImage::ExtractRect(int left, int top, int width, int height,
+                           unsigned char *red, unsigned char *green, unsigned char *blue, int stride) const
+{
+    unsigned char palette[256*4];
+    if(m_bitCount==8)
+        this->FullPalette(palette);
+
+    //各行互不相干，按行分给几个线程
+    ThreadPool::Instance().For(height,ROWS_PER_TASK,[&](int begin,int end){
+        for(int row=begin;row<end;row++)
+        {
+            size_t i=(size_t)row*stride;
+            const unsigned char *pixel=this->Row(top+row)+(size_t)left*(m_bitCount/8);
+            if(m_bitCount==8)
+                PixelCodec::ExpandPalette(pixel,palette,red+i,green+i,blue+i,width);
+            else
+                PixelCodec::SplitBgr(pixel,red+i,green+i,blue+i,width);
+        }
+    });
+}
+
+void BmpImage::StoreRect(int left, int top, int width, int height,
+                         const unsigned char *red, const unsigned char *green, const unsigned char *blue, int stride)
+{
+    if(m_bitCount!=8)
+    {
+        ThreadPool::Instance().For(height,ROWS_PER_TASK,[&](int begin,int end){
+            for(int row=begin;row<end;row++)
+            {
+                size_t i=(size_t)row*stride;
+                PixelCodec::MergeBgr(red+i,green+i,blue+i,this->Row(top+row)+(size_t)left*3,width);
+            }
+        });
+        return;
+    }
+
+    std::map<unsigned int,unsigned char> paletteIndex;      //颜色 -> 调色板编号，只建一次，不用每个点都把调色板扫一遍
+    int grayIndex[256];                                     //灰度图的颜色r=g=b，直接按灰度查，不用查map。-1表示没有这个灰度
+    for(int i=0;i<256;i++)
+        grayIndex[i]=-1;
+    const unsigned char *palette=this->Palette();
+    for(int i=0;i<m_paletteSize;i++)
+    {
+        unsigned int color=(palette[4*i+2]<<16)|(palette[4*i+1]<<8)|palette[4*i];
+        paletteIndex[color]=(unsigned char)i;
+        if(palette[4*i]==palette[4*i+1] && palette[4*i]==palette[4*i+2])
+            grayIndex[palette[4*i]]=i;
+    }
+
+    ThreadPool::Instance().For(height,ROWS_PER_TASK,[&](int begin,int end){
+        for(int row=begin;row<end;row++)
+        {
+            unsigned char *pixel=this->Row(top+row)+left;
+            size_t i=(size_t)row*stride;
+            for(int x=0;x<width;x++,i++)
+            {
+                if(red[i]==green[i] && red[i]==blue[i])
+                {
+                    if(grayIndex[red[i]]>=0)
+                        pixel[x]=(unsigned char)grayIndex[red[i]];
+                    continue;
+                }
+                unsigned int color=(red[i]<<16)|(green[i]<<8)|blue[i];
+                std::map<unsigned int,unsigned char>::const_iterator found=paletteIndex.find(color);
+                if(found!=paletteIndex.end())
+                    pixel[x]=found->second;
+            }
+        }
+    });
+}
+
+void BmpImage::ToRgb32Rect(int left, int top, int width, int height, unsigned char *image, ptrdiff_t bytesPerLine) const
+{
+    unsigned int lut[256];
+    if(m_bitCount==8)
+    {
+        unsigned char palette[256*4];
+        this->FullPalette(palette);
+        for(int i=0;i<256;i++)
+            lut[i]=0xff000000u|((unsigned int)palette[4*i+2]<<16)|((unsigned int)palette[4*i+1]<<8)|palette[4*i];
+    }
+
+    ThreadPool::Instance().For(height,ROWS_PER_TASK,[&](int begin,int end){
+        for(int row=top+begin;row<top+end;row++)
+        {
+            //高度>0时图片信息是从最后一行开始储存的
+            int line=m_bottomUp?m_height-1-row:row;
+            unsigned int *target=(unsigned int *)(image+line*bytesPerLine)+left;
+            if(m_bitCount==8)
+                PixelCodec::IndexToRgb32(this->Row(row)+left,lut,target,width);
+            else
+                PixelCodec::BgrToRgb32(this->Row(row)+(size_t)left*3,target,width);
+        }
+    });
+}
+
+void BmpImage::CopyPixels(int left, int top, int width, int height, unsigned char *pixels) const
+{
+    size_t rowBytes=(size_t)width*(m_bitCount/8);
+    for(int row=0;row<height;row++)
+        memcpy(pixels+rowBytes*row,this->Row(top+row)+(size_t)left*(m_bitCount/8),rowBytes);
+}
+
+void BmpImage::PastePixels(int left, int top, int width, int height, const unsigned char *pixels)
+{
+    size_t rowBytes=(size_t)width*(m_bitCount/8);
+    for(int row=0;row<height;row++)
+        memcpy(this->Row(top+row)+(size_t)left*(m_bitCount/8),pixels+rowBytes*row,rowBytes);
+}
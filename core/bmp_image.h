@@ -0,0 +1,103 @@
+#ifndef BMP_IMAGE
+#define BMP_IMAGE
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+//一幅8位或24位的bmp图像。和文件里一样，整个文件的内容原样放在一块内存里，
+//像素按文件里的储存顺序访问：第0行是文件里最前面的那一行（高度为正时是图像的最下面一行）
+//只用到标准C++，不依赖Qt的界面部分，批处理、命令行工具都可以直接用
+//文件内容也可以不在自己的内存里，而是映射进来的整个文件（BmpCodec::Map），比内存还大的图也能按行带处理。
+//所有的大小、偏移都是size_t，超过4GB的文件也可以
+class BmpImage
+{
+public:
+    BmpImage();
+    //复制出来的总是自己内存里的一份，映射的文件也一样
+    BmpImage(const BmpImage &other);
+    BmpImage &operator=(const BmpImage &other);
+
+    //解析内存里的整个bmp文件，成功返回0，否则返回FORMAT_ERROR、BITCOUNT_ERROR或SIZE_ERROR（见global_defs.h）
+    int Parse(const unsigned char *data,size_t size);
+    //只解析文件开头的BMP_HEADER_SIZE个字节，fileSize是整个文件的大小。成功时按fileSize分配好内存，
+    //之后由调用者把文件剩下的内容（调色板、像素）读进FileContent()对应的位置，可以分段读
+    //RLE8、RLE4压缩的图按解开的8位分配好内存并清零，文件头也改成不压缩的；调用者只读调色板（到OffBits()为止），
+    //压缩的像素交给BmpRle::Decoder解到像素行里
+    int ParseHeader(const unsigned char *header,size_t fileSize);
+    //直接用别人的内存里的整个文件，不复制。owner管这块内存，最后一个引用它的BmpImage释放时才释放
+    //压缩的图没法就地用，返回FORMAT_ERROR
+    int Attach(unsigned char *data,size_t size,const std::shared_ptr<void> &owner);
+    bool IsNull() const {return m_size==0;}
+    bool IsAttached() const {return m_owner!=0;}
+
+    unsigned char *FileContent() {return m_data;}
+    const unsigned char *FileContent() const {return m_data;}
+    size_t FileSize() const {return m_size;}
+
+    int Width() const {return m_width;}
+    int Height() const {return m_height;}               //总是正的
+    //点数，也就是一个通道的字节数。Width()*Height()用int乘会溢出，要用这个。解析时保证了它的16倍也不超出size_t，
+    //32位的程序里各种滤波按它的几倍分配通道也不会溢出
+    size_t PixelCount() const {return (size_t)m_width*m_height;}
+    bool IsBottomUp() const {return m_bottomUp;}        //文件里的高度为正时，像素从图像最下面一行开始存
+    int BitCount() const {return m_bitCount;}           //RLE4的图解开后也是8位
+    //读进来的文件的压缩方式：BMP_RGB、BMP_RLE8或BMP_RLE4。内存里的像素总是解开的，保存时可以照原来的方式压缩
+    int Compression() const {return m_compression;}
+    size_t OffBits() const {return m_offBits;}          //像素数据离文件开头的距离
+    size_t RowStride() const {return m_rowStride;}      //文件里一行占的字节数，按4字节补齐
+    int PaddingBytes() const {return (int)(m_rowStride-(size_t)m_width*(m_bitCount/8));}
+
+    //8位图的调色板，每种颜色4字节：b、g、r、保留。24位图没有调色板，PaletteSize()为0
+    const unsigned char *Palette() const {return m_data+m_palettePos;}
+    int PaletteSize() const {return m_paletteSize;}
+
+    unsigned char *Row(int row) {return m_data+m_offBits+(size_t)row*m_rowStride;}
+    const unsigned char *Row(int row) const {return m_data+m_offBits+(size_t)row*m_rowStride;}
+
+    //按储存顺序把每个点的r、g、b拆到三个通道，每个通道Width()*Height()个字节。8位的图要查调色板
+    void ExtractPlanes(unsigned char *red,unsigned char *green,unsigned char *blue) const;
+    //ExtractPlanes的反过程。8位的图要在调色板里找这个颜色：有多个相同颜色时取最后一个，找不到就保留原来的编号
+    void StorePlanes(const unsigned char *red,const unsigned char *green,const unsigned char *blue);
+    //同上，只处理储存顺序的第firstRow行开始的rowCount行，每个通道rowCount*Width()个字节
+    void ExtractRows(int firstRow,int rowCount,unsigned char *red,unsigned char *green,unsigned char *blue) const;
+    void StoreRows(int firstRow,int rowCount,const unsigned char *red,const unsigned char *green,const unsigned char *blue);
+    //把储存顺序的第firstRow行开始的rowCount行转成0xffRRGGBB，写到image里对应的显示行（已经上下翻好）。
+    //image指向显示的第0行（图像最上面一行），bytesPerLine是显示图像一行的字节数，可以直接用QImage::Format_RGB32的内存
+    void ToRgb32(int firstRow,int rowCount,unsigned char *image,ptrdiff_t bytesPerLine) const;
+
+    //以上几个只处理储存顺序的一块矩形：第top行开始的height行、第left列开始的width列
+    //三个通道里一行占stride个字节（stride>=width），可以直接指到更大的通道里的某个位置
+    void ExtractRect(int left,int top,int width,int height,
+                     unsigned char *red,unsigned char *green,unsigned char *blue,int stride) const;
+    void StoreRect(int left,int top,int width,int height,
+                   const unsigned char *red,const unsigned char *green,const unsigned char *blue,int stride);
+    //image仍然指向整幅显示图像的第0行，只改这块矩形对应的点
+    void ToRgb32Rect(int left,int top,int width,int height,unsigned char *image,ptrdiff_t bytesPerLine) const;
+
+    //文件里这块矩形的原始像素（不含补齐的字节），一行接一行，共width*height*BitCount()/8个字节。撤销时用
+    void CopyPixels(int left,int top,int width,int height,unsigned char *pixels) const;
+    void PastePixels(int left,int top,int width,int height,const unsigned char *pixels);
+
+private:
+    //检查文件头，设置宽高等，不动文件内容
+    int ParseLayout(const unsigned char *header,size_t fileSize);
+    //256项的调色板，超出PaletteSize()的编号当作黑色，查表时不会读到调色板外面
+    void FullPalette(unsigned char palette[256*4]) const;
+
+    std::vector<unsigned char> m_fileContent;   //自己的内存。映射的文件不用它
+    std::shared_ptr<void> m_owner;              //Attach进来的内存的主人
+    unsigned char *m_data;                      //整个文件的内容，指向m_fileContent或者Attach的内存
+    size_t m_size;
+    int m_width;
+    int m_height;
+    bool m_bottomUp;
+    int m_bitCount;
+    int m_compression;
+    size_t m_offBits;
+    size_t m_rowStride;
+    size_t m_palettePos;
+    int m_paletteSize;
+};
+
+#endif // BMP_IMAGE
@@ -0,0 +1,213 @@
+#include "bmp_rle.h"
+#include "bmp_image.h"
+#include "global_defs.h"
+#include "thread_pool.h"
+#include <vector>
+#include <cstring>
+
+namespace
+{
+    //bmp文件头里的各个字段的位置
+    const int FILE_SIZE_POS=2;
+    const int HEIGHT_POS=22;
+    const int COMPRESSION_POS=30;
+    const int IMAGE_SIZE_POS=34;
+
+    const size_t BAND_PIXELS=1<<20;     //编码时每个线程一次大约做这么多点
+
+    void PutUInt32(unsigned char *p,unsigned int value)
+    {
+        p[0]=(unsigned char)value;
+        p[1]=(unsigned char)(value>>8);
+        p[2]=(unsigned char)(value>>16);
+        p[3]=(unsigned char)(value>>24);
+    }
+
+    //EncodeRow编一行最多写这么多字节
+    size_t MaxRowBytes(int width)
+    {
+        return 2*(size_t)width+2;
+    }
+
+    //x往后走count个点，超出这一行就停在行尾，后面的点都不写
+    int Advance(int x,int count,int width)
+    {
+        return count<width-x?x+count:width;
+    }
+
+    //一行编码成RLE8：连续2个以上相同的点用编码模式（个数、颜色）；其余的点攒起来用绝对模式
+    //（0、个数、原样的点，按2字节补齐），绝对模式至少3个点，不够的还是一个一个地用编码模式
+    //一行的最后写行尾（0、0），整幅图的最后一行写图尾（0、1）。
+    //最长是每个点都用编码模式，每个点2个字节（绝对模式至少3个点，每个点不超过2个字节），再加行尾，见MaxRowBytes
+    void EncodeRow(const unsigned char *row,int width,bool last,std::vector<unsigned char> &out)
+    {
+        int x=0;
+        while(x<width)
+        {
+            int run=1;
+            while(x+run<width && run<255 && row[x+run]==row[x])
+                run++;
+            if(run>=2)
+            {
+                out.push_back((unsigned char)run);
+                out.push_back(row[x]);
+                x+=run;
+                continue;
+            }
+
+            //到下一段3个以上相同的点为止
+            int end=x+1;
+            while(end<width && end-x<255 && !(end+2<width && row[end]==row[end+1] && row[end]==row[end+2]))
+                end++;
+            int count=end-x;
+            if(count<3)
+            {
+                for(int i=0;i<count;i++)
+                {
+                    out.push_back(1);
+                    out.push_back(row[x+i]);
+                }
+            }
+            else
+            {
+                out.push_back(0);
+                out.push_back((unsigned char)count);
+                out.insert(out.end(),row+x,row+end);
+                if(count&1)
+                    out.push_back(0);
+            }
+            x=end;
+        }
+        out.push_back(0);
+        out.push_back(last?1:0);
+    }
+}
+
+BmpRle::Decoder::Decoder(BmpImage &image)
+    : m_image(image),m_rle4(image.Compression()==BMP_RLE4),m_width(image.Width()),m_height(image.Height()),m_x(0),m_y(0)
+{
+}
+
+size_t BmpRle::Decoder::Decode(const unsigned char *data, size_t size)
+{
+    //压缩的图总是从最下面一行开始存，文件里的行序就是储存顺序
+    size_t pos=0;
+    while(m_y<m_height && pos+2<=size)
+    {
+        int count=data[pos];
+        int value=data[pos+1];
+        if(count>0)
+        {
+            //编码模式：count个点都是value；RLE4时value的高4位、低4位两个颜色轮流用
+            unsigned char *row=m_image.Row(m_y);
+            int next=Advance(m_x,count,m_width);
+            if(!m_rle4)
+                memset(row+m_x,value,next-m_x);
+            else
+            {
+                unsigned char colors[2]={(unsigned char)(value>>4),(unsigned char)(value&15)};
+                for(int x=m_x;x<next;x++)
+                    row[x]=colors[(x-m_x)&1];
+            }
+            m_x=next;
+            pos+=2;
+        }
+        else if(value==0)       //行尾
+        {
+            m_x=0;
+            m_y++;
+            pos+=2;
+        }
+        else if(value==1)       //图尾
+        {
+            m_y=m_height;
+            pos+=2;
+        }
+        else if(value==2)       //位移：往右dx、往上dy
+        {
+            if(pos+4>size)
+                break;
+            m_x=Advance(m_x,data[pos+2],m_width);
+            m_y+=data[pos+3];
+            pos+=4;
+        }
+        else
+        {
+            //绝对模式：后面value个点原样存着，RLE4时一个字节两个点，按2字节补齐
+            size_t bytes=m_rle4?(size_t)(value+1)/2:(size_t)value;
+            bytes=(bytes+1)&~(size_t)1;
+            if(pos+2+bytes>size)
+                break;
+            const unsigned char *literal=data+pos+2;
+            unsigned char *row=m_image.Row(m_y);
+            int next=Advance(m_x,value,m_width);
+            if(!m_rle4)
+                memcpy(row+m_x,literal,next-m_x);
+            else
+            {
+                for(int i=0;i<next-m_x;i++)
+                    row[m_x+i]=(unsigned char)(i&1?literal[i/2]&15:literal[i/2]>>4);
+            }
+            m_x=next;
+            pos+=2+bytes;
+        }
+    }
+    return pos;
+}
+
+int BmpRle::Write(FILE *file, const BmpImage &image)
+{
+    //压缩的图只能从下往上存，高度为负的图倒过来写
+    std::vector<unsigned char> header(image.FileContent(),image.FileContent()+image.OffBits());
+    PutUInt32(&header[HEIGHT_POS],(unsigned int)image.Height());
+    PutUInt32(&header[COMPRESSION_POS],BMP_RLE8);
+    if(fwrite(&header[0],1,header.size(),file)!=header.size())
+        return IO_ERROR;
+
+    int width=image.Width();
+    int height=image.Height();
+    ThreadPool &pool=ThreadPool::Instance();
+    int threads=pool.ThreadCount();
+    int bandRows=(int)(BAND_PIXELS/(size_t)width);
+    if(bandRows<1)
+        bandRows=1;
+    std::vector<std::vector<unsigned char> > bands(threads);
+    unsigned long long written=0;
+
+    //每次每个线程编码一段行，编完了按顺序写出去，内存里只放这么多压缩后的数据
+    for(int first=0;first<height;first+=threads*bandRows)
+    {
+        pool.For(threads,1,[&](int begin,int end){
+            for(int band=begin;band<end;band++)
+            {
+                bands[band].clear();
+                int top=first+band*bandRows;
+                int bottom=top+bandRows<height?top+bandRows:height;
+                if(top<bottom)
+                    bands[band].reserve((size_t)(bottom-top)*MaxRowBytes(width));     //编码时不用再重新分配
+                for(int y=top;y<bottom;y++)
+                {
+                    const unsigned char *row=image.Row(image.IsBottomUp()?y:height-1-y);
+                    EncodeRow(row,width,y==height-1,bands[band]);
+                }
+            }
+        });
+        for(int band=0;band<threads;band++)
+        {
+            if(!bands[band].empty() && fwrite(&bands[band][0],1,bands[band].size(),file)!=bands[band].size())
+                return IO_ERROR;
+            written+=bands[band].size();
+        }
+    }
+
+    //写完才知道压缩后多大，回去填文件大小和像素数据大小。超过4GB存不下，填0
+    unsigned long long fileSize=header.size()+written;
+    unsigned char size[4];
+    PutUInt32(size,fileSize>0xffffffffull?0:(unsigned int)fileSize);
+    if(fseek(file,FILE_SIZE_POS,SEEK_SET)!=0 || fwrite(size,1,4,file)!=4)
+        return IO_ERROR;
+    PutUInt32(size,written>0xffffffffull?0:(unsigned int)written);
+    if(fseek(file,IMAGE_SIZE_POS,SEEK_SET)!=0 || fwrite(size,1,4,file)!=4)
+        return IO_ERROR;
+    return 0;
+}
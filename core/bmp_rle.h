@@ -0,0 +1,42 @@
+#ifndef BMP_RLE
+#define BMP_RLE
+
+#include <cstddef>
+#include <cstdio>
+
+class BmpImage;
+
+//BI_RLE8、BI_RLE4压缩的bmp：读的时候解成8位不压缩的放在BmpImage里，写的时候可以按RLE8压缩
+//压缩的图在网络盘上能小好几倍，读写的字节少了，解码、编码的时间比省下的传输时间少得多
+namespace BmpRle
+{
+    //把压缩的像素直接解到image的像素行里。image要先用ParseHeader按解开的8位准备好（Compression()不是BMP_RGB），
+    //内存已经清零，跳过的点（位移、行没写满就换行）保持0，也就是调色板里的第0种颜色
+    //压缩的数据可以分几次给：Decode只解完整的指令，返回用掉的字节数，剩下的不到一条指令的字节下次接在新数据前面再给
+    class Decoder
+    {
+    public:
+        explicit Decoder(BmpImage &image);
+
+        size_t Decode(const unsigned char *data,size_t size);
+        //数据没有了，后面没解到的行就当是解完了
+        void Finish() {m_y=m_height;}
+        bool IsFinished() const {return m_y>=m_height;}
+        //储存顺序从第0行开始已经解完的行数，ImageLoader按它一段一段地显示
+        int RowsDone() const {return m_y<m_height?m_y:m_height;}
+
+    private:
+        BmpImage &m_image;
+        bool m_rle4;
+        int m_width;
+        int m_height;
+        int m_x;
+        int m_y;
+    };
+
+    //把8位的image按RLE8写到file里：文件头、调色板照抄，改成压缩的；像素按一段一段的行并行编码，按顺序写
+    //成功返回0，否则返回IO_ERROR。有很多噪声的照片压缩后可能反而更大
+    int Write(FILE *file,const BmpImage &image);
+}
+
+#endif // BMP_RLE
@@ -0,0 +1,47 @@
+# 图像处理核心：bmp读写和各种滤波，只用标准C++，不依赖Qt的界面部分
+# 界面程序和批处理程序都include这个文件；core.pro把它单独编成静态库
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+# 用std::thread的线程池按行并行
+CONFIG += c++11
+# x86上打开SSSE3，bmp的像素格式转换用pshufb。查调色板的AVX2 gather在pixel_codec.cpp里运行时检测，不用加-mavx2
+contains(QT_ARCH, x86_64)|contains(QT_ARCH, i386) {
+    !msvc: QMAKE_CXXFLAGS += -mssse3
+}
+
+SOURCES += $$PWD/bmp_image.cpp \
+    $$PWD/bmp_codec.cpp \
+    $$PWD/bmp_rle.cpp \
+    $$PWD/image_filters.cpp \
+    $$PWD/window_filter.cpp \
+    $$PWD/in_place_filter.cpp \
+    $$PWD/filter_scratch.cpp \
+    $$PWD/temporal_filter.cpp \
+    $$PWD/pixel_codec.cpp \
+    $$PWD/noise_estimator.cpp \
+    $$PWD/filter_pipeline.cpp \
+    $$PWD/thread_pool.cpp \
+    $$PWD/image_metrics.cpp \
+    $$PWD/noise_generator.cpp \
+    $$PWD/noise_mask.cpp \
+    $$PWD/reference_filters.cpp
+
+HEADERS += $$PWD/global_defs.h \
+    $$PWD/bmp_image.h \
+    $$PWD/bmp_codec.h \
+    $$PWD/bmp_rle.h \
+    $$PWD/image_filters.h \
+    $$PWD/window_filter.h \
+    $$PWD/in_place_filter.h \
+    $$PWD/filter_scratch.h \
+    $$PWD/temporal_filter.h \
+    $$PWD/pixel_codec.h \
+    $$PWD/thread_pool.h \
+    $$PWD/image_metrics.h \
+    $$PWD/noise_generator.h \
+    $$PWD/noise_mask.h \
+    $$PWD/noise_estimator.h \
+    $$PWD/filter_pipeline.h \
+    $$PWD/reference_filters.h
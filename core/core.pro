@@ -0,0 +1,13 @@
+#-------------------------------------------------
+#
+# 图像处理核心库，不依赖Qt，给没有显示器的批处理机器直接链接
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = dipcore
+TEMPLATE = lib
+CONFIG += staticlib
+
+include(core.pri)
@@ -0,0 +1,167 @@
+#include "filter_pipeline.h"
+#include "bmp_image.h"
+#include "filter_scratch.h"
+#include "window_filter.h"
+#include "in_place_filter.h"
+#include "global_defs.h"
+#include "thread_pool.h"
+#include <cstring>
+
+namespace
+{
+    const int BAND_BYTES=256*1024;      //一个行带三个通道大约这么大，能放进二级缓存
+
+    //每一级输入缓冲区里的行：[begin,end)在缓冲区里，[begin,done)这些行的结果已经交给下一级了
+    struct StageRows
+    {
+        int begin;
+        int end;
+        int done;
+    };
+}
+
+FilterPipeline::FilterPipeline()
+{
+}
+
+void FilterPipeline::Add(StageKind kind, int size, int percentile)
+{
+    Stage stage;
+    stage.kind=kind;
+    stage.size=size;
+    stage.percentile=percentile;
+    m_stages.push_back(stage);
+}
+
+void FilterPipeline::Run(BmpImage &image, FilterScratch &scratch) const
+{
+    int stageCount=(int)m_stages.size();
+    if(stageCount==0)
+        return;
+
+    int width=image.Width();
+    int height=image.Height();
+    int totalRadius=0,maxSize=MAX_FILTER_SIZE;
+    int buffers=0;          //就地滤波和百分位数滤波都不用scratch里的通道，只有最小值、最大值要van Herk的缓冲区
+    for(int k=0;k<stageCount;k++)
+    {
+        totalRadius+=m_stages[k].size/2;
+        if(m_stages[k].size>maxSize)
+            maxSize=m_stages[k].size;
+        if(m_stages[k].kind==MIN || m_stages[k].kind==MAX)
+            buffers=FilterScratch::SEPARABLE;
+    }
+
+    //每一级的缓冲区最多放：上面留的半径行、还没滤的半径行、新来的一个行带和前面各级最后一次多交出来的行
+    int bandRows=(int)(BAND_BYTES/(3*(size_t)width));
+    if(bandRows<1)
+        bandRows=1;
+    if(bandRows>height)
+        bandRows=height;
+    int capacity=bandRows+2*totalRadius;
+    if(capacity>height)
+        capacity=height;
+
+    //不是就地滤的几级三个通道分给几个线程，每个线程用自己的那份scratch，WindowFilter每次只处理capacity行以内
+    ThreadPool &pool=ThreadPool::Instance();
+    scratch.PrepareWorkers(pool.ThreadCount());
+    size_t ringPlane=(size_t)capacity*width;
+    scratch.ReservePipelineRows(ringPlane*3*(stageCount+1));
+    unsigned char *rings=scratch.PipelineRows();
+
+    //第k级的输入是rings[k]，最后一份是每一级滤波结果的临时缓冲区
+    std::vector<StageRows> rows(stageCount);
+    for(int k=0;k<stageCount;k++)
+        rows[k].begin=rows[k].end=rows[k].done=0;
+    unsigned int palette[256];
+    int paletteSize=InPlaceFilter::PaletteColors(image,palette);
+    unsigned char *temp[3];
+    for(int channel=0;channel<3;channel++)
+        temp[channel]=rings+ringPlane*(3*stageCount+channel);
+
+    for(int row=0;row<height;row+=bandRows)
+    {
+        int count=row+bandRows>height?height-row:bandRows;
+        unsigned char *ring=rings;
+        image.ExtractRows(row,count,ring+(size_t)(rows[0].end-rows[0].begin)*width,
+                          ring+ringPlane+(size_t)(rows[0].end-rows[0].begin)*width,
+                          ring+ringPlane*2+(size_t)(rows[0].end-rows[0].begin)*width);
+        rows[0].end+=count;
+
+        for(int k=0;k<stageCount;k++)
+        {
+            const Stage &stage=m_stages[k];
+            StageRows &in=rows[k];
+            int radius=stage.size/2;
+
+            //下面还差radius行没来的行，窗口不完整，先不滤
+            int produce=in.end==height?height:in.end-radius;
+            if(produce<=in.done)
+                break;              //后面各级也不会有新的输入
+
+            int first=in.done-radius<0?0:in.done-radius;
+            int last=produce+radius>height?height:produce+radius;
+            unsigned char *input=rings+ringPlane*3*k;
+            const unsigned char *src[3];
+            for(int channel=0;channel<3;channel++)
+                src[channel]=input+ringPlane*channel+(size_t)(first-in.begin)*width;
+
+            //把[first,last)当成一幅小图来滤，最上面和最下面几行的窗口被截断了，不要，只取[done,produce)
+            const unsigned char *result[3]={temp[0],temp[1],temp[2]};
+            if(stage.kind==MEDIAN || stage.kind==ADAPTIVE_MEDIAN)
+            {
+                //就地滤：缓冲区里[first,done)留的是上次滤过的值，正好是就地滤波的窗口要用的
+                unsigned char *planes[3];
+                for(int channel=0;channel<3;channel++)
+                    result[channel]=planes[channel]=input+ringPlane*channel+(size_t)(first-in.begin)*width;
+                const unsigned int *colors=image.BitCount()==8?palette:0;
+                if(stage.kind==MEDIAN)
+                    InPlaceFilter::MedianFilter(planes,width,last-first,0,in.done-first,width,produce-first,0,stage.size,
+                                                colors,paletteSize);
+                else
+                    InPlaceFilter::AdaptiveMedianFilter(planes,width,last-first,0,in.done-first,width,produce-first,0,stage.size,
+                                                        colors,paletteSize);
+            }
+            else
+            {
+                pool.For(3,1,[&](int begin,int end){
+                    FilterScratch &local=scratch.Worker(ThreadPool::ThreadIndex());
+                    local.Reserve(width,capacity,maxSize,buffers);     //只有第一次才真正分配
+                    for(int channel=begin;channel<end;channel++)
+                    {
+                        if(stage.kind==MIN)
+                            WindowFilter::MinFilter(src[channel],temp[channel],width,last-first,stage.size,local);
+                        else if(stage.kind==MAX)
+                            WindowFilter::MaxFilter(src[channel],temp[channel],width,last-first,stage.size,local);
+                        else
+                            WindowFilter::RankFilter(src[channel],temp[channel],width,last-first,stage.size,stage.percentile,local);
+                    }
+                });
+            }
+
+            size_t offset=(size_t)(in.done-first)*width;
+            size_t bytes=(size_t)(produce-in.done)*width;
+            if(k==stageCount-1)
+                image.StoreRows(in.done,produce-in.done,result[0]+offset,result[1]+offset,result[2]+offset);
+            else
+            {
+                StageRows &out=rows[k+1];
+                unsigned char *output=rings+ringPlane*3*(k+1);
+                for(int channel=0;channel<3;channel++)
+                    memcpy(output+ringPlane*channel+(size_t)(out.end-out.begin)*width,result[channel]+offset,bytes);
+                out.end+=produce-in.done;
+            }
+            in.done=produce;
+
+            //再往上的行以后的窗口都用不到了，剩下的挪到缓冲区开头
+            int keep=produce-radius<in.begin?in.begin:produce-radius;
+            if(keep>in.begin)
+            {
+                for(int channel=0;channel<3;channel++)
+                    memmove(input+ringPlane*channel,input+ringPlane*channel+(size_t)(keep-in.begin)*width,
+                            (size_t)(in.end-keep)*width);
+                in.begin=keep;
+            }
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef FILTER_PIPELINE
+#define FILTER_PIPELINE
+
+#include <vector>
+
+class BmpImage;
+class FilterScratch;
+
+//一串滤波操作，比如3x3中值之后再自适应中值。Run时几个操作融合在一起，按行带（一次几十行）流过去：
+//每一级的输入只留最近的几行（环形缓冲区，够一个行带加上上下窗口半径），图像只读一遍、写一遍，
+//不用每一级都把整幅图拆通道、滤波、写回。结果和一级一级地对整幅图滤波一样：中值、自适应中值两种级和ImageFilters一样就地滤，
+//每个点都按调色板判断；其他几级8位图的中间结果不再经过调色板，中间的颜色不在调色板里时也不会被换回原来的编号
+//行带是一个一个按顺序流的；每一级里中值、自适应中值按InPlaceFilter的做法分给几个线程，其他几级三个通道分给几个线程
+class FilterPipeline
+{
+public:
+    enum StageKind{MEDIAN,MIN,MAX,RANK,ADAPTIVE_MEDIAN};
+
+    FilterPipeline();
+
+    void AddMedian(int size) {this->Add(MEDIAN,size,50);}
+    void AddMin(int size) {this->Add(MIN,size,0);}
+    void AddMax(int size) {this->Add(MAX,size,100);}
+    void AddRank(int size,int percentile) {this->Add(RANK,size,percentile);}
+    void AddAdaptiveMedian(int maxSize) {this->Add(ADAPTIVE_MEDIAN,maxSize,50);}
+    void Add(StageKind kind,int size,int percentile);       //percentile只对RANK有用
+    void Clear() {m_stages.clear();}
+    bool IsEmpty() const {return m_stages.empty();}
+
+    //按顺序执行所有操作，scratch和ImageFilters里的一样会按需要Reserve
+    void Run(BmpImage &image,FilterScratch &scratch) const;
+
+private:
+    struct Stage
+    {
+        StageKind kind;
+        int size;
+        int percentile;
+    };
+
+    std::vector<Stage> m_stages;
+};
+
+#endif // FILTER_PIPELINE
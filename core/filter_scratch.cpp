@@ -0,0 +1,87 @@
+#include "filter_scratch.h"
+#include "thread_pool.h"
+#include "global_defs.h"
+#include <cstring>
+
+FilterScratch::FilterScratch()
+    : m_width(0),m_height(0),m_maxWindowSize(0),m_buffers(0),m_planeSize(0),m_windowCapacity(0)
+{
+}
+
+void FilterScratch::Reserve(int width, int height, int maxWindowSize, int buffers)
+{
+    if(width<=m_width && height<=m_height && maxWindowSize<=m_maxWindowSize && (buffers&~m_buffers)==0)
+        return;
+
+    if(width<m_width)
+        width=m_width;
+    if(height<m_height)
+        height=m_height;
+    if(maxWindowSize<m_maxWindowSize)
+        maxWindowSize=m_maxWindowSize;
+    buffers|=m_buffers;
+
+    m_width=width;
+    m_height=height;
+    m_maxWindowSize=maxWindowSize;
+    m_buffers=buffers;
+    m_planeSize=(size_t)width*height;
+    m_windowCapacity=(size_t)maxWindowSize*maxWindowSize;
+    m_window.resize(m_windowCapacity*3);
+
+    if(buffers&PLANES)
+    {
+        m_source.reset(new unsigned char[m_planeSize*3]);
+        m_result.reset(new unsigned char[m_planeSize*3]);
+        //和ImageFilters分行带的切法一样，每个线程清零自己那几行，物理页就分在这个线程所在的节点上
+        unsigned char *source=m_source.get();
+        unsigned char *result=m_result.get();
+        size_t planeSize=m_planeSize;
+        ThreadPool::Instance().For(height,ROWS_PER_TASK,[=](int begin,int end){
+            for(int channel=0;channel<3;channel++)
+            {
+                memset(source+planeSize*channel+(size_t)begin*width,0,(size_t)(end-begin)*width);
+                memset(result+planeSize*channel+(size_t)begin*width,0,(size_t)(end-begin)*width);
+            }
+        });
+    }
+    if(buffers&(SEPARABLE|PIXEL_LISTS))
+        m_temp.resize(m_planeSize);
+    if(buffers&SEPARABLE)
+    {
+        int radius=maxWindowSize/2;
+        int longer=width>height?width:height;
+        m_prefix.resize((size_t)(height+2*radius)*width);
+        m_suffix.resize(m_prefix.size());
+        m_pad.resize(longer+2*radius);
+    }
+    if(buffers&PIXEL_LISTS)
+    {
+        m_pixelLists.resize(m_planeSize*3);
+        m_markPlane.resize(m_planeSize,0);
+    }
+}
+
+void FilterScratch::PrepareWorkers(int count)
+{
+    while((int)m_workers.size()<count)
+        m_workers.push_back(std::unique_ptr<FilterScratch>(new FilterScratch()));
+}
+
+void FilterScratch::ReserveRegionPlanes(size_t planeSize)
+{
+    if(m_regionPlanes.size()<planeSize*6)
+        m_regionPlanes.resize(planeSize*6);
+}
+
+void FilterScratch::ReservePipelineRows(size_t size)
+{
+    if(m_pipelineRows.size()<size)
+        m_pipelineRows.resize(size);
+}
+
+void FilterScratch::ReserveStatPlanes(size_t size)
+{
+    if(m_statPlanes.size()<size)
+        m_statPlanes.resize(size);
+}
@@ -0,0 +1,94 @@
+#ifndef FILTER_SCRATCH
+#define FILTER_SCRATCH
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+//一次滤波任务要用的所有临时内存：三个通道的原图和结果、可分离滤波的中间结果、
+//van Herk的前缀/后缀行、直方图、自适应滤波的窗口缓冲区、时间滤波的分块缓冲区
+//每种滤波在开始之前按图像大小把自己要用的那几种Reserve一次，之后滤波的循环里只取不分配，也不再逐个像素地清零；
+//用不到的缓冲区不分配
+//不是线程安全的，每个线程用自己的一份：并行滤波时用Worker(i)给第i个线程的那份
+class FilterScratch
+{
+public:
+    //Reserve要准备的几种缓冲区，按要做的滤波组合起来
+    enum BufferKind
+    {
+        PLANES=1,           //三个通道的原图和结果
+        SEPARABLE=2,        //van Herk的临时通道、前缀/后缀行和补齐行：最小值、最大值滤波和用到它们的滤波
+        PIXEL_LISTS=4       //迭代中值滤波的三个点列表、标记通道和临时通道
+    };
+
+    FilterScratch();
+
+    //按width*height的图像、最大maxWindowSize x maxWindowSize的窗口准备好buffers（BufferKind的组合）里的缓冲区，
+    //已经够大就什么都不做。以前准备过的其他几种也按新的大小重新准备
+    //原图和结果通道按ThreadPool按行分段的切法由各个线程第一次写，分到各自的NUMA节点上
+    void Reserve(int width,int height,int maxWindowSize,int buffers);
+
+    //并行滤波时每个线程自己的一份，按ThreadPool::ThreadIndex()取。第一次Reserve在那个线程里做，内存也就在它的节点上
+    void PrepareWorkers(int count);
+    FilterScratch &Worker(int index) {return *m_workers[index];}
+
+    size_t PlaneSize() const {return m_planeSize;}
+    unsigned char *SourcePlane(int channel) {return m_source.get()+m_planeSize*channel;}   //channel:0红 1绿 2蓝
+    unsigned char *ResultPlane(int channel) {return m_result.get()+m_planeSize*channel;}
+    unsigned char *TempPlane() {return &m_temp[0];}
+
+    //van Herk用的：前缀行和后缀行，各(height+2*radius)*width个字节；补齐边界用的一行
+    unsigned char *PrefixRows() {return &m_prefix[0];}
+    unsigned char *SuffixRows() {return &m_suffix[0];}
+    unsigned char *PadLine() {return &m_pad[0];}
+
+    int *Histogram() {return m_histogram;}          //256格
+    int *CoarseHistogram() {return m_coarse;}       //16格，每格对应Histogram()的16格
+
+    unsigned char *Window(int channel) {return &m_window[m_windowCapacity*channel];}   //一个窗口里的所有值
+
+    //迭代中值滤波用的：变化点、候选点、候选点的新值三个列表，各PlaneSize()个ptrdiff_t（点数可以超过2^31）；
+    //和一个标记通道，PlaneSize()个字节，用的人要保证用完之后恢复成全0
+    ptrdiff_t *PixelLists() {return &m_pixelLists[0];}
+    unsigned char *MarkPlane() {return &m_markPlane[0];}
+
+    //下面几种的大小要看具体的滤波怎么切分，由用到它的滤波在开始之前按最大的需要Reserve一次，已经够大就什么都不做
+    //只滤图像的一块区域时用的：三个通道的原图和结果，共6个通道，每个planeSize字节
+    void ReserveRegionPlanes(size_t planeSize);
+    unsigned char *RegionPlanes() {return &m_regionPlanes[0];}
+    //FilterPipeline每一级的行缓冲区，共size个字节
+    void ReservePipelineRows(size_t size);
+    unsigned char *PipelineRows() {return &m_pipelineRows[0];}
+    //自适应滤波一个行带的统计量，共size个字节（见WindowFilter::AdaptiveStatSize）
+    void ReserveStatPlanes(size_t size);
+    unsigned char *StatPlanes() {return &m_statPlanes[0];}
+
+private:
+    FilterScratch(const FilterScratch &);
+    FilterScratch &operator=(const FilterScratch &);
+
+    int m_width;
+    int m_height;
+    int m_maxWindowSize;
+    int m_buffers;                                  //已经准备好的BufferKind
+    size_t m_planeSize;
+    size_t m_windowCapacity;
+
+    std::unique_ptr<unsigned char[]> m_source;      //不用vector，免得分配时在当前线程里清零
+    std::unique_ptr<unsigned char[]> m_result;
+    std::vector<unsigned char> m_temp;
+    std::vector<unsigned char> m_prefix;
+    std::vector<unsigned char> m_suffix;
+    std::vector<unsigned char> m_pad;
+    std::vector<unsigned char> m_window;
+    std::vector<unsigned char> m_regionPlanes;
+    std::vector<unsigned char> m_pipelineRows;
+    std::vector<ptrdiff_t> m_pixelLists;
+    std::vector<unsigned char> m_markPlane;
+    std::vector<unsigned char> m_statPlanes;
+    std::vector<std::unique_ptr<FilterScratch> > m_workers;
+    int m_histogram[256];
+    int m_coarse[16];
+};
+
+#endif // FILTER_SCRATCH
@@ -0,0 +1,21 @@
+#ifndef GLOBAL_DEFS
+#define GLOBAL_DEFS
+
+const int FORMAT_ERROR=1;       //不是bmp文件，或者文件不完整
+const int BITCOUNT_ERROR=2;     //是bmp，但不是8位或24位的
+const int IO_ERROR=3;           //文件打不开、读写失败
+const int SIZE_ERROR=4;         //图像大小不对：两幅图的大小不一样，或者宽高不是正数，或者大到这个平台上放不下
+
+const int MAX_FILTER_SIZE=7;    //目前支持的最大窗口是7x7
+const int MAX_MEDIAN_PASSES=20; //迭代中值滤波默认最多做几遍
+
+const int ROWS_PER_TASK=64;     //按行并行时每个线程至少分到这么多行，太小的图就不值得分
+
+const int BMP_HEADER_SIZE=54;   //文件头加上最常见的40字节的信息头，ParseHeader只需要这么多
+
+//bmp文件头里的压缩方式。不用windows.h里的BI_RGB等名字，那几个是宏
+const int BMP_RGB=0;            //不压缩
+const int BMP_RLE8=1;           //8位的行程编码
+const int BMP_RLE4=2;           //4位的行程编码，读进来时解成8位
+
+#endif // GLOBAL_DEFS
@@ -0,0 +1,328 @@
+#include "image_filters.h"
+#include "bmp_image.h"
+#include "filter_scratch.h"
+#include "window_filter.h"
+#include "noise_estimator.h"
+#include "global_defs.h"
+#include "thread_pool.h"
+#include "pixel_codec.h"
+#include "in_place_filter.h"
+#include <cstring>
+
+namespace
+{
+    //把scratch里的原图按行分给线程池，每个线程把自己那段连同上下radius行一起滤，再把中间那段拷进scratch的结果通道
+    //窗口在图像边界上本来就是截断的，多带上下radius行就和对整幅图滤波的结果完全一样
+    //filter(source,result,rows,scratch)对从source开始的rows行做滤波，scratch是当前线程自己的那份，按buffers准备
+    template<class Filter>
+    void FilterInBands(FilterScratch &scratch,int width,int height,int radius,int buffers,const Filter &filter)
+    {
+        ThreadPool &pool=ThreadPool::Instance();
+        scratch.PrepareWorkers(pool.ThreadCount());
+        pool.For(height,ROWS_PER_TASK,[&](int begin,int end){
+            if(begin==0 && end==height)     //没有分段，直接滤整幅图
+            {
+                unsigned char *source[3]={scratch.SourcePlane(0),scratch.SourcePlane(1),scratch.SourcePlane(2)};
+                unsigned char *result[3]={scratch.ResultPlane(0),scratch.ResultPlane(1),scratch.ResultPlane(2)};
+                filter(source,result,height,scratch);
+                return;
+            }
+
+            int top=begin-radius<0?0:begin-radius;
+            int bottom=end+radius>height?height:end+radius;
+            FilterScratch &local=scratch.Worker(ThreadPool::ThreadIndex());
+            local.Reserve(width,bottom-top,2*radius+1>MAX_FILTER_SIZE?2*radius+1:MAX_FILTER_SIZE,buffers);
+            unsigned char *source[3],*result[3];
+            for(int channel=0;channel<3;channel++)
+            {
+                source[channel]=scratch.SourcePlane(channel)+(size_t)top*width;
+                result[channel]=local.ResultPlane(channel);
+            }
+            filter(source,result,bottom-top,local);
+            for(int channel=0;channel<3;channel++)
+                memcpy(scratch.ResultPlane(channel)+(size_t)begin*width,result[channel]+(size_t)(begin-top)*width,(size_t)(end-begin)*width);
+        });
+    }
+
+    //kind对应的滤波要的缓冲区：原图和结果通道总要，最小值、最大值还要van Herk的那几种
+    int BuffersFor(FilterPipeline::StageKind kind)
+    {
+        if(kind==FilterPipeline::MIN || kind==FilterPipeline::MAX)
+            return FilterScratch::PLANES|FilterScratch::SEPARABLE;
+        return FilterScratch::PLANES;
+    }
+
+    //对scratch里拆出来的width x height的小图做kind对应的滤波（最小值、最大值、百分位数），结果写进结果通道
+    void FilterPlanes(FilterScratch &scratch,int width,int height,FilterPipeline::StageKind kind,int size,int percentile)
+    {
+        FilterInBands(scratch,width,height,size/2,BuffersFor(kind),[&](unsigned char *source[3],unsigned char *result[3],int rows,FilterScratch &local){
+            for(int channel=0;channel<3;channel++)
+            {
+                if(kind==FilterPipeline::MIN)
+                    WindowFilter::MinFilter(source[channel],result[channel],width,rows,size,local);
+                else if(kind==FilterPipeline::MAX)
+                    WindowFilter::MaxFilter(source[channel],result[channel],width,rows,size,local);
+                else
+                    WindowFilter::RankFilter(source[channel],result[channel],width,rows,size,percentile,local);
+            }
+        });
+    }
+
+    //把region连同四周窗口半径宽的一圈（超出图像的部分不要）拆到scratch的原图通道里滤波，
+    //mask为0的点换回原来的值，再交给store(result,stride)：result是三个通道里region左上角的点，一行stride个字节
+    //读、滤、写的量都和region的大小成正比
+    template<class Store>
+    void FilterImageRegion(const BmpImage &image,const ImageFilters::Region &region,FilterPipeline::StageKind kind,
+                           int size,int percentile,FilterScratch &scratch,const Store &store)
+    {
+        int radius=size/2;
+        int left=region.left-radius<0?0:region.left-radius;
+        int top=region.top-radius<0?0:region.top-radius;
+        int right=region.right+radius>image.Width()?image.Width():region.right+radius;
+        int bottom=region.bottom+radius>image.Height()?image.Height():region.bottom+radius;
+        int width=right-left;
+        int height=bottom-top;
+        int regionWidth=region.right-region.left;
+        int regionHeight=region.bottom-region.top;
+        if(regionWidth<=0 || regionHeight<=0)
+            return;
+
+        scratch.Reserve(width,height,size>MAX_FILTER_SIZE?size:MAX_FILTER_SIZE,BuffersFor(kind));     //只有第一次滤波时才真正分配
+        image.ExtractRect(left,top,width,height,scratch.SourcePlane(0),scratch.SourcePlane(1),scratch.SourcePlane(2),width);
+
+        size_t offset=(size_t)(region.top-top)*width+(region.left-left);
+        if(kind==FilterPipeline::MEDIAN || kind==FilterPipeline::ADAPTIVE_MEDIAN)
+        {
+            //原来的两种中值滤波就地滤，滤完的点马上用在后面的窗口里；mask为0的点本来就不动
+            unsigned char *planes[3]={scratch.SourcePlane(0),scratch.SourcePlane(1),scratch.SourcePlane(2)};
+            unsigned int palette[256];
+            int paletteSize=InPlaceFilter::PaletteColors(image,palette);
+            const unsigned int *colors=image.BitCount()==8?palette:0;
+            if(kind==FilterPipeline::MEDIAN)
+                InPlaceFilter::MedianFilter(planes,width,height,region.left-left,region.top-top,region.right-left,region.bottom-top,
+                                            region.mask,size,colors,paletteSize);
+            else
+                InPlaceFilter::AdaptiveMedianFilter(planes,width,height,region.left-left,region.top-top,region.right-left,
+                                                    region.bottom-top,region.mask,size,colors,paletteSize);
+            const unsigned char *result[3]={planes[0]+offset,planes[1]+offset,planes[2]+offset};
+            store(result,width);
+            return;
+        }
+
+        FilterPlanes(scratch,width,height,kind,size,percentile);
+
+        if(region.mask!=0)
+        {
+            for(int channel=0;channel<3;channel++)
+            {
+                const unsigned char *src=scratch.SourcePlane(channel)+offset;
+                unsigned char *dst=scratch.ResultPlane(channel)+offset;
+                for(int y=0;y<regionHeight;y++)
+                {
+                    const unsigned char *mask=region.mask+(size_t)y*regionWidth;
+                    for(int x=0;x<regionWidth;x++)
+                    {
+                        if(mask[x]==0)
+                            dst[(size_t)y*width+x]=src[(size_t)y*width+x];
+                    }
+                }
+            }
+        }
+        const unsigned char *result[3]={scratch.ResultPlane(0)+offset,scratch.ResultPlane(1)+offset,scratch.ResultPlane(2)+offset};
+        store(result,width);
+    }
+
+    ImageFilters::Region WholeImage(const BmpImage &image)
+    {
+        ImageFilters::Region region={0,0,image.Width(),image.Height(),0};
+        return region;
+    }
+
+    void ApplyFilter(BmpImage &image,const ImageFilters::Region &region,FilterPipeline::StageKind kind,
+                     int size,int percentile,FilterScratch &scratch)
+    {
+        FilterImageRegion(image,region,kind,size,percentile,scratch,[&](const unsigned char *const result[3],int stride){
+            image.StoreRect(region.left,region.top,region.right-region.left,region.bottom-region.top,
+                            result[0],result[1],result[2],stride);
+        });
+    }
+}
+
+namespace
+{
+    //只对scratch里原图的[left,right) x [top,bottom)这块做choice对应的滤波，结果写进scratch的结果通道
+    //把这块连同四周窗口半径宽的一圈（超出图像的部分不要）拷到local里单独滤，和对整幅图滤波的结果完全一样
+    void FilterRegion(FilterScratch &scratch,FilterScratch &local,int width,int height,NoiseEstimator::FilterChoice choice,
+                      int left,int top,int right,int bottom)
+    {
+        int size=NoiseEstimator::WindowSize(choice);
+        int radius=size/2;
+        int regionLeft=left-radius<0?0:left-radius;
+        int regionTop=top-radius<0?0:top-radius;
+        int regionRight=right+radius>width?width:right+radius;
+        int regionBottom=bottom+radius>height?height:bottom+radius;
+        int regionWidth=regionRight-regionLeft;
+        int regionHeight=regionBottom-regionTop;
+        size_t regionSize=(size_t)regionWidth*regionHeight;
+
+        unsigned char *planes=local.RegionPlanes();
+        unsigned char *source[3],*result[3];
+        for(int channel=0;channel<3;channel++)
+        {
+            source[channel]=planes+regionSize*channel;
+            result[channel]=planes+regionSize*(3+channel);
+            const unsigned char *src=scratch.SourcePlane(channel);
+            for(int y=regionTop;y<regionBottom;y++)
+                memcpy(source[channel]+(size_t)(y-regionTop)*regionWidth,src+(size_t)y*width+regionLeft,regionWidth);
+        }
+
+        if(choice==NoiseEstimator::ADAPTIVE_MEDIAN)
+            WindowFilter::AdaptiveMedianFilter(source,result,regionWidth,regionHeight,size,local);
+        else
+        {
+            for(int channel=0;channel<3;channel++)
+                WindowFilter::RankFilter(source[channel],result[channel],regionWidth,regionHeight,size,50,local);
+        }
+
+        for(int channel=0;channel<3;channel++)
+        {
+            unsigned char *dst=scratch.ResultPlane(channel);
+            for(int y=top;y<bottom;y++)
+                memcpy(dst+(size_t)y*width+left,
+                       result[channel]+(size_t)(y-regionTop)*regionWidth+(left-regionLeft),right-left);
+        }
+    }
+}
+
+void ImageFilters::MedianFilter(BmpImage &image, int size, FilterScratch &scratch)
+{
+    ApplyFilter(image,WholeImage(image),FilterPipeline::MEDIAN,size,50,scratch);
+}
+
+void ImageFilters::MinFilter(BmpImage &image, int size, FilterScratch &scratch)
+{
+    ApplyFilter(image,WholeImage(image),FilterPipeline::MIN,size,0,scratch);
+}
+
+void ImageFilters::MaxFilter(BmpImage &image, int size, FilterScratch &scratch)
+{
+    ApplyFilter(image,WholeImage(image),FilterPipeline::MAX,size,100,scratch);
+}
+
+void ImageFilters::RankFilter(BmpImage &image, int size, int percentile, FilterScratch &scratch)
+{
+    ApplyFilter(image,WholeImage(image),FilterPipeline::RANK,size,percentile,scratch);
+}
+
+void ImageFilters::AdaptiveMedianFilter(BmpImage &image, int maxSize, FilterScratch &scratch)
+{
+    ApplyFilter(image,WholeImage(image),FilterPipeline::ADAPTIVE_MEDIAN,maxSize,50,scratch);
+}
+
+void ImageFilters::MedianFilter(BmpImage &image, int size, const Region &region, FilterScratch &scratch)
+{
+    ApplyFilter(image,region,FilterPipeline::MEDIAN,size,50,scratch);
+}
+
+void ImageFilters::MinFilter(BmpImage &image, int size, const Region &region, FilterScratch &scratch)
+{
+    ApplyFilter(image,region,FilterPipeline::MIN,size,0,scratch);
+}
+
+void ImageFilters::MaxFilter(BmpImage &image, int size, const Region &region, FilterScratch &scratch)
+{
+    ApplyFilter(image,region,FilterPipeline::MAX,size,100,scratch);
+}
+
+void ImageFilters::RankFilter(BmpImage &image, int size, int percentile, const Region &region, FilterScratch &scratch)
+{
+    ApplyFilter(image,region,FilterPipeline::RANK,size,percentile,scratch);
+}
+
+void ImageFilters::AdaptiveMedianFilter(BmpImage &image, int maxSize, const Region &region, FilterScratch &scratch)
+{
+    ApplyFilter(image,region,FilterPipeline::ADAPTIVE_MEDIAN,maxSize,50,scratch);
+}
+
+void ImageFilters::PreviewFilter(const BmpImage &image, FilterPipeline::StageKind kind, int size, int percentile,
+                                 const Region &region, unsigned char *rgb32, ptrdiff_t bytesPerLine, FilterScratch &scratch)
+{
+    int regionHeight=region.bottom-region.top;
+    bool bottomUp=image.IsBottomUp();
+    FilterImageRegion(image,region,kind,size,percentile,scratch,[&](const unsigned char *const result[3],int stride){
+        ThreadPool::Instance().For(regionHeight,ROWS_PER_TASK,[&](int begin,int end){
+            for(int row=begin;row<end;row++)
+            {
+                size_t i=(size_t)row*stride;
+                int line=bottomUp?regionHeight-1-row:row;       //和BmpImage::ToRgb32一样上下翻过来
+                PixelCodec::PlanesToRgb32(result[0]+i,result[1]+i,result[2]+i,(unsigned int *)(rgb32+line*bytesPerLine),
+                                          region.right-region.left);
+            }
+        });
+    });
+}
+
+int ImageFilters::IterativeMedianFilter(BmpImage &image, int size, int maxPasses, FilterScratch &scratch)
+{
+    int width=image.Width();
+    int height=image.Height();
+
+    scratch.Reserve(width,height,size>MAX_FILTER_SIZE?size:MAX_FILTER_SIZE,FilterScratch::PLANES|FilterScratch::PIXEL_LISTS);
+    unsigned char *source[3]={scratch.SourcePlane(0),scratch.SourcePlane(1),scratch.SourcePlane(2)};
+    unsigned char *result[3]={scratch.ResultPlane(0),scratch.ResultPlane(1),scratch.ResultPlane(2)};
+    image.ExtractPlanes(source[0],source[1],source[2]);
+    int passes=WindowFilter::IterativeMedianFilter(source,result,width,height,size,maxPasses,scratch);
+    image.StorePlanes(result[0],result[1],result[2]);
+    return passes;
+}
+
+double ImageFilters::AutoFilter(BmpImage &image, FilterScratch &scratch)
+{
+    int width=image.Width();
+    int height=image.Height();
+
+    scratch.Reserve(width,height,MAX_FILTER_SIZE,FilterScratch::PLANES);
+    //一次最多滤一整行块，连同上下的窗口半径。块的临时内存用Worker(0)那份，按这么大准备
+    int regionHeight=AUTO_BLOCK_SIZE+MAX_FILTER_SIZE-1>height?height:AUTO_BLOCK_SIZE+MAX_FILTER_SIZE-1;
+    scratch.PrepareWorkers(1);
+    FilterScratch &local=scratch.Worker(0);
+    local.Reserve(width,regionHeight,MAX_FILTER_SIZE,FilterScratch::SEPARABLE);
+    local.ReserveRegionPlanes((size_t)width*regionHeight);
+    local.ReserveStatPlanes(WindowFilter::AdaptiveStatSize(width,regionHeight,MAX_FILTER_SIZE));
+    const unsigned char *source[3]={scratch.SourcePlane(0),scratch.SourcePlane(1),scratch.SourcePlane(2)};
+    image.ExtractPlanes(scratch.SourcePlane(0),scratch.SourcePlane(1),scratch.SourcePlane(2));
+    for(int channel=0;channel<3;channel++)      //不滤的块保持原样
+        memcpy(scratch.ResultPlane(channel),source[channel],image.PixelCount());
+
+    double noise=0;
+    for(int top=0;top<height;top+=AUTO_BLOCK_SIZE)
+    {
+        int bottom=top+AUTO_BLOCK_SIZE>height?height:top+AUTO_BLOCK_SIZE;
+
+        //同一行里相邻的、选了同一种滤波器的块合在一起滤，少拷一些边
+        int runLeft=0;
+        NoiseEstimator::FilterChoice runChoice=NoiseEstimator::NO_FILTER;
+        for(int left=0;left<width;left+=AUTO_BLOCK_SIZE)
+        {
+            int right=left+AUTO_BLOCK_SIZE>width?width:left+AUTO_BLOCK_SIZE;
+            double density=NoiseEstimator::Density(source,width,height,left,top,right,bottom,AUTO_SAMPLE_STEP);
+            noise+=density*(right-left)*(bottom-top);
+
+            NoiseEstimator::FilterChoice choice=NoiseEstimator::ChooseFilter(density);
+            if(left==0)
+                runChoice=choice;
+            else if(choice!=runChoice)
+            {
+                if(runChoice!=NoiseEstimator::NO_FILTER)
+                    FilterRegion(scratch,local,width,height,runChoice,runLeft,top,left,bottom);
+                runLeft=left;
+                runChoice=choice;
+            }
+        }
+        if(runChoice!=NoiseEstimator::NO_FILTER)
+            FilterRegion(scratch,local,width,height,runChoice,runLeft,top,width,bottom);
+    }
+
+    image.StorePlanes(scratch.ResultPlane(0),scratch.ResultPlane(1),scratch.ResultPlane(2));
+    return noise/(double)image.PixelCount();
+}
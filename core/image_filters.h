@@ -0,0 +1,56 @@
+#ifndef IMAGE_FILTERS
+#define IMAGE_FILTERS
+
+#include <cstddef>
+#include "filter_pipeline.h"
+
+class BmpImage;
+class FilterScratch;
+
+//对整幅bmp图像做滤波：拆成r、g、b三个通道交给WindowFilter，滤完再写回图像
+//中值、自适应中值滤波和原来一样就地滤（见InPlaceFilter），其他滤波读的都是滤波前的图像。
+//scratch会按需要Reserve，同一个scratch可以在多次滤波之间复用
+namespace ImageFilters
+{
+    //图像里要滤的一块：储存顺序（见BmpImage）的[left,right) x [top,bottom)。
+    //mask不为0时是这块矩形里每个点一个字节，一行right-left个，只有不为0的点会变
+    struct Region
+    {
+        int left;
+        int top;
+        int right;
+        int bottom;
+        const unsigned char *mask;
+    };
+
+    void MedianFilter(BmpImage &image,int size,FilterScratch &scratch);
+    void MinFilter(BmpImage &image,int size,FilterScratch &scratch);
+    void MaxFilter(BmpImage &image,int size,FilterScratch &scratch);
+    void RankFilter(BmpImage &image,int size,int percentile,FilterScratch &scratch);
+    void AdaptiveMedianFilter(BmpImage &image,int maxSize,FilterScratch &scratch);
+    //反复做中值滤波直到图像不再变化，最多maxPasses遍，返回做了几遍。每遍都读上一遍的结果、写到另一块，不是就地滤的，
+    //所以做1遍和MedianFilter（就地）不一样，和RankFilter的50%一样
+    int IterativeMedianFilter(BmpImage &image,int size,int maxPasses,FilterScratch &scratch);
+
+    //只滤region这块：连同四周窗口半径宽的一圈一起读出来滤，结果和对整幅图滤波后只取这块一样，
+    //解码、滤波、写回的量都只和这块的大小有关。两种就地的中值滤波例外：这块外面的点不滤，窗口里用的是它们原来的值
+    void MedianFilter(BmpImage &image,int size,const Region &region,FilterScratch &scratch);
+    void MinFilter(BmpImage &image,int size,const Region &region,FilterScratch &scratch);
+    void MaxFilter(BmpImage &image,int size,const Region &region,FilterScratch &scratch);
+    void RankFilter(BmpImage &image,int size,int percentile,const Region &region,FilterScratch &scratch);
+    void AdaptiveMedianFilter(BmpImage &image,int maxSize,const Region &region,FilterScratch &scratch);
+
+    //预览：对region这块做kind对应的滤波，结果不写回image，直接转成0xffRRGGBB写到rgb32里（一块region大小的显示图像，
+    //已经上下翻好，bytesPerLine是一行的字节数）。8位图的结果不经过调色板，颜色不在调色板里时和真正滤波的结果略有不同
+    void PreviewFilter(const BmpImage &image,FilterPipeline::StageKind kind,int size,int percentile,
+                       const Region &region,unsigned char *rgb32,ptrdiff_t bytesPerLine,FilterScratch &scratch);
+
+    //自动模式：把图像分成AUTO_BLOCK_SIZE见方的块，每块估计噪声密度（见NoiseEstimator，每隔AUTO_SAMPLE_STEP个点取一个），
+    //噪声少的块用小窗口中值滤波，多的用大窗口或自适应，没有噪声的块不动。返回整幅图的噪声密度
+    //各块读的都是滤波前的图像，中值、自适应中值都不是就地滤的
+    const int AUTO_BLOCK_SIZE=64;
+    const int AUTO_SAMPLE_STEP=3;
+    double AutoFilter(BmpImage &image,FilterScratch &scratch);
+}
+
+#endif // IMAGE_FILTERS
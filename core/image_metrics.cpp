@@ -0,0 +1,192 @@
+#include "image_metrics.h"
+#include "bmp_image.h"
+#include "filter_scratch.h"
+#include "thread_pool.h"
+#include "global_defs.h"
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    const int SSIM_WINDOW=8;
+    const double SSIM_C1=(0.01*255)*(0.01*255);
+    const double SSIM_C2=(0.03*255)*(0.03*255);
+    const int SQUARE_BLOCK=4096;        //32位的累加器每加这么多个点就倒进64位的和里，不会溢出
+
+    //一行里两幅图对应点的差的平方和
+    unsigned long long SquaredError(const unsigned char *a,const unsigned char *b,size_t count)
+    {
+        unsigned long long sum=0;
+        size_t x=0;
+#if defined(__SSE2__)
+        const __m128i zero=_mm_setzero_si128();
+        while(x+16<=count)
+        {
+            __m128i acc=zero;
+            size_t end=x+SQUARE_BLOCK<count?x+SQUARE_BLOCK:count;
+            for(;x+16<=end;x+=16)
+            {
+                __m128i va=_mm_loadu_si128((const __m128i *)(a+x));
+                __m128i vb=_mm_loadu_si128((const __m128i *)(b+x));
+                __m128i diff=_mm_or_si128(_mm_subs_epu8(va,vb),_mm_subs_epu8(vb,va));
+                __m128i low=_mm_unpacklo_epi8(diff,zero);
+                __m128i high=_mm_unpackhi_epi8(diff,zero);
+                acc=_mm_add_epi32(acc,_mm_add_epi32(_mm_madd_epi16(low,low),_mm_madd_epi16(high,high)));
+            }
+            unsigned int lanes[4];
+            _mm_storeu_si128((__m128i *)lanes,acc);
+            sum+=(unsigned long long)lanes[0]+lanes[1]+lanes[2]+lanes[3];
+        }
+#endif
+        for(;x<count;x++)
+        {
+            int diff=a[x]-b[x];
+            sum+=diff*diff;
+        }
+        return sum;
+    }
+
+    //每一列窗口高度那么多行的和：a、b、a*a、b*b、a*b，sign为-1时减掉这一行
+    struct ColumnSums
+    {
+        std::vector<int> a,b,aa,bb,ab;
+        explicit ColumnSums(int width) : a(width,0),b(width,0),aa(width,0),bb(width,0),ab(width,0) {}
+
+        void AddRow(const unsigned char *rowA,const unsigned char *rowB,int width,int sign)
+        {
+            int x=0;
+#if defined(__SSE2__)
+            const __m128i zero=_mm_setzero_si128();
+            for(;x+8<=width;x+=8)
+            {
+                __m128i a16=_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(rowA+x)),zero);
+                __m128i b16=_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(rowB+x)),zero);
+                for(int half=0;half<2;half++)
+                {
+                    //每个32位里高16位是0，madd正好得到a*a、a*b
+                    __m128i a32=half==0?_mm_unpacklo_epi16(a16,zero):_mm_unpackhi_epi16(a16,zero);
+                    __m128i b32=half==0?_mm_unpacklo_epi16(b16,zero):_mm_unpackhi_epi16(b16,zero);
+                    __m128i values[5]={a32,b32,_mm_madd_epi16(a32,a32),_mm_madd_epi16(b32,b32),_mm_madd_epi16(a32,b32)};
+                    int *sums[5]={&a[x+4*half],&b[x+4*half],&aa[x+4*half],&bb[x+4*half],&ab[x+4*half]};
+                    for(int i=0;i<5;i++)
+                    {
+                        __m128i old=_mm_loadu_si128((const __m128i *)sums[i]);
+                        old=sign>0?_mm_add_epi32(old,values[i]):_mm_sub_epi32(old,values[i]);
+                        _mm_storeu_si128((__m128i *)sums[i],old);
+                    }
+                }
+            }
+#endif
+            for(;x<width;x++)
+            {
+                int va=rowA[x],vb=rowB[x];
+                a[x]+=sign*va;
+                b[x]+=sign*vb;
+                aa[x]+=sign*va*va;
+                bb[x]+=sign*vb*vb;
+                ab[x]+=sign*va*vb;
+            }
+        }
+    };
+
+    //左上角在第[firstRow,lastRow)行的所有window x window窗口的SSIM之和
+    //相当于积分图：列和随着行往下滑动时加一行、减一行，行内的窗口和随着列往右滑动时加一列、减一列，
+    //每个窗口O(1)，内存只要五行
+    double SsimSum(const unsigned char *a,const unsigned char *b,int width,int window,int firstRow,int lastRow)
+    {
+        ColumnSums columns(width);
+        for(int y=firstRow;y<firstRow+window;y++)
+            columns.AddRow(a+(size_t)y*width,b+(size_t)y*width,width,1);
+
+        double n=(double)window*window;
+        double sum=0;
+        for(int y=firstRow;y<lastRow;y++)
+        {
+            if(y>firstRow)
+            {
+                columns.AddRow(a+(size_t)(y+window-1)*width,b+(size_t)(y+window-1)*width,width,1);
+                columns.AddRow(a+(size_t)(y-1)*width,b+(size_t)(y-1)*width,width,-1);
+            }
+
+            int sa=0,sb=0,saa=0,sbb=0,sab=0;
+            for(int x=0;x<window;x++)
+            {
+                sa+=columns.a[x];
+                sb+=columns.b[x];
+                saa+=columns.aa[x];
+                sbb+=columns.bb[x];
+                sab+=columns.ab[x];
+            }
+            for(int x=0;;x++)
+            {
+                double muA=sa/n,muB=sb/n;
+                double varA=saa/n-muA*muA;
+                double varB=sbb/n-muB*muB;
+                double cov=sab/n-muA*muB;
+                sum+=(2*muA*muB+SSIM_C1)*(2*cov+SSIM_C2)/((muA*muA+muB*muB+SSIM_C1)*(varA+varB+SSIM_C2));
+
+                if(x+window>=width)
+                    break;
+                sa+=columns.a[x+window]-columns.a[x];
+                sb+=columns.b[x+window]-columns.b[x];
+                saa+=columns.aa[x+window]-columns.aa[x];
+                sbb+=columns.bb[x+window]-columns.bb[x];
+                sab+=columns.ab[x+window]-columns.ab[x];
+            }
+        }
+        return sum;
+    }
+}
+
+int ImageMetrics::Compare(const BmpImage &image, const BmpImage &reference, Quality &quality, FilterScratch &scratch)
+{
+    int width=image.Width();
+    int height=image.Height();
+    if(width!=reference.Width() || height!=reference.Height() || width==0 || height==0)
+        return SIZE_ERROR;
+
+    scratch.Reserve(width,height,MAX_FILTER_SIZE,FilterScratch::PLANES);
+    image.ExtractPlanes(scratch.SourcePlane(0),scratch.SourcePlane(1),scratch.SourcePlane(2));
+    reference.ExtractPlanes(scratch.ResultPlane(0),scratch.ResultPlane(1),scratch.ResultPlane(2));
+
+    ThreadPool &pool=ThreadPool::Instance();
+    std::mutex mutex;
+    unsigned long long squaredError=0;
+    pool.For(height,ROWS_PER_TASK,[&](int begin,int end){
+        unsigned long long sum=0;
+        for(int channel=0;channel<3;channel++)
+        {
+            size_t offset=(size_t)begin*width;
+            sum+=SquaredError(scratch.SourcePlane(channel)+offset,scratch.ResultPlane(channel)+offset,(size_t)(end-begin)*width);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        squaredError+=sum;
+    });
+
+    //图比窗口还小时整幅图当一个窗口
+    int window=SSIM_WINDOW;
+    if(window>width)
+        window=width;
+    if(window>height)
+        window=height;
+    int windowRows=height-window+1;
+    int windowColumns=width-window+1;
+    double ssimSum=0;
+    pool.For(windowRows,ROWS_PER_TASK,[&](int begin,int end){
+        double sum=0;
+        for(int channel=0;channel<3;channel++)
+            sum+=SsimSum(scratch.SourcePlane(channel),scratch.ResultPlane(channel),width,window,begin,end);
+        std::lock_guard<std::mutex> lock(mutex);
+        ssimSum+=sum;
+    });
+
+    quality.mse=squaredError/(3.0*width*height);
+    quality.psnr=quality.mse>0?10*std::log10(255.0*255.0/quality.mse):std::numeric_limits<double>::infinity();
+    quality.ssim=ssimSum/(3.0*windowRows*windowColumns);
+    return 0;
+}
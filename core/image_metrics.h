@@ -0,0 +1,22 @@
+#ifndef IMAGE_METRICS
+#define IMAGE_METRICS
+
+class BmpImage;
+class FilterScratch;
+
+//两幅一样大的图之间的质量指标，r、g、b三个通道一起算（对所有通道的所有点平均）
+//用来和干净的参考图比较滤波的效果，或者比较滤波前后。按行分给线程池，逐点的运算用SSE2
+namespace ImageMetrics
+{
+    struct Quality
+    {
+        double mse;         //均方误差
+        double psnr;        //峰值信噪比，dB。两幅图一模一样时是正无穷
+        double ssim;        //结构相似度，8x8的窗口逐点滑动，所有窗口和三个通道的平均，1表示一样
+    };
+
+    //image和reference的宽高要一样，位数可以不同。成功返回0，大小不一样返回SIZE_ERROR
+    int Compare(const BmpImage &image,const BmpImage &reference,Quality &quality,FilterScratch &scratch);
+}
+
+#endif // IMAGE_METRICS
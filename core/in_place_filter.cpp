@@ -0,0 +1,653 @@
+#include "in_place_filter.h"
+#include "bmp_image.h"
+#include "global_defs.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    //一个通道的滑动直方图，另外维护一个16格的粗直方图，找第k个数时先在粗直方图上定位
+    struct Histogram
+    {
+        int fine[256];
+        int coarse[16];
+
+        void Clear()
+        {
+            memset(fine,0,sizeof(fine));
+            memset(coarse,0,sizeof(coarse));
+        }
+        void Add(unsigned char v) {fine[v]++;coarse[v>>4]++;}
+        void Remove(unsigned char v) {fine[v]--;coarse[v>>4]--;}
+        //排好序之后下标为rank的值
+        unsigned char Select(int rank) const
+        {
+            int bin=0;
+            while(rank>=coarse[bin])
+                rank-=coarse[bin++];
+            int value=bin<<4;
+            while(rank>=fine[value])
+                rank-=fine[value++];
+            return (unsigned char)value;
+        }
+    };
+
+    //一个通道一种窗口大小的窗口，值排好序放着，最小值、最大值、中值直接取。沿着一行往右滑时只出去一列、进来一列，
+    //写回一个点时把它原来的值换成新值，不用每个点都把整个窗口重新拷一遍、排一遍
+    struct SortedWindow
+    {
+        unsigned char values[MAX_FILTER_SIZE*MAX_FILTER_SIZE];
+        int count;
+
+        void Add(unsigned char v)
+        {
+            unsigned char *pos=std::upper_bound(values,values+count,v);
+            memmove(pos+1,pos,values+count-pos);
+            *pos=v;
+            count++;
+        }
+        void Remove(unsigned char v)
+        {
+            unsigned char *pos=std::lower_bound(values,values+count,v);
+            memmove(pos,pos+1,values+count-pos-1);
+            count--;
+        }
+        //把一个old换成v，只挪两者之间的那几个值。窗口很小，从头找比二分查找快
+        void Replace(unsigned char old,unsigned char v)
+        {
+            int i=0;
+            while(values[i]<old)
+                i++;
+            if(v>old)
+            {
+                for(;i+1<count && values[i+1]<v;i++)
+                    values[i]=values[i+1];
+            }
+            else
+            {
+                for(;i>0 && values[i-1]>v;i--)
+                    values[i]=values[i-1];
+            }
+            values[i]=v;
+        }
+    };
+
+    struct Area
+    {
+        int width;
+        int height;
+        int left;
+        int top;
+        int right;
+        int bottom;
+        const unsigned char *mask;
+    };
+
+    bool InPalette(const unsigned int *palette,int paletteSize,const unsigned char value[3])
+    {
+        unsigned int color=((unsigned int)value[0]<<16)|((unsigned int)value[1]<<8)|value[2];
+        return std::binary_search(palette,palette+paletteSize,color);
+    }
+
+    //第column列落在窗口里的那几行，加进（sign为1）或者减出（sign为-1）各个通道的直方图
+    void AddColumn(unsigned char *const planes[3],int firstChannel,int lastChannel,Histogram histograms[3],
+                   int width,int top,int bottom,int column,int sign)
+    {
+        for(int channel=firstChannel;channel<lastChannel;channel++)
+        {
+            const unsigned char *src=planes[channel]+(size_t)top*width+column;
+            Histogram &histogram=histograms[channel];
+            for(int row=top;row<=bottom;row++,src+=width)
+            {
+                if(sign>0)
+                    histogram.Add(*src);
+                else
+                    histogram.Remove(*src);
+            }
+        }
+    }
+
+    //对[firstChannel,lastChannel)这几个通道做就地中值滤波。palette不为0时三个通道必须一起做
+    void MedianChannels(unsigned char *const planes[3],int firstChannel,int lastChannel,const Area &area,int size,
+                        const unsigned int *palette,int paletteSize)
+    {
+        int radius=size/2;
+        int width=area.width;
+        Histogram histograms[3];
+        for(int y=area.top;y<area.bottom;y++)
+        {
+            int top=y-radius<0?0:y-radius;
+            int bottom=y+radius>area.height-1?area.height-1:y+radius;
+            int rows=bottom-top+1;
+            const unsigned char *mask=area.mask!=0?area.mask+(size_t)(y-area.top)*(area.right-area.left):0;
+
+            //每行从这块的左边开始重新建直方图，上面几行已经是滤过的值了
+            for(int channel=firstChannel;channel<lastChannel;channel++)
+                histograms[channel].Clear();
+            int initLeft=area.left-radius<0?0:area.left-radius;
+            for(int x=initLeft;x<=area.left+radius && x<width;x++)
+                AddColumn(planes,firstChannel,lastChannel,histograms,width,top,bottom,x,1);
+
+            for(int x=area.left;x<area.right;x++)
+            {
+                if(x>area.left)
+                {
+                    if(x+radius<width)
+                        AddColumn(planes,firstChannel,lastChannel,histograms,width,top,bottom,x+radius,1);
+                    if(x-radius-1>=0)
+                        AddColumn(planes,firstChannel,lastChannel,histograms,width,top,bottom,x-radius-1,-1);
+                }
+                if(mask!=0 && mask[x-area.left]==0)
+                    continue;
+
+                int left=x-radius<0?0:x-radius;
+                int right=x+radius>width-1?width-1:x+radius;
+                int rank=rows*(right-left+1)/2;
+                unsigned char median[3];
+                for(int channel=firstChannel;channel<lastChannel;channel++)
+                    median[channel]=histograms[channel].Select(rank);
+                if(palette!=0 && !InPalette(palette,paletteSize,median))
+                    continue;
+
+                //这个点还在后面几个点的窗口里，直方图里它的值也要换成新的
+                size_t pos=(size_t)y*width+x;
+                for(int channel=firstChannel;channel<lastChannel;channel++)
+                {
+                    unsigned char &value=planes[channel][pos];
+                    if(value!=median[channel])
+                    {
+                        histograms[channel].Remove(value);
+                        histograms[channel].Add(median[channel]);
+                        value=median[channel];
+                    }
+                }
+            }
+        }
+    }
+
+#if defined(__SSE2__)
+    //条带：16行一起滤，第k行放在SIMD的第k个字节里，一步16行各往右走一列，第k行比第k-1行落后lag=radius+1列。
+    //这样第k行的窗口里，上面几行用到的点都已经滤过了，下面几行用到的点都还没滤，本行左边的点刚滤过，
+    //和一个点一个点按顺序滤的结果完全一样。为了让同一步里16行的窗口落在同一个地方，把图像斜着转置进缓冲区：
+    //图像第top-radius+j行、第x列的点放在缓冲区第x+j*lag列的第j个字节，一列STRIP_STRIDE个字节。
+    //窗口里的每个位置，16行各自要的点就是缓冲区一列里连着的16个字节，一次读进来
+    const int STRIP_ROWS=16;
+    const int STRIP_STRIDE=32;          //一列放条带的16行和上下各radius行，radius不能超过8
+    const int STRIP_COLUMNS=512;        //缓冲区每个通道留的列数，用到头了就把还要用的几列挪回开头
+    const int STRIP_STEPS=64;           //每次先把往后这么多步要用的列填好
+    const int BIT_SERIAL_LIMIT=15;      //计数用的是8位，窗口最多255个点
+
+    struct Strip
+    {
+        unsigned char *const *planes;
+        const Area *area;
+        int radius;                     //缓冲区按这么大的窗口准备，滤波的窗口不能比它大
+        int lag;
+        int y;                          //条带第一行
+        int rows;                       //条带有几行，不超过STRIP_ROWS
+        int first;                      //缓冲区第0列是斜过来之后的第几列
+        int filled;                     //斜过来之后的[first,filled)列已经填好了
+        unsigned char columns[3][STRIP_COLUMNS*STRIP_STRIDE];
+
+        //第step步的时候第lane行在第几列
+        int Column(int step,int lane) const {return area->left+step-lane*lag;}
+
+        //第step步第0行的点在缓冲区里的位置，第lane行的点在它后面第lane个字节；
+        //窗口里(dx,dy)那个位置，16行的点从它往后(dx+dy*lag)*STRIP_STRIDE+dy个字节开始
+        unsigned char *Center(int channel,int step)
+        {
+            return columns[channel]+(size_t)(area->left+step+radius*lag-first)*STRIP_STRIDE+radius;
+        }
+
+        //做到第end步为止要用到的最右边那列（斜过来之后的）的下一列。图像上第j行要读到第FillEnd(end)-j*lag列为止
+        int FillEnd(int end) const {return area->left+end+radius+2*radius*lag;}
+
+        //走到第step步之前，把到end步为止要用的列填好，前面不再用的列挪掉
+        void Fill(int step,int end)
+        {
+            int last=FillEnd(end);
+            if(last-first>STRIP_COLUMNS)
+            {
+                int keep=area->left+step-radius;
+                for(int channel=0;channel<3;channel++)
+                    memmove(columns[channel],columns[channel]+(size_t)(keep-first)*STRIP_STRIDE,(size_t)(filled-keep)*STRIP_STRIDE);
+                first=keep;
+            }
+            int width=area->width;
+            for(int channel=0;channel<3;channel++)
+            {
+                unsigned char *dst=columns[channel]+(size_t)(filled-first)*STRIP_STRIDE;
+                memset(dst,0,(size_t)(last-filled)*STRIP_STRIDE);      //图像外面补0
+                for(int j=0;j<rows+2*radius;j++)
+                {
+                    int row=y-radius+j;
+                    if(row<0 || row>=area->height)
+                        continue;
+                    int begin=filled-j*lag<0?0:filled-j*lag;
+                    int stop=last-j*lag>width?width:last-j*lag;
+                    const unsigned char *src=planes[channel]+(size_t)row*width;
+                    unsigned char *out=columns[channel]+(size_t)(begin+j*lag-first)*STRIP_STRIDE+j;
+                    for(int x=begin;x<stop;x++,out+=STRIP_STRIDE)
+                        *out=src[x];
+                }
+            }
+            filled=last;
+        }
+
+        //第step步要滤的几行，第lane位为1表示第lane行要滤
+        int Active(int step) const
+        {
+            int span=area->right-area->left;
+            int active=0;
+            for(int lane=0;lane<rows;lane++)
+            {
+                int x=step-lane*lag;
+                if(x<0 || x>=span)
+                    continue;
+                if(area->mask!=0 && area->mask[(size_t)(y+lane-area->top)*span+x]==0)
+                    continue;
+                active|=1<<lane;
+            }
+            return active;
+        }
+
+        //第step步各行半径为r的窗口里有几个点落在图像内
+        __m128i Count(int step,int r) const
+        {
+            unsigned char count[STRIP_ROWS];
+            for(int lane=0;lane<STRIP_ROWS;lane++)
+            {
+                int row=y+lane;
+                int x=Column(step,lane);
+                int rowCount=(row+r>area->height-1?area->height-1:row+r)-(row-r<0?0:row-r)+1;
+                int columnCount=(x+r>area->width-1?area->width-1:x+r)-(x-r<0?0:x-r)+1;
+                count[lane]=(unsigned char)(rowCount>0 && columnCount>0?rowCount*columnCount:1);   //不滤的行随便给一个
+            }
+            return _mm_loadu_si128((const __m128i *)count);
+        }
+
+        //把第lane行这一步的点改成value，图像和缓冲区里都改
+        void Write(int channel,int step,int lane,unsigned char value)
+        {
+            planes[channel][(size_t)(y+lane)*area->width+Column(step,lane)]=value;
+            Center(channel,step)[lane]=value;
+        }
+    };
+
+    //16行一起做位串行选择：center是这一步第0行的点，每行在半径为r的窗口里找排序后的第count-need个。
+    //图像外面补的是0，试探值不会是0，所以补的点从来不算进“不小于试探值”的点里
+    __m128i StripSelect(const unsigned char *center,int r,int lag,__m128i need)
+    {
+        __m128i result=_mm_setzero_si128();
+        for(int bit=128;bit>0;bit>>=1)
+        {
+            __m128i trial=_mm_or_si128(result,_mm_set1_epi8((char)bit));
+            __m128i notLess=_mm_setzero_si128();
+            for(int dy=-r;dy<=r;dy++)
+            {
+                const unsigned char *line=center+(dy*lag-r)*STRIP_STRIDE+dy;
+                for(int dx=0;dx<2*r+1;dx++,line+=STRIP_STRIDE)
+                {
+                    __m128i value=_mm_loadu_si128((const __m128i *)line);
+                    notLess=_mm_sub_epi8(notLess,_mm_cmpeq_epi8(_mm_max_epu8(value,trial),value));
+                }
+            }
+            __m128i accept=_mm_cmpeq_epi8(_mm_max_epu8(notLess,need),notLess);
+            result=_mm_or_si128(result,_mm_and_si128(accept,_mm_set1_epi8((char)bit)));
+        }
+        return result;
+    }
+
+    //把[top,bottom)分成16行一条，每一步用step(strip,step,active)滤，active里第lane位为1表示第lane行要滤。
+    //几个线程同时做，按顺序一条一条地领。第t条的缓冲区要用到第t-1条最下面几行，填之前等第t-1条把要用的那几列滤完，
+    //所以相邻的两条像波浪一样错开一点同时往右走。第t-1条也要读第t条最上面几行原来的值，
+    //它填缓冲区时总是比自己最下面一行滤到的地方靠右，第t条等它滤过去再写，就不会把它还没读的点改掉。
+    //不用ForEachTask：它一开始给每个线程分连续的一段，后面那段的第一条要等前面那段全部做完
+    template<class Step>
+    void RunStrips(unsigned char *const planes[3],const Area &area,int radius,const Step &step)
+    {
+        int strips=(area.bottom-area.top+STRIP_ROWS-1)/STRIP_ROWS;
+        std::vector<std::atomic<int> > progress(strips);    //第t条最下面一行[area.left,progress[t])这几列已经滤好了
+        for(int t=0;t<strips;t++)
+            progress[t].store(area.left,std::memory_order_relaxed);
+        std::atomic<int> next(0);
+        ThreadPool &pool=ThreadPool::Instance();
+        int threads=pool.ThreadCount()<strips?pool.ThreadCount():strips;
+        pool.For(threads,1,[&](int,int){
+            Strip strip;
+            strip.planes=planes;
+            strip.area=&area;
+            strip.radius=radius;
+            strip.lag=radius+1;
+            for(int t=next.fetch_add(1);t<strips;t=next.fetch_add(1))
+            {
+                strip.y=area.top+t*STRIP_ROWS;
+                strip.rows=strip.y+STRIP_ROWS>area.bottom?area.bottom-strip.y:STRIP_ROWS;
+                strip.first=strip.filled=area.left-radius;
+                int steps=area.right-area.left+(strip.rows-1)*strip.lag;
+                for(int begin=0;begin<steps;begin+=STRIP_STEPS)
+                {
+                    int end=begin+STRIP_STEPS>steps?steps:begin+STRIP_STEPS;
+                    if(t>0)
+                    {
+                        int need=strip.FillEnd(end)<area.right?strip.FillEnd(end):area.right;
+                        while(progress[t-1].load(std::memory_order_acquire)<need)
+                            std::this_thread::yield();
+                    }
+                    strip.Fill(begin,end);
+                    for(int i=begin;i<end;i++)
+                    {
+                        int active=strip.Active(i);
+                        if(active!=0)
+                            step(strip,i,active);
+                    }
+                    int done=area.left+end-(strip.rows-1)*strip.lag;
+                    if(done>area.left)
+                        progress[t].store(done<area.right?done:area.right,std::memory_order_release);
+                }
+                progress[t].store(area.right,std::memory_order_release);
+            }
+        });
+    }
+
+    //条带上的中值滤波，窗口就是缓冲区准备的大小
+    void MedianStrips(unsigned char *const planes[3],const Area &area,int size,const unsigned int *palette,int paletteSize)
+    {
+        int radius=size/2;
+        RunStrips(planes,area,radius,[&](Strip &strip,int step,int active){
+            __m128i count=strip.Count(step,radius);
+            //排序后下标为count/2的点：不小于它的至少要有count-count/2个
+            __m128i need=_mm_sub_epi8(count,_mm_and_si128(_mm_srli_epi16(count,1),_mm_set1_epi8(0x7f)));
+            unsigned char median[3][STRIP_ROWS];
+            for(int channel=0;channel<3;channel++)
+                _mm_storeu_si128((__m128i *)median[channel],StripSelect(strip.Center(channel,step),radius,strip.lag,need));
+            for(;active!=0;active&=active-1)
+            {
+                int lane=__builtin_ctz(active);
+                if(palette!=0)
+                {
+                    unsigned char value[3]={median[0][lane],median[1][lane],median[2][lane]};
+                    if(!InPalette(palette,paletteSize,value))
+                        continue;
+                }
+                for(int channel=0;channel<3;channel++)
+                    strip.Write(channel,step,lane,median[channel][lane]);
+            }
+        });
+    }
+
+    //一步里16行半径为r的窗口一起过一遍：最大值，不小于median的点数，不小于value的点数。
+    //补的0只在median、value是0的时候会被多算进去，所以用的时候要另外判断它们不是0
+    void StripStats(const unsigned char *center,int r,int lag,__m128i median,__m128i value,
+                    __m128i &high,__m128i &notLessMedian,__m128i &notLessValue)
+    {
+        high=notLessMedian=notLessValue=_mm_setzero_si128();
+        for(int dy=-r;dy<=r;dy++)
+        {
+            const unsigned char *line=center+(dy*lag-r)*STRIP_STRIDE+dy;
+            for(int dx=0;dx<2*r+1;dx++,line+=STRIP_STRIDE)
+            {
+                __m128i v=_mm_loadu_si128((const __m128i *)line);
+                high=_mm_max_epu8(high,v);
+                notLessMedian=_mm_sub_epi8(notLessMedian,_mm_cmpeq_epi8(_mm_max_epu8(v,median),v));
+                notLessValue=_mm_sub_epi8(notLessValue,_mm_cmpeq_epi8(_mm_max_epu8(v,value),v));
+            }
+        }
+    }
+
+    //16行里v严格介于窗口最小值和最大值之间的那几行是0xff，其余的是0；mask里为0的行直接是0
+    //窗口里有比v小的点，就是v不是0而且不小于v的点比窗口里的点少。a<b即b-a（饱和减法）不为0
+    __m128i InRange(__m128i v,__m128i count,__m128i high,__m128i notLess,__m128i mask)
+    {
+        const __m128i zero=_mm_setzero_si128();
+        mask=_mm_andnot_si128(_mm_cmpeq_epi8(v,zero),mask);
+        mask=_mm_andnot_si128(_mm_cmpeq_epi8(_mm_subs_epu8(count,notLess),zero),mask);
+        return _mm_andnot_si128(_mm_cmpeq_epi8(_mm_subs_epu8(high,v),zero),mask);
+    }
+
+    //条带上的自适应中值滤波，判断的规则和WindowFilter::AdaptiveDecide一样：16行的点一起求中值、最大值，
+    //用掩码把结果混合进去，没有分支；这一步16行都定下来了就不再加大窗口。缓冲区按最大的窗口准备
+    void AdaptiveStrips(unsigned char *const planes[3],const Area &area,int maxSize,const unsigned int *palette,int paletteSize)
+    {
+        int maxRadius=maxSize/2;
+        RunStrips(planes,area,maxRadius,[&](Strip &strip,int step,int active){
+            unsigned char lanes[STRIP_ROWS];
+            for(int lane=0;lane<STRIP_ROWS;lane++)
+                lanes[lane]=(unsigned char)((active>>lane)&1?0xff:0);
+            __m128i pending=_mm_loadu_si128((const __m128i *)lanes);
+            const unsigned char *center[3];
+            __m128i value[3],result[3];
+            for(int channel=0;channel<3;channel++)
+            {
+                center[channel]=strip.Center(channel,step);
+                result[channel]=value[channel]=_mm_loadu_si128((const __m128i *)center[channel]);    //窗口加到最大也不行就保留当前点
+            }
+            for(int r=1;r<=maxRadius;r++)
+            {
+                __m128i count=strip.Count(step,r);
+                __m128i need=_mm_sub_epi8(count,_mm_and_si128(_mm_srli_epi16(count,1),_mm_set1_epi8(0x7f)));
+                __m128i medianInRange=pending;
+                __m128i thisInRange=_mm_cmpeq_epi8(count,count);
+                __m128i median[3];
+                for(int channel=0;channel<3;channel++)
+                {
+                    median[channel]=StripSelect(center[channel],r,strip.lag,need);
+                    __m128i high,notLessMedian,notLessValue;
+                    StripStats(center[channel],r,strip.lag,median[channel],value[channel],high,notLessMedian,notLessValue);
+                    medianInRange=InRange(median[channel],count,high,notLessMedian,medianInRange);
+                    thisInRange=InRange(value[channel],count,high,notLessValue,thisInRange);
+                }
+                //medianInRange只在还没定下来的行里有，这次定下来的行当前点不在范围内就取中值
+                __m128i useMedian=_mm_andnot_si128(thisInRange,medianInRange);
+                for(int channel=0;channel<3;channel++)
+                    result[channel]=_mm_or_si128(_mm_and_si128(useMedian,median[channel]),_mm_andnot_si128(useMedian,result[channel]));
+                pending=_mm_andnot_si128(medianInRange,pending);
+                if(_mm_movemask_epi8(pending)==0)
+                    break;
+            }
+
+            //只写回变了的点
+            unsigned char out[3][STRIP_ROWS];
+            int changed=0;
+            for(int channel=0;channel<3;channel++)
+            {
+                _mm_storeu_si128((__m128i *)out[channel],result[channel]);
+                changed|=_mm_movemask_epi8(_mm_cmpeq_epi8(result[channel],value[channel]))^0xffff;
+            }
+            for(changed&=active;changed!=0;changed&=changed-1)
+            {
+                int lane=__builtin_ctz(changed);
+                unsigned char color[3]={out[0][lane],out[1][lane],out[2][lane]};
+                if(palette!=0 && !InPalette(palette,paletteSize,color))
+                    continue;
+                for(int channel=0;channel<3;channel++)
+                    strip.Write(channel,step,lane,color[channel]);
+            }
+        });
+    }
+#endif
+
+    //把三个通道交给filter(firstChannel,lastChannel)：8位图要按调色板判断，三个通道一起做；
+    //24位图三个通道互不影响，分给三个线程
+    template<class Filter>
+    void SplitChannels(const unsigned int *palette,const Filter &filter)
+    {
+        if(palette!=0)
+        {
+            filter(0,3);
+            return;
+        }
+        ThreadPool::Instance().For(3,1,[&](int begin,int end){
+            filter(begin,end);
+        });
+    }
+}
+
+int InPlaceFilter::PaletteColors(const BmpImage &image, unsigned int colors[])
+{
+    if(image.BitCount()!=8)
+        return 0;
+    const unsigned char *entries=image.Palette();
+    int count=image.PaletteSize();
+    for(int i=0;i<count;i++)
+        colors[i]=((unsigned int)entries[4*i+2]<<16)|((unsigned int)entries[4*i+1]<<8)|entries[4*i];
+    std::sort(colors,colors+count);
+    return (int)(std::unique(colors,colors+count)-colors);
+}
+
+void InPlaceFilter::MedianFilter(unsigned char *const planes[3], int width, int height, int left, int top, int right, int bottom,
+                                 const unsigned char *mask, int size, const unsigned int *palette, int paletteSize)
+{
+#if defined(__SSE2__)
+    if(size<=BIT_SERIAL_MAX_SIZE)
+    {
+        BitSerialMedianFilter(planes,width,height,left,top,right,bottom,mask,size,palette,paletteSize);
+        return;
+    }
+#endif
+    HistogramMedianFilter(planes,width,height,left,top,right,bottom,mask,size,palette,paletteSize);
+}
+
+void InPlaceFilter::HistogramMedianFilter(unsigned char *const planes[3], int width, int height, int left, int top, int right, int bottom,
+                                          const unsigned char *mask, int size, const unsigned int *palette, int paletteSize)
+{
+    Area area={width,height,left,top,right,bottom,mask};
+    SplitChannels(palette,[&](int firstChannel,int lastChannel){
+        MedianChannels(planes,firstChannel,lastChannel,area,size,palette,paletteSize);
+    });
+}
+
+void InPlaceFilter::BitSerialMedianFilter(unsigned char *const planes[3], int width, int height, int left, int top, int right, int bottom,
+                                          const unsigned char *mask, int size, const unsigned int *palette, int paletteSize)
+{
+#if defined(__SSE2__)
+    if(size<=BIT_SERIAL_LIMIT)
+    {
+        Area area={width,height,left,top,right,bottom,mask};
+        MedianStrips(planes,area,size,palette,paletteSize);
+        return;
+    }
+#endif
+    HistogramMedianFilter(planes,width,height,left,top,right,bottom,mask,size,palette,paletteSize);
+}
+
+void InPlaceFilter::AdaptiveMedianFilter(unsigned char *const planes[3], int width, int height, int left, int top, int right, int bottom,
+                                         const unsigned char *mask, int maxSize, const unsigned int *palette, int paletteSize)
+{
+    if(maxSize>MAX_FILTER_SIZE)
+        maxSize=MAX_FILTER_SIZE;
+    if(maxSize<3)
+        return;
+#if defined(__SSE2__)
+    Area area={width,height,left,top,right,bottom,mask};
+    AdaptiveStrips(planes,area,maxSize,palette,paletteSize);
+#else
+    SortedAdaptiveMedianFilter(planes,width,height,left,top,right,bottom,mask,maxSize,palette,paletteSize);
+#endif
+}
+
+void InPlaceFilter::SortedAdaptiveMedianFilter(unsigned char *const planes[3], int width, int height, int left, int top, int right, int bottom,
+                                               const unsigned char *mask, int maxSize, const unsigned int *palette, int paletteSize)
+{
+    if(maxSize>MAX_FILTER_SIZE)
+        maxSize=MAX_FILTER_SIZE;
+    int sizes=(maxSize-1)/2;                    //3x3、5x5……各一组窗口
+    SortedWindow windows[MAX_FILTER_SIZE/2][3];
+    int windowColumn[MAX_FILTER_SIZE/2];        //每组窗口现在是以本行哪一列为中心的，-1表示要重新建
+
+    for(int y=top;y<bottom;y++)
+    {
+        const unsigned char *maskRow=mask!=0?mask+(size_t)(y-top)*(right-left):0;
+        for(int i=0;i<sizes;i++)
+            windowColumn[i]=-1;
+        for(int x=left;x<right;x++)
+        {
+            if(maskRow!=0 && maskRow[x-left]==0)
+                continue;
+
+            size_t pos=(size_t)y*width+x;
+            unsigned char center[3]={planes[0][pos],planes[1][pos],planes[2][pos]};
+            unsigned char result[3]={center[0],center[1],center[2]};    //窗口加到最大也不行就保留当前点
+            int used=0;
+            for(int i=0;i<sizes;i++)
+            {
+                int radius=i+1;
+                int windowTop=y-radius<0?0:y-radius;
+                int windowBottom=y+radius>height-1?height-1:y+radius;
+                if(x>left && windowColumn[i]==x-1)
+                {
+                    //上一个点用过这么大的窗口：左边出去一列，右边进来一列
+                    for(int channel=0;channel<3;channel++)
+                    {
+                        SortedWindow &window=windows[i][channel];
+                        const unsigned char *src=planes[channel]+(size_t)windowTop*width;
+                        for(int row=windowTop;row<=windowBottom;row++,src+=width)
+                        {
+                            if(x-1-radius>=0 && x+radius<width)
+                                window.Replace(src[x-1-radius],src[x+radius]);
+                            else if(x-1-radius>=0)
+                                window.Remove(src[x-1-radius]);
+                            else if(x+radius<width)
+                                window.Add(src[x+radius]);
+                        }
+                    }
+                }
+                else
+                {
+                    int windowLeft=x-radius<0?0:x-radius;
+                    int windowRight=x+radius>width-1?width-1:x+radius;
+                    int length=windowRight-windowLeft+1;
+                    for(int channel=0;channel<3;channel++)
+                    {
+                        SortedWindow &window=windows[i][channel];
+                        window.count=(windowBottom-windowTop+1)*length;
+                        for(int row=windowTop;row<=windowBottom;row++)
+                            memcpy(window.values+(row-windowTop)*length,planes[channel]+(size_t)row*width+windowLeft,length);
+                        std::sort(window.values,window.values+window.count);
+                    }
+                }
+                windowColumn[i]=x;
+                used=i+1;
+
+                bool medianInRange=true,thisInRange=true;
+                unsigned char median[3];
+                for(int channel=0;channel<3;channel++)
+                {
+                    const SortedWindow &window=windows[i][channel];
+                    unsigned char low=window.values[0];
+                    unsigned char high=window.values[window.count-1];
+                    median[channel]=window.values[window.count/2];
+                    if(!(median[channel]>low && median[channel]<high))
+                        medianInRange=false;
+                    if(!(center[channel]>low && center[channel]<high))
+                        thisInRange=false;
+                }
+                if(medianInRange)
+                {
+                    if(!thisInRange)
+                        memcpy(result,median,3);
+                    break;
+                }
+            }
+
+            if(palette!=0 && !InPalette(palette,paletteSize,result))
+                continue;
+            //这个点还在下一个点的几个窗口里，窗口里它的值也要换成新的
+            for(int channel=0;channel<3;channel++)
+            {
+                if(result[channel]==center[channel])
+                    continue;
+                for(int i=0;i<used;i++)
+                    windows[i][channel].Replace(center[channel],result[channel]);
+                planes[channel][pos]=result[channel];
+            }
+        }
+    }
+}
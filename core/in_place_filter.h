@@ -0,0 +1,45 @@
+#ifndef IN_PLACE_FILTER
+#define IN_PLACE_FILTER
+
+class BmpImage;
+
+//原来界面上的中值滤波、自适应中值滤波的做法：按储存顺序一个点一个点地滤，每个点的结果马上写回，
+//后面的点的窗口里，上面几行和本行左边的点用的都是已经滤过的值。边界处只用落在图像内的那部分窗口
+//planes是r、g、b三个通道，每个通道width x height，一行width个字节。只改[left,right) x [top,bottom)这块里
+//mask不为0的点（mask一行right-left个字节，为0时整块都改），窗口可以用到整个width x height
+//palette是8位图调色板里的颜色（见PaletteColors），24位图传0：结果的颜色不在调色板里时这个点保留原来的颜色，
+//和原来找不到颜色就保留原来的编号一样
+namespace InPlaceFilter
+{
+    //8位图调色板里的颜色0xRRGGBB，排好序、去掉重复的，返回有几种；24位图返回0
+    int PaletteColors(const BmpImage &image,unsigned int colors[256]);
+
+    //中值（窗口内点数为偶数时取靠上的那个）。按窗口大小在下面两种实现里选快的那个，
+    //分界是BIT_SERIAL_MAX_SIZE（用dip_batch -benchmark量出来的）
+    void MedianFilter(unsigned char *const planes[3],int width,int height,int left,int top,int right,int bottom,
+                      const unsigned char *mask,int size,const unsigned int *palette,int paletteSize);
+    //每个通道一个滑动直方图，写回一个点时把直方图里它的值也换掉。24位图三个通道互不影响，分给三个线程做。
+    //不像WindowFilter那样竖着切条（见WindowFilter::TileBytes）：切了以后条最右边的点的窗口里，
+    //右上方下一条的点还没滤过，结果就和按顺序滤不一样了。宽图上要快就用下面的位串行，它只在一个每通道16KB的缓冲区里读
+    void HistogramMedianFilter(unsigned char *const planes[3],int width,int height,int left,int top,int right,int bottom,
+                               const unsigned char *mask,int size,const unsigned int *palette,int paletteSize);
+    //位串行（见WindowFilter::BitSerialRankFilter），16行一起滤：第k行比上一行落后半径加1列，
+    //这样16行里每个点的窗口都和按顺序滤时一样，可以放在SIMD的16个字节里同时比较、计数。
+    //几个线程各领一条16行，下一条跟在上一条后面错开几列同时往右走，结果和一个线程按顺序滤完全一样。
+    //窗口超过15x15或者没有SSE2时用直方图
+    void BitSerialMedianFilter(unsigned char *const planes[3],int width,int height,int left,int top,int right,int bottom,
+                               const unsigned char *mask,int size,const unsigned int *palette,int paletteSize);
+    //不超过这么大的窗口用位串行。2048x512的24位图上单线程3x3到9x9比直方图快约3.2倍、2.4倍、1.7倍、1.2倍，11x11差不多
+    const int BIT_SERIAL_MAX_SIZE=9;
+
+    //自适应中值滤波，判断的规则见WindowFilter::AdaptiveMedianFilter，只是窗口里用的是已经滤过的值。
+    //和BitSerialMedianFilter一样16行一起滤，每种窗口大小16个点一起求中值、最大值，判断用SIMD掩码混合结果，
+    //16个点都定下来了才不再加大窗口，分给几个线程的做法也一样。没有SSE2时就是下面的SortedAdaptiveMedianFilter
+    void AdaptiveMedianFilter(unsigned char *const planes[3],int width,int height,int left,int top,int right,int bottom,
+                              const unsigned char *mask,int maxSize,const unsigned int *palette,int paletteSize);
+    //同上，逐点做：每个点从3x3开始，定不下来才加大窗口。每种大小的窗口排好序留着，下一个点也用到时只滑过去一列
+    void SortedAdaptiveMedianFilter(unsigned char *const planes[3],int width,int height,int left,int top,int right,int bottom,
+                                    const unsigned char *mask,int maxSize,const unsigned int *palette,int paletteSize);
+}
+
+#endif // IN_PLACE_FILTER
@@ -0,0 +1,107 @@
+#include "noise_estimator.h"
+#include "global_defs.h"
+#include <cstddef>
+
+namespace
+{
+    const int IMPULSE_THRESHOLD=40;     //比邻居们大（小）这么多才算脉冲
+    const int SATURATED_LOW=10;         //椒噪声接近0，盐噪声接近255
+    const int SATURATED_HIGH=245;
+
+    //选滤波器用的密度上限
+    const double CLEAN_DENSITY=0.002;
+    const double MEDIAN_3_DENSITY=0.12;
+    const double MEDIAN_5_DENSITY=0.25;
+    const double MEDIAN_7_DENSITY=0.40;
+
+    bool IsImpulseInPlane(const unsigned char *plane,int width,int x,int y)
+    {
+        const unsigned char *center=plane+(size_t)y*width+x;
+        int value=*center;
+        int low=255,high=0,far=0;
+        for(int dy=-1;dy<=1;dy++)
+        {
+            const unsigned char *line=center+(ptrdiff_t)dy*width;
+            for(int dx=-1;dx<=1;dx++)
+            {
+                if(dx==0 && dy==0)
+                    continue;
+                int neighbour=line[dx];
+                if(neighbour<low)
+                    low=neighbour;
+                if(neighbour>high)
+                    high=neighbour;
+                if(neighbour-value>IMPULSE_THRESHOLD || value-neighbour>IMPULSE_THRESHOLD)
+                    far++;
+            }
+        }
+        if(value>high+IMPULSE_THRESHOLD || value<low-IMPULSE_THRESHOLD)
+            return true;
+        //噪声很密的时候邻居里也有同样的噪声点，上面的判断会漏掉
+        return (value<=SATURATED_LOW || value>=SATURATED_HIGH) && far>=4;
+    }
+}
+
+double NoiseEstimator::Density(const unsigned char *const planes[3], int width, int height,
+                               int left, int top, int right, int bottom, int step)
+{
+    //最外面一圈没有完整的邻居，不取
+    if(left<1)
+        left=1;
+    if(top<1)
+        top=1;
+    if(right>width-1)
+        right=width-1;
+    if(bottom>height-1)
+        bottom=height-1;
+    if(step<1)
+        step=1;
+
+    long long samples=0,impulses=0;
+    for(int y=top;y<bottom;y+=step)
+    {
+        for(int x=left;x<right;x+=step)
+        {
+            samples++;
+            if(IsImpulseInPlane(planes[0],width,x,y) || IsImpulseInPlane(planes[1],width,x,y) || IsImpulseInPlane(planes[2],width,x,y))
+                impulses++;
+        }
+    }
+    return samples>0?(double)impulses/samples:0;
+}
+
+bool NoiseEstimator::IsImpulse(const unsigned char *const planes[3], int width, int height, int x, int y)
+{
+    if(x<1 || y<1 || x>=width-1 || y>=height-1)
+        return false;
+    return IsImpulseInPlane(planes[0],width,x,y) || IsImpulseInPlane(planes[1],width,x,y) || IsImpulseInPlane(planes[2],width,x,y);
+}
+
+NoiseEstimator::FilterChoice NoiseEstimator::ChooseFilter(double density)
+{
+    if(density<CLEAN_DENSITY)
+        return NO_FILTER;
+    if(density<MEDIAN_3_DENSITY)
+        return MEDIAN_3;
+    if(density<MEDIAN_5_DENSITY)
+        return MEDIAN_5;
+    if(density<MEDIAN_7_DENSITY)
+        return MEDIAN_7;
+    return ADAPTIVE_MEDIAN;
+}
+
+int NoiseEstimator::WindowSize(FilterChoice choice)
+{
+    switch(choice)
+    {
+    case MEDIAN_3:
+        return 3;
+    case MEDIAN_5:
+        return 5;
+    case MEDIAN_7:
+    case ADAPTIVE_MEDIAN:
+        return MAX_FILTER_SIZE;
+    default:
+        return 0;
+    }
+}
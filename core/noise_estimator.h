@@ -0,0 +1,23 @@
+#ifndef NOISE_ESTIMATOR
+#define NOISE_ESTIMATOR
+
+//椒盐（脉冲）噪声密度的快速估计，用来自动选择滤波器。隔几个点抽样，一幅512x512的图只要几毫秒
+//planes是r、g、b三个通道，每个通道width*height个字节，和WindowFilter一样
+namespace NoiseEstimator
+{
+    //自动模式可以选的滤波器，按开销从小到大排
+    enum FilterChoice{NO_FILTER,MEDIAN_3,MEDIAN_5,MEDIAN_7,ADAPTIVE_MEDIAN};
+
+    //估计[left,right) x [top,bottom)这块区域里的噪声点所占的比例（0-1），每隔step行、step列取一个点
+    //一个点在任意一个通道里比周围8个点都明显大或明显小，或者是接近0/255、且和一半以上的邻居差得很远，就算噪声
+    double Density(const unsigned char *const planes[3],int width,int height,
+                   int left,int top,int right,int bottom,int step);
+    //(x,y)这一点是不是噪声，判断和Density一样。最外面一圈总是false。NoiseMask用它逐点检测
+    bool IsImpulse(const unsigned char *const planes[3],int width,int height,int x,int y);
+
+    //按噪声密度选最便宜又够用的滤波器：中值滤波在噪声不到窗口一半时有效，窗口越大越慢、也越模糊
+    FilterChoice ChooseFilter(double density);
+    int WindowSize(FilterChoice choice);     //对应的（最大）窗口大小，NO_FILTER为0
+}
+
+#endif // NOISE_ESTIMATOR
@@ -0,0 +1,184 @@
+#include "noise_generator.h"
+#include "bmp_image.h"
+#include "thread_pool.h"
+#include "global_defs.h"
+#include <cstdio>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    const size_t NOISE_BAND_BYTES=16<<20;   //每次生成、写出这么多字节的行
+
+    void PutInt32(unsigned char *p,unsigned int value)
+    {
+        p[0]=(unsigned char)value;
+        p[1]=(unsigned char)(value>>8);
+        p[2]=(unsigned char)(value>>16);
+        p[3]=(unsigned char)(value>>24);
+    }
+
+    //32位的可逆哈希，输入差一位输出就差不多一半的位
+    inline unsigned int Hash32(unsigned int x)
+    {
+        x^=x>>16;
+        x*=0x7feb352du;
+        x^=x>>15;
+        x*=0x846ca68bu;
+        x^=x>>16;
+        return x;
+    }
+
+#if defined(__SSE2__)
+    //SSE2没有32位的乘法，用两次32x32->64的乘法拼出低32位
+    inline __m128i MultiplyLow32(__m128i a,__m128i b)
+    {
+        __m128i even=_mm_mul_epu32(a,b);
+        __m128i odd=_mm_mul_epu32(_mm_srli_epi64(a,32),_mm_srli_epi64(b,32));
+        return _mm_unpacklo_epi32(_mm_shuffle_epi32(even,_MM_SHUFFLE(0,0,2,0)),_mm_shuffle_epi32(odd,_MM_SHUFFLE(0,0,2,0)));
+    }
+
+    inline __m128i Hash32(__m128i x)
+    {
+        x=_mm_xor_si128(x,_mm_srli_epi32(x,16));
+        x=MultiplyLow32(x,_mm_set1_epi32(0x7feb352d));
+        x=_mm_xor_si128(x,_mm_srli_epi32(x,15));
+        x=MultiplyLow32(x,_mm_set1_epi32((int)0x846ca68bu));
+        x=_mm_xor_si128(x,_mm_srli_epi32(x,16));
+        return x;
+    }
+#endif
+
+    //一行里每个点的随机数：Hash32(Hash32(列^key)^key2)。只哈希一次的话，两行的key只差低几位时
+    //两行的随机数只是互相换了位置
+    void RowRandoms(unsigned long long seed,int row,int width,unsigned int *randoms)
+    {
+        unsigned int key=Hash32(Hash32((unsigned int)seed^Hash32((unsigned int)(seed>>32)))+(unsigned int)row*0x9e3779b9u);
+        unsigned int key2=Hash32(key);
+        int x=0;
+#if defined(__SSE2__)
+        __m128i vkey=_mm_set1_epi32((int)key);
+        __m128i vkey2=_mm_set1_epi32((int)key2);
+        __m128i column=_mm_setr_epi32(0,1,2,3);
+        for(;x+4<=width;x+=4)
+        {
+            __m128i value=Hash32(_mm_xor_si128(Hash32(_mm_xor_si128(column,vkey)),vkey2));
+            _mm_storeu_si128((__m128i *)(randoms+x),value);
+            column=_mm_add_epi32(column,_mm_set1_epi32(4));
+        }
+#endif
+        for(;x<width;x++)
+            randoms[x]=Hash32(Hash32((unsigned int)x^key)^key2);
+    }
+}
+
+int NoiseGenerator::Generate(const char *fileName, const BmpImage *clean, const Options &options)
+{
+    int width=options.width>0?options.width:(clean!=0?clean->Width():0);
+    int height=options.height>0?options.height:(clean!=0?clean->Height():0);
+    if(width<=0 || height<=0)
+        return SIZE_ERROR;
+    size_t rowStride=((size_t)width*24+31)/32*4;
+    unsigned long long fileSize=BMP_HEADER_SIZE+(unsigned long long)rowStride*height;
+
+    //小于threshold的点是噪声，其中小于threshold/2的是黑点
+    unsigned long long threshold=options.density<=0?0:options.density>=1?0x100000000ull
+                                :(unsigned long long)(options.density*4294967296.0);
+
+    //输出的每一列、每一行对应干净图的哪一列、哪一行（显示顺序）
+    std::vector<int> sourceColumn;
+    if(clean!=0)
+    {
+        sourceColumn.resize(width);
+        for(int x=0;x<width;x++)
+            sourceColumn[x]=(int)((long long)x*clean->Width()/width);
+    }
+
+    unsigned char header[BMP_HEADER_SIZE]={0};
+    header[0]='B';
+    header[1]='M';
+    PutInt32(&header[2],fileSize>0xffffffffull?0:(unsigned int)fileSize);     //超过4GB存不下，读的时候也不用这个字段
+    PutInt32(&header[10],BMP_HEADER_SIZE);
+    PutInt32(&header[14],40);
+    PutInt32(&header[18],(unsigned int)width);
+    PutInt32(&header[22],(unsigned int)height);
+    header[26]=1;
+    header[28]=24;
+
+    FILE *file=fopen(fileName,"wb");
+    if(file==0)
+        return IO_ERROR;
+    bool failed=fwrite(header,1,BMP_HEADER_SIZE,file)!=BMP_HEADER_SIZE;
+
+    int bandRows=(int)(NOISE_BAND_BYTES/rowStride);
+    if(bandRows<1)
+        bandRows=1;
+    if(bandRows>height)
+        bandRows=height;
+    std::vector<unsigned char> band((size_t)bandRows*rowStride,0);     //补齐的字节一直是0
+
+    for(int firstRow=0;firstRow<height && !failed;firstRow+=bandRows)
+    {
+        int rowCount=firstRow+bandRows<=height?bandRows:height-firstRow;
+        ThreadPool::Instance().For(rowCount,ROWS_PER_TASK,[&](int begin,int end){
+            std::vector<unsigned int> randoms(width);
+            std::vector<unsigned char> planes(clean!=0?(size_t)clean->Width()*3:0);
+            int extractedRow=-1;
+            for(int i=begin;i<end;i++)
+            {
+                int row=firstRow+i;             //储存顺序，第0行是最下面一行
+                int displayRow=height-1-row;
+                unsigned char *pixel=&band[(size_t)i*rowStride];
+                if(clean!=0)
+                {
+                    int sourceWidth=clean->Width();
+                    int sourceRow=(int)((long long)displayRow*clean->Height()/height);
+                    if(clean->IsBottomUp())
+                        sourceRow=clean->Height()-1-sourceRow;
+                    if(sourceRow!=extractedRow)
+                    {
+                        clean->ExtractRows(sourceRow,1,&planes[0],&planes[sourceWidth],&planes[2*sourceWidth]);
+                        extractedRow=sourceRow;
+                    }
+                    for(int x=0;x<width;x++)
+                    {
+                        int column=sourceColumn[x];
+                        pixel[3*x]=planes[2*sourceWidth+column];
+                        pixel[3*x+1]=planes[sourceWidth+column];
+                        pixel[3*x+2]=planes[column];
+                    }
+                }
+                else
+                {
+                    unsigned char green=(unsigned char)(16+(height>1?(long long)displayRow*223/(height-1):0));
+                    for(int x=0;x<width;x++)
+                    {
+                        pixel[3*x]=((x/64+displayRow/64)%2)?80:176;
+                        pixel[3*x+1]=green;
+                        pixel[3*x+2]=(unsigned char)(16+(width>1?(long long)x*223/(width-1):0));
+                    }
+                }
+
+                RowRandoms(options.seed,row,width,&randoms[0]);
+                for(int x=0;x<width;x++)
+                {
+                    if(randoms[x]<threshold)
+                    {
+                        unsigned char value=randoms[x]<threshold/2?0:255;
+                        pixel[3*x]=value;
+                        pixel[3*x+1]=value;
+                        pixel[3*x+2]=value;
+                    }
+                }
+            }
+        });
+        size_t bytes=(size_t)rowCount*rowStride;
+        failed=fwrite(&band[0],1,bytes,file)!=bytes;
+    }
+
+    if(fclose(file)!=0)
+        failed=true;
+    return failed?IO_ERROR:0;
+}
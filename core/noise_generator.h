@@ -0,0 +1,25 @@
+#ifndef NOISE_GENERATOR
+#define NOISE_GENERATOR
+
+class BmpImage;
+
+//给测速、核对生成大图：在干净的图上加椒盐噪声，直接按bmp的格式一段一段写到文件里，
+//整幅图不用放在内存里，8K、上亿像素的图几秒钟就能生成
+//随机数是以(种子, 行, 列)为计数器的哈希，不依赖生成的顺序：同样的参数在任何线程数下生成的文件都一模一样
+namespace NoiseGenerator
+{
+    struct Options
+    {
+        int width;                  //输出的大小。为0时用干净图的大小
+        int height;
+        double density;             //每个点被换成椒盐噪声的概率，0-1，黑、白各一半
+        unsigned long long seed;
+    };
+
+    //clean为0时合成一幅干净的图：横向、纵向两个渐变加上64x64的棋盘格，取值在16-239之间，不会和噪声混淆
+    //否则把clean按最近邻缩放到输出大小。输出总是高度为正的24位bmp，和界面程序、BmpCodec读的一样
+    //成功返回0，大小不对返回SIZE_ERROR，写文件失败返回IO_ERROR。超过4GB的文件，文件头里的文件大小写0
+    int Generate(const char *fileName,const BmpImage *clean,const Options &options);
+}
+
+#endif // NOISE_GENERATOR
@@ -0,0 +1,240 @@
+#include "noise_mask.h"
+#include "bmp_image.h"
+#include "filter_scratch.h"
+#include "noise_estimator.h"
+#include "reference_filters.h"
+#include "thread_pool.h"
+#include "global_defs.h"
+#include <bitset>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    const char MASK_MAGIC[8]={'D','I','P','M','A','S','K','1'};
+    const int MASK_HEADER_SIZE=24;
+    const unsigned char ROW_RUNS=0;
+    const unsigned char ROW_BITS=1;
+
+    void PutUInt(unsigned char *p,unsigned long long value,int bytes)
+    {
+        for(int i=0;i<bytes;i++)
+            p[i]=(unsigned char)(value>>(8*i));
+    }
+
+    unsigned long long GetUInt(const unsigned char *p,int bytes)
+    {
+        unsigned long long value=0;
+        for(int i=0;i<bytes;i++)
+            value|=(unsigned long long)p[i]<<(8*i);
+        return value;
+    }
+
+    void PutVarint(std::vector<unsigned char> &out,unsigned int value)
+    {
+        while(value>=0x80)
+        {
+            out.push_back((unsigned char)(value|0x80));
+            value>>=7;
+        }
+        out.push_back((unsigned char)value);
+    }
+
+    //读一个变长整数，越界或者太长时返回false
+    bool GetVarint(const unsigned char *&p,const unsigned char *end,unsigned int &value)
+    {
+        value=0;
+        for(int shift=0;shift<35 && p<end;shift+=7)
+        {
+            unsigned char byte=*p++;
+            value|=(unsigned int)(byte&0x7f)<<shift;
+            if(!(byte&0x80))
+                return true;
+        }
+        return false;
+    }
+}
+
+NoiseMask::NoiseMask()
+    : m_width(0),m_height(0),m_wordsPerRow(0),m_checksum(0)
+{
+}
+
+void NoiseMask::Detect(const BmpImage &image, FilterScratch &scratch)
+{
+    m_width=image.Width();
+    m_height=image.Height();
+    m_wordsPerRow=((size_t)m_width+63)/64;
+    m_bits.assign(m_wordsPerRow*m_height,0);
+    m_checksum=ReferenceFilters::Checksum(image);
+
+    scratch.Reserve(m_width,m_height,MAX_FILTER_SIZE,FilterScratch::PLANES);
+    image.ExtractPlanes(scratch.SourcePlane(0),scratch.SourcePlane(1),scratch.SourcePlane(2));
+    const unsigned char *planes[3]={scratch.SourcePlane(0),scratch.SourcePlane(1),scratch.SourcePlane(2)};
+
+    //每行从新的64位开始，各线程写的行不会共用一个字
+    ThreadPool::Instance().For(m_height,ROWS_PER_TASK,[&](int begin,int end){
+        for(int y=begin;y<end;y++)
+        {
+            unsigned long long *row=&m_bits[(size_t)y*m_wordsPerRow];
+            for(int x=0;x<m_width;x++)
+            {
+                if(NoiseEstimator::IsImpulse(planes,m_width,m_height,x,y))
+                    row[x/64]|=1ull<<(x%64);
+            }
+        }
+    });
+}
+
+long long NoiseMask::Count() const
+{
+    long long count=0;
+    for(size_t i=0;i<m_bits.size();i++)
+        count+=(long long)std::bitset<64>(m_bits[i]).count();
+    return count;
+}
+
+double NoiseMask::Density() const
+{
+    return m_bits.empty()?0:(double)this->Count()/((double)m_width*m_height);
+}
+
+bool NoiseMask::Matches(const BmpImage &image) const
+{
+    return !m_bits.empty() && image.Width()==m_width && image.Height()==m_height
+           && ReferenceFilters::Checksum(image)==m_checksum;
+}
+
+void NoiseMask::ToRegion(ImageFilters::Region &region, std::vector<unsigned char> &bytes) const
+{
+    bytes.resize((size_t)m_width*m_height);
+    ThreadPool::Instance().For(m_height,ROWS_PER_TASK,[&](int begin,int end){
+        for(int y=begin;y<end;y++)
+        {
+            unsigned char *line=&bytes[(size_t)y*m_width];
+            for(int x=0;x<m_width;x++)
+                line[x]=this->IsNoise(x,y);
+        }
+    });
+    region.left=0;
+    region.top=0;
+    region.right=m_width;
+    region.bottom=m_height;
+    region.mask=bytes.empty()?0:&bytes[0];
+}
+
+int NoiseMask::Save(const char *fileName) const
+{
+    FILE *file=fopen(fileName,"wb");
+    if(file==0)
+        return IO_ERROR;
+
+    unsigned char header[MASK_HEADER_SIZE];
+    memcpy(header,MASK_MAGIC,sizeof(MASK_MAGIC));
+    PutUInt(header+8,(unsigned int)m_width,4);
+    PutUInt(header+12,(unsigned int)m_height,4);
+    PutUInt(header+16,m_checksum,8);
+    bool failed=fwrite(header,1,MASK_HEADER_SIZE,file)!=(size_t)MASK_HEADER_SIZE;
+
+    size_t bitBytes=((size_t)m_width+7)/8;
+    std::vector<unsigned char> line;
+    for(int y=0;y<m_height && !failed;y++)
+    {
+        line.clear();
+        line.push_back(ROW_RUNS);
+        bool noise=false;
+        int x=0;
+        while(x<m_width && line.size()<=bitBytes)
+        {
+            int start=x;
+            while(x<m_width && this->IsNoise(x,y)==noise)
+                x++;
+            PutVarint(line,(unsigned int)(x-start));
+            noise=!noise;
+        }
+        if(x<m_width || line.size()>bitBytes+1)     //游程比原样的位还长
+        {
+            line.assign(bitBytes+1,0);
+            line[0]=ROW_BITS;
+            const unsigned long long *row=&m_bits[(size_t)y*m_wordsPerRow];
+            for(size_t i=0;i<bitBytes;i++)
+                line[1+i]=(unsigned char)(row[i/8]>>(8*(i%8)));
+        }
+        failed=fwrite(&line[0],1,line.size(),file)!=line.size();
+    }
+
+    if(fclose(file)!=0)
+        failed=true;
+    return failed?IO_ERROR:0;
+}
+
+int NoiseMask::Load(const char *fileName, const BmpImage &image)
+{
+    FILE *file=fopen(fileName,"rb");
+    if(file==0)
+        return IO_ERROR;
+    std::vector<unsigned char> content;
+    unsigned char buffer[65536];
+    size_t count;
+    while((count=fread(buffer,1,sizeof(buffer),file))>0)
+        content.insert(content.end(),buffer,buffer+count);
+    bool failed=ferror(file)!=0;
+    fclose(file);
+    if(failed)
+        return IO_ERROR;
+
+    if(content.size()<(size_t)MASK_HEADER_SIZE || memcmp(&content[0],MASK_MAGIC,sizeof(MASK_MAGIC))!=0)
+        return FORMAT_ERROR;
+    long long width=(int)GetUInt(&content[8],4);
+    long long height=(int)GetUInt(&content[12],4);
+    if(width<=0 || height<=0)
+        return FORMAT_ERROR;
+    //每行至少有一个字节的类型，行数不会比文件还多；宽度从文件里看不出上限，和要用它的图对一下，坏文件不会让下面分配一大块内存
+    if((size_t)height>content.size()-MASK_HEADER_SIZE || width!=image.Width() || height!=image.Height())
+        return FORMAT_ERROR;
+
+    size_t wordsPerRow=((size_t)width+63)/64;
+    size_t bitBytes=((size_t)width+7)/8;
+    std::vector<unsigned long long> bits(wordsPerRow*height,0);
+    const unsigned char *p=&content[MASK_HEADER_SIZE];
+    const unsigned char *end=&content[0]+content.size();
+    for(long long y=0;y<height;y++)
+    {
+        if(p>=end)
+            return FORMAT_ERROR;
+        unsigned long long *row=&bits[(size_t)y*wordsPerRow];
+        unsigned char type=*p++;
+        if(type==ROW_BITS)
+        {
+            if((size_t)(end-p)<bitBytes)
+                return FORMAT_ERROR;
+            for(size_t i=0;i<bitBytes;i++)
+                row[i/8]|=(unsigned long long)p[i]<<(8*(i%8));
+            if(width%64!=0)             //最后一个字里超出宽度的位不要
+                row[wordsPerRow-1]&=(1ull<<(width%64))-1;
+            p+=bitBytes;
+        }
+        else if(type==ROW_RUNS)
+        {
+            bool noise=false;
+            for(long long x=0;x<width;noise=!noise)
+            {
+                unsigned int run;
+                if(!GetVarint(p,end,run) || run>width-x)
+                    return FORMAT_ERROR;
+                for(long long i=x;noise && i<x+run;i++)
+                    row[i/64]|=1ull<<(i%64);
+                x+=run;
+            }
+        }
+        else
+            return FORMAT_ERROR;
+    }
+
+    m_width=(int)width;
+    m_height=(int)height;
+    m_wordsPerRow=wordsPerRow;
+    m_checksum=GetUInt(&content[16],8);
+    m_bits.swap(bits);
+    return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef NOISE_MASK
+#define NOISE_MASK
+
+#include <vector>
+#include "image_filters.h"
+
+class BmpImage;
+class FilterScratch;
+
+const char NOISE_MASK_SUFFIX[]=".mask";     //image.bmp的噪声点存在image.bmp.mask
+
+//一幅图里椒盐噪声点的位置，每个点一位，按储存顺序，每行从64位的边界开始
+//检测一次之后存到图像旁边，以后换参数重新滤波、多遍滤波都直接用，不用每次都重新找噪声点
+//滤波时用ToRegion变成ImageFilters::Region的mask，只有噪声点会被换掉（开关型滤波），其余的点保持原样
+//文件格式：8字节的"DIPMASK1"，宽、高（各4字节），检测时的图像的校验和（8字节），都是小头；
+//然后每行一个字节的类型：0是游程，从不是噪声的点开始交替的长度，每个长度是7位一组的变长整数；1是原样的位，
+//(宽+7)/8个字节，低位在前。每行取短的那种，噪声少时游程短，噪声多时不超过每点一位
+class NoiseMask
+{
+public:
+    NoiseMask();
+
+    //逐点检测image里的噪声点（NoiseEstimator::IsImpulse），记下image的校验和。按行分给线程池
+    void Detect(const BmpImage &image,FilterScratch &scratch);
+
+    bool IsNull() const {return m_bits.empty();}
+    int Width() const {return m_width;}
+    int Height() const {return m_height;}
+    bool IsNoise(int x,int y) const {return (m_bits[(size_t)y*m_wordsPerRow+x/64]>>(x%64))&1;}
+    long long Count() const;
+    double Density() const;
+
+    //是不是在这幅图（文件内容完全一样）上检测出来的。图改过以后要重新检测
+    bool Matches(const BmpImage &image) const;
+
+    //整幅图的region，mask放在bytes里，每个点一个字节，噪声点为1
+    void ToRegion(ImageFilters::Region &region,std::vector<unsigned char> &bytes) const;
+
+    //成功返回0，否则返回IO_ERROR或FORMAT_ERROR（见global_defs.h）
+    int Save(const char *fileName) const;
+    //读给image存的噪声点，宽、高和image不一样时在分配内存之前就返回FORMAT_ERROR。是否就是这幅图还要用Matches判断
+    int Load(const char *fileName,const BmpImage &image);
+
+private:
+    int m_width;
+    int m_height;
+    size_t m_wordsPerRow;
+    unsigned long long m_checksum;
+    std::vector<unsigned long long> m_bits;
+};
+
+#endif // NOISE_MASK
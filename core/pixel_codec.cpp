@@ -0,0 +1,230 @@
+#include "pixel_codec.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+//gcc、clang在x86上不用-mavx2也能单独把一个函数编成AVX2的，运行时看CPU支不支持再调用；msvc只能编译时打开
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define PIXEL_CODEC_AVX2 1
+#define PIXEL_CODEC_AVX2_TARGET __attribute__((target("avx2")))
+#elif defined(__AVX2__)
+#define PIXEL_CODEC_AVX2 1
+#define PIXEL_CODEC_AVX2_TARGET
+#endif
+#if defined(PIXEL_CODEC_AVX2)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+#if defined(PIXEL_CODEC_AVX2)
+    bool HasAvx2()
+    {
+#if defined(__AVX2__)
+        return true;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2")!=0;
+#endif
+    }
+
+    //一次查8个点，返回做了几个点，剩下的逐点做
+    PIXEL_CODEC_AVX2_TARGET int IndexToRgb32Avx2(const unsigned char *index,const unsigned int *lut,unsigned int *rgb32,int count)
+    {
+        int x=0;
+        for(;x+8<=count;x+=8)
+        {
+            __m256i indices=_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(index+x)));
+            _mm256_storeu_si256((__m256i *)(rgb32+x),_mm256_i32gather_epi32((const int *)lut,indices,4));
+        }
+        return x;
+    }
+
+    //一次16个点：按编号取出调色板里的4个字节（b,g,r,保留），每128位里先把4个点的b、g、r各排到一起，
+    //再把两半的同一个通道拼起来。返回做了几个点，剩下的逐点做
+    PIXEL_CODEC_AVX2_TARGET int ExpandPaletteAvx2(const unsigned char *index,const unsigned char *palette,
+                                                  unsigned char *red,unsigned char *green,unsigned char *blue,int count)
+    {
+        const __m256i group=_mm256_setr_epi8(0,4,8,12,1,5,9,13,2,6,10,14,3,7,11,15,
+                                             0,4,8,12,1,5,9,13,2,6,10,14,3,7,11,15);
+        const __m256i order=_mm256_setr_epi32(0,4,1,5,2,6,3,7);
+        int x=0;
+        for(;x+16<=count;x+=16)
+        {
+            __m128i indices=_mm_loadu_si128((const __m128i *)(index+x));
+            __m256i low=_mm256_i32gather_epi32((const int *)palette,_mm256_cvtepu8_epi32(indices),4);
+            __m256i high=_mm256_i32gather_epi32((const int *)palette,_mm256_cvtepu8_epi32(_mm_srli_si128(indices,8)),4);
+            //每个里面前8个字节是8个点的b，接着是g、r
+            low=_mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(low,group),order);
+            high=_mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(high,group),order);
+            __m128i lowBg=_mm256_castsi256_si128(low),highBg=_mm256_castsi256_si128(high);
+            _mm_storeu_si128((__m128i *)(blue+x),_mm_unpacklo_epi64(lowBg,highBg));
+            _mm_storeu_si128((__m128i *)(green+x),_mm_unpackhi_epi64(lowBg,highBg));
+            _mm_storeu_si128((__m128i *)(red+x),_mm_unpacklo_epi64(_mm256_extracti128_si256(low,1),_mm256_extracti128_si256(high,1)));
+        }
+        return x;
+    }
+#endif
+
+#if defined(__SSSE3__)
+    //连续16个点是48个字节，分三次读。拆通道时第channel个通道从第chunk块里取哪些字节，
+    //合通道时第chunk块的每个字节从哪个通道的哪个点来，用pshufb的掩码表示，取不到的位置是0x80
+    struct ShuffleMasks
+    {
+        __m128i split[3][3];        //[通道][块]，通道0是b，1是g，2是r（和文件里的顺序一样）
+        __m128i merge[3][3];        //[块][通道]
+
+        ShuffleMasks()
+        {
+            for(int channel=0;channel<3;channel++)
+            {
+                for(int chunk=0;chunk<3;chunk++)
+                {
+                    char split_[16],merge_[16];
+                    for(int i=0;i<16;i++)
+                    {
+                        int source=3*i+channel;             //第i个点的这个通道在48个字节里的位置
+                        split_[i]=(char)(source/16==chunk?source%16:0x80);
+                        int target=16*chunk+i;              //第chunk块的第i个字节
+                        merge_[i]=(char)(target%3==channel?target/3:0x80);
+                    }
+                    split[channel][chunk]=_mm_loadu_si128((const __m128i *)split_);
+                    merge[chunk][channel]=_mm_loadu_si128((const __m128i *)merge_);
+                }
+            }
+        }
+    };
+
+    const ShuffleMasks masks;
+#endif
+}
+
+void PixelCodec::SplitBgr(const unsigned char *bgr, unsigned char *red, unsigned char *green, unsigned char *blue, int count)
+{
+    int x=0;
+#if defined(__SSSE3__)
+    unsigned char *planes[3]={blue,green,red};
+    for(;x+16<=count;x+=16,bgr+=48)
+    {
+        __m128i chunk[3]={_mm_loadu_si128((const __m128i *)bgr),
+                          _mm_loadu_si128((const __m128i *)(bgr+16)),
+                          _mm_loadu_si128((const __m128i *)(bgr+32))};
+        for(int channel=0;channel<3;channel++)
+        {
+            __m128i value=_mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(chunk[0],masks.split[channel][0]),
+                                                    _mm_shuffle_epi8(chunk[1],masks.split[channel][1])),
+                                       _mm_shuffle_epi8(chunk[2],masks.split[channel][2]));
+            _mm_storeu_si128((__m128i *)(planes[channel]+x),value);
+        }
+    }
+#endif
+    for(;x<count;x++,bgr+=3)
+    {
+        blue[x]=bgr[0];
+        green[x]=bgr[1];
+        red[x]=bgr[2];
+    }
+}
+
+void PixelCodec::MergeBgr(const unsigned char *red, const unsigned char *green, const unsigned char *blue, unsigned char *bgr, int count)
+{
+    int x=0;
+#if defined(__SSSE3__)
+    const unsigned char *planes[3]={blue,green,red};
+    for(;x+16<=count;x+=16,bgr+=48)
+    {
+        __m128i value[3];
+        for(int channel=0;channel<3;channel++)
+            value[channel]=_mm_loadu_si128((const __m128i *)(planes[channel]+x));
+        for(int chunk=0;chunk<3;chunk++)
+        {
+            __m128i out=_mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(value[0],masks.merge[chunk][0]),
+                                                  _mm_shuffle_epi8(value[1],masks.merge[chunk][1])),
+                                     _mm_shuffle_epi8(value[2],masks.merge[chunk][2]));
+            _mm_storeu_si128((__m128i *)(bgr+16*chunk),out);
+        }
+    }
+#endif
+    for(;x<count;x++,bgr+=3)
+    {
+        bgr[0]=blue[x];
+        bgr[1]=green[x];
+        bgr[2]=red[x];
+    }
+}
+
+void PixelCodec::ExpandPalette(const unsigned char *index, const unsigned char *palette,
+                               unsigned char *red, unsigned char *green, unsigned char *blue, int count)
+{
+    int x=0;
+#if defined(PIXEL_CODEC_AVX2)
+    static const bool avx2=HasAvx2();
+    if(avx2)
+        x=ExpandPaletteAvx2(index,palette,red,green,blue,count);
+#endif
+    for(;x<count;x++)
+    {
+        const unsigned char *color=palette+4*index[x];     //注意顺序！小头！！
+        red[x]=color[2];
+        green[x]=color[1];
+        blue[x]=color[0];
+    }
+}
+
+void PixelCodec::BgrToRgb32(const unsigned char *bgr, unsigned int *rgb32, int count)
+{
+    int x=0;
+#if defined(__SSSE3__)
+    //每次读16个字节、用前12个（4个点），所以最后几个点留给下面逐点做，免得读过界
+    const __m128i expand=_mm_setr_epi8(0,1,2,(char)0x80,3,4,5,(char)0x80,6,7,8,(char)0x80,9,10,11,(char)0x80);
+    const __m128i alpha=_mm_set1_epi32((int)0xff000000);
+    for(;x+6<=count;x+=4,bgr+=12)
+    {
+        __m128i value=_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)bgr),expand);
+        _mm_storeu_si128((__m128i *)(rgb32+x),_mm_or_si128(value,alpha));
+    }
+#endif
+    for(;x<count;x++,bgr+=3)
+        rgb32[x]=0xff000000u|((unsigned int)bgr[2]<<16)|((unsigned int)bgr[1]<<8)|bgr[0];
+}
+
+void PixelCodec::IndexToRgb32(const unsigned char *index, const unsigned int *lut, unsigned int *rgb32, int count)
+{
+    int x=0;
+#if defined(PIXEL_CODEC_AVX2)
+    static const bool avx2=HasAvx2();
+    if(avx2)
+        x=IndexToRgb32Avx2(index,lut,rgb32,count);
+#endif
+    for(;x<count;x++)
+        rgb32[x]=lut[index[x]];
+}
+
+void PixelCodec::PlanesToRgb32(const unsigned char *red, const unsigned char *green, const unsigned char *blue,
+                               unsigned int *rgb32, int count)
+{
+    int x=0;
+#if defined(__SSE2__)
+    //内存里一个点是b,g,r,0xff：先把b和g、r和0xff按字节交错，再按16位交错
+    const __m128i alpha=_mm_set1_epi8((char)0xff);
+    for(;x+16<=count;x+=16)
+    {
+        __m128i r=_mm_loadu_si128((const __m128i *)(red+x));
+        __m128i g=_mm_loadu_si128((const __m128i *)(green+x));
+        __m128i b=_mm_loadu_si128((const __m128i *)(blue+x));
+        __m128i bgLow=_mm_unpacklo_epi8(b,g);
+        __m128i bgHigh=_mm_unpackhi_epi8(b,g);
+        __m128i raLow=_mm_unpacklo_epi8(r,alpha);
+        __m128i raHigh=_mm_unpackhi_epi8(r,alpha);
+        _mm_storeu_si128((__m128i *)(rgb32+x),_mm_unpacklo_epi16(bgLow,raLow));
+        _mm_storeu_si128((__m128i *)(rgb32+x+4),_mm_unpackhi_epi16(bgLow,raLow));
+        _mm_storeu_si128((__m128i *)(rgb32+x+8),_mm_unpacklo_epi16(bgHigh,raHigh));
+        _mm_storeu_si128((__m128i *)(rgb32+x+12),_mm_unpackhi_epi16(bgHigh,raHigh));
+    }
+#endif
+    for(;x<count;x++)
+        rgb32[x]=0xff000000u|((unsigned int)red[x]<<16)|((unsigned int)green[x]<<8)|blue[x];
+}
@@ -0,0 +1,24 @@
+#ifndef PIXEL_CODEC
+#define PIXEL_CODEC
+
+//bmp的一行像素和滤波用的r、g、b三个通道、显示用的32位颜色之间的转换，count是一行的点数
+//有SSSE3时用pshufb一次换16个点；显示8位图时CPU支持AVX2就用gather查调色板（运行时检测，不用-mavx2）；否则逐点做，结果都一样
+namespace PixelCodec
+{
+    //24位：b,g,r,b,g,r... 拆成三个通道 / 合回去
+    void SplitBgr(const unsigned char *bgr,unsigned char *red,unsigned char *green,unsigned char *blue,int count);
+    void MergeBgr(const unsigned char *red,const unsigned char *green,const unsigned char *blue,unsigned char *bgr,int count);
+
+    //8位：按调色板把编号展开成三个通道。palette是256项的b,g,r,保留
+    void ExpandPalette(const unsigned char *index,const unsigned char *palette,
+                       unsigned char *red,unsigned char *green,unsigned char *blue,int count);
+
+    //显示用的32位颜色，0xffRRGGBB，和QImage::Format_RGB32一样
+    void BgrToRgb32(const unsigned char *bgr,unsigned int *rgb32,int count);
+    //lut是256项的0xffRRGGBB
+    void IndexToRgb32(const unsigned char *index,const unsigned int *lut,unsigned int *rgb32,int count);
+    //滤波结果的三个通道直接转成显示用的颜色
+    void PlanesToRgb32(const unsigned char *red,const unsigned char *green,const unsigned char *blue,unsigned int *rgb32,int count);
+}
+
+#endif // PIXEL_CODEC
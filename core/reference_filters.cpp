@@ -0,0 +1,418 @@
+#include "reference_filters.h"
+#include "bmp_image.h"
+#include "noise_estimator.h"
+#include "global_defs.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+    const int SSIM_WINDOW=8;
+    const double SSIM_C1=(0.01*255)*(0.01*255);
+    const double SSIM_C2=(0.03*255)*(0.03*255);
+
+    //储存顺序第y行第x列的点的r、g、b
+    void GetColor(const BmpImage &image,int x,int y,unsigned char rgb[3])
+    {
+        const unsigned char *row=image.Row(y);
+        if(image.BitCount()==24)
+        {
+            rgb[0]=row[3*x+2];
+            rgb[1]=row[3*x+1];
+            rgb[2]=row[3*x];
+            return;
+        }
+        int index=row[x];
+        if(index>=image.PaletteSize())
+        {
+            rgb[0]=rgb[1]=rgb[2]=0;
+            return;
+        }
+        const unsigned char *entry=image.Palette()+4*index;
+        rgb[0]=entry[2];
+        rgb[1]=entry[1];
+        rgb[2]=entry[0];
+    }
+
+    void SetColor(BmpImage &image,int x,int y,const unsigned char rgb[3])
+    {
+        unsigned char *row=image.Row(y);
+        if(image.BitCount()==24)
+        {
+            row[3*x+2]=rgb[0];
+            row[3*x+1]=rgb[1];
+            row[3*x]=rgb[2];
+            return;
+        }
+        for(int index=0;index<image.PaletteSize();index++)
+        {
+            const unsigned char *entry=image.Palette()+4*index;
+            if(entry[2]==rgb[0] && entry[1]==rgb[1] && entry[0]==rgb[2])
+                row[x]=(unsigned char)index;
+        }
+    }
+
+    //整幅图的r、g、b三个通道，每个通道width*height个字节
+    struct Planes
+    {
+        int width;
+        int height;
+        std::vector<unsigned char> data;
+
+        explicit Planes(const BmpImage &image) : width(image.Width()),height(image.Height()),data(image.PixelCount()*3)
+        {
+            for(int y=0;y<height;y++)
+            {
+                for(int x=0;x<width;x++)
+                {
+                    unsigned char rgb[3];
+                    GetColor(image,x,y,rgb);
+                    for(int channel=0;channel<3;channel++)
+                        (*this)[channel][(size_t)y*width+x]=rgb[channel];
+                }
+            }
+        }
+        unsigned char *operator[](int channel) {return &data[(size_t)width*height*channel];}
+        const unsigned char *operator[](int channel) const {return &data[(size_t)width*height*channel];}
+    };
+
+    //拷出以(x,y)为中心、size x size的窗口落在图像内的部分，排好序
+    void SortedWindow(const unsigned char *plane,int width,int height,int x,int y,int size,
+                      std::vector<unsigned char> &window)
+    {
+        int radius=size/2;
+        window.clear();
+        for(int row=y-radius;row<=y+radius;row++)
+        {
+            for(int column=x-radius;column<=x+radius;column++)
+            {
+                if(row>=0 && row<height && column>=0 && column<width)
+                    window.push_back(plane[(size_t)row*width+column]);
+            }
+        }
+        std::sort(window.begin(),window.end());
+    }
+
+    unsigned char Rank(const unsigned char *plane,int width,int height,int x,int y,int size,int percentile,
+                       std::vector<unsigned char> &window)
+    {
+        SortedWindow(plane,width,height,x,y,size,window);
+        int count=(int)window.size();
+        return window[(percentile*(count-1)+99)/100];
+    }
+
+    //(x,y)这一点自适应中值滤波的结果，planes里是窗口里各点现在的值
+    void Adaptive(const Planes &planes,int x,int y,int maxSize,unsigned char result[3],std::vector<unsigned char> window[3])
+    {
+        size_t pos=(size_t)y*planes.width+x;
+        for(int channel=0;channel<3;channel++)
+            result[channel]=planes[channel][pos];          //窗口加到最大也不行就保留当前点
+        for(int size=3;size<=maxSize;size+=2)
+        {
+            bool medianInRange=true,thisInRange=true;
+            for(int channel=0;channel<3;channel++)
+            {
+                SortedWindow(planes[channel],planes.width,planes.height,x,y,size,window[channel]);
+                unsigned char low=window[channel].front();
+                unsigned char median=window[channel][window[channel].size()/2];
+                unsigned char high=window[channel].back();
+                unsigned char center=planes[channel][pos];
+                if(!(median>low && median<high))
+                    medianInRange=false;
+                if(!(center>low && center<high))
+                    thisInRange=false;
+            }
+
+            if(medianInRange)
+            {
+                if(!thisInRange)
+                {
+                    for(int channel=0;channel<3;channel++)
+                        result[channel]=window[channel][window[channel].size()/2];
+                }
+                return;
+            }
+        }
+    }
+
+    bool Selected(const ImageFilters::Region &region,int x,int y)
+    {
+        return region.mask==0 || region.mask[(size_t)(y-region.top)*(region.right-region.left)+(x-region.left)]!=0;
+    }
+
+    //就地滤波：按储存顺序逐点算出新的颜色写回图像，planes跟着改成写回之后图像里的颜色
+    template<class Filter>
+    void FilterInPlace(BmpImage &image,const ImageFilters::Region &region,const Filter &filter)
+    {
+        Planes planes(image);
+        for(int y=region.top;y<region.bottom;y++)
+        {
+            for(int x=region.left;x<region.right;x++)
+            {
+                if(!Selected(region,x,y))
+                    continue;
+                unsigned char rgb[3];
+                filter(planes,x,y,rgb);
+                SetColor(image,x,y,rgb);
+                GetColor(image,x,y,rgb);
+                for(int channel=0;channel<3;channel++)
+                    planes[channel][(size_t)y*planes.width+x]=rgb[channel];
+            }
+        }
+    }
+
+    //把result里的颜色写回region这块
+    void StoreRegion(BmpImage &image,const Planes &result,const ImageFilters::Region &region)
+    {
+        for(int y=region.top;y<region.bottom;y++)
+        {
+            for(int x=region.left;x<region.right;x++)
+            {
+                size_t pos=(size_t)y*result.width+x;
+                unsigned char rgb[3]={result[0][pos],result[1][pos],result[2][pos]};
+                SetColor(image,x,y,rgb);
+            }
+        }
+    }
+
+    ImageFilters::Region WholeImage(const BmpImage &image)
+    {
+        ImageFilters::Region region={0,0,image.Width(),image.Height(),0};
+        return region;
+    }
+
+    void PutInt32(unsigned char *p,unsigned int value)
+    {
+        p[0]=(unsigned char)value;
+        p[1]=(unsigned char)(value>>8);
+        p[2]=(unsigned char)(value>>16);
+        p[3]=(unsigned char)(value>>24);
+    }
+}
+
+void ReferenceFilters::RankFilter(BmpImage &image, int size, int percentile)
+{
+    RankFilter(image,size,percentile,WholeImage(image));
+}
+
+void ReferenceFilters::RankFilter(BmpImage &image, int size, int percentile, const ImageFilters::Region &region)
+{
+    Planes source(image);
+    Planes result(source);
+    std::vector<unsigned char> window;
+    for(int channel=0;channel<3;channel++)
+    {
+        for(int y=region.top;y<region.bottom;y++)
+        {
+            for(int x=region.left;x<region.right;x++)
+            {
+                if(Selected(region,x,y))
+                    result[channel][(size_t)y*source.width+x]=Rank(source[channel],source.width,source.height,x,y,size,percentile,window);
+            }
+        }
+    }
+    StoreRegion(image,result,region);
+}
+
+void ReferenceFilters::MedianFilter(BmpImage &image, int size)
+{
+    MedianFilter(image,size,WholeImage(image));
+}
+
+void ReferenceFilters::MedianFilter(BmpImage &image, int size, const ImageFilters::Region &region)
+{
+    std::vector<unsigned char> window;
+    FilterInPlace(image,region,[&](const Planes &planes,int x,int y,unsigned char rgb[3]){
+        for(int channel=0;channel<3;channel++)
+        {
+            SortedWindow(planes[channel],planes.width,planes.height,x,y,size,window);
+            rgb[channel]=window[window.size()/2];
+        }
+    });
+}
+
+void ReferenceFilters::AdaptiveMedianFilter(BmpImage &image, int maxSize)
+{
+    AdaptiveMedianFilter(image,maxSize,WholeImage(image));
+}
+
+void ReferenceFilters::AdaptiveMedianFilter(BmpImage &image, int maxSize, const ImageFilters::Region &region)
+{
+    std::vector<unsigned char> window[3];
+    FilterInPlace(image,region,[&](const Planes &planes,int x,int y,unsigned char rgb[3]){
+        Adaptive(planes,x,y,maxSize,rgb,window);
+    });
+}
+
+int ReferenceFilters::IterativeMedianFilter(BmpImage &image, int size, int maxPasses)
+{
+    Planes source(image);
+    Planes result(source);
+    std::vector<unsigned char> window;
+    int passes=0;
+    bool changed=true;
+    while(changed && passes<maxPasses)
+    {
+        passes++;
+        for(int channel=0;channel<3;channel++)
+        {
+            for(int y=0;y<source.height;y++)
+            {
+                for(int x=0;x<source.width;x++)
+                    result[channel][(size_t)y*source.width+x]=Rank(source[channel],source.width,source.height,x,y,size,50,window);
+            }
+        }
+        changed=result.data!=source.data;
+        source.data=result.data;
+    }
+    StoreRegion(image,result,WholeImage(image));
+    return passes;
+}
+
+double ReferenceFilters::AutoFilter(BmpImage &image)
+{
+    Planes source(image);
+    Planes result(source);
+    int width=source.width;
+    int height=source.height;
+    const unsigned char *planes[3]={source[0],source[1],source[2]};
+    std::vector<unsigned char> window[3];
+    double noise=0;
+    for(int top=0;top<height;top+=ImageFilters::AUTO_BLOCK_SIZE)
+    {
+        int bottom=std::min(top+ImageFilters::AUTO_BLOCK_SIZE,height);
+        for(int left=0;left<width;left+=ImageFilters::AUTO_BLOCK_SIZE)
+        {
+            int right=std::min(left+ImageFilters::AUTO_BLOCK_SIZE,width);
+            double density=NoiseEstimator::Density(planes,width,height,left,top,right,bottom,ImageFilters::AUTO_SAMPLE_STEP);
+            noise+=density*(right-left)*(bottom-top);
+
+            NoiseEstimator::FilterChoice choice=NoiseEstimator::ChooseFilter(density);
+            int size=NoiseEstimator::WindowSize(choice);
+            for(int y=top;y<bottom && choice!=NoiseEstimator::NO_FILTER;y++)
+            {
+                for(int x=left;x<right;x++)
+                {
+                    size_t pos=(size_t)y*width+x;
+                    unsigned char rgb[3];
+                    if(choice==NoiseEstimator::ADAPTIVE_MEDIAN)
+                        Adaptive(source,x,y,size,rgb,window);
+                    else
+                    {
+                        for(int channel=0;channel<3;channel++)
+                            rgb[channel]=Rank(source[channel],width,height,x,y,size,50,window[0]);
+                    }
+                    for(int channel=0;channel<3;channel++)
+                        result[channel][pos]=rgb[channel];
+                }
+            }
+        }
+    }
+    StoreRegion(image,result,WholeImage(image));
+    return noise/((double)width*height);
+}
+
+int ReferenceFilters::Compare(const BmpImage &image, const BmpImage &reference, ImageMetrics::Quality &quality)
+{
+    int width=image.Width();
+    int height=image.Height();
+    if(width!=reference.Width() || height!=reference.Height() || width==0 || height==0)
+        return SIZE_ERROR;
+
+    Planes a(image),b(reference);
+    unsigned long long squaredError=0;
+    for(size_t i=0;i<a.data.size();i++)
+    {
+        int diff=a.data[i]-b.data[i];
+        squaredError+=diff*diff;
+    }
+
+    int window=std::min(std::min(SSIM_WINDOW,width),height);
+    int windowRows=height-window+1;
+    int windowColumns=width-window+1;
+    double n=(double)window*window;
+    double ssimSum=0;
+    for(int channel=0;channel<3;channel++)
+    {
+        for(int top=0;top<windowRows;top++)
+        {
+            for(int left=0;left<windowColumns;left++)
+            {
+                long long sa=0,sb=0,saa=0,sbb=0,sab=0;
+                for(int y=top;y<top+window;y++)
+                {
+                    for(int x=left;x<left+window;x++)
+                    {
+                        int va=a[channel][(size_t)y*width+x];
+                        int vb=b[channel][(size_t)y*width+x];
+                        sa+=va;
+                        sb+=vb;
+                        saa+=va*va;
+                        sbb+=vb*vb;
+                        sab+=va*vb;
+                    }
+                }
+                double muA=sa/n,muB=sb/n;
+                double varA=saa/n-muA*muA;
+                double varB=sbb/n-muB*muB;
+                double cov=sab/n-muA*muB;
+                ssimSum+=(2*muA*muB+SSIM_C1)*(2*cov+SSIM_C2)/((muA*muA+muB*muB+SSIM_C1)*(varA+varB+SSIM_C2));
+            }
+        }
+    }
+
+    quality.mse=squaredError/(3.0*width*height);
+    quality.psnr=quality.mse>0?10*std::log10(255.0*255.0/quality.mse):std::numeric_limits<double>::infinity();
+    quality.ssim=ssimSum/(3.0*windowRows*windowColumns);
+    return 0;
+}
+
+unsigned long long ReferenceFilters::Checksum(const BmpImage &image)
+{
+    unsigned long long hash=14695981039346656037ULL;
+    const unsigned char *data=image.FileContent();
+    for(size_t i=0;i<image.FileSize();i++)
+    {
+        hash^=data[i];
+        hash*=1099511628211ULL;
+    }
+    return hash;
+}
+
+void ReferenceFilters::MakeTestImage(int width, int height, unsigned int seed, BmpImage &image)
+{
+    size_t rowStride=((size_t)width*24+31)/32*4;
+    std::vector<unsigned char> file(54+rowStride*height,0);
+    file[0]='B';
+    file[1]='M';
+    PutInt32(&file[2],(unsigned int)file.size());
+    PutInt32(&file[10],54);
+    PutInt32(&file[14],40);
+    PutInt32(&file[18],(unsigned int)width);
+    PutInt32(&file[22],(unsigned int)height);
+    file[26]=1;
+    file[28]=24;
+
+    unsigned int state=seed;
+    for(int y=0;y<height;y++)
+    {
+        unsigned char *pixel=&file[54+(size_t)y*rowStride];
+        for(int x=0;x<width;x++)
+        {
+            for(int channel=0;channel<3;channel++)
+            {
+                state=state*1664525u+1013904223u;       //线性同余，各个平台上都一样
+                unsigned int noise=state>>24;
+                if(noise<13)
+                    pixel[3*x+channel]=0;
+                else if(noise>=243)
+                    pixel[3*x+channel]=255;
+                else
+                    pixel[3*x+channel]=(unsigned char)((x*(channel+1)+y*2)%200+28);
+            }
+        }
+    }
+    image.Parse(&file[0],file.size());
+}
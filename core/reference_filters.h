@@ -0,0 +1,44 @@
+#ifndef REFERENCE_FILTERS
+#define REFERENCE_FILTERS
+
+#include "image_filters.h"
+#include "image_metrics.h"
+
+class BmpImage;
+
+//最直接的逐点实现：每个点把窗口里的值拷出来排好序再取。很慢，只用来核对各种优化过的实现
+//结果是约定好的“标准答案”：边界处只用落在图像内的那部分窗口。直接按储存顺序读写图像里的点，不用BmpImage拆通道的那些函数：
+//8位图读的时候查调色板（超出调色板的编号当作黑色），写的时候从头到尾找一样的颜色，取最后一个，找不到就不改这个点
+//dip_batch -verify用它生成、核对golden.txt里的校验和
+namespace ReferenceFilters
+{
+    //窗口内的第percentile百分位数，下标是(percentile*(点数-1)+99)/100，50即中值。读的都是滤波前的图像
+    //region这块里mask为0的点按原来的颜色重新写一遍，和ImageFilters一样
+    void RankFilter(BmpImage &image,int size,int percentile);
+    void RankFilter(BmpImage &image,int size,int percentile,const ImageFilters::Region &region);
+    //原来界面上的中值滤波：按储存顺序一个点一个点地滤，结果马上写回，后面的点的窗口里用的是已经滤过的值
+    //窗口内点数为偶数时取靠上的那个。只有region这块里mask不为0的点会写
+    void MedianFilter(BmpImage &image,int size);
+    void MedianFilter(BmpImage &image,int size,const ImageFilters::Region &region);
+    //原来界面上的自适应中值滤波，规则见WindowFilter::AdaptiveMedianFilter，和MedianFilter一样就地滤
+    void AdaptiveMedianFilter(BmpImage &image,int maxSize);
+    void AdaptiveMedianFilter(BmpImage &image,int maxSize,const ImageFilters::Region &region);
+
+    //反复对整幅图做RankFilter的中值（不就地），直到不再变化或者做满maxPasses遍，返回做了几遍
+    //中间几遍的结果不经过调色板，同ImageFilters::IterativeMedianFilter
+    int IterativeMedianFilter(BmpImage &image,int size,int maxPasses);
+    //自动模式，分块、估计噪声、选滤波器同ImageFilters::AutoFilter，每块的中值、自适应中值读的都是滤波前的图像
+    //返回整幅图的噪声密度
+    double AutoFilter(BmpImage &image);
+
+    //逐个窗口直接算的MSE、PSNR、SSIM，定义同ImageMetrics::Compare。大小不一样返回SIZE_ERROR
+    int Compare(const BmpImage &image,const BmpImage &reference,ImageMetrics::Quality &quality);
+
+    //整个文件内容的64位FNV-1a校验和
+    unsigned long long Checksum(const BmpImage &image);
+
+    //生成一幅固定的24位测试图：平滑的渐变加上约一成的椒盐噪声，同样的参数每次生成的都一样
+    void MakeTestImage(int width,int height,unsigned int seed,BmpImage &image);
+}
+
+#endif // REFERENCE_FILTERS
@@ -0,0 +1,82 @@
+#include "temporal_filter.h"
+#include <cstring>
+
+namespace
+{
+    const size_t CHUNK_SIZE=4096;      //一次处理这么多个位置，count段加起来也能放进L1/L2
+}
+
+TemporalFilter::SlidingMedian::SlidingMedian()
+    : m_length(0),m_maxCount(0),m_count(0)
+{
+}
+
+void TemporalFilter::SlidingMedian::Reset(size_t length, int maxCount)
+{
+    m_length=length;
+    m_maxCount=maxCount;
+    m_count=0;
+    m_sorted.resize(length*maxCount);
+}
+
+void TemporalFilter::SlidingMedian::Add(const unsigned char *frame)
+{
+    int count=m_count;
+    for(size_t start=0;start<m_length;start+=CHUNK_SIZE)
+    {
+        size_t chunk=m_length-start<CHUNK_SIZE?m_length-start:CHUNK_SIZE;
+        const unsigned char *value=frame+start;
+
+        //插入v之后第k小的是max(s[k-1],min(v,s[k]))，s[-1]当作0，s[count]当作255。从大到小算，用到的都还是原来的值
+        unsigned char *top=&m_sorted[m_length*count+start];
+        if(count==0)
+            memcpy(top,value,chunk);
+        else
+        {
+            const unsigned char *below=top-m_length;
+            for(size_t i=0;i<chunk;i++)
+                top[i]=below[i]>value[i]?below[i]:value[i];
+        }
+        for(int k=count-1;k>=0;k--)
+        {
+            unsigned char *s=&m_sorted[m_length*k+start];
+            if(k==0)
+            {
+                for(size_t i=0;i<chunk;i++)
+                    s[i]=value[i]<s[i]?value[i]:s[i];
+                continue;
+            }
+            const unsigned char *below=s-m_length;
+            for(size_t i=0;i<chunk;i++)
+            {
+                unsigned char low=value[i]<s[i]?value[i]:s[i];
+                s[i]=below[i]>low?below[i]:low;
+            }
+        }
+    }
+    m_count++;
+}
+
+void TemporalFilter::SlidingMedian::Remove(const unsigned char *frame)
+{
+    for(size_t start=0;start<m_length;start+=CHUNK_SIZE)
+    {
+        size_t chunk=m_length-start<CHUNK_SIZE?m_length-start:CHUNK_SIZE;
+        const unsigned char *value=frame+start;
+
+        //删掉v之后第k小的是s[k]<v?s[k]:s[k+1]（前面比v小的不动，从v起往前挪一格）。从小到大算
+        for(int k=0;k+1<m_count;k++)
+        {
+            unsigned char *s=&m_sorted[m_length*k+start];
+            const unsigned char *above=s+m_length;
+            for(size_t i=0;i<chunk;i++)
+                s[i]=s[i]<value[i]?s[i]:above[i];
+        }
+    }
+    m_count--;
+}
+
+void TemporalFilter::SlidingMedian::Median(unsigned char *dst) const
+{
+    memcpy(dst,&m_sorted[m_length*(m_count/2)],m_length);
+}
@@ -0,0 +1,35 @@
+#ifndef TEMPORAL_FILTER
+#define TEMPORAL_FILTER
+
+#include <cstddef>
+#include <vector>
+
+//时间方向的滤波：同一场景连拍的多帧图像，对每个位置在各帧之间取中值
+namespace TemporalFilter
+{
+    //滑动的中值：每个位置上窗口里的各帧的值一直按从小到大存着。窗口往后滑一帧时只要删掉出去的那帧的值、
+    //插入进来的那帧的值，每个位置O(K)次比较，不用每帧都把K个值重新排一遍序
+    //第k小的值放在一整段里，删、插都是对一整段数组做min/max，编译器可以向量化；按块做，K段加起来能放进缓存
+    class SlidingMedian
+    {
+    public:
+        SlidingMedian();
+
+        //清空窗口，每帧length个字节，窗口里最多maxCount帧。只在这里分配内存
+        void Reset(size_t length,int maxCount);
+        void Add(const unsigned char *frame);
+        //frame的内容要和Add时一样，而且还在窗口里
+        void Remove(const unsigned char *frame);
+        int Count() const {return m_count;}
+        //窗口里各帧每个位置的中值（偶数个时取靠上的那个）存到dst，Count()不能为0
+        void Median(unsigned char *dst) const;
+
+    private:
+        size_t m_length;
+        int m_maxCount;
+        int m_count;
+        std::vector<unsigned char> m_sorted;    //第k小的值在m_sorted[k*m_length+i]
+    };
+}
+
+#endif // TEMPORAL_FILTER
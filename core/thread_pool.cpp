@@ -0,0 +1,301 @@
+#include "thread_pool.h"
+#include <cstdlib>
+#include <cstring>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+namespace
+{
+    const char THREADS_VARIABLE[]="DIP_THREADS";
+    const char PIN_VARIABLE[]="DIP_PIN_THREADS";
+
+    thread_local int threadIndex=0;
+    thread_local bool insideFor=false;      //正在做For的某一段，包括调用For的线程自己做第0段的时候
+    thread_local bool timing=false;         //这个线程干活的时间已经在外面一层记着了，里面再调用For时不重复算
+
+    //一个线程还没做的任务[begin,end)，放在一个64位整数里，取任务和偷任务都只要一次CAS
+    unsigned long long PackRange(int begin,int end)
+    {
+        return (unsigned long long)(unsigned int)begin<<32 | (unsigned int)end;
+    }
+    int RangeBegin(unsigned long long range) {return (int)(range>>32);}
+    int RangeEnd(unsigned long long range) {return (int)(range&0xffffffffu);}
+
+    //把当前线程绑到第cpu个核上，不支持的平台上什么都不做
+    void PinCurrentThread(int cpu)
+    {
+        int cpuCount=(int)std::thread::hardware_concurrency();
+        if(cpuCount<=0)
+            return;
+        cpu%=cpuCount;
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu,&set);
+        pthread_setaffinity_np(pthread_self(),sizeof(set),&set);
+#elif defined(_WIN32)
+        SetThreadAffinityMask(GetCurrentThread(),(DWORD_PTR)1<<cpu);
+#endif
+    }
+}
+
+ThreadPool &ThreadPool::Instance()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+ThreadPool::ThreadPool()
+    : m_threadCount(1),m_pinned(false),m_generation(0),m_stopping(false),m_body(0),m_count(0),m_chunks(0),m_pending(0)
+{
+    const char *threads=getenv(THREADS_VARIABLE);
+    const char *pin=getenv(PIN_VARIABLE);
+    this->Start(threads?atoi(threads):0,pin && strcmp(pin,"1")==0);
+}
+
+ThreadPool::~ThreadPool()
+{
+    this->Stop();
+}
+
+void ThreadPool::Configure(int threads, bool pin)
+{
+    //拿着m_runMutex，别的线程的For要么已经做完，要么在自己的线程里做（只读m_threadCount、在m_mutex里记统计）
+    std::lock_guard<std::mutex> running(m_runMutex);
+    this->Stop();
+    this->Start(threads,pin);
+}
+
+int ThreadPool::ThreadIndex()
+{
+    return threadIndex;
+}
+
+void ThreadPool::Start(int threads, bool pin)
+{
+    if(threads<=0)
+        threads=(int)std::thread::hardware_concurrency();
+    if(threads<=0)
+        threads=1;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_threadCount=threads;
+        m_pinned=pin;
+        m_stopping=false;
+        m_stats.assign(threads,ThreadStats());
+        for(int i=0;i<threads;i++)
+        {
+            m_stats[i].busySeconds=0;
+            m_stats[i].tasks=0;
+            m_stats[i].stolen=0;
+        }
+        m_statsStart=std::chrono::steady_clock::now();
+    }
+
+    for(int i=1;i<threads;i++)      //第0段由调用For的线程自己做
+        m_workers.push_back(std::thread(&ThreadPool::WorkerLoop,this,i,m_generation));
+}
+
+void ThreadPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping=true;
+    }
+    m_wake.notify_all();
+    for(size_t i=0;i<m_workers.size();i++)
+        m_workers[i].join();
+    m_workers.clear();
+}
+
+void ThreadPool::WorkerLoop(int index, long long seen)
+{
+    threadIndex=index;
+    if(m_pinned)
+        PinCurrentThread(index);
+
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while(!m_stopping && m_generation==seen)
+                m_wake.wait(lock);
+            if(m_stopping)
+                return;
+            seen=m_generation;
+        }
+
+        if(index<m_chunks)
+            this->RunChunk(index);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(--m_pending==0)
+            m_done.notify_one();
+    }
+}
+
+void ThreadPool::RunChunk(int index)
+{
+    int begin=(int)((long long)m_count*index/m_chunks);
+    int end=(int)((long long)m_count*(index+1)/m_chunks);
+    bool wasInside=insideFor;
+    insideFor=true;
+    this->Timed(index,[&](){(*m_body)(begin,end);});
+    insideFor=wasInside;
+}
+
+void ThreadPool::Timed(int index, const std::function<void()> &work)
+{
+    bool outer=!timing;
+    timing=true;
+    std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+    work();
+    std::chrono::duration<double> busy=std::chrono::steady_clock::now()-start;
+    timing=!outer;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(index<(int)m_stats.size())       //不在线程池里的线程记在第0个上；Configure之后线程少了的也不越界
+    {
+        if(outer)
+            m_stats[index].busySeconds+=busy.count();
+        m_stats[index].tasks++;
+    }
+}
+
+void ThreadPool::Run(int count, int grain, const std::function<void(int,int)> &body)
+{
+    if(count<=0)
+        return;
+    if(grain<1)
+        grain=1;
+
+    //在For的某一段里又调用For、别的线程正在用线程池、或者只有一段时，就在当前线程里做，照样记统计
+    //段数要拿到m_runMutex之后再按线程数算，免得中间被Configure改了
+    std::unique_lock<std::mutex> running(m_runMutex,std::defer_lock);
+    if(!insideFor)
+        running.try_lock();
+    int threads=m_threadCount;
+    int chunks=threads<count/grain?threads:count/grain;
+    if(!running.owns_lock() || chunks<=1)
+    {
+        if(running.owns_lock())
+            running.unlock();
+        this->Timed(threadIndex,[&](){body(0,count);});
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_body=&body;
+        m_count=count;
+        m_chunks=chunks;
+        m_pending=(int)m_workers.size();
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    this->RunChunk(0);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(m_pending>0)
+        m_done.wait(lock);
+    m_body=0;
+}
+
+void ThreadPool::RunTasks(int count, const std::function<void(int)> &body)
+{
+    if(count<=0)
+        return;
+    int threads=m_threadCount;
+    int slots=threads<count?threads:count;
+    std::vector<std::atomic<unsigned long long> > ranges(slots);
+    std::vector<long long> stolen(slots,0);
+    for(int i=0;i<slots;i++)
+        ranges[i]=PackRange((int)((long long)count*i/slots),(int)((long long)count*(i+1)/slots));
+
+    //第i段在第i个线程上做，self就是这个线程的那份任务。Configure之后线程少了时一个线程会分到几段，
+    //只从第一段开始做，别的段靠偷，照样都能做完
+    this->Run(slots,1,[&](int begin,int end){
+        if(begin==0 && end==slots)  //没有分给线程池（在For里又调用、或者线程池正忙），全在当前线程里做
+        {
+            for(int task=0;task<count;task++)
+                body(task);
+            return;
+        }
+
+        int self=begin;
+        for(;;)
+        {
+            //先从自己那段的前面取
+            unsigned long long range=ranges[self].load();
+            while(RangeBegin(range)<RangeEnd(range))
+            {
+                if(ranges[self].compare_exchange_weak(range,PackRange(RangeBegin(range)+1,RangeEnd(range))))
+                {
+                    body(RangeBegin(range));
+                    range=ranges[self].load();
+                }
+            }
+
+            //自己的做完了，从剩得最多的那个线程的后面偷一半。都没剩了就结束
+            int victim=-1;
+            int most=0;
+            for(int i=0;i<slots;i++)
+            {
+                unsigned long long other=ranges[i].load();
+                if(i!=self && RangeEnd(other)-RangeBegin(other)>most)
+                {
+                    victim=i;
+                    most=RangeEnd(other)-RangeBegin(other);
+                }
+            }
+            if(victim<0)
+                return;
+            unsigned long long other=ranges[victim].load();
+            int otherBegin=RangeBegin(other);
+            int otherEnd=RangeEnd(other);
+            if(otherBegin>=otherEnd)
+                continue;
+            int middle=otherBegin+(otherEnd-otherBegin)/2;
+            if(ranges[victim].compare_exchange_strong(other,PackRange(otherBegin,middle)))
+            {
+                stolen[self]+=otherEnd-middle;
+                ranges[self]=PackRange(middle,otherEnd);
+            }
+        }
+    });
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(int i=0;i<slots && i<(int)m_stats.size();i++)
+        m_stats[i].stolen+=stolen[i];
+}
+
+std::vector<ThreadPool::ThreadStats> ThreadPool::Statistics() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+double ThreadPool::ElapsedSeconds() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-m_statsStart;
+    return elapsed.count();
+}
+
+void ThreadPool::ResetStatistics()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(size_t i=0;i<m_stats.size();i++)
+    {
+        m_stats[i].busySeconds=0;
+        m_stats[i].tasks=0;
+        m_stats[i].stolen=0;
+    }
+    m_statsStart=std::chrono::steady_clock::now();
+}
@@ -0,0 +1,89 @@
+#ifndef THREAD_POOL
+#define THREAD_POOL
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <atomic>
+
+//整个进程共用的线程池，滤波、bmp的编解码、批处理都用它
+//线程数和是否绑核可以用环境变量DIP_THREADS、DIP_PIN_THREADS=1设置，dip_batch还可以用-threads、-pin
+//For把[0,count)平均切成几段，第i段总是由第i个线程做（第0个是调用For的线程），
+//所以按同样的切法第一次写内存（FilterScratch::Reserve里就是这样），每段的内存就在做它的那个线程所在的NUMA节点上
+class ThreadPool
+{
+public:
+    //第一次调用时按环境变量创建
+    static ThreadPool &Instance();
+
+    //threads<=0时用CPU的核数。pin为true时第i个工作线程绑在第i个核上。会等正在做的For做完再换，
+    //同时别的线程调用的For在它们自己的线程里做。不能在For的body里调用（会等自己做完，死锁）
+    void Configure(int threads,bool pin);
+    int ThreadCount() const {return m_threadCount;}
+    bool IsPinned() const {return m_pinned;}
+
+    //body(begin,end)，每段至少grain个，count不够分时用的线程少一些。在线程池的线程里再调用For就直接在当前线程做
+    template<class Body>
+    void For(int count,int grain,const Body &body)
+    {
+        this->Run(count,grain,std::function<void(int,int)>(body));
+    }
+    //每个任务代价差别很大时用：body(task)对[0,count)里的每个task各调用一次。开始时同样按线程平均分成连续的几段，
+    //每个线程从自己那段的前面取任务，做完了就从剩得最多的线程那段的后面偷一半过来，不会有线程早早闲着
+    template<class Body>
+    void ForEachTask(int count,const Body &body)
+    {
+        this->RunTasks(count,std::function<void(int)>(body));
+    }
+    //当前线程在线程池里的编号，不是线程池里的线程（包括没有在For里的调用者）为0
+    static int ThreadIndex();
+
+    //每个线程的统计：在For里干活的时间、做了几段。没有分给线程池、在调用的线程里直接做的For也算，
+    //不在线程池里的线程算在第0个上；For里又调用For时时间只算外面那层
+    struct ThreadStats
+    {
+        double busySeconds;
+        long long tasks;
+        long long stolen;       //ForEachTask里从别的线程偷来的任务数
+    };
+    std::vector<ThreadStats> Statistics() const;
+    double ElapsedSeconds() const;          //从上次ResetStatistics（或者创建、Configure）到现在
+    void ResetStatistics();
+
+private:
+    ThreadPool();
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &);
+    ThreadPool &operator=(const ThreadPool &);
+
+    void Run(int count,int grain,const std::function<void(int,int)> &body);
+    void RunTasks(int count,const std::function<void(int)> &body);
+    void Start(int threads,bool pin);
+    void Stop();
+    void WorkerLoop(int index,long long seen);    //seen是创建时的任务编号，只做比它新的任务
+    void RunChunk(int index);
+    void Timed(int index,const std::function<void()> &work);     //做work，时间、段数记到第index个线程的统计里
+
+    std::atomic<int> m_threadCount;         //For不拿m_runMutex就在自己的线程里做时也要读，Configure同时在改
+    std::atomic<bool> m_pinned;
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_runMutex;                  //同一时间只做一个For，别的线程同时调用时在自己的线程里做
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;         //有新任务或者要退出了
+    std::condition_variable m_done;         //一个任务的各段都做完了
+    long long m_generation;                 //每发一个任务加1
+    bool m_stopping;
+    const std::function<void(int,int)> *m_body;
+    int m_count;
+    int m_chunks;
+    int m_pending;
+
+    std::vector<ThreadStats> m_stats;
+    std::chrono::steady_clock::time_point m_statsStart;
+};
+
+#endif // THREAD_POOL
@@ -0,0 +1,686 @@
+#include "window_filter.h"
+#include "filter_scratch.h"
+#include <algorithm>
+#include <atomic>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <cstring>
+
+namespace
+{
+    struct MinOp
+    {
+        static const unsigned char padding=255;     //边界外补的值，不会影响结果
+        static unsigned char Apply(unsigned char a,unsigned char b){return a<b?a:b;}
+    };
+
+    struct MaxOp
+    {
+        static const unsigned char padding=0;
+        static unsigned char Apply(unsigned char a,unsigned char b){return a>b?a:b;}
+    };
+
+    //van Herk/Gil-Werman：把补齐后的序列按size分块，g是块内前缀，h是块内后缀
+    //以x开头、长为size的窗口最多跨在相邻的两块上，结果就是h[x]和g[x+size-1]再比一次
+    //这里的“一个元素”是一整行（length个字节），这样整行一起算，编译器好向量化
+    template<class Op>
+    void VanHerkColumns(const unsigned char *src,unsigned char *dst,int count,int length,int size,
+                        unsigned char *g,unsigned char *h,const unsigned char *pad)
+    {
+        int radius=size/2;
+        int paddedCount=count+2*radius;
+
+        for(int i=0;i<paddedCount;i++)
+        {
+            const unsigned char *in=(i<radius || i>=count+radius)?pad:src+(size_t)(i-radius)*length;
+            unsigned char *out=g+(size_t)i*length;
+            if(i%size==0)
+                memcpy(out,in,length);
+            else
+            {
+                const unsigned char *prev=out-length;
+                for(int j=0;j<length;j++)
+                    out[j]=Op::Apply(prev[j],in[j]);
+            }
+        }
+        for(int i=paddedCount-1;i>=0;i--)
+        {
+            const unsigned char *in=(i<radius || i>=count+radius)?pad:src+(size_t)(i-radius)*length;
+            unsigned char *out=h+(size_t)i*length;
+            if(i%size==size-1 || i==paddedCount-1)
+                memcpy(out,in,length);
+            else
+            {
+                const unsigned char *next=out+length;
+                for(int j=0;j<length;j++)
+                    out[j]=Op::Apply(next[j],in[j]);
+            }
+        }
+        for(int i=0;i<count;i++)
+        {
+            const unsigned char *left=h+(size_t)i*length;
+            const unsigned char *right=g+(size_t)(i+size-1)*length;
+            unsigned char *out=dst+(size_t)i*length;
+            for(int j=0;j<length;j++)
+                out[j]=Op::Apply(left[j],right[j]);
+        }
+    }
+
+    //同样的算法，用在一行之内。line是补齐后的一行，长count+2*radius
+    template<class Op>
+    void VanHerkRow(const unsigned char *line,unsigned char *dst,int count,int size,
+                    unsigned char *g,unsigned char *h)
+    {
+        int paddedCount=count+size-1;
+
+        for(int i=0;i<paddedCount;i++)
+            g[i]=(i%size==0)?line[i]:Op::Apply(g[i-1],line[i]);
+        for(int i=paddedCount-1;i>=0;i--)
+            h[i]=(i%size==size-1 || i==paddedCount-1)?line[i]:Op::Apply(h[i+1],line[i]);
+        for(int i=0;i<count;i++)
+            dst[i]=Op::Apply(h[i],g[i+size-1]);
+    }
+
+    template<class Op>
+    void SeparableFilter(const unsigned char *src,unsigned char *dst,int width,int height,int size,
+                         FilterScratch &scratch)
+    {
+        int radius=size/2;
+        int longer=width>height?width:height;
+        unsigned char *temp=scratch.TempPlane();
+        unsigned char *g=scratch.PrefixRows();
+        unsigned char *h=scratch.SuffixRows();
+        unsigned char *pad=scratch.PadLine();
+        memset(pad,Op::padding,longer+2*radius);
+
+        //先做列方向，一个“元素”是一整行
+        VanHerkColumns<Op>(src,temp,height,width,size,g,h,pad);
+
+        //再做行方向，把每行拷进两头补好的pad里再算
+        for(int y=0;y<height;y++)
+        {
+            memcpy(pad+radius,temp+(size_t)y*width,width);
+            VanHerkRow<Op>(pad,dst+(size_t)y*width,width,size,g,h);
+        }
+    }
+
+    //把以(x,y)为中心、size x size的窗口落在图像内的部分拷到三个window里，返回点数
+    int GatherWindow(const unsigned char *const src[3],int width,int height,int x,int y,int size,
+                     unsigned char *const window[3])
+    {
+        int radius=size/2;
+        int top=y-radius<0?0:y-radius;
+        int bottom=y+radius>height-1?height-1:y+radius;
+        int left=x-radius<0?0:x-radius;
+        int right=x+radius>width-1?width-1:x+radius;
+        int length=right-left+1;
+        int count=0;
+
+        for(int row=top;row<=bottom;row++,count+=length)
+        {
+            size_t offset=(size_t)row*width+left;
+            for(int channel=0;channel<3;channel++)
+                memcpy(window[channel]+count,src[channel]+offset,length);
+        }
+        return count;
+    }
+
+    //宽图一行很长，7x7窗口的7行加起来放不进一级缓存，每个点都要从二级缓存甚至内存里取。
+    //所以把图竖着切成宽TileWidth的条，一条从上到下做完再做下一条，窗口里的几行就一直在一级缓存里
+    std::atomic<int> tileBytes(WindowFilter::DEFAULT_TILE_BYTES);
+
+    int TileWidth(int size)
+    {
+        int tileWidth=tileBytes.load(std::memory_order_relaxed)/size/64*64;
+        return tileWidth<64?64:tileWidth;
+    }
+
+    //马上要进窗口的那一行，先让CPU取到缓存里。row超出图像就什么都不做
+    void PrefetchRow(const unsigned char *src,int width,int height,int row,int left,int right)
+    {
+#if defined(__SSE2__)
+        if(row>=height)
+            return;
+        if(left<0)
+            left=0;
+        if(right>width)
+            right=width;
+        const char *line=(const char *)src+(size_t)row*width;
+        for(int x=left;x<right;x+=64)
+            _mm_prefetch(line+x,_MM_HINT_T0);
+#else
+        (void)src;(void)width;(void)height;(void)row;(void)left;(void)right;
+#endif
+    }
+
+    //位串行选择：结果是满足“窗口里比t小的点不超过rank个”的最大的t，从最高位起一位一位地定
+    //这里是一个点的版本，窗口是[top,bottom] x [left,right]
+    unsigned char BitSerialSelect(const unsigned char *src,int width,int top,int bottom,int left,int right,int rank)
+    {
+        int result=0;
+        for(int bit=128;bit>0;bit>>=1)
+        {
+            int trial=result|bit;
+            int less=0;
+            for(int row=top;row<=bottom;row++)
+            {
+                const unsigned char *line=src+(size_t)row*width;
+                for(int x=left;x<=right;x++)
+                    less+=line[x]<trial;
+            }
+            if(less<=rank)
+                result=trial;
+        }
+        return (unsigned char)result;
+    }
+
+    //第x列的点，窗口左右在图像边上截断
+    unsigned char BitSerialPixel(const unsigned char *src,int width,int top,int bottom,int x,int radius,int percentile)
+    {
+        int left=x-radius<0?0:x-radius;
+        int right=x+radius>width-1?width-1:x+radius;
+        int count=(bottom-top+1)*(right-left+1);
+        return BitSerialSelect(src,width,top,bottom,left,right,(percentile*(count-1)+99)/100);
+    }
+
+#if defined(__SSE2__)
+    //同样的算法，16个点一起做：每个点在一个字节里，比较、计数都是16路并行的
+    //first指向窗口第一行、第一个点左上角的那个点，窗口完全在图像内，每个点的rows*size个点里要求rank
+    void BitSerialSelect16(const unsigned char *first,int width,int rows,int size,int rank,unsigned char *dst)
+    {
+        const __m128i need=_mm_set1_epi8((char)(rows*size-rank));    //不小于t的点至少要有这么多
+        __m128i result=_mm_setzero_si128();
+        for(int bit=128;bit>0;bit>>=1)
+        {
+            __m128i trial=_mm_or_si128(result,_mm_set1_epi8((char)bit));
+            __m128i notLess=_mm_setzero_si128();
+            for(int row=0;row<rows;row++)
+            {
+                const unsigned char *line=first+(size_t)row*width;
+                for(int dx=0;dx<size;dx++)
+                {
+                    __m128i value=_mm_loadu_si128((const __m128i *)(line+dx));
+                    //value>=trial时是0xff，即-1，减掉就是加1
+                    notLess=_mm_sub_epi8(notLess,_mm_cmpeq_epi8(_mm_max_epu8(value,trial),value));
+                }
+            }
+            __m128i accept=_mm_cmpeq_epi8(_mm_max_epu8(notLess,need),notLess);
+            result=_mm_or_si128(result,_mm_and_si128(accept,_mm_set1_epi8((char)bit)));
+        }
+        _mm_storeu_si128((__m128i *)dst,result);
+    }
+#endif
+
+    //自适应滤波按行带做，一个行带的统计量（9个通道）加上标记大约这么大，能放进二级缓存
+    const int ADAPTIVE_BAND_BYTES=512*1024;
+    const int ADAPTIVE_MIN_BAND_ROWS=16;
+    const int ADAPTIVE_SPARSE_LIMIT=16;     //没定下来的点不到行带的1/16时逐点做
+
+    //自适应滤波对一个窗口大小的判断，count个点一起做，pending里0xff的点是还没定下来的：
+    //  中值严格介于最小值和最大值之间（A）时这个点就定了：当前点也严格介于两者之间（B）就保留当前点，否则取中值
+    //这里没有分支，A、B都算成每个点一个字节的掩码，用掩码把结果混合进去。返回还有几个点没定下来
+    size_t AdaptiveDecide(const unsigned char *const center[3],const unsigned char *const zmin[3],
+                        const unsigned char *const zmax[3],const unsigned char *const zmed[3],
+                        unsigned char *const out[3],unsigned char *pending,size_t count)
+    {
+        size_t i=0;
+        size_t left=0;
+#if defined(__SSE2__)
+        const __m128i zero=_mm_setzero_si128();
+        for(;i+16<=count;i+=16)
+        {
+            __m128i isPending=_mm_loadu_si128((const __m128i *)(pending+i));
+            __m128i medianInRange=_mm_cmpeq_epi8(zero,zero);
+            __m128i thisInRange=medianInRange;
+            __m128i center_[3],median_[3];
+            for(int channel=0;channel<3;channel++)
+            {
+                __m128i low=_mm_loadu_si128((const __m128i *)(zmin[channel]+i));
+                __m128i high=_mm_loadu_si128((const __m128i *)(zmax[channel]+i));
+                median_[channel]=_mm_loadu_si128((const __m128i *)(zmed[channel]+i));
+                center_[channel]=_mm_loadu_si128((const __m128i *)(center[channel]+i));
+                //a<b即b-a（饱和减法）不为0
+                medianInRange=_mm_andnot_si128(_mm_cmpeq_epi8(_mm_subs_epu8(median_[channel],low),zero),medianInRange);
+                medianInRange=_mm_andnot_si128(_mm_cmpeq_epi8(_mm_subs_epu8(high,median_[channel]),zero),medianInRange);
+                thisInRange=_mm_andnot_si128(_mm_cmpeq_epi8(_mm_subs_epu8(center_[channel],low),zero),thisInRange);
+                thisInRange=_mm_andnot_si128(_mm_cmpeq_epi8(_mm_subs_epu8(high,center_[channel]),zero),thisInRange);
+            }
+            __m128i decide=_mm_and_si128(isPending,medianInRange);
+            __m128i useMedian=_mm_andnot_si128(thisInRange,decide);
+            for(int channel=0;channel<3;channel++)
+            {
+                __m128i result=_mm_loadu_si128((const __m128i *)(out[channel]+i));
+                result=_mm_or_si128(_mm_and_si128(useMedian,median_[channel]),_mm_andnot_si128(useMedian,result));
+                _mm_storeu_si128((__m128i *)(out[channel]+i),result);
+            }
+            isPending=_mm_andnot_si128(medianInRange,isPending);
+            _mm_storeu_si128((__m128i *)(pending+i),isPending);
+            for(int mask=_mm_movemask_epi8(isPending);mask!=0;mask&=mask-1)
+                left++;
+        }
+#endif
+        for(;i<count;i++)
+        {
+            unsigned char medianInRange=0xff,thisInRange=0xff;
+            for(int channel=0;channel<3;channel++)
+            {
+                if(!(zmed[channel][i]>zmin[channel][i] && zmed[channel][i]<zmax[channel][i]))
+                    medianInRange=0;
+                if(!(center[channel][i]>zmin[channel][i] && center[channel][i]<zmax[channel][i]))
+                    thisInRange=0;
+            }
+            unsigned char useMedian=pending[i]&medianInRange&~thisInRange;
+            for(int channel=0;channel<3;channel++)
+                out[channel][i]=(unsigned char)((useMedian&zmed[channel][i])|(~useMedian&out[channel][i]));
+            pending[i]&=~medianInRange;
+            left+=pending[i]!=0;
+        }
+        return left;
+    }
+
+    //剩下没定下来的点不多时，一个一个地做：从firstSize的窗口开始，每个窗口求最小值、最大值、中值
+    void AdaptivePixel(const unsigned char *const src[3],unsigned char *const dst[3],int width,int height,
+                       int x,int y,int firstSize,int maxSize,unsigned char *const window[3])
+    {
+        size_t pos=(size_t)y*width+x;
+        for(int size=firstSize;size<=maxSize;size+=2)
+        {
+            int count=GatherWindow(src,width,height,x,y,size,window);
+            unsigned char low[3],median[3],high[3];
+            bool medianInRange=true,thisInRange=true;
+            for(int channel=0;channel<3;channel++)
+            {
+                unsigned char *values=window[channel];
+                std::nth_element(values,values+count/2,values+count);
+                median[channel]=values[count/2];
+                low[channel]=*std::min_element(values,values+count/2+1);
+                high[channel]=*std::max_element(values+count/2,values+count);
+                if(!(median[channel]>low[channel] && median[channel]<high[channel]))
+                    medianInRange=false;
+                if(!(src[channel][pos]>low[channel] && src[channel][pos]<high[channel]))
+                    thisInRange=false;
+            }
+            if(medianInRange)
+            {
+                if(!thisInRange)
+                {
+                    for(int channel=0;channel<3;channel++)
+                        dst[channel][pos]=median[channel];
+                }
+                return;
+            }
+        }
+    }
+
+    //变化的点或者要重新算的点超过整幅图的1/SPARSE_LIMIT时，这一遍直接整幅图滤
+    const int SPARSE_LIMIT=4;
+
+    //dst整幅图再做一遍中值滤波，变了的点记到changed里，返回变了几个点。mark进出时都是全0
+    ptrdiff_t FullMedianPass(unsigned char *const dst[3],int width,int height,int size,ptrdiff_t *changed,
+                             unsigned char *mark,FilterScratch &scratch)
+    {
+        size_t planeSize=(size_t)width*height;
+        unsigned char *temp=scratch.TempPlane();
+        for(int channel=0;channel<3;channel++)
+        {
+            WindowFilter::RankFilter(dst[channel],temp,width,height,size,50,scratch);
+            unsigned char *plane=dst[channel];
+            for(size_t i=0;i<planeSize;i++)
+            {
+                if(temp[i]!=plane[i])
+                {
+                    mark[i]=1;
+                    plane[i]=temp[i];
+                }
+            }
+        }
+
+        ptrdiff_t changedCount=0;
+        for(size_t i=0;i<planeSize;i++)
+        {
+            if(mark[i])
+            {
+                changed[changedCount++]=(ptrdiff_t)i;
+                mark[i]=0;
+            }
+        }
+        return changedCount;
+    }
+
+    //只重新计算窗口里有changed的点的那些点，返回新的变化点数；候选点太多时放弃，返回-1，图像不变
+    ptrdiff_t SparseMedianPass(unsigned char *const dst[3],int width,int height,int size,ptrdiff_t *changed,ptrdiff_t changedCount,
+                               ptrdiff_t *candidates,ptrdiff_t *values,unsigned char *mark,FilterScratch &scratch)
+    {
+        int radius=size/2;
+        ptrdiff_t candidateLimit=(ptrdiff_t)((size_t)width*height/SPARSE_LIMIT);
+        ptrdiff_t candidateCount=0;
+        for(ptrdiff_t i=0;i<changedCount && candidateCount<=candidateLimit;i++)
+        {
+            int x=(int)(changed[i]%width);
+            int y=(int)(changed[i]/width);
+            int top=y-radius<0?0:y-radius;
+            int bottom=y+radius>height-1?height-1:y+radius;
+            int left=x-radius<0?0:x-radius;
+            int right=x+radius>width-1?width-1:x+radius;
+            for(int row=top;row<=bottom;row++)
+            {
+                for(int column=left;column<=right;column++)
+                {
+                    ptrdiff_t pos=(ptrdiff_t)row*width+column;
+                    if(!mark[pos])
+                    {
+                        mark[pos]=1;
+                        candidates[candidateCount++]=pos;
+                    }
+                }
+            }
+        }
+
+        if(candidateCount>candidateLimit)
+        {
+            for(ptrdiff_t i=0;i<candidateCount;i++)
+                mark[candidates[i]]=0;
+            return -1;
+        }
+
+        //先按这一遍开始时的图像把所有候选点算完，再一起写回去
+        unsigned char *window[3]={scratch.Window(0),scratch.Window(1),scratch.Window(2)};
+        for(ptrdiff_t i=0;i<candidateCount;i++)
+        {
+            int count=GatherWindow(dst,width,height,(int)(candidates[i]%width),(int)(candidates[i]/width),size,window);
+            int value=0;
+            for(int channel=0;channel<3;channel++)
+            {
+                std::nth_element(window[channel],window[channel]+count/2,window[channel]+count);
+                value|=window[channel][count/2]<<(8*channel);
+            }
+            values[i]=value;
+        }
+
+        ptrdiff_t newCount=0;
+        for(ptrdiff_t i=0;i<candidateCount;i++)
+        {
+            ptrdiff_t pos=candidates[i];
+            mark[pos]=0;
+            bool isChanged=false;
+            for(int channel=0;channel<3;channel++)
+            {
+                unsigned char value=(unsigned char)(values[i]>>(8*channel));
+                if(dst[channel][pos]!=value)
+                {
+                    dst[channel][pos]=value;
+                    isChanged=true;
+                }
+            }
+            if(isChanged)
+                changed[newCount++]=pos;
+        }
+        return newCount;
+    }
+}
+
+void WindowFilter::MinFilter(const unsigned char *src,unsigned char *dst,int width,int height,int size,
+                             FilterScratch &scratch)
+{
+    SeparableFilter<MinOp>(src,dst,width,height,size,scratch);
+}
+
+void WindowFilter::MaxFilter(const unsigned char *src,unsigned char *dst,int width,int height,int size,
+                             FilterScratch &scratch)
+{
+    SeparableFilter<MaxOp>(src,dst,width,height,size,scratch);
+}
+
+//窗口往右移一格时，只要把移出去的一列从直方图里减掉、把移进来的一列加上
+//另外维护一个16格的粗直方图，找第k个数的时候先在粗直方图上定位，再到细直方图的16格里找
+void WindowFilter::RankFilter(const unsigned char *src,unsigned char *dst,int width,int height,
+                              int size,int percentile,FilterScratch &scratch)
+{
+#if defined(__SSE2__)
+    if(size<=BIT_SERIAL_MAX_SIZE)
+    {
+        BitSerialRankFilter(src,dst,width,height,size,percentile);
+        return;
+    }
+#endif
+    HistogramRankFilter(src,dst,width,height,size,percentile,scratch);
+}
+
+void WindowFilter::SetTileBytes(int bytes)
+{
+    tileBytes.store(bytes,std::memory_order_relaxed);
+}
+
+int WindowFilter::TileBytes()
+{
+    return tileBytes.load(std::memory_order_relaxed);
+}
+
+void WindowFilter::HistogramRankFilter(const unsigned char *src,unsigned char *dst,int width,int height,
+                                       int size,int percentile,FilterScratch &scratch)
+{
+    int radius=size/2;
+    int *histogram=scratch.Histogram();
+    int *coarse=scratch.CoarseHistogram();
+    int tileWidth=TileWidth(size);
+
+    for(int tileLeft=0;tileLeft<width;tileLeft+=tileWidth)
+    {
+        int tileRight=tileLeft+tileWidth>width?width:tileLeft+tileWidth;
+        for(int y=0;y<height;y++)
+        {
+            int top=y-radius<0?0:y-radius;
+            int bottom=y+radius>height-1?height-1:y+radius;
+            int rows=bottom-top+1;
+            const unsigned char *firstRow=src+(size_t)top*width;
+            PrefetchRow(src,width,height,y+radius+1,tileLeft-radius,tileRight+radius);
+
+            memset(histogram,0,256*sizeof(int));      //每行清一次，不是每个点
+            memset(coarse,0,16*sizeof(int));
+            int initLeft=tileLeft-radius<0?0:tileLeft-radius;
+            for(int x=initLeft;x<=tileLeft+radius && x<width;x++)
+            {
+                for(int i=0;i<rows;i++)
+                {
+                    unsigned char v=firstRow[(size_t)i*width+x];
+                    histogram[v]++;
+                    coarse[v>>4]++;
+                }
+            }
+
+            for(int x=tileLeft;x<tileRight;x++)
+            {
+                if(x>tileLeft)
+                {
+                    if(x+radius<width)              //新进来的一列
+                    {
+                        for(int i=0;i<rows;i++)
+                        {
+                            unsigned char v=firstRow[(size_t)i*width+x+radius];
+                            histogram[v]++;
+                            coarse[v>>4]++;
+                        }
+                    }
+                    if(x-radius-1>=0)               //移出去的一列
+                    {
+                        for(int i=0;i<rows;i++)
+                        {
+                            unsigned char v=firstRow[(size_t)i*width+x-radius-1];
+                            histogram[v]--;
+                            coarse[v>>4]--;
+                        }
+                    }
+                }
+
+                int left=x-radius<0?0:x-radius;
+                int right=x+radius>width-1?width-1:x+radius;
+                int count=rows*(right-left+1);
+                int rank=(percentile*(count-1)+99)/100;     //排好序之后的下标，向上取整
+
+                int bin=0;
+                while(rank>=coarse[bin])
+                    rank-=coarse[bin++];
+                int value=bin<<4;
+                while(rank>=histogram[value])
+                    rank-=histogram[value++];
+                dst[(size_t)y*width+x]=(unsigned char)value;
+            }
+        }
+    }
+}
+
+size_t WindowFilter::AdaptiveStatSize(int width, int height, int maxSize)
+{
+    //AdaptiveMedianRows里行带的行数是ADAPTIVE_BAND_BYTES/(10*宽)，至少ADAPTIVE_MIN_BAND_ROWS行，再加上下的窗口半径，
+    //不超过图像的高；宽小一些的图，行带行数乘宽也不会超过这个
+    size_t band=(size_t)ADAPTIVE_BAND_BYTES>(size_t)10*ADAPTIVE_MIN_BAND_ROWS*width?
+                (size_t)ADAPTIVE_BAND_BYTES:(size_t)10*ADAPTIVE_MIN_BAND_ROWS*width;
+    size_t size=band+(size_t)10*(maxSize/2*2)*width;
+    size_t whole=(size_t)10*width*height;
+    return size<whole?size:whole;
+}
+
+void WindowFilter::AdaptiveMedianFilter(const unsigned char *const src[3],unsigned char *const dst[3],
+                                        int width,int height,int maxSize,FilterScratch &scratch)
+{
+    AdaptiveMedianRows(src,dst,width,height,0,height,maxSize,scratch);
+}
+
+void WindowFilter::AdaptiveMedianRows(const unsigned char *const src[3],unsigned char *const dst[3],
+                                      int width,int height,int firstRow,int lastRow,int maxSize,FilterScratch &scratch)
+{
+    int maxRadius=maxSize/2;
+    int bandRows=ADAPTIVE_BAND_BYTES/(10*width);
+    if(bandRows<ADAPTIVE_MIN_BAND_ROWS)
+        bandRows=ADAPTIVE_MIN_BAND_ROWS;
+    if(bandRows>lastRow-firstRow)
+        bandRows=lastRow-firstRow;
+    int capacity=bandRows+2*maxRadius>height?height:bandRows+2*maxRadius;
+
+    //每个通道的最小值、最大值、中值，和还没定下来的点的标记（0xff是没定）
+    size_t statPlane=(size_t)capacity*width;
+    unsigned char *stats=scratch.StatPlanes();
+    unsigned char *low[3],*high[3],*median[3];
+    for(int channel=0;channel<3;channel++)
+    {
+        low[channel]=stats+statPlane*channel;
+        high[channel]=stats+statPlane*(3+channel);
+        median[channel]=stats+statPlane*(6+channel);
+    }
+    unsigned char *pending=stats+statPlane*9;
+
+    for(int bandTop=firstRow;bandTop<lastRow;bandTop+=bandRows)
+    {
+        int bandBottom=bandTop+bandRows>lastRow?lastRow:bandTop+bandRows;
+        size_t bandOffset=(size_t)bandTop*width;
+        size_t bandSize=(size_t)(bandBottom-bandTop)*width;
+
+        //默认保留当前点
+        for(int channel=0;channel<3;channel++)
+            memcpy(dst[channel]+bandOffset,src[channel]+bandOffset,bandSize);
+        memset(pending,0xff,bandSize);
+
+        for(int size=3;size<=maxSize;size+=2)
+        {
+            //[first,last)当成一幅小图整行整行地算统计量，行带里的点的窗口都是完整的（或者在图像边上截断）
+            //只多算当前窗口半径那么多行，行带很窄（并行时的小块）时多算的也不多
+            int first=bandTop-size/2<0?0:bandTop-size/2;
+            int last=bandBottom+size/2>height?height:bandBottom+size/2;
+            size_t statOffset=(size_t)(bandTop-first)*width;      //行带在统计量里的位置
+            for(int channel=0;channel<3;channel++)
+            {
+                const unsigned char *rows=src[channel]+(size_t)first*width;
+                MinFilter(rows,low[channel],width,last-first,size,scratch);
+                MaxFilter(rows,high[channel],width,last-first,size,scratch);
+                RankFilter(rows,median[channel],width,last-first,size,50,scratch);
+            }
+
+            const unsigned char *center[3]={src[0]+bandOffset,src[1]+bandOffset,src[2]+bandOffset};
+            unsigned char *out[3]={dst[0]+bandOffset,dst[1]+bandOffset,dst[2]+bandOffset};
+            const unsigned char *zmin[3]={low[0]+statOffset,low[1]+statOffset,low[2]+statOffset};
+            const unsigned char *zmax[3]={high[0]+statOffset,high[1]+statOffset,high[2]+statOffset};
+            const unsigned char *zmed[3]={median[0]+statOffset,median[1]+statOffset,median[2]+statOffset};
+            size_t left=AdaptiveDecide(center,zmin,zmax,zmed,out,pending,bandSize);
+            if(left==0)
+                break;          //这个行带的点都定下来了，不用再加大窗口
+
+            //剩下的点很少时，整行整行地再算一遍大窗口不划算，逐点做完
+            if(left*ADAPTIVE_SPARSE_LIMIT<bandSize)
+            {
+                unsigned char *window[3]={scratch.Window(0),scratch.Window(1),scratch.Window(2)};
+                for(size_t i=0;i<bandSize;i++)
+                {
+                    if(pending[i])
+                        AdaptivePixel(src,dst,width,height,(int)(i%width),bandTop+(int)(i/width),size+2,maxSize,window);
+                }
+                break;
+            }
+        }
+    }
+}
+
+int WindowFilter::IterativeMedianFilter(const unsigned char *const src[3],unsigned char *const dst[3],
+                                        int width,int height,int size,int maxPasses,FilterScratch &scratch)
+{
+    size_t planeSize=(size_t)width*height;
+    ptrdiff_t *changed=scratch.PixelLists();
+    ptrdiff_t *candidates=changed+planeSize;
+    ptrdiff_t *values=candidates+planeSize;
+    unsigned char *mark=scratch.MarkPlane();
+
+    //第一遍
+    for(int channel=0;channel<3;channel++)
+        RankFilter(src[channel],dst[channel],width,height,size,50,scratch);
+    ptrdiff_t changedCount=0;
+    for(size_t i=0;i<planeSize;i++)
+    {
+        if(dst[0][i]!=src[0][i] || dst[1][i]!=src[1][i] || dst[2][i]!=src[2][i])
+            changed[changedCount++]=(ptrdiff_t)i;
+    }
+
+    int passes=1;
+    while(changedCount>0 && passes<maxPasses)
+    {
+        passes++;
+        ptrdiff_t sparseCount=-1;
+        if((size_t)changedCount<=planeSize/SPARSE_LIMIT)
+            sparseCount=SparseMedianPass(dst,width,height,size,changed,changedCount,candidates,values,mark,scratch);
+        changedCount=sparseCount>=0?sparseCount:FullMedianPass(dst,width,height,size,changed,mark,scratch);
+    }
+    return passes;
+}
+
+void WindowFilter::BitSerialRankFilter(const unsigned char *src,unsigned char *dst,int width,int height,
+                                       int size,int percentile)
+{
+    int radius=size/2;
+    int tileWidth=TileWidth(size);
+
+    for(int tileLeft=0;tileLeft<width;tileLeft+=tileWidth)
+    {
+        int tileRight=tileLeft+tileWidth>width?width:tileLeft+tileWidth;
+        for(int y=0;y<height;y++)
+        {
+            int top=y-radius<0?0:y-radius;
+            int bottom=y+radius>height-1?height-1:y+radius;
+            int rows=bottom-top+1;
+            unsigned char *out=dst+(size_t)y*width;
+            PrefetchRow(src,width,height,y+radius+1,tileLeft-radius,tileRight+radius);
+
+            int x=tileLeft;
+#if defined(__SSE2__)
+            //窗口左右都不出界的点，窗口大小一样，16个一组；图像左边的几个点单独做
+            int rank=(percentile*(rows*size-1)+99)/100;
+            int simdLeft=tileLeft>radius?tileLeft:radius;
+            int simdRight=tileRight<width-radius?tileRight:width-radius;
+            for(;x<simdLeft && x<tileRight;x++)
+                out[x]=BitSerialPixel(src,width,top,bottom,x,radius,percentile);
+            for(;x+16<=simdRight;x+=16)
+                BitSerialSelect16(src+(size_t)top*width+x-radius,width,rows,size,rank,out+x);
+#endif
+            for(;x<tileRight;x++)
+                out[x]=BitSerialPixel(src,width,top,bottom,x,radius,percentile);
+        }
+    }
+}
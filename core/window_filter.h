@@ -0,0 +1,65 @@
+#ifndef WINDOW_FILTER
+#define WINDOW_FILTER
+
+#include <cstddef>
+
+class FilterScratch;
+
+//基于滑动窗口的快速滤波引擎。处理单个通道：每像素一个字节，一行width个字节，行与行紧挨着存
+//边界处只用落在图像内的那部分窗口（和原来中值滤波的处理一样），src和dst不能是同一块内存
+//临时内存都从scratch里拿，scratch要事先按这幅图和窗口大小Reserve过
+namespace WindowFilter
+{
+    //van Herk/Gil-Werman算法，行、列分开做，每个像素只需常数次比较，与窗口大小无关
+    void MinFilter(const unsigned char *src,unsigned char *dst,int width,int height,int size,
+                   FilterScratch &scratch);
+    void MaxFilter(const unsigned char *src,unsigned char *dst,int width,int height,int size,
+                   FilterScratch &scratch);
+
+    //求窗口内的第percentile百分位数，percentile取0-100
+    //0即最小值，100即最大值，50即中值（窗口内点数为偶数时取靠上的那个）
+    //按窗口大小在下面两种实现里选快的那个，分界是BIT_SERIAL_MAX_SIZE（用dip_batch -benchmark量出来的）
+    void RankFilter(const unsigned char *src,unsigned char *dst,int width,int height,
+                    int size,int percentile,FilterScratch &scratch);
+    //直方图滑动窗口（Huang算法），每个点的开销和窗口边长成正比
+    void HistogramRankFilter(const unsigned char *src,unsigned char *dst,int width,int height,
+                             int size,int percentile,FilterScratch &scratch);
+    //位串行：从最高位起每次定一位，数窗口里比试探值小的点有几个。一行里16个点放在SIMD的16个字节里一起比较、计数，
+    //每个点的开销是8*size*size次比较除以16，小窗口时最快。不用临时内存
+    void BitSerialRankFilter(const unsigned char *src,unsigned char *dst,int width,int height,
+                             int size,int percentile);
+    //不超过这么大的窗口用位串行。1024x1024的图上3x3、5x5、7x7都比直方图快（约5.5倍、2.5倍、1.4倍）；
+    //计数用的是8位，窗口最多255个点
+    const int BIT_SERIAL_MAX_SIZE=7;
+
+    //上面两种实现把宽图竖着切成条，一条里窗口的那几行占这么多字节，默认是一级缓存的三分之一左右
+    //只影响速度，不影响结果（dip_batch -tile、-verify）。不要在别的线程正在滤波时改。
+    //InPlaceFilter的中值、自适应不用它，原因见那边
+    const int DEFAULT_TILE_BYTES=16*1024;
+    void SetTileBytes(int bytes);
+    int TileBytes();
+
+    //自适应中值滤波，r、g、b三个通道一起判断。窗口从3x3开始：
+    //  中值严格介于最小值和最大值之间时，若当前点也严格介于两者之间就保留当前点，否则取中值；
+    //  中值不在范围内就把窗口加大2，超过maxSize时保留当前点
+    //src、dst都是三个通道的数组
+    //按行带做：每种窗口大小先用van Herk和位串行引擎把整行整行的最小值、最大值、中值算出来，
+    //再用SIMD掩码一次判断16个点；一个行带里的点都定下来了就不再加大窗口
+    //scratch要有SEPARABLE，还要事先ReserveStatPlanes(AdaptiveStatSize(...))
+    void AdaptiveMedianFilter(const unsigned char *const src[3],unsigned char *const dst[3],
+                              int width,int height,int maxSize,FilterScratch &scratch);
+    //同上，只算dst的[firstRow,lastRow)这几行，窗口仍然取整幅图的。几个线程可以同时算不同的行
+    void AdaptiveMedianRows(const unsigned char *const src[3],unsigned char *const dst[3],
+                            int width,int height,int firstRow,int lastRow,int maxSize,FilterScratch &scratch);
+    //不超过width x height的图做自适应滤波时一个行带的统计量要多少字节
+    size_t AdaptiveStatSize(int width,int height,int maxSize);
+
+    //反复做size x size的中值滤波，直到图像不再变化或者做满maxPasses遍，返回做了几遍。r、g、b三个通道一起判断
+    //第一遍滤整幅图，之后只重新计算窗口里有上一遍变过的点的那些点，其他点的窗口没变，结果也不会变；
+    //变化的点太多时还是整幅图滤一遍更快。结果和每遍都对整幅图滤波一样。scratch要有PIXEL_LISTS
+    //src、dst两块轮流用，一遍里的点读的都是上一遍的值，和InPlaceFilter按顺序就地滤不同
+    int IterativeMedianFilter(const unsigned char *const src[3],unsigned char *const dst[3],
+                              int width,int height,int size,int maxPasses,FilterScratch &scratch);
+}
+
+#endif // WINDOW_FILTER
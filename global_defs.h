@@ -1,7 +0,0 @@
-#ifndef GLOBAL_DEFS
-#define GLOBAL_DEFS
-
-const int FORMAT_ERROR=1;
-
-#endif // GLOBAL_DEFS
-
@@ -0,0 +1,92 @@
+#include "image_loader.h"
+#include "bmp_image.h"
+#include "bmp_rle.h"
+#include "global_defs.h"
+#include <QFile>
+#include <vector>
+#include <cstring>
+
+namespace
+{
+    const qint64 BAND_BYTES=4*1024*1024;     //每段大约读这么多字节
+}
+
+ImageLoader::ImageLoader(QString fileName, BmpImage *image, QObject *parent)
+    : QThread(parent),m_fileName(fileName),m_image(image)
+{
+}
+
+void ImageLoader::run()
+{
+    QFile file(m_fileName);
+    if(!file.open(QFile::ReadOnly) || !file.seek(m_image->OffBits()))
+    {
+        emit loadFailed();
+        return;
+    }
+
+    if(m_image->Compression()!=BMP_RGB)
+    {
+        this->LoadCompressed(file);
+        return;
+    }
+
+    int height=m_image->Height();
+    qint64 rowStride=m_image->RowStride();
+    int bandRows=(int)(BAND_BYTES/rowStride);
+    if(bandRows<1)
+        bandRows=1;
+
+    //像素在文件里是一行接一行存的，内存里也一样，所以一段可以一次读进来
+    for(int firstRow=0;firstRow<height;firstRow+=bandRows)
+    {
+        if(isInterruptionRequested())
+            return;
+
+        int rowCount=height-firstRow<bandRows?height-firstRow:bandRows;
+        if(file.read((char *)m_image->Row(firstRow),rowCount*rowStride)!=rowCount*rowStride)
+        {
+            emit loadFailed();
+            return;
+        }
+        emit bandLoaded(firstRow,rowCount);
+    }
+
+    //像素后面可能还有别的内容，保存的时候要原样写回去
+    qint64 pixelEnd=m_image->OffBits()+rowStride*height;
+    qint64 rest=(qint64)m_image->FileSize()-pixelEnd;
+    if(rest>0)
+        file.read((char *)m_image->FileContent()+pixelEnd,rest);
+}
+
+void ImageLoader::LoadCompressed(QFile &file)
+{
+    //压缩的像素一块一块地读，直接解到image里，解完几行就显示几行
+    BmpRle::Decoder decoder(*m_image);
+    std::vector<unsigned char> buffer(BAND_BYTES);
+    size_t kept=0;
+    int rowsShown=0;
+    while(!decoder.IsFinished())
+    {
+        if(isInterruptionRequested())
+            return;
+
+        qint64 got=file.read((char *)&buffer[kept],(qint64)(buffer.size()-kept));
+        if(got<0)
+        {
+            emit loadFailed();
+            return;
+        }
+        if(got==0)
+            decoder.Finish();       //数据不完整，后面的行保持第0种颜色
+        size_t used=decoder.Decode(&buffer[0],kept+(size_t)got);
+        kept=kept+(size_t)got-used;
+        memmove(&buffer[0],&buffer[used],kept);
+
+        if(decoder.RowsDone()>rowsShown)
+        {
+            emit bandLoaded(rowsShown,decoder.RowsDone()-rowsShown);
+            rowsShown=decoder.RowsDone();
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef IMAGE_LOADER
+#define IMAGE_LOADER
+
+#include <QThread>
+#include <QString>
+
+class BmpImage;
+class QFile;
+
+//在后台线程里把像素数据一段一段地读进image。文件头和调色板要事先读好（BmpImage::ParseHeader）
+//每读完一段就发一次bandLoaded，行号是储存顺序的行号。读的时候不能再动image
+//RLE压缩的图边读边解，解完几行发几行
+class ImageLoader:public QThread
+{
+    Q_OBJECT
+public:
+    ImageLoader(QString fileName,BmpImage *image,QObject *parent=0);
+
+signals:
+    void bandLoaded(int firstRow,int rowCount);
+    void loadFailed();
+
+protected:
+    void run();
+
+private:
+    void LoadCompressed(QFile &file);
+
+    QString m_fileName;
+    BmpImage *m_image;
+};
+
+#endif // IMAGE_LOADER
@@ -1,1848 +1,570 @@
 #include "image_widget.h"
 #include "global_defs.h"
+#include "image_filters.h"
+#include "image_metrics.h"
+#include "noise_mask.h"
+#include "bmp_codec.h"
+#include "image_loader.h"
+#include "preview_renderer.h"
 #include <QMessageBox>
 #include <QPainter>
-#include <QPen>
 #include <QFileDialog>
+#include <QFile>
 #include <QDebug>
+#include <cstring>
 
-ImageWidget::ImageWidget(QString fileName, QWidget *parent)
-    : QWidget(parent),m_fileName(fileName),m_isDirty(false),m_maxFilterSize(7),
-      m_offBitsPos(10),m_widthPos(18),m_heightPos(22),
-      m_bitCountPos(28),m_palettePos(54),m_paddingBits(0)
+namespace
 {
-    m_file=new QFile(m_fileName);
-    m_file->open(QFile::ReadOnly);         //注意要open
-    m_fileSize=m_file->size();
-    m_fileContent=new unsigned char[m_fileSize];
-    m_fileBackup=new unsigned char[m_fileSize];
+    const int MASK_BRUSH_RADIUS=8;      //按住Ctrl涂选区时笔刷的半径
+    const int MAX_UNDO_STEPS=10;
+    const unsigned int MASK_OVERLAY_COLOR=0x60ff0000u;     //半透明的红色，ARGB
+    const int PREVIEW_DELAY_MS=15;      //参数停下来这么久才开始滤预览，不到一帧
+}
 
-    m_file->read((char*)m_fileContent,m_fileSize);
-    memcpy(m_fileBackup,m_fileContent,m_fileSize);
+ImageWidget::ImageWidget(QString fileName, QWidget *parent)
+    : QWidget(parent),m_fileName(fileName),m_loader(0),m_rowsLoaded(0),m_isLoaded(false),m_loadFailed(false),
+      m_isDirty(false),m_maxFilterSize(MAX_FILTER_SIZE),m_selecting(false),m_painting(false),
+      m_previewRenderer(0),m_previewSize(3),m_previewPercentile(50),m_comparing(false),m_divider(0)
+{
+    //这里只读文件头和调色板，很快；像素交给ImageLoader在后台读
+    QFile file(m_fileName);
+    file.open(QFile::ReadOnly);         //注意要open
+    QByteArray header=file.read(BMP_HEADER_SIZE);
+
+    int error=FORMAT_ERROR;
+    if(header.size()==BMP_HEADER_SIZE)
+        error=m_image.ParseHeader((const unsigned char *)header.constData(),file.size());
+    if(error==0)
+    {
+        qint64 paletteBytes=m_image.OffBits()-BMP_HEADER_SIZE;
+        if(file.read((char *)m_image.FileContent()+BMP_HEADER_SIZE,paletteBytes)!=paletteBytes)
+            error=FORMAT_ERROR;
+    }
 
-    if(m_fileContent[0]!=0x42 || m_fileContent[1]!=0x4D)            //bmp文件
+    if(error==BITCOUNT_ERROR)
     {
-        QMessageBox::information(this,"error","This is not a bitmap.",QMessageBox::Ok);
+        QMessageBox::information(this,"error","This is not an 8-bitmap or a 24-bitmap.",QMessageBox::Ok);
         this->deleteLater();
         throw FORMAT_ERROR;
     }
-    else if((m_bitCount=m_fileContent[m_bitCountPos])!=8 && m_bitCount!=24) //只允许8位和24位
+    else if(error==SIZE_ERROR)
     {
-        QMessageBox::information(this,"error","This is not an 8-bitmap or a 24-bitmap.",QMessageBox::Ok);
+        QMessageBox::information(this,"error","This bitmap is too large for this build.",QMessageBox::Ok);
         this->deleteLater();
         throw FORMAT_ERROR;
     }
-    else
+    else if(error!=0)
     {
-        m_offBits=m_fileContent[m_offBitsPos]+m_fileContent[m_offBitsPos+1]*256
-                +m_fileContent[m_offBitsPos+2]*256*256
-                +m_fileContent[m_offBitsPos+3]*256*256*256;
-        m_width=m_fileContent[m_widthPos]+m_fileContent[m_widthPos+1]*256
-                +m_fileContent[m_widthPos+2]*256*256
-                +m_fileContent[m_widthPos+3]*256*256*256;
-        m_height=m_fileContent[m_heightPos]+m_fileContent[m_heightPos+1]*256
-                +m_fileContent[m_heightPos+2]*256*256
-                +m_fileContent[m_heightPos+3]*256*256*256;
-        if(m_width%4!=0)
-            m_paddingBits= 4 - m_width%4;
+        QMessageBox::information(this,"error","This is not a bitmap.",QMessageBox::Ok);
+        this->deleteLater();
+        throw FORMAT_ERROR;
     }
+
+    m_display=QImage(m_image.Width(),m_image.Height(),QImage::Format_RGB32);
+    if(m_display.isNull())      //QImage最多2GB，更大的图只能用dip_batch -mapped处理
+    {
+        QMessageBox::information(this,"error","This bitmap is too large to display.",QMessageBox::Ok);
+        this->deleteLater();
+        throw FORMAT_ERROR;
+    }
+    m_display.fill(Qt::gray);           //还没读到的部分先显示成灰色
+    setMinimumSize(m_image.Width(),m_image.Height());
+
+    m_loader=new ImageLoader(m_fileName,&m_image,this);
+    connect(m_loader,SIGNAL(bandLoaded(int,int)),this,SLOT(onBandLoaded(int,int)));
+    connect(m_loader,SIGNAL(loadFailed()),this,SLOT(onLoadFailed()));
+    connect(m_loader,SIGNAL(finished()),this,SLOT(onLoaderFinished()));
+    m_loader->start();
+
+    m_previewTimer.setSingleShot(true);
+    m_previewTimer.setInterval(PREVIEW_DELAY_MS);
+    connect(&m_previewTimer,SIGNAL(timeout()),this,SLOT(onPreviewTimeout()));
 }
 
 ImageWidget::~ImageWidget()
 {
+    if(m_loader!=0)         //还在读的话让它停下来，等它退出以后才能释放m_image
+    {
+        m_loader->requestInterruption();
+        m_loader->wait();
+    }
+    delete m_previewRenderer;       //它读m_image，要在m_image之前停下来
+}
+
+void ImageWidget::onBandLoaded(int firstRow, int rowCount)
+{
+    this->UpdateDisplay(firstRow,rowCount);
+    m_rowsLoaded+=rowCount;
+    emit loadProgress(m_rowsLoaded,m_image.Height());
+
+    int top=m_image.IsBottomUp()?m_image.Height()-firstRow-rowCount:firstRow;
+    update(0,top,m_image.Width(),rowCount);
+}
+
+void ImageWidget::onLoadFailed()
+{
+    m_loadFailed=true;
+    QMessageBox::information(this,"error","Failed to read the bitmap.",QMessageBox::Ok);
+    emit loadFailed();
+}
 
+void ImageWidget::onLoaderFinished()
+{
+    if(m_loadFailed || m_rowsLoaded!=m_image.Height())
+        return;
+    this->SaveBackup();
+    m_isLoaded=true;
+    emit loaded();
+}
+
+void ImageWidget::UpdateDisplay(int firstRow, int rowCount)
+{
+    m_image.ToRgb32(firstRow,rowCount,m_display.bits(),m_display.bytesPerLine());
 }
 
 void ImageWidget::paintEvent(QPaintEvent *e)
 {
     QPainter painter(this);     //注意这个this，一定要的！
-    QPen pen;
+    if(m_comparing)
+    {
+        //两幅图都已经转换好了，拖动分界线时只是各画一部分
+        QRect before=e->rect().intersected(QRect(0,0,m_divider,m_image.Height()));
+        QRect after=e->rect().intersected(QRect(m_divider,0,m_image.Width()-m_divider,m_image.Height()));
+        if(!before.isEmpty())
+            painter.drawImage(before,m_backupDisplay,before);
+        if(!after.isEmpty())
+            painter.drawImage(after,m_display,after);
+        painter.setPen(QPen(QColor(Qt::white),1));
+        painter.drawLine(m_divider,e->rect().top(),m_divider,e->rect().bottom());
+        e->accept();
+        return;
+    }
+    painter.drawImage(e->rect(),m_display,e->rect());
+    if(!m_previewRect.isEmpty())
+        painter.drawImage(m_previewRect.topLeft(),m_previewImage);
+    if(!m_maskBounds.isEmpty())
+        painter.drawImage(e->rect(),m_maskOverlay,e->rect());
+    if(!m_selection.isEmpty())
+    {
+        painter.setPen(QPen(QColor(Qt::yellow),1,Qt::DashLine));
+        painter.drawRect(m_selection.adjusted(0,0,-1,-1));
+    }
+    e->accept();
+}
 
-    if(m_bitCount==8)       //8位，256色，即灰度，有调色板。注意调色板每四字节表示一种颜色，因为有一字节是保留字节
+void ImageWidget::mousePressEvent(QMouseEvent *e)
+{
+    if(!m_isLoaded)
+        return;
+    if(e->button()==Qt::RightButton)
     {
-        if(m_height>0)          //高度>0，则图片信息是从最后一行开始储存的
-        {
-            int currentPos=m_offBits;
-            for(int heightLoop=m_height-1;heightLoop>=0;heightLoop--)
-            {
-                for(int widthLoop=0;widthLoop!=m_width;widthLoop++)
-                {
-                    unsigned char b=m_fileContent[m_palettePos+4*m_fileContent[currentPos]];    //注意顺序！小头！！
-                    unsigned char g=m_fileContent[m_palettePos+4*m_fileContent[currentPos]+1];
-                    unsigned char r=m_fileContent[m_palettePos+4*m_fileContent[currentPos]+2];
+        this->ClearSelection();
+        return;
+    }
+    if(e->button()!=Qt::LeftButton)
+        return;
 
-                    currentPos++;
-                    pen.setColor(QColor(r,g,b));
-                    painter.setPen(pen);            //每次换颜色之后都要重新setPen
-                    painter.drawPoint(widthLoop,heightLoop);
-                }
-                currentPos+=m_paddingBits;          //填充的东西要空过去！！！
-            }
-        }
-        else                //m_height<0，图片信息从第一行开始储存
+    if(m_comparing)
+        this->MoveDivider(e->x());
+    else if(e->modifiers() & Qt::ControlModifier)
+    {
+        if(!m_selection.isEmpty())      //矩形和涂的选区只能有一种
         {
-            int currentPos=m_offBits;
-            for(int heightLoop=0;heightLoop!=-m_height;heightLoop++)
-            {
-                for(int widthLoop=0;widthLoop!=m_width;widthLoop++)
-                {
-                    unsigned char b=m_fileContent[m_palettePos+4*m_fileContent[currentPos]];
-                    unsigned char g=m_fileContent[m_palettePos+4*m_fileContent[currentPos]+1];
-                    unsigned char r=m_fileContent[m_palettePos+4*m_fileContent[currentPos]+2];
-                    currentPos++;
-                    pen.setColor(QColor(r,g,b));
-                    painter.setPen(pen);
-                    painter.drawPoint(widthLoop,heightLoop);
-                }
-                currentPos+=m_paddingBits;
-            }
+            update(m_selection);
+            m_selection=QRect();
         }
+        m_painting=true;
+        this->PaintMask(e->x(),e->y());
     }
-    else if(m_bitCount==24)     //24位，真彩色
+    else
     {
-        if(m_height>0)
-        {
-            int currentPos=m_offBits;
-            for(int heightLoop=m_height-1;heightLoop>=0;heightLoop--)
-            {
-                for(int widthLoop=0;widthLoop!=m_width;widthLoop++)
-                {
-                    unsigned char b=m_fileContent[currentPos];      //注意顺序！！！小头啊小头
-                    unsigned char g=m_fileContent[currentPos+1];
-                    unsigned char r=m_fileContent[currentPos+2];
-                    currentPos+=3;
-                    pen.setColor(QColor(r,g,b));
-                    painter.setPen(pen);
-                    painter.drawPoint(widthLoop,heightLoop);
-                }
-                currentPos+=m_paddingBits*3;
-            }
-        }
-        else
-        {
-            int currentPos=m_offBits;
-            for(int heightLoop=0;heightLoop!=-m_height;heightLoop++)
-            {
-                for(int widthLoop=0;widthLoop!=m_width;widthLoop++)
-                {
-                    unsigned char b=m_fileContent[currentPos];
-                    unsigned char g=m_fileContent[currentPos+1];
-                    unsigned char r=m_fileContent[currentPos+2];
-                    currentPos+=3;
-                    pen.setColor(QColor(r,g,b));
-                    painter.setPen(pen);
-                    painter.drawPoint(widthLoop,heightLoop);
-                }
-                currentPos+=m_paddingBits*3;
-            }
-        }
+        this->ClearSelection();
+        m_selecting=true;
+        m_dragStart=e->pos();
     }
-    e->accept();
 }
 
-void ImageWidget::onMedianFiltering(int level)
+void ImageWidget::mouseMoveEvent(QMouseEvent *e)
 {
-    m_isDirty=true;
-
-    int height=m_height;
-    if(height<0)            //无论是从第一行开始储存还是从最后一行开始储存，都按储存顺序进行处理就可以
-        height=-height;
+    if(m_comparing)
+    {
+        if(e->buttons() & Qt::LeftButton)
+            this->MoveDivider(e->x());
+    }
+    else if(m_painting)
+        this->PaintMask(e->x(),e->y());
+    else if(m_selecting)
+    {
+        QRect old=m_selection;
+        m_selection=QRect(m_dragStart,e->pos()).normalized().intersected(QRect(0,0,m_image.Width(),m_image.Height()));
+        update(old.united(m_selection));
+    }
+}
 
-    int currentPos=m_offBits;
-    unsigned char r=0,g=0,b=0;
+void ImageWidget::mouseReleaseEvent(QMouseEvent *e)
+{
+    Q_UNUSED(e);
+    m_selecting=false;
+    m_painting=false;
+}
 
-    for(int heightLoop=0;heightLoop<height;heightLoop++)
+void ImageWidget::ClearSelection()
+{
+    if(!m_selection.isEmpty())
+        update(m_selection);
+    if(!m_maskBounds.isEmpty())
     {
-        for(int widthLoop=0;widthLoop!=m_width;widthLoop++)
+        update(m_maskBounds);
+        for(int y=m_maskBounds.top();y<=m_maskBounds.bottom();y++)
         {
-            //图片的边界部分，整个的mask并不能fit in；但是又不能直接不管，成为盲区。所以就得分类讨论，在边界的地方apply mask的一部分
-            if(level==3)
-            {
-                if(heightLoop==0)   //第一行（这里的第一行不一定是图像的最上面，而是内存中储存在最前面的那一行）
-                {
-                    if(widthLoop==0)                        //第一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,8,9};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-1)           //最后一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,6,7,8};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else                                    //中间的点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,6,7,8,9};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                }
-                else if(heightLoop==height-1)               //最后一行
-                {
-                    if(widthLoop==0)                        //第一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,3,4};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-1)               //最后一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,4,5,6};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else                //中间的点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,3,4,5,6};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                }
-                else                                        //除了第一行和最后一行
-                {
-                    if(widthLoop==0)                        //第一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,3,4,8,9};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-1)           //最后一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,4,5,6,7,8};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else                                    //中间的点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,3,4,5,6,7,8,9};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                }
-            }
-            else if(level==5)
-            {
-                if(heightLoop==0)   //第一行（这里的第一行不一定是图像的最上面，而是内存中储存在最前面的那一行）
-                {
-                    if(widthLoop==0)                        //第一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,8,9,10,22,23,24,25};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==1)               //第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,6,7,8,9,10,21,22,23,24,25};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-2)       //倒数第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={18,6,1,2,19,7,8,9,20,21,22,23};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-1)           //最后一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={18,6,1,19,7,8,20,21,22};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else                                    //中间的点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={18,6,1,2,10,19,7,8,9,25,20,21,22,23,24};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                }
-                else if(heightLoop==1)  //第二行
-                {
-                    if(widthLoop==0)                        //第一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,8,9,10,22,23,24,25,4,3,11};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==1)               //第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,6,7,8,9,10,21,22,23,24,25,5,4,3,11};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-2)       //倒数第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={18,6,1,2,19,7,8,9,20,21,22,23,17,5,4,3};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-1)           //最后一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={18,6,1,19,7,8,20,21,22,17,5,4};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else                                    //中间的点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={18,6,1,2,10,19,7,8,9,25,20,21,22,23,24,17,5,4,3,11};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                }
-                else if(heightLoop==height-2)   //倒数第二行
-                {
-                    if(widthLoop==0)                        //第一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={14,13,12,11,4,3,1,2,10,8,9,25};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==1)               //第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={15,14,13,12,5,4,3,11,6,1,2,10,7,8,9,25};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-2)       //倒数第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={16,15,14,13,17,5,4,3,18,6,1,2,19,7,8,9};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-1)           //最后一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={16,15,14,17,5,4,18,6,1,19,7,8};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else                                    //中间的点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={18,6,1,2,10,19,7,8,9,25,17,5,4,3,11,16,15,14,13,12};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                }
-                else if(heightLoop==height-1)               //最后一行
-                {
-                    if(widthLoop==0)                        //第一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={14,13,12,11,4,3,1,2,10};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==1)               //第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={15,14,13,12,5,4,3,11,6,1,2,10};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-2)       //倒数第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={16,15,14,13,17,5,4,3,18,6,1,2};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-1)           //最后一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={16,15,14,17,5,4,18,6,1};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else                                    //中间的点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={18,6,1,2,10,17,5,4,3,11,16,15,14,13,12};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                }
-                else                                        //中间的行
-                {
-                    if(widthLoop==0)                        //第一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={14,13,12,4,3,11,1,2,10,8,9,25,22,23,24};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==1)               //第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={15,14,13,12,5,4,3,11,6,1,2,10,7,8,9,25,21,22,23,24};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-2)       //倒数第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={16,15,14,13,17,5,4,3,18,6,1,2,19,7,8,9,20,21,22,23};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-1)           //最后一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={16,15,14,17,5,4,18,6,1,19,7,8,20,21,22};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else                                    //中间的点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                }
-            }
-            else if(level==7)
-            {
-                if(heightLoop==0)   //第一行（这里的第一行不一定是图像的最上面，而是内存中储存在最前面的那一行）
-                {
-                    if(widthLoop==0)                        //第一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==1)               //第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 6,7,21,43};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==2)               //第三点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 6,7,21,43, 18,19,20,42};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-3)       //倒数第三点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={38,18,6,1,39,19,7,8,40,20,21,22,41,42,43,44, 2,9,23,45, 10,25,24,46};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-2)       //倒数第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={38,18,6,1,39,19,7,8,40,20,21,22,41,42,43,44, 2,9,23,45};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-1)           //最后一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={38,18,6,1,39,19,7,8,40,20,21,22,41,42,43,44};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else                                    //中间的点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 6,7,21,43, 18,19,20,42, 38,39,40,41};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                }
-                else if(heightLoop==1)  //第二行
-                {
-                    if(widthLoop==0)                        //第一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 4,3,11,27};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==1)               //第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 6,7,21,43, 5,4,3,11,27};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==2)               //第三点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 6,7,21,43, 18,19,20,42, 17,5,4,3,11,27};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-3)       //倒数第三点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={38,18,6,1,39,19,7,8,40,20,21,22,41,42,43,44, 2,9,23,45, 10,25,24,46, 37,17,5,4,3,11};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-2)       //倒数第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={38,18,6,1,39,19,7,8,40,20,21,22,41,42,43,44, 2,9,23,45, 37,17,5,4,3};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-1)           //最后一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={38,18,6,1,39,19,7,8,40,20,21,22,41,42,43,44, 37,17,5,4};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else                                    //中间的点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 6,7,21,43, 18,19,20,42, 38,39,40,41, 37,17,5,4,3,11,27};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                }
-                else if(heightLoop==2)  //第三行
-                {
-                    if(widthLoop==0)                        //第一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 4,3,11,27, 14,13,12,28};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==1)               //第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 6,7,21,43, 5,4,3,11,27, 15,14,13,12,28};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==2)               //第三点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 6,7,21,43, 18,19,20,42, 17,5,4,3,11,27, 16,15,14,13,12,28};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-3)       //倒数第三点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={38,18,6,1,39,19,7,8,40,20,21,22,41,42,43,44, 2,9,23,45, 10,25,24,46, 37,17,5,4,3,11, 36,16,15,14,13,12};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-2)       //倒数第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={38,18,6,1,39,19,7,8,40,20,21,22,41,42,43,44, 2,9,23,45, 37,17,5,4,3, 36,16,15,14,13};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-1)           //最后一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={38,18,6,1,39,19,7,8,40,20,21,22,41,42,43,44, 37,17,5,4, 36,16,15,14};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else                                    //中间的点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 6,7,21,43, 18,19,20,42, 38,39,40,41, 37,17,5,4,3,11,27, 36,16,15,14,13,12,28};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                }
-                else if(heightLoop==height-3)   //倒数第三行
-                {
-                    if(widthLoop==0)                        //第一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 8,9,25,49, 22,23,24,48};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==1)               //第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 7,8,9,25,49, 21,22,23,24,48};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==2)               //第三点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 34,16,17,18, 19,7,8,9,25,49, 20,21,22,23,24,48};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-3)       //倒数第三点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 31,13,3,2, 30,12,11,10, 39,19,7,8,9,25, 40,20,21,22,23,24};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-2)       //倒数第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 31,13,3,2, 39,19,7,8,9, 40,20,21,22,23};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-1)           //最后一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 39,19,7,8, 40,20,21,22};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else                                    //中间的点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 34,16,17,18, 35,36,37,38, 39,19,7,8,9,25,49, 40,20,21,22,23,24,48};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                }
-                else if(heightLoop==height-2)   //倒数第二行
-                {
-                    if(widthLoop==0)                        //第一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 8,9,25,49};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==1)               //第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 7,8,9,25,49};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==2)               //第三点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 34,16,17,18, 19,7,8,9,25,49};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-3)       //倒数第三点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 31,13,3,2, 30,12,11,10, 39,19,7,8,9,25};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-2)       //倒数第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 31,13,3,2, 39,19,7,8,9};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-1)           //最后一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 39,19,7,8};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else                                    //中间的点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 34,16,17,18, 35,36,37,38, 39,19,7,8,9,25,49};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                }
-                else if(heightLoop==height-1)               //最后一行
-                {
-                    if(widthLoop==0)                        //第一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==1)               //第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==2)               //第三点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 34,16,17,18};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-3)       //倒数第三点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 31,13,3,2, 30,12,11,10};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-2)       //倒数第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 31,13,3,2};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-1)           //最后一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else                                    //中间的点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 34,16,17,18, 35,36,37,38};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                }
-                else                                        //中间的行
-                {
-                    if(widthLoop==0)                        //第一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 8,9,25,49, 22,23,24,48, 44,45,46,47};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==1)               //第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 7,8,9,25,49, 21,22,23,24,48, 43,44,45,46,47};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==2)               //第三点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 34,16,17,18, 19,7,8,9,25,49, 20,21,22,23,24,48, 42,43,44,45,46,47};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-3)       //倒数第三点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 31,13,3,2, 30,12,11,10, 39,19,7,8,9,25, 40,20,21,22,23,24, 41,42,43,44,45,46};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-2)       //倒数第二点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 31,13,3,2, 39,19,7,8,9, 40,20,21,22,23, 41,42,43,44,45};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else if(widthLoop==m_width-1)           //最后一点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 39,19,7,8, 40,20,21,22, 41,42,43,44};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                    else                                    //中间的点
-                    {
-                        unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 34,16,17,18, 35,36,37,38, 39,19,7,8,9,25,49, 40,20,21,22,23,24,48, 41,42,43,44,45,46,47};
-                        this->GetMedianInAMask(locations,currentPos,&r,&g,&b);
-                    }
-                }
-            }
+            memset(&m_mask[(size_t)y*m_image.Width()+m_maskBounds.left()],0,m_maskBounds.width());
+            memset(m_maskOverlay.scanLine(y)+m_maskBounds.left()*4,0,m_maskBounds.width()*4);
+        }
+    }
+    m_selection=QRect();
+    m_maskBounds=QRect();
+}
 
-            //8位的图是有调色板的，要找到颜色值对应的调色板，把调色板的编号存在内容里面
-            if(m_bitCount==8)
-            {
-                for(int i=m_palettePos;i<m_offBits;i+=4)
-                {
-                    if(m_fileContent[i+2]==r && m_fileContent[i+1]==g && m_fileContent[i]==b)
-                    {
-                        m_fileContent[currentPos]=(unsigned char)((i-m_palettePos)/4);
-                    }
-                }
-                currentPos++;
-            }
-            //24位的没有调色板，直接把颜色值存在内容里面
-            else if(m_bitCount==24)
-            {
-                m_fileContent[currentPos+2]=r;
-                m_fileContent[currentPos+1]=g;
-                m_fileContent[currentPos]=b;
+void ImageWidget::PaintMask(int x, int y)
+{
+    int width=m_image.Width();
+    int height=m_image.Height();
+    if(m_mask.empty())
+    {
+        m_mask.assign(m_image.PixelCount(),0);
+        m_maskOverlay=QImage(width,height,QImage::Format_ARGB32);
+        m_maskOverlay.fill(Qt::transparent);
+    }
 
-                currentPos+=3;
-            }
+    QRect brush=QRect(x-MASK_BRUSH_RADIUS,y-MASK_BRUSH_RADIUS,2*MASK_BRUSH_RADIUS+1,2*MASK_BRUSH_RADIUS+1)
+                .intersected(QRect(0,0,width,height));
+    if(brush.isEmpty())
+        return;
+    for(int row=brush.top();row<=brush.bottom();row++)
+    {
+        unsigned int *overlay=(unsigned int *)m_maskOverlay.scanLine(row);
+        for(int column=brush.left();column<=brush.right();column++)
+        {
+            if((column-x)*(column-x)+(row-y)*(row-y)>MASK_BRUSH_RADIUS*MASK_BRUSH_RADIUS)
+                continue;
+            m_mask[(size_t)row*width+column]=1;
+            overlay[column]=MASK_OVERLAY_COLOR;
         }
-        if(m_bitCount==8)
-            currentPos+=(m_paddingBits);          //填充的东西要空过去
-        else if(m_bitCount==24)
-            currentPos+=m_paddingBits*3;          //填充的东西要空过去
     }
+    m_maskBounds=m_maskBounds.isEmpty()?brush:m_maskBounds.united(brush);
+    update(brush);
+}
+
+void ImageWidget::SelectedRegion(ImageFilters::Region &region, std::vector<unsigned char> &mask) const
+{
+    int height=m_image.Height();
+    QRect selection=!m_maskBounds.isEmpty()?m_maskBounds:m_selection;
+    if(selection.isEmpty())
+        selection=QRect(0,0,m_image.Width(),height);
+
+    //显示的第y行是储存的第height-1-y行（高度为正时）
+    region.left=selection.left();
+    region.right=selection.left()+selection.width();
+    region.top=m_image.IsBottomUp()?height-selection.top()-selection.height():selection.top();
+    region.bottom=region.top+selection.height();
+    region.mask=0;
+    if(m_maskBounds.isEmpty())
+        return;
+
+    int regionWidth=region.right-region.left;
+    mask.resize((size_t)regionWidth*selection.height());
+    for(int row=region.top;row<region.bottom;row++)
+    {
+        int line=m_image.IsBottomUp()?height-1-row:row;
+        memcpy(&mask[(size_t)(row-region.top)*regionWidth],&m_mask[(size_t)line*m_image.Width()+region.left],regionWidth);
+    }
+    region.mask=&mask[0];
+}
 
-    update();
+void ImageWidget::PushUndo(const ImageFilters::Region &region)
+{
+    UndoStep step;
+    step.left=region.left;
+    step.top=region.top;
+    step.width=region.right-region.left;
+    step.height=region.bottom-region.top;
+    step.pixels.resize((size_t)step.width*step.height*(m_image.BitCount()/8));
+    m_image.CopyPixels(step.left,step.top,step.width,step.height,&step.pixels[0]);
+
+    m_undoSteps.push_back(step);
+    if((int)m_undoSteps.size()>MAX_UNDO_STEPS)
+        m_undoSteps.pop_front();
+    emit undoAvailable(true);
 }
 
-void ImageWidget::onAdaptiveMedianFiltering()
+void ImageWidget::RepaintRegion(int left, int top, int right, int bottom)
+{
+    m_image.ToRgb32Rect(left,top,right-left,bottom-top,m_display.bits(),m_display.bytesPerLine());
+    int line=m_image.IsBottomUp()?m_image.Height()-bottom:top;
+    update(left,line,right-left,bottom-top);
+}
+
+void ImageWidget::FilterSelection(const std::function<void(const ImageFilters::Region &)> &filter)
 {
+    ImageFilters::Region region;
+    std::vector<unsigned char> mask;
+    this->SelectedRegion(region,mask);
+    this->CancelPreview();
+    this->PushUndo(region);
     m_isDirty=true;
+    filter(region);
+    this->RepaintRegion(region.left,region.top,region.right,region.bottom);
+}
 
-    int height=m_height;
-    if(height<0)            //无论是从第一行开始储存还是从最后一行开始储存，都按储存顺序进行处理就可以
-        height=-height;
+void ImageWidget::onUndo()
+{
+    if(m_undoSteps.empty())
+        return;
+    this->CancelPreview();
+    const UndoStep &step=m_undoSteps.back();
+    m_image.PastePixels(step.left,step.top,step.width,step.height,&step.pixels[0]);
+    this->RepaintRegion(step.left,step.top,step.left+step.width,step.top+step.height);
+    m_undoSteps.pop_back();
+    emit undoAvailable(!m_undoSteps.empty());
+}
 
-    int currentPos=m_offBits;
-    unsigned char r=0,g=0,b=0;
+void ImageWidget::onMedianFiltering(int level)
+{
+    this->FilterSelection([&](const ImageFilters::Region &region){
+        ImageFilters::MedianFilter(m_image,level,region,m_scratch);
+    });
+}
 
-    for(int heightLoop=0;heightLoop<height;heightLoop++)
-    {
-        for(int widthLoop=0;widthLoop!=m_width;widthLoop++)
-        {
-            int currentSize=3;  //当前的mask大小
-            bool ifMedianInRange=false,ifThisInRange=false;
+void ImageWidget::onMinFiltering(int level)
+{
+    this->FilterSelection([&](const ImageFilters::Region &region){
+        ImageFilters::MinFilter(m_image,level,region,m_scratch);
+    });
+}
 
-            while(1)
-            {
-                //根据currentSize分成几类
-                if(currentSize==3)
-                {
-                    if(heightLoop==0)   //第一行（这里的第一行不一定是图像的最上面，而是内存中储存在最前面的那一行）
-                    {
-                        if(widthLoop==0)                        //第一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,8,9};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-1)           //最后一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,6,7,8};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else                                    //中间的点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,6,7,8,9};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                    }
-                    else if(heightLoop==height-1)               //最后一行
-                    {
-                        if(widthLoop==0)                        //第一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,3,4};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-1)               //最后一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,4,5,6};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else                //中间的点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,3,4,5,6};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                    }
-                    else                                        //除了第一行和最后一行
-                    {
-                        if(widthLoop==0)                        //第一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,3,4,8,9};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-1)           //最后一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,4,5,6,7,8};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else                                    //中间的点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,3,4,5,6,7,8,9};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                    }
-                }
-                else if(currentSize==5)
-                {
-                    if(heightLoop==0)   //第一行（这里的第一行不一定是图像的最上面，而是内存中储存在最前面的那一行）
-                    {
-                        if(widthLoop==0)                        //第一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,8,9,10,22,23,24,25};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==1)               //第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,6,7,8,9,10,21,22,23,24,25};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-2)       //倒数第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={18,6,1,2,19,7,8,9,20,21,22,23};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-1)           //最后一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={18,6,1,19,7,8,20,21,22};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else                                    //中间的点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={18,6,1,2,10,19,7,8,9,25,20,21,22,23,24};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                    }
-                    else if(heightLoop==1)  //第二行
-                    {
-                        if(widthLoop==0)                        //第一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,8,9,10,22,23,24,25,4,3,11};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==1)               //第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,6,7,8,9,10,21,22,23,24,25,5,4,3,11};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-2)       //倒数第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={18,6,1,2,19,7,8,9,20,21,22,23,17,5,4,3};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-1)           //最后一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={18,6,1,19,7,8,20,21,22,17,5,4};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else                                    //中间的点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={18,6,1,2,10,19,7,8,9,25,20,21,22,23,24,17,5,4,3,11};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                    }
-                    else if(heightLoop==height-2)   //倒数第二行
-                    {
-                        if(widthLoop==0)                        //第一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={14,13,12,11,4,3,1,2,10,8,9,25};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==1)               //第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={15,14,13,12,5,4,3,11,6,1,2,10,7,8,9,25};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-2)       //倒数第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={16,15,14,13,17,5,4,3,18,6,1,2,19,7,8,9};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-1)           //最后一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={16,15,14,17,5,4,18,6,1,19,7,8};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else                                    //中间的点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={18,6,1,2,10,19,7,8,9,25,17,5,4,3,11,16,15,14,13,12};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                    }
-                    else if(heightLoop==height-1)               //最后一行
-                    {
-                        if(widthLoop==0)                        //第一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={14,13,12,11,4,3,1,2,10};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==1)               //第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={15,14,13,12,5,4,3,11,6,1,2,10};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-2)       //倒数第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={16,15,14,13,17,5,4,3,18,6,1,2};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-1)           //最后一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={16,15,14,17,5,4,18,6,1};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else                                    //中间的点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={18,6,1,2,10,17,5,4,3,11,16,15,14,13,12};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                    }
-                    else                                        //中间的行
-                    {
-                        if(widthLoop==0)                        //第一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={14,13,12,4,3,11,1,2,10,8,9,25,22,23,24};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==1)               //第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={15,14,13,12,5,4,3,11,6,1,2,10,7,8,9,25,21,22,23,24};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-2)       //倒数第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={16,15,14,13,17,5,4,3,18,6,1,2,19,7,8,9,20,21,22,23};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-1)           //最后一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={16,15,14,17,5,4,18,6,1,19,7,8,20,21,22};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else                                    //中间的点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                    }
-                }
-                else if(currentSize==7)
-                {
-                    if(heightLoop==0)   //第一行（这里的第一行不一定是图像的最上面，而是内存中储存在最前面的那一行）
-                    {
-                        if(widthLoop==0)                        //第一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==1)               //第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 6,7,21,43};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==2)               //第三点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 6,7,21,43, 18,19,20,42};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-3)       //倒数第三点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={38,18,6,1,39,19,7,8,40,20,21,22,41,42,43,44, 2,9,23,45, 10,25,24,46};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-2)       //倒数第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={38,18,6,1,39,19,7,8,40,20,21,22,41,42,43,44, 2,9,23,45};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-1)           //最后一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={38,18,6,1,39,19,7,8,40,20,21,22,41,42,43,44};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else                                    //中间的点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 6,7,21,43, 18,19,20,42, 38,39,40,41};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                    }
-                    else if(heightLoop==1)  //第二行
-                    {
-                        if(widthLoop==0)                        //第一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 4,3,11,27};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==1)               //第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 6,7,21,43, 5,4,3,11,27};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==2)               //第三点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 6,7,21,43, 18,19,20,42, 17,5,4,3,11,27};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-3)       //倒数第三点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={38,18,6,1,39,19,7,8,40,20,21,22,41,42,43,44, 2,9,23,45, 10,25,24,46, 37,17,5,4,3,11};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-2)       //倒数第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={38,18,6,1,39,19,7,8,40,20,21,22,41,42,43,44, 2,9,23,45, 37,17,5,4,3};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-1)           //最后一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={38,18,6,1,39,19,7,8,40,20,21,22,41,42,43,44, 37,17,5,4};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else                                    //中间的点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 6,7,21,43, 18,19,20,42, 38,39,40,41, 37,17,5,4,3,11,27};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                    }
-                    else if(heightLoop==2)  //第三行
-                    {
-                        if(widthLoop==0)                        //第一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 4,3,11,27, 14,13,12,28};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==1)               //第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 6,7,21,43, 5,4,3,11,27, 15,14,13,12,28};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==2)               //第三点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 6,7,21,43, 18,19,20,42, 17,5,4,3,11,27, 16,15,14,13,12,28};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-3)       //倒数第三点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={38,18,6,1,39,19,7,8,40,20,21,22,41,42,43,44, 2,9,23,45, 10,25,24,46, 37,17,5,4,3,11, 36,16,15,14,13,12};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-2)       //倒数第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={38,18,6,1,39,19,7,8,40,20,21,22,41,42,43,44, 2,9,23,45, 37,17,5,4,3, 36,16,15,14,13};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-1)           //最后一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={38,18,6,1,39,19,7,8,40,20,21,22,41,42,43,44, 37,17,5,4, 36,16,15,14};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else                                    //中间的点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={1,2,10,26,8,9,25,49,22,23,24,48,44,45,46,47, 6,7,21,43, 18,19,20,42, 38,39,40,41, 37,17,5,4,3,11,27, 36,16,15,14,13,12,28};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                    }
-                    else if(heightLoop==height-3)   //倒数第三行
-                    {
-                        if(widthLoop==0)                        //第一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 8,9,25,49, 22,23,24,48};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==1)               //第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 7,8,9,25,49, 21,22,23,24,48};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==2)               //第三点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 34,16,17,18, 19,7,8,9,25,49, 20,21,22,23,24,48};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-3)       //倒数第三点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 31,13,3,2, 30,12,11,10, 39,19,7,8,9,25, 40,20,21,22,23,24};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-2)       //倒数第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 31,13,3,2, 39,19,7,8,9, 40,20,21,22,23};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-1)           //最后一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 39,19,7,8, 40,20,21,22};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else                                    //中间的点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 34,16,17,18, 35,36,37,38, 39,19,7,8,9,25,49, 40,20,21,22,23,24,48};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                    }
-                    else if(heightLoop==height-2)   //倒数第二行
-                    {
-                        if(widthLoop==0)                        //第一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 8,9,25,49};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==1)               //第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 7,8,9,25,49};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==2)               //第三点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 34,16,17,18, 19,7,8,9,25,49};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-3)       //倒数第三点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 31,13,3,2, 30,12,11,10, 39,19,7,8,9,25};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-2)       //倒数第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 31,13,3,2, 39,19,7,8,9};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-1)           //最后一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 39,19,7,8};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else                                    //中间的点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 34,16,17,18, 35,36,37,38, 39,19,7,8,9,25,49};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                    }
-                    else if(heightLoop==height-1)               //最后一行
-                    {
-                        if(widthLoop==0)                        //第一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==1)               //第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==2)               //第三点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 34,16,17,18};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-3)       //倒数第三点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 31,13,3,2, 30,12,11,10};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-2)       //倒数第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 31,13,3,2};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-1)           //最后一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else                                    //中间的点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 34,16,17,18, 35,36,37,38};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                    }
-                    else                                        //中间的行
-                    {
-                        if(widthLoop==0)                        //第一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 8,9,25,49, 22,23,24,48, 44,45,46,47};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==1)               //第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 7,8,9,25,49, 21,22,23,24,48, 43,44,45,46,47};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==2)               //第三点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 34,16,17,18, 19,7,8,9,25,49, 20,21,22,23,24,48, 42,43,44,45,46,47};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-3)       //倒数第三点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 31,13,3,2, 30,12,11,10, 39,19,7,8,9,25, 40,20,21,22,23,24, 41,42,43,44,45,46};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-2)       //倒数第二点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 31,13,3,2, 39,19,7,8,9, 40,20,21,22,23, 41,42,43,44,45};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else if(widthLoop==m_width-1)           //最后一点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={35,34,33,32,36,16,15,14,37,17,5,4,38,18,6,1, 39,19,7,8, 40,20,21,22, 41,42,43,44};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                        else                                    //中间的点
-                        {
-                            unsigned char locations[m_maxFilterSize*m_maxFilterSize]={32,31,30,29,14,13,12,28,4,3,11,27,1,2,10,26, 33,15,5,6, 34,16,17,18, 35,36,37,38, 39,19,7,8,9,25,49, 40,20,21,22,23,24,48, 41,42,43,44,45,46,47};
-                            this->GetMedianInAMask(locations,currentPos,&r,&g,&b,&ifMedianInRange,&ifThisInRange);
-                        }
-                    }
-                }
-                //目前支持的最大size是7x7
+void ImageWidget::onMaxFiltering(int level)
+{
+    this->FilterSelection([&](const ImageFilters::Region &region){
+        ImageFilters::MaxFilter(m_image,level,region,m_scratch);
+    });
+}
 
-                //根据结果自适应判断改取什么颜色值
-                if(ifMedianInRange)
-                {
-                    if(ifThisInRange)
-                    {
-                        if(m_bitCount==8)   //8位bitmap
-                        {
-                            r=m_fileContent[m_palettePos+4*m_fileContent[currentPos]+2];
-                            g=m_fileContent[m_palettePos+4*m_fileContent[currentPos]+1];
-                            b=m_fileContent[m_palettePos+4*m_fileContent[currentPos]];
-                        }
-                        else if(m_bitCount==24) //24位bitmap
-                        {
-                            r=m_fileContent[currentPos+2];
-                            g=m_fileContent[currentPos+1];
-                            b=m_fileContent[currentPos];
-                        }
-                    }
-                    break;
-                }
-                else
-                {
-                    currentSize+=2;
-                    if(currentSize>m_maxFilterSize)
-                    {
-                        if(m_bitCount==8)
-                        {
-                            r=m_fileContent[m_palettePos+4*m_fileContent[currentPos]+2];
-                            g=m_fileContent[m_palettePos+4*m_fileContent[currentPos]+1];
-                            b=m_fileContent[m_palettePos+4*m_fileContent[currentPos]];
-                        }
-                        else if(m_bitCount==24)
-                        {
-                            r=m_fileContent[currentPos+2];
-                            g=m_fileContent[currentPos+1];
-                            b=m_fileContent[currentPos];
-                        }
-                        break;
-                    }
-                }
-            }
+void ImageWidget::onRankFiltering(int level, int percentile)
+{
+    this->FilterSelection([&](const ImageFilters::Region &region){
+        ImageFilters::RankFilter(m_image,level,percentile,region,m_scratch);
+    });
+}
 
-            if(m_bitCount==8)
-            {
-                for(int i=m_palettePos;i<m_offBits;i+=4)
-                {
-                    if(m_fileContent[i+2]==r && m_fileContent[i+1]==g && m_fileContent[i]==b)
-                    {
-                        m_fileContent[currentPos]=(unsigned char)((i-m_palettePos)/4);
-                    }
-                }
-                currentPos++;
-            }
-            else if(m_bitCount==24)
-            {
-                m_fileContent[currentPos+2]=r;
-                m_fileContent[currentPos+1]=g;
-                m_fileContent[currentPos]=b;
+void ImageWidget::onAdaptiveMedianFiltering()
+{
+    this->FilterSelection([&](const ImageFilters::Region &region){
+        ImageFilters::AdaptiveMedianFilter(m_image,m_maxFilterSize,region,m_scratch);
+    });
+}
 
-                currentPos+=3;
-            }
+void ImageWidget::onAutoFiltering()
+{
+    ImageFilters::Region whole={0,0,m_image.Width(),m_image.Height(),0};      //按块选滤波器，总是整幅图
+    this->CancelPreview();
+    this->PushUndo(whole);
+    m_isDirty=true;
+    double density=ImageFilters::AutoFilter(m_image,m_scratch);
+    this->UpdateDisplay(0,m_image.Height());
+    update();
+    emit noiseEstimated(density);
+}
 
+void ImageWidget::onSelectNoise()
+{
+    if(!m_isLoaded)
+        return;
+    NoiseMask noise;
+    QByteArray maskFile=QFile::encodeName(m_fileName+NOISE_MASK_SUFFIX);
+    if(m_isDirty || noise.Load(maskFile.constData(),m_image)!=0 || !noise.Matches(m_image))
+    {
+        noise.Detect(m_image,m_scratch);
+        if(!m_isDirty)
+            noise.Save(maskFile.constData());
+    }
+
+    this->ClearSelection();
+    int width=m_image.Width();
+    int height=m_image.Height();
+    if(m_mask.empty())
+    {
+        m_mask.assign(m_image.PixelCount(),0);
+        m_maskOverlay=QImage(width,height,QImage::Format_ARGB32);
+        m_maskOverlay.fill(Qt::transparent);
+    }
+    for(int y=0;y<height;y++)
+    {
+        int row=m_image.IsBottomUp()?height-1-y:y;      //m_mask是显示坐标
+        unsigned char *mask=&m_mask[(size_t)y*width];
+        unsigned int *overlay=(unsigned int *)m_maskOverlay.scanLine(y);
+        for(int x=0;x<width;x++)
+        {
+            if(noise.IsNoise(x,row))
+            {
+                mask[x]=1;
+                overlay[x]=MASK_OVERLAY_COLOR;
+            }
         }
-        if(m_bitCount==8)
-            currentPos+=(m_paddingBits);          //填充的东西要空过去
-        else if(m_bitCount==24)
-            currentPos+=m_paddingBits*3;          //填充的东西要空过去
     }
+    m_maskBounds=QRect(0,0,width,height);
     update();
+    emit noiseEstimated(noise.Density());
 }
 
-void ImageWidget::onSave()
+void ImageWidget::onIterativeMedianFiltering(int level)
 {
-    if(m_isDirty)
-    {
-        m_file->close();                    //要关掉当前文件，重新以WirteOnly的模式重新建一个，因为ReadWrite模式是append的
-        m_file->deleteLater();
-        m_file=new QFile(m_fileName);
-        m_file->open(QFile::WriteOnly);
-        m_file->write((char *)m_fileContent,m_fileSize);
+    ImageFilters::Region whole={0,0,m_image.Width(),m_image.Height(),0};      //迭代要看整幅图的变化，总是整幅图
+    this->CancelPreview();
+    this->PushUndo(whole);
+    m_isDirty=true;
+    int passes=ImageFilters::IterativeMedianFilter(m_image,level,MAX_MEDIAN_PASSES,m_scratch);
+    this->UpdateDisplay(0,m_image.Height());
+    update();
+    emit iterativeFilteringDone(passes);
+}
 
-        memcpy(m_fileBackup,m_fileContent,m_fileSize);  //保存以后“恢复”功能就以当前的图像为基准了
-        m_isDirty=false;
+void ImageWidget::Write(const QString &fileName)
+{
+    //打开的是RLE压缩的图时照样压缩着存，RLE4解开后是8位的，存成RLE8
+    if(m_image.Compression()!=BMP_RGB)
+        BmpCodec::Save(QFile::encodeName(fileName).constData(),m_image,BMP_RLE8);
+    else
+    {
+        QFile file(fileName);
+        file.open(QFile::WriteOnly);
+        file.write((const char *)m_image.FileContent(),m_image.FileSize());
     }
+
+    this->SaveBackup();         //保存以后“恢复”功能就以当前的图像为基准了
+    m_isDirty=false;
+}
+
+void ImageWidget::onSave()
+{
+    if(m_isDirty)
+        this->Write(m_fileName);
     QMessageBox::information(this,"Information","保存成功！");
 }
 
 void ImageWidget::onSaveAs()
 {
-    m_file->close();
-    m_file->deleteLater();
                             //getSaveFileName作用也仅仅是范围一个文件名，与getOpenFileName的区别在于返回的可以是不存在的文件
     m_fileName=QFileDialog::getSaveFileName(this,"Save",QDir::currentPath(),"bitmaps(*.bmp)");
-    m_file=new QFile(m_fileName);
-    m_file->open(QFile::WriteOnly);
-    m_file->write((char *)m_fileContent,m_fileSize);
-    memcpy(m_fileBackup,m_fileContent,m_fileSize);
+    this->Write(m_fileName);
 
     QMessageBox::information(this,"Information","保存成功！");
-    m_isDirty=false;
 }
 
-//返回中位数
-unsigned char ImageWidget::FindMedian(unsigned char a[], int count)
+void ImageWidget::onRestore()
 {
-    for(int i=0;i<count-1;i++)
+    if(m_isDirty)
     {
-        for(int j=0;j<count-i-1;j++)
-        {
-            if(a[j]>a[j+1])
-            {
-                unsigned char b=a[j];
-                a[j]=a[j+1];
-                a[j+1]=b;
-            }
-        }
+        this->CancelPreview();
+        m_image=m_backup;
+        m_display=m_backupDisplay;      //不用重新转换，下次改显示时才真正复制一份
+        update();
+        m_undoSteps.clear();
+        emit undoAvailable(false);
     }
-    return a[count/2];
 }
 
-//给定一个存有位置的数组locations，位置范围是1 - m_maxFilterSize*m_maxFilterSize
-//以3x3的mask为例，位置的顺序如下：（参数currentPos就是位置1在文件中的真实位置）
-//  5 4 3
-//  6 1 2
-//  7 8 9
-//5x5的mask：
-//  16 15 14 13 12
-//  17  5  4  3 11
-//  18  6  1  2 10
-//  19  7  8  9 25
-//  20 21 22 23 24
-//只要指定了位置，就可以读出所要的东西
-//要求locations数组中所有非零的都位于0前面，数组大小为m_maxFilterSize*m_maxFilterSize
-//返回这些点的r、g、b中位数，存在给的参数*r,*g,*b中
-//返回两个bool值，分别表示：中位数是否小于最大数且大于最小数；中点的值是否小于最大数且大于最小数
-//  分别储存在*ifMedianInRange,*ifThisInRange中
-//目前支持最大的mask是7x7，要再大可以继续写
-void ImageWidget::GetMedianInAMask(unsigned char locations[],int currentPos,
-                                   unsigned char *r,unsigned char *g,unsigned char *b,
-                                   bool *ifMedianInRange,bool *ifThisInRange)
+void ImageWidget::onMeasureQuality(QString referenceFile)
 {
-    int count=0;    //记录总共有多少位是有数据的
-    unsigned char bufferRed[m_maxFilterSize*m_maxFilterSize]={0};
-    unsigned char bufferGreen[m_maxFilterSize*m_maxFilterSize]={0};
-    unsigned char bufferBlue[m_maxFilterSize*m_maxFilterSize]={0};
-
-    for(int i=0;locations[i]!=0 && i<m_maxFilterSize*m_maxFilterSize;i++,count++)
+    if(!m_isLoaded)
+        return;
+    BmpImage loaded;
+    if(!referenceFile.isEmpty() && BmpCodec::Load(QFile::encodeName(referenceFile).constData(),loaded)!=0)
     {
-        if(m_bitCount==8)
-        {
-            switch (locations[i])
-            {
-            case 1:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos]];
-                break;
-            case 2:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+1]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+1]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+1]];
-                break;
-            case 3:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits+1]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits+1]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits+1]];
-                break;
-            case 4:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits]];
-                break;
-            case 5:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits-1]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits-1]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits-1]];
-                break;
-            case 6:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-1]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-1]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-1]];
-                break;
-            case 7:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits-1]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits-1]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits-1]];
-                break;
-            case 8:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits]];
-                break;
-            case 9:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits+1]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits+1]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits+1]];
-                break;
-            case 10:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2]];
-                break;
-            case 11:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits+2]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits+2]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits+2]];
-                break;
-            case 12:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits+2]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits+2]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits+2]];
-                break;
-            case 13:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits+1]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits+1]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits+1]];
-                break;
-            case 14:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits]];
-                break;
-            case 15:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits-1]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits-1]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits-1]];
-                break;
-            case 16:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits-2]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits-2]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits-2]];
-                break;
-            case 17:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits-2]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits-2]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits-2]];
-                break;
-            case 18:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2]];
-                break;
-            case 19:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits-2]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits-2]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits-2]];
-                break;
-            case 20:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits-2]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits-2]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits-2]];
-                break;
-            case 21:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits-1]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits-1]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits-1]];
-                break;
-            case 22:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits]];
-                break;
-            case 23:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits+1]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits+1]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits+1]];
-                break;
-            case 24:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits+2]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits+2]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits+2]];
-                break;
-            case 25:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits+2]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits+2]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits+2]];
-                break;
-            case 26:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3]];
-                break;
-            case 27:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits+3]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits+3]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits+3]];
-                break;
-            case 28:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits+3]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits+3]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits+3]];
-                break;
-            case 29:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits+3]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits+3]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits+3]];
-                break;
-            case 30:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits+2]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits+2]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits+2]];
-                break;
-            case 31:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits+1]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits+1]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits+1]];
-                break;
-            case 32:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits]];
-                break;
-            case 33:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits-1]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits-1]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits-1]];
-                break;
-            case 34:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits-2]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits-2]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits-2]];
-                break;
-            case 35:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits-3]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits-3]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3*m_width-3*m_paddingBits-3]];
-                break;
-            case 36:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits-3]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits-3]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-2*m_width-2*m_paddingBits-3]];
-                break;
-            case 37:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits-3]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits-3]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-m_width-m_paddingBits-3]];
-                break;
-            case 38:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos-3]];
-                break;
-            case 39:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits-3]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits-3]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits-3]];
-                break;
-            case 40:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits-3]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits-3]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits-3]];
-                break;
-            case 41:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits-3]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits-3]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits-3]];
-                break;
-            case 42:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits-2]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits-2]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits-2]];
-                break;
-            case 43:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits-1]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits-1]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits-1]];
-                break;
-            case 44:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits]];
-                break;
-            case 45:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits+1]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits+1]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits+1]];
-                break;
-            case 46:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits+2]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits+2]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits+2]];
-                break;
-            case 47:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits+3]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits+3]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+3*m_width+3*m_paddingBits+3]];
-                break;
-            case 48:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits+3]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits+3]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+2*m_width+2*m_paddingBits+3]];
-                break;
-            case 49:
-                bufferRed[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits+3]+2];
-                bufferGreen[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits+3]+1];
-                bufferBlue[i]=m_fileContent[m_palettePos+4*m_fileContent[currentPos+m_width+m_paddingBits+3]];
-                break;
-            }
-        }
-        else if(m_bitCount==24)
-        {
-            switch(locations[i])
-            {
-            case 1:
-                bufferRed[i]=m_fileContent[currentPos+2];
-                bufferGreen[i]=m_fileContent[currentPos+1];
-                bufferBlue[i]=m_fileContent[currentPos];
-                break;
-            case 2:
-                bufferRed[i]=m_fileContent[currentPos+1*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+1*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+1*3];
-                break;
-            case 3:
-                bufferRed[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3+1*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3+1*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3+1*3];
-                break;
-            case 4:
-                bufferRed[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3];
-                break;
-            case 5:
-                bufferRed[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3-1*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3-1*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3-1*3];
-                break;
-            case 6:
-                bufferRed[i]=m_fileContent[currentPos-1*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-1*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-1*3];
-                break;
-            case 7:
-                bufferRed[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3-1*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3-1*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3-1*3];
-                break;
-            case 8:
-                bufferRed[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3];
-                break;
-            case 9:
-                bufferRed[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3+1*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3+1*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3+1*3];
-                break;
-            case 10:
-                bufferRed[i]=m_fileContent[currentPos+2*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+2*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+2*3];
-                break;
-            case 11:
-                bufferRed[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3+2*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3+2*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3+2*3];
-                break;
-            case 12:
-                bufferRed[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3+2*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3+2*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3+2*3];
-                break;
-            case 13:
-                bufferRed[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3+1*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3+1*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3+1*3];
-                break;
-            case 14:
-                bufferRed[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3];
-                break;
-            case 15:
-                bufferRed[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3-1*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3-1*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3-1*3];
-                break;
-            case 16:
-                bufferRed[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3-2*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3-2*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3-2*3];
-                break;
-            case 17:
-                bufferRed[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3-2*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3-2*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3-2*3];
-                break;
-            case 18:
-                bufferRed[i]=m_fileContent[currentPos-2*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-2*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-2*3];
-                break;
-            case 19:
-                bufferRed[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3-2*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3-2*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3-2*3];
-                break;
-            case 20:
-                bufferRed[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3-2*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3-2*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3-2*3];
-                break;
-            case 21:
-                bufferRed[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3-1*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3-1*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3-1*3];
-                break;
-            case 22:
-                bufferRed[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3];
-                break;
-            case 23:
-                bufferRed[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3+1*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3+1*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3+1*3];
-                break;
-            case 24:
-                bufferRed[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3+2*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3+2*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3+2*3];
-                break;
-            case 25:
-                bufferRed[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3+2*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3+2*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3+2*3];
-                break;
-            case 26:
-                bufferRed[i]=m_fileContent[currentPos+3*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+3*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+3*3];
-                break;
-            case 27:
-                bufferRed[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3+3*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3+3*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3+3*3];
-                break;
-            case 28:
-                bufferRed[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3+3*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3+3*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3+3*3];
-                break;
-            case 29:
-                bufferRed[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3+3*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3+3*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3+3*3];
-                break;
-            case 30:
-                bufferRed[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3+2*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3+2*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3+2*3];
-                break;
-            case 31:
-                bufferRed[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3+1*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3+1*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3+1*3];
-                break;
-            case 32:
-                bufferRed[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3];
-                break;
-            case 33:
-                bufferRed[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3-1*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3-1*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3-1*3];
-                break;
-            case 34:
-                bufferRed[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3-2*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3-2*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3-2*3];
-                break;
-            case 35:
-                bufferRed[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3-3*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3-3*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-3*m_width*3-3*m_paddingBits*3-3*3];
-                break;
-            case 36:
-                bufferRed[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3-3*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3-3*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-2*m_width*3-2*m_paddingBits*3-3*3];
-                break;
-            case 37:
-                bufferRed[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3-3*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3-3*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-m_width*3-m_paddingBits*3-3*3];
-                break;
-            case 38:
-                bufferRed[i]=m_fileContent[currentPos-3*3+2];
-                bufferGreen[i]=m_fileContent[currentPos-3*3+1];
-                bufferBlue[i]=m_fileContent[currentPos-3*3];
-                break;
-            case 39:
-                bufferRed[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3-3*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3-3*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3-3*3];
-                break;
-            case 40:
-                bufferRed[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3-3*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3-3*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3-3*3];
-                break;
-            case 41:
-                bufferRed[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3-3*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3-3*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3-3*3];
-                break;
-            case 42:
-                bufferRed[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3-2*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3-2*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3-2*3];
-                break;
-            case 43:
-                bufferRed[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3-1*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3-1*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3-1*3];
-                break;
-            case 44:
-                bufferRed[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3];
-                break;
-            case 45:
-                bufferRed[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3+1*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3+1*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3+1*3];
-                break;
-            case 46:
-                bufferRed[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3+2*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3+2*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3+2*3];
-                break;
-            case 47:
-                bufferRed[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3+3*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3+3*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+3*m_width*3+3*m_paddingBits*3+3*3];
-                break;
-            case 48:
-                bufferRed[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3+3*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3+3*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+2*m_width*3+2*m_paddingBits*3+3*3];
-                break;
-            case 49:
-                bufferRed[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3+3*3+2];
-                bufferGreen[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3+3*3+1];
-                bufferBlue[i]=m_fileContent[currentPos+m_width*3+m_paddingBits*3+3*3];
-                break;
-            }
-        }
+        QMessageBox::information(this,"error","Failed to read the reference bitmap.",QMessageBox::Ok);
+        return;
     }
+    ImageMetrics::Quality quality;
+    if(ImageMetrics::Compare(m_image,referenceFile.isEmpty()?m_backup:loaded,quality,m_scratch)==SIZE_ERROR)
+    {
+        QMessageBox::information(this,"error","The reference bitmap has a different size.",QMessageBox::Ok);
+        return;
+    }
+    emit qualityMeasured(quality.mse,quality.psnr,quality.ssim);
+}
 
-    *r=this->FindMedian(bufferRed,count);
-    *g=this->FindMedian(bufferGreen,count);
-    *b=this->FindMedian(bufferBlue,count);
+void ImageWidget::onRankPreview(int level, int percentile)
+{
+    if(!m_isLoaded)
+        return;
+    m_previewSize=level;
+    m_previewPercentile=percentile;
+    m_previewTimer.start();         //还在等的话重新计时，之前的参数就不做了
+}
 
-    if(ifMedianInRange!=0 && ifThisInRange!=0)
+void ImageWidget::onPreviewTimeout()
+{
+    QRect viewport=visibleRegion().boundingRect().intersected(QRect(0,0,m_image.Width(),m_image.Height()));
+    if(viewport.isEmpty())
+        return;
+    if(m_previewRenderer==0)
     {
-        if(*r>bufferRed[0] && *r<bufferRed[count-1] &&
-                *g>bufferGreen[0] && *g<bufferGreen[count-1] &&
-                *b>bufferBlue[0] && *b<bufferBlue[count-1])
-            *ifMedianInRange=true;
-        else
-            *ifMedianInRange=false;
-
-        if(m_bitCount==8)
-        {
-            if(m_fileContent[m_palettePos+4*m_fileContent[currentPos]+2]>bufferRed[0]
-                    && m_fileContent[m_palettePos+4*m_fileContent[currentPos]+2]<bufferRed[count-1]
-                    && m_fileContent[m_palettePos+4*m_fileContent[currentPos]+1]>bufferGreen[0]
-                    && m_fileContent[m_palettePos+4*m_fileContent[currentPos]+1]<bufferGreen[count-1]
-                    && m_fileContent[m_palettePos+4*m_fileContent[currentPos]]>bufferBlue[0]
-                    && m_fileContent[m_palettePos+4*m_fileContent[currentPos]]<bufferBlue[count-1])
-                *ifThisInRange=true;
-            else
-                *ifThisInRange=false;
-        }
-        else if(m_bitCount==24)
-        {
-            if(m_fileContent[currentPos+2]>bufferRed[0] && m_fileContent[currentPos+2]<bufferRed[count-1]
-                    && m_fileContent[currentPos+1]>bufferGreen[0] && m_fileContent[currentPos+1]<bufferGreen[count-1]
-                    && m_fileContent[currentPos]>bufferBlue[0] && m_fileContent[currentPos]<bufferBlue[count-1])
-                *ifThisInRange=true;
-            else
-                *ifThisInRange=false;
-        }
+        m_previewRenderer=new PreviewRenderer(&m_image);
+        connect(m_previewRenderer,SIGNAL(previewReady(int,QImage,QRect)),this,SLOT(onPreviewReady(int,QImage,QRect)));
+        m_previewRenderer->start();
     }
+    m_previewRenderer->Request(FilterPipeline::RANK,m_previewSize,m_previewPercentile,viewport);
 }
 
-void ImageWidget::onRestore()
+void ImageWidget::onPreviewReady(int generation, QImage image, QRect rect)
 {
-    if(m_isDirty)
+    if(m_previewRenderer==0 || generation!=m_previewRenderer->Generation())
+        return;         //已经有更新的请求了，或者预览已经停了
+    QRect old=m_previewRect;
+    m_previewImage=image;
+    m_previewRect=rect;
+    update(old.united(rect));
+}
+
+void ImageWidget::onStopPreview()
+{
+    this->CancelPreview();
+}
+
+void ImageWidget::CancelPreview()
+{
+    m_previewTimer.stop();
+    if(m_previewRenderer!=0)
+        m_previewRenderer->Cancel();
+    if(!m_previewRect.isEmpty())
+        update(m_previewRect);
+    m_previewRect=QRect();
+    m_previewImage=QImage();
+}
+
+void ImageWidget::SaveBackup()
+{
+    m_backup=m_image;
+    m_backupDisplay=m_display;
+}
+
+void ImageWidget::onCompare(bool enabled)
+{
+    if(enabled)
     {
-        memcpy(m_fileContent,m_fileBackup,m_fileSize);
-        update();
+        this->CancelPreview();      //对比的是已经滤好的结果
+        m_divider=m_image.Width()/2;
     }
+    m_comparing=enabled;
+    update();
+}
+
+void ImageWidget::MoveDivider(int x)
+{
+    x=x<0?0:(x>m_image.Width()?m_image.Width():x);
+    if(x==m_divider)
+        return;
+    int left=x<m_divider?x:m_divider;
+    int right=x<m_divider?m_divider:x;
+    m_divider=x;
+    update(left-1,0,right-left+3,m_image.Height());     //只重画两条分界线之间，原图和结果都不用重新转换
 }
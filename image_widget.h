@@ -4,8 +4,25 @@
 #include <QWidget>
 #include <QString>
 #include <QPaintEvent>
-#include <QFile>
+#include <QImage>
+#include <QMouseEvent>
+#include <QRect>
+#include <QTimer>
+#include <vector>
+#include <deque>
+#include <functional>
+#include "bmp_image.h"
+#include "filter_scratch.h"
+#include "image_filters.h"
 
+class ImageLoader;
+class PreviewRenderer;
+
+//显示一幅bmp图像并响应各种滤波操作。图像本身和滤波都在core里，这里只负责显示、保存和恢复
+//构造时只同步读文件头和调色板，宽高马上就能拿到；像素在后台一段一段地读，读完一段显示一段，
+//全部读完之后发loaded，在这之前不能滤波、保存
+//对比模式下左边显示原图（m_backup）、右边显示当前的结果，左键拖动分界线
+//左键拖出一个矩形，或者按住Ctrl用左键涂出一块，或者选出所有噪声点，之后的中值、最小值、最大值、百分位数和自适应滤波只处理这一块；右键取消
 class ImageWidget:public QWidget
 {
     Q_OBJECT
@@ -13,44 +30,114 @@ public:
     ImageWidget(QString fileName,QWidget *parent=0);
     ~ImageWidget();
 
+    int ImageWidth() const {return m_image.Width();}
+    int ImageHeight() const {return m_image.Height();}
+    int BitCount() const {return m_image.BitCount();}
+    bool IsLoaded() const {return m_isLoaded;}
+
+signals:
+    void loadProgress(int rowsLoaded,int totalRows);
+    void loaded();
+    void loadFailed();
+    void noiseEstimated(double density);   //自动滤波前估计出的噪声密度，0-1
+    //反复中值滤波做了几遍。每遍读上一遍的结果整幅图一起滤，不像中值按钮那样就地滤，做1遍的结果也和中值按钮不同
+    void iterativeFilteringDone(int passes);
+    void undoAvailable(bool available);
+    void qualityMeasured(double mse,double psnr,double ssim);
+
 private:
-    unsigned char FindMedian(unsigned char a[],int count);
-    void GetMedianInAMask(unsigned char locations[],int currentPos,
-                          unsigned char *r,unsigned char *g,unsigned char *b,
-                          bool *ifMedianInRange=0,bool *ifThisInRange=0);
+    void Write(const QString &fileName);
+    void UpdateDisplay(int firstRow,int rowCount);  //把储存顺序的这几行转换到m_display里
+
+    //选中的部分换成储存顺序的区域，mask放涂出来的那块的标记。什么都没选时是整幅图
+    void SelectedRegion(ImageFilters::Region &region,std::vector<unsigned char> &mask) const;
+    //把region这块的原始像素记下来以便撤销，滤波，再只重画这块
+    void FilterSelection(const std::function<void(const ImageFilters::Region &)> &filter);
+    void PushUndo(const ImageFilters::Region &region);
+    void RepaintRegion(int left,int top,int right,int bottom);     //储存顺序的矩形
+    void PaintMask(int x,int y);
+    void ClearSelection();
+    void CancelPreview();       //改m_image之前都要先停掉预览
+    void SaveBackup();          //m_image作为“恢复”和对比的基准
+    void MoveDivider(int x);
+
+    //撤销一步要恢复的像素：储存顺序的一块矩形和它在文件里的原始字节
+    struct UndoStep
+    {
+        int left;
+        int top;
+        int width;
+        int height;
+        std::vector<unsigned char> pixels;
+    };
 
 private:    
-    QFile *m_file;
     QString m_fileName;
-    unsigned char *m_fileContent;        //指向图片文件的内容
-    unsigned char *m_fileBackup;         //文件内容备份
-    qint64 m_fileSize;          //文件大小
+    BmpImage m_image;           //当前的图像
+    BmpImage m_backup;          //图像备份，“恢复”时用
+    QImage m_display;           //显示用的图像，和m_image同步，paintEvent直接画它
+    QImage m_backupDisplay;     //m_backup的显示图像。m_backup总是在和m_image一样时更新，所以直接共享m_display的数据，不用重新转换
+    ImageLoader *m_loader;
+    int m_rowsLoaded;
+    bool m_isLoaded;
+    bool m_loadFailed;
     bool m_isDirty;             //标志内存中的图像是否被修改过了
     const int m_maxFilterSize;
+    FilterScratch m_scratch;    //滤波用的临时内存，第一次滤波时按图像大小分配，之后一直复用
 
-    int m_offBits;              //储存像素信息的内容离文件开始的距离
-    const int m_offBitsPos;     //该距离在bmp文件中的位置
-    int m_width;
-    const int m_widthPos;
-    int m_height;
-    const int m_heightPos;
-    int m_bitCount;             //是多少位的bmp
-    const int m_bitCountPos;
-    const int m_palettePos;     //调色板位置
+    QRect m_selection;          //选中的矩形，显示坐标
+    QPoint m_dragStart;
+    bool m_selecting;
+    bool m_painting;
+    std::vector<unsigned char> m_mask;     //涂出来的部分，显示坐标，每个点一个字节，第一次涂时才分配
+    QRect m_maskBounds;         //涂过的点的范围
+    QImage m_maskOverlay;       //涂过的部分半透明地盖在图像上
+    std::deque<UndoStep> m_undoSteps;
 
-    int m_paddingBits;          //用来补齐m_width的bit数！
-        //因为windows进行行扫描的时候最小单位是4字节，所以如果图片宽不是4的倍数，要用0,0,0补齐
+    PreviewRenderer *m_previewRenderer;     //第一次预览时才创建
+    QTimer m_previewTimer;      //参数连续变化时只在停下来一会儿之后才发请求
+    int m_previewSize;
+    int m_previewPercentile;
+    QImage m_previewImage;      //显示出来的那块的预览，盖在m_display上面
+    QRect m_previewRect;
+
+    bool m_comparing;
+    int m_divider;              //对比模式下分界线的x坐标，左边是原图
 
 protected:
     void paintEvent(QPaintEvent *e);
+    void mousePressEvent(QMouseEvent *e);
+    void mouseMoveEvent(QMouseEvent *e);
+    void mouseReleaseEvent(QMouseEvent *e);
 
-protected slots:
+public slots:
     void onMedianFiltering(int level);
+    void onMinFiltering(int level);
+    void onMaxFiltering(int level);
+    void onRankFiltering(int level,int percentile);
     void onAdaptiveMedianFiltering();
+    void onAutoFiltering();
+    void onIterativeMedianFiltering(int level);
+    //找出噪声点作为选区（和Ctrl涂出来的一样），之后的滤波只换掉这些点。图没改过时优先读文件旁边存的噪声点，
+    //没有或者对不上就检测一遍再存下来
+    void onSelectNoise();
+    //实时预览百分位数滤波（中值、最小值、最大值都是它的特例）：只滤当前显示出来的部分，结果不写进图像
+    void onRankPreview(int level,int percentile);
+    void onStopPreview();
+    void onCompare(bool enabled);
+    //当前图像和参考图比较，算MSE、PSNR、SSIM。referenceFile为空时和原图（m_backup）比
+    void onMeasureQuality(QString referenceFile);
+
+protected slots:
     void onSave();
     void onSaveAs();
     void onRestore();
+    void onUndo();
+    void onBandLoaded(int firstRow,int rowCount);
+    void onLoadFailed();
+    void onLoaderFinished();
+    void onPreviewTimeout();
+    void onPreviewReady(int generation,QImage image,QRect rect);
 };
 
 #endif // IMAGE_WIDGET
-
@@ -0,0 +1,100 @@
+#include "preview_renderer.h"
+#include "bmp_image.h"
+#include "image_filters.h"
+
+namespace
+{
+    //一次滤这么多显示行，每做完一条看一下有没有新的请求，被代替的请求最多再多做这么一条
+    const int PREVIEW_STRIP_ROWS=64;
+}
+
+PreviewRenderer::PreviewRenderer(const BmpImage *image, QObject *parent)
+    : QThread(parent),m_image(image),m_generation(0),m_started(0),m_busy(false),m_stopping(false)
+{
+}
+
+PreviewRenderer::~PreviewRenderer()
+{
+    m_mutex.lock();
+    m_stopping=true;
+    m_generation++;
+    m_wake.wakeAll();
+    m_mutex.unlock();
+    wait();
+}
+
+int PreviewRenderer::Request(FilterPipeline::StageKind kind, int size, int percentile, const QRect &rect)
+{
+    QMutexLocker locker(&m_mutex);
+    m_job.kind=kind;
+    m_job.size=size;
+    m_job.percentile=percentile;
+    m_job.rect=rect;
+    m_generation++;
+    m_wake.wakeAll();
+    return m_generation;
+}
+
+void PreviewRenderer::Cancel()
+{
+    QMutexLocker locker(&m_mutex);
+    m_generation++;
+    m_started=m_generation;         //这个编号没有请求，后台线程不会去做
+    while(m_busy)
+        m_idle.wait(&m_mutex);
+}
+
+int PreviewRenderer::Generation()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_generation;
+}
+
+bool PreviewRenderer::IsSuperseded(int generation)
+{
+    QMutexLocker locker(&m_mutex);
+    return generation!=m_generation;
+}
+
+void PreviewRenderer::run()
+{
+    for(;;)
+    {
+        m_mutex.lock();
+        m_busy=false;
+        m_idle.wakeAll();
+        while(!m_stopping && m_started==m_generation)
+            m_wake.wait(&m_mutex);
+        if(m_stopping)
+        {
+            m_mutex.unlock();
+            return;
+        }
+        Job job=m_job;
+        int generation=m_generation;
+        m_started=generation;
+        m_busy=true;
+        m_mutex.unlock();
+
+        //一条一条地滤，每条连同窗口半径的一圈单独读出来，结果直接写进预览图像的对应行
+        QImage image(job.rect.width(),job.rect.height(),QImage::Format_RGB32);
+        int height=m_image->Height();
+        bool superseded=false;
+        for(int y=0;y<job.rect.height() && !superseded;y+=PREVIEW_STRIP_ROWS)
+        {
+            int rows=job.rect.height()-y<PREVIEW_STRIP_ROWS?job.rect.height()-y:PREVIEW_STRIP_ROWS;
+            int line=job.rect.top()+y;          //显示行
+            ImageFilters::Region region;
+            region.left=job.rect.left();
+            region.right=job.rect.left()+job.rect.width();
+            region.top=m_image->IsBottomUp()?height-line-rows:line;
+            region.bottom=region.top+rows;
+            region.mask=0;
+            ImageFilters::PreviewFilter(*m_image,job.kind,job.size,job.percentile,region,
+                                        image.scanLine(y),image.bytesPerLine(),m_scratch);
+            superseded=this->IsSuperseded(generation);
+        }
+        if(!superseded)
+            emit previewReady(generation,image,job.rect);
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef PREVIEW_RENDERER
+#define PREVIEW_RENDERER
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QImage>
+#include <QRect>
+#include "filter_pipeline.h"
+#include "filter_scratch.h"
+
+class BmpImage;
+
+//实时预览：在后台线程里只对显示出来的那块做滤波，结果是一块和它一样大的显示图像，不改image
+//新的请求会代替还没做完的旧请求：旧的在做完当前这一条之后就放弃，不再发previewReady
+//预览期间不能改image，要改之前先调用Cancel
+class PreviewRenderer:public QThread
+{
+    Q_OBJECT
+public:
+    PreviewRenderer(const BmpImage *image,QObject *parent=0);
+    ~PreviewRenderer();
+
+    //rect是显示坐标，返回这次请求的编号
+    int Request(FilterPipeline::StageKind kind,int size,int percentile,const QRect &rect);
+    //放弃所有请求，等正在做的停下来再返回
+    void Cancel();
+    int Generation();       //最新一次请求的编号，previewReady里的编号不是它就是过时的
+
+signals:
+    void previewReady(int generation,QImage image,QRect rect);
+
+protected:
+    void run();
+
+private:
+    bool IsSuperseded(int generation);
+
+    struct Job
+    {
+        FilterPipeline::StageKind kind;
+        int size;
+        int percentile;
+        QRect rect;
+    };
+
+    const BmpImage *m_image;
+    FilterScratch m_scratch;
+    QMutex m_mutex;
+    QWaitCondition m_wake;          //有新请求或者要退出了
+    QWaitCondition m_idle;          //后台线程没在做事了
+    Job m_job;
+    int m_generation;               //最新请求的编号
+    int m_started;                  //后台线程拿走的最后一个请求的编号
+    bool m_busy;
+    bool m_stopping;
+};
+
+#endif // PREVIEW_RENDERER
@@ -4,6 +4,7 @@
 #include <QString>
 #include <QFileDialog>
 #include <QDebug>
+#include <cmath>
 
 Widget::Widget(QWidget *parent)
     : QWidget(parent),m_imageWidget(0)
@@ -24,22 +25,87 @@ Widget::Widget(QWidget *parent)
 
     m_btn3MedianFiltering=new QPushButton("3x3 Median Filter");
     m_btn3MedianFiltering->setEnabled(false);
+    connect(m_btn3MedianFiltering,SIGNAL(clicked(bool)),this,SLOT(on3MedianFiltering()));
     m_menuLayout->addLayout(m_btnLayout2);
     m_menuLayout->addStretch(1);
     m_btnLayout2->addWidget(m_btn3MedianFiltering);
 
     m_btn5MedianFiltering=new QPushButton("5x5 Median Filter");
     m_btn5MedianFiltering->setEnabled(false);
+    connect(m_btn5MedianFiltering,SIGNAL(clicked(bool)),this,SLOT(on5MedianFiltering()));
     m_btnLayout2->addWidget(m_btn5MedianFiltering);
 
     m_btn7MedianFiltering=new QPushButton("7x7 Median Filter");
     m_btn7MedianFiltering->setEnabled(false);
+    connect(m_btn7MedianFiltering,SIGNAL(clicked(bool)),this,SLOT(on7MedianFiltering()));
     m_btnLayout2->addWidget(m_btn7MedianFiltering);
 
     m_btnAdaptiveMedianFiltering=new QPushButton("Apaptive Median Filter");
     m_btnAdaptiveMedianFiltering->setEnabled(false);
     m_btnLayout2->addWidget(m_btnAdaptiveMedianFiltering);
 
+    m_btnAutoFiltering=new QPushButton("Auto Filter");     //按噪声多少自动选滤波器
+    m_btnAutoFiltering->setEnabled(false);
+    m_btnLayout2->addWidget(m_btnAutoFiltering);
+
+    m_btnSelectNoise=new QPushButton("Select Noise");
+    m_btnSelectNoise->setEnabled(false);
+    m_btnLayout2->addWidget(m_btnSelectNoise);
+
+    m_btnLayout3=new QVBoxLayout();
+    m_menuLayout->addLayout(m_btnLayout3);
+    m_menuLayout->addStretch(1);
+
+    m_cmbWindowSize=new QComboBox();
+    m_cmbWindowSize->addItem("3x3",3);
+    m_cmbWindowSize->addItem("5x5",5);
+    m_cmbWindowSize->addItem("7x7",7);
+    m_cmbWindowSize->setEnabled(false);
+    m_btnLayout3->addWidget(m_cmbWindowSize);
+
+    m_btnMinFiltering=new QPushButton("Min Filter");
+    m_btnMinFiltering->setEnabled(false);
+    m_btnLayout3->addWidget(m_btnMinFiltering);
+    connect(m_btnMinFiltering,SIGNAL(clicked(bool)),this,SLOT(onMinFiltering()));
+
+    m_btnMaxFiltering=new QPushButton("Max Filter");
+    m_btnMaxFiltering->setEnabled(false);
+    m_btnLayout3->addWidget(m_btnMaxFiltering);
+    connect(m_btnMaxFiltering,SIGNAL(clicked(bool)),this,SLOT(onMaxFiltering()));
+
+    QHBoxLayout *rankLayout=new QHBoxLayout();
+    m_spinPercentile=new QSpinBox();
+    m_spinPercentile->setRange(0,100);
+    m_spinPercentile->setValue(50);
+    m_spinPercentile->setSuffix("%");
+    m_spinPercentile->setEnabled(false);
+    m_btnRankFiltering=new QPushButton("Rank Filter");
+    m_btnRankFiltering->setEnabled(false);
+    rankLayout->addWidget(m_btnRankFiltering);
+    rankLayout->addWidget(m_spinPercentile);
+    m_btnLayout3->addLayout(rankLayout);
+    connect(m_btnRankFiltering,SIGNAL(clicked(bool)),this,SLOT(onRankFiltering()));
+
+    m_sliderPercentile=new QSlider(Qt::Horizontal);
+    m_sliderPercentile->setRange(0,100);
+    m_sliderPercentile->setValue(50);
+    m_sliderPercentile->setEnabled(false);
+    m_btnLayout3->addWidget(m_sliderPercentile);
+    connect(m_sliderPercentile,SIGNAL(valueChanged(int)),m_spinPercentile,SLOT(setValue(int)));
+    connect(m_spinPercentile,SIGNAL(valueChanged(int)),m_sliderPercentile,SLOT(setValue(int)));
+
+    m_chkLivePreview=new QCheckBox("Live Preview");
+    m_chkLivePreview->setEnabled(false);
+    m_btnLayout3->addWidget(m_chkLivePreview);
+    connect(m_chkLivePreview,SIGNAL(toggled(bool)),this,SLOT(onLivePreviewToggled(bool)));
+    connect(m_spinPercentile,SIGNAL(valueChanged(int)),this,SLOT(onPreviewParameterChanged()));
+    connect(m_cmbWindowSize,SIGNAL(currentIndexChanged(int)),this,SLOT(onPreviewParameterChanged()));
+
+    m_btnIterativeMedianFiltering=new QPushButton("Iterative Median");     //反复中值滤波直到不再变化
+    m_btnIterativeMedianFiltering->setEnabled(false);
+    m_btnLayout3->addWidget(m_btnIterativeMedianFiltering);
+    connect(m_btnIterativeMedianFiltering,SIGNAL(clicked(bool)),this,SLOT(onIterativeMedianFiltering()));
+
     m_btnSave=new QPushButton("保存");
     m_btnSave->setEnabled(false);
     m_btnLayout1->addWidget(m_btnSave);
@@ -51,6 +117,27 @@ Widget::Widget(QWidget *parent)
     m_btnRestore=new QPushButton("恢复");
     m_btnRestore->setEnabled(false);
     m_btnLayout1->addWidget(m_btnRestore);
+
+    m_btnUndo=new QPushButton("撤销");
+    m_btnUndo->setEnabled(false);
+    m_btnLayout1->addWidget(m_btnUndo);
+
+    m_chkCompare=new QCheckBox("对比");
+    m_chkCompare->setEnabled(false);
+    m_btnLayout1->addWidget(m_chkCompare);
+
+    m_btnQuality=new QPushButton("与原图比较");
+    m_btnQuality->setEnabled(false);
+    m_btnLayout1->addWidget(m_btnQuality);
+    connect(m_btnQuality,SIGNAL(clicked(bool)),this,SLOT(onMeasureAgainstOriginal()));
+
+    m_btnQualityReference=new QPushButton("与参考图比较");
+    m_btnQualityReference->setEnabled(false);
+    m_btnLayout1->addWidget(m_btnQualityReference);
+    connect(m_btnQualityReference,SIGNAL(clicked(bool)),this,SLOT(onMeasureAgainstReference()));
+
+    m_lblImageInfo=new QLabel();
+    m_layout->addWidget(m_lblImageInfo);
 }
 
 Widget::~Widget()
@@ -70,39 +157,125 @@ void Widget::onLoadImage()
             m_imageWidget=new ImageWidget(fileName);
             m_layout->addWidget(m_imageWidget);
 
-            m_btn3MedianFiltering->setEnabled(true);
-            m_btn5MedianFiltering->setEnabled(true);
-            m_btn7MedianFiltering->setEnabled(true);
-            m_btnAdaptiveMedianFiltering->setEnabled(true);
-            m_btnSave->setEnabled(true);
-            m_btnSaveAs->setEnabled(true);
-            m_btnRestore->setEnabled(true);
-
-            connect(m_btn3MedianFiltering,SIGNAL(clicked(bool)),this,SLOT(on3MedianFiltering()));
-            connect(m_btn5MedianFiltering,SIGNAL(clicked(bool)),this,SLOT(on5MedianFiltering()));
-            connect(m_btn7MedianFiltering,SIGNAL(clicked(bool)),this,SLOT(on7MedianFiltering()));
+            m_lblImageInfo->setText(QString("%1 x %2, %3-bit").arg(m_imageWidget->ImageWidth())
+                                    .arg(m_imageWidget->ImageHeight()).arg(m_imageWidget->BitCount()));
+            this->SetImageButtonsEnabled(false);        //像素读完之前不能滤波、保存
+
+            connect(m_imageWidget,SIGNAL(loadProgress(int,int)),this,SLOT(onImageLoadProgress(int,int)));
+            connect(m_imageWidget,SIGNAL(loaded()),this,SLOT(onImageLoaded()));
+            connect(m_imageWidget,SIGNAL(loadFailed()),this,SLOT(onImageLoadFailed()));
             connect(this,SIGNAL(launchMedianFiltering(int)),m_imageWidget,SLOT(onMedianFiltering(int)));
+            connect(this,SIGNAL(launchMinFiltering(int)),m_imageWidget,SLOT(onMinFiltering(int)));
+            connect(this,SIGNAL(launchMaxFiltering(int)),m_imageWidget,SLOT(onMaxFiltering(int)));
+            connect(this,SIGNAL(launchRankFiltering(int,int)),m_imageWidget,SLOT(onRankFiltering(int,int)));
+            connect(this,SIGNAL(launchIterativeMedianFiltering(int)),m_imageWidget,SLOT(onIterativeMedianFiltering(int)));
+            connect(this,SIGNAL(launchRankPreview(int,int)),m_imageWidget,SLOT(onRankPreview(int,int)));
+            connect(this,SIGNAL(stopPreview()),m_imageWidget,SLOT(onStopPreview()));
+            connect(m_chkCompare,SIGNAL(toggled(bool)),m_imageWidget,SLOT(onCompare(bool)));
+            connect(this,SIGNAL(launchMeasureQuality(QString)),m_imageWidget,SLOT(onMeasureQuality(QString)));
+            connect(m_imageWidget,SIGNAL(qualityMeasured(double,double,double)),this,SLOT(onQualityMeasured(double,double,double)));
+            connect(m_imageWidget,SIGNAL(iterativeFilteringDone(int)),this,SLOT(onIterativeFilteringDone(int)));
             connect(m_btnAdaptiveMedianFiltering,SIGNAL(clicked(bool)),m_imageWidget,SLOT(onAdaptiveMedianFiltering()));
+            connect(m_btnAutoFiltering,SIGNAL(clicked(bool)),m_imageWidget,SLOT(onAutoFiltering()));
+            connect(m_btnSelectNoise,SIGNAL(clicked(bool)),m_imageWidget,SLOT(onSelectNoise()));
+            connect(m_imageWidget,SIGNAL(noiseEstimated(double)),this,SLOT(onNoiseEstimated(double)));
             connect(m_btnSave,SIGNAL(clicked(bool)),m_imageWidget,SLOT(onSave()));
             connect(m_btnSaveAs,SIGNAL(clicked(bool)),m_imageWidget,SLOT(onSaveAs()));
             connect(m_btnRestore,SIGNAL(clicked(bool)),m_imageWidget,SLOT(onRestore()));
+            connect(m_btnUndo,SIGNAL(clicked(bool)),m_imageWidget,SLOT(onUndo()));
+            connect(m_imageWidget,SIGNAL(undoAvailable(bool)),m_btnUndo,SLOT(setEnabled(bool)));
         }
         catch(int e)
         {
             if(e==FORMAT_ERROR)
             {
-                m_btn3MedianFiltering->setEnabled(false);
-                m_btn5MedianFiltering->setEnabled(false);
-                m_btn7MedianFiltering->setEnabled(false);
-                m_btnAdaptiveMedianFiltering->setEnabled(false);
-                m_btnSave->setEnabled(false);
-                m_btnSaveAs->setEnabled(false);
-                m_btnRestore->setEnabled(false);
+                m_imageWidget=0;        //构造失败的已经deleteLater了
+                m_lblImageInfo->clear();
+                this->SetImageButtonsEnabled(false);
             }
         }
     }
 }
 
+void Widget::SetImageButtonsEnabled(bool enabled)
+{
+    m_btn3MedianFiltering->setEnabled(enabled);
+    m_btn5MedianFiltering->setEnabled(enabled);
+    m_btn7MedianFiltering->setEnabled(enabled);
+    m_btnAdaptiveMedianFiltering->setEnabled(enabled);
+    m_btnAutoFiltering->setEnabled(enabled);
+    m_btnSelectNoise->setEnabled(enabled);
+    m_cmbWindowSize->setEnabled(enabled);
+    m_spinPercentile->setEnabled(enabled);
+    m_sliderPercentile->setEnabled(enabled);
+    m_chkLivePreview->setEnabled(enabled);
+    m_btnMinFiltering->setEnabled(enabled);
+    m_btnMaxFiltering->setEnabled(enabled);
+    m_btnRankFiltering->setEnabled(enabled);
+    m_btnIterativeMedianFiltering->setEnabled(enabled);
+    m_btnSave->setEnabled(enabled);
+    m_btnSaveAs->setEnabled(enabled);
+    m_btnRestore->setEnabled(enabled);
+    m_btnUndo->setEnabled(false);       //新载入的图还没有可以撤销的
+    m_chkCompare->setEnabled(enabled);
+    m_chkCompare->setChecked(false);
+    m_btnQuality->setEnabled(enabled);
+    m_btnQualityReference->setEnabled(enabled);
+}
+
+void Widget::onMeasureAgainstOriginal()
+{
+    emit launchMeasureQuality(QString());
+}
+
+void Widget::onMeasureAgainstReference()
+{
+    QString fileName=QFileDialog::getOpenFileName(this,"选择参考图",QDir::currentPath(),"bitmaps(*.bmp)");
+    if(!fileName.isEmpty())
+        emit launchMeasureQuality(fileName);
+}
+
+void Widget::onQualityMeasured(double mse, double psnr, double ssim)
+{
+    m_lblImageInfo->setText(QString("%1 x %2, %3-bit, MSE %4, PSNR %5 dB, SSIM %6").arg(m_imageWidget->ImageWidth())
+                            .arg(m_imageWidget->ImageHeight()).arg(m_imageWidget->BitCount())
+                            .arg(mse,0,'f',2).arg(std::isinf(psnr)?QString("inf"):QString::number(psnr,'f',2))
+                            .arg(ssim,0,'f',4));
+}
+
+void Widget::onImageLoadProgress(int rowsLoaded, int totalRows)
+{
+    m_lblImageInfo->setText(QString("%1 x %2, %3-bit, 载入中 %4%").arg(m_imageWidget->ImageWidth())
+                            .arg(m_imageWidget->ImageHeight()).arg(m_imageWidget->BitCount())
+                            .arg((qint64)rowsLoaded*100/totalRows));
+}
+
+void Widget::onImageLoaded()
+{
+    m_lblImageInfo->setText(QString("%1 x %2, %3-bit").arg(m_imageWidget->ImageWidth())
+                            .arg(m_imageWidget->ImageHeight()).arg(m_imageWidget->BitCount()));
+    this->SetImageButtonsEnabled(true);
+}
+
+void Widget::onNoiseEstimated(double density)
+{
+    m_lblImageInfo->setText(QString("%1 x %2, %3-bit, 噪声 %4%").arg(m_imageWidget->ImageWidth())
+                            .arg(m_imageWidget->ImageHeight()).arg(m_imageWidget->BitCount())
+                            .arg(density*100,0,'f',1));
+}
+
+void Widget::onIterativeFilteringDone(int passes)
+{
+    m_lblImageInfo->setText(QString("%1 x %2, %3-bit, 迭代 %4 遍（不就地）").arg(m_imageWidget->ImageWidth())
+                            .arg(m_imageWidget->ImageHeight()).arg(m_imageWidget->BitCount()).arg(passes));
+}
+
+void Widget::onImageLoadFailed()
+{
+    m_lblImageInfo->setText("载入失败");
+    this->SetImageButtonsEnabled(false);
+}
+
 void Widget::on3MedianFiltering()
 {
     emit launchMedianFiltering(3);
@@ -117,3 +290,37 @@ void Widget::on7MedianFiltering()
 {
     emit launchMedianFiltering(7);
 }
+
+void Widget::onMinFiltering()
+{
+    emit launchMinFiltering(m_cmbWindowSize->itemData(m_cmbWindowSize->currentIndex()).toInt());
+}
+
+void Widget::onMaxFiltering()
+{
+    emit launchMaxFiltering(m_cmbWindowSize->itemData(m_cmbWindowSize->currentIndex()).toInt());
+}
+
+void Widget::onRankFiltering()
+{
+    emit launchRankFiltering(m_cmbWindowSize->itemData(m_cmbWindowSize->currentIndex()).toInt(),m_spinPercentile->value());
+}
+
+void Widget::onIterativeMedianFiltering()
+{
+    emit launchIterativeMedianFiltering(m_cmbWindowSize->itemData(m_cmbWindowSize->currentIndex()).toInt());
+}
+
+void Widget::onPreviewParameterChanged()
+{
+    if(m_chkLivePreview->isChecked())
+        emit launchRankPreview(m_cmbWindowSize->itemData(m_cmbWindowSize->currentIndex()).toInt(),m_spinPercentile->value());
+}
+
+void Widget::onLivePreviewToggled(bool checked)
+{
+    if(checked)
+        this->onPreviewParameterChanged();
+    else
+        emit stopPreview();
+}
@@ -5,6 +5,11 @@
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QPushButton>
+#include <QComboBox>
+#include <QSpinBox>
+#include <QLabel>
+#include <QSlider>
+#include <QCheckBox>
 #include "image_widget.h"
 
 class Widget : public QWidget
@@ -20,23 +25,63 @@ protected slots:
     void on5MedianFiltering();
     void on3MedianFiltering();
     void on7MedianFiltering();
+    void onMinFiltering();
+    void onMaxFiltering();
+    void onRankFiltering();
+    void onIterativeMedianFiltering();
+    void onImageLoadProgress(int rowsLoaded,int totalRows);
+    void onImageLoaded();
+    void onImageLoadFailed();
+    void onNoiseEstimated(double density);
+    void onIterativeFilteringDone(int passes);
+    void onPreviewParameterChanged();
+    void onLivePreviewToggled(bool checked);
+    void onMeasureAgainstOriginal();
+    void onMeasureAgainstReference();
+    void onQualityMeasured(double mse,double psnr,double ssim);
 
 signals:
     void launchMedianFiltering(int);
+    void launchMinFiltering(int);
+    void launchMaxFiltering(int);
+    void launchRankFiltering(int,int);
+    void launchIterativeMedianFiltering(int);
+    void launchRankPreview(int,int);
+    void stopPreview();
+    void launchMeasureQuality(QString);
+
+private:
+    void SetImageButtonsEnabled(bool enabled);
 
 private:
     QVBoxLayout *m_layout;
     QVBoxLayout *m_btnLayout1;
     QVBoxLayout *m_btnLayout2;
+    QVBoxLayout *m_btnLayout3;
     QHBoxLayout *m_menuLayout;
     ImageWidget *m_imageWidget;
     QPushButton *m_btn3MedianFiltering;
     QPushButton *m_btn5MedianFiltering;
     QPushButton *m_btn7MedianFiltering;
     QPushButton *m_btnAdaptiveMedianFiltering;
+    QPushButton *m_btnAutoFiltering;
+    QPushButton *m_btnSelectNoise;      //选出所有噪声点，之后的滤波只换掉它们
+    QComboBox *m_cmbWindowSize;         //最小值、最大值、百分位数滤波的窗口大小
+    QSpinBox *m_spinPercentile;
+    QSlider *m_sliderPercentile;        //和m_spinPercentile同步，拖动时方便实时预览
+    QCheckBox *m_chkCompare;            //左右对比原图和结果
+    QCheckBox *m_chkLivePreview;        //选中时改窗口大小、百分位数就只滤显示出来的部分预览，点Rank Filter才滤整幅图
+    QPushButton *m_btnMinFiltering;
+    QPushButton *m_btnMaxFiltering;
+    QPushButton *m_btnRankFiltering;
+    QPushButton *m_btnIterativeMedianFiltering;
     QPushButton *m_btnSave;
     QPushButton *m_btnSaveAs;
     QPushButton *m_btnRestore;
+    QPushButton *m_btnUndo;             //撤销上一次滤波，只恢复那次滤过的部分
+    QPushButton *m_btnQuality;          //和原图比较MSE、PSNR、SSIM
+    QPushButton *m_btnQualityReference; //和另选的一幅参考图（比如加噪之前的干净图）比较
+    QLabel *m_lblImageInfo;             //图像的大小、位数和载入进度
 };
 
 #endif // WIDGET_H